@@ -2,9 +2,56 @@ LOCAL_PATH:= $(call my-dir)
 
 include $(CLEAR_VARS)
 
-LOCAL_SRC_FILES := btctl.c util.c rl_helper.c
-LOCAL_SHARED_LIBRARIES := libhardware
+LOCAL_SRC_FILES := btctl.c util.c rl_helper.c rssi_history.c \
+                   devices.c gatt_db.c conn.c timeout.c scan_stats.c \
+                   fleet.c file_xfer.c notif_sink.c \
+                   record.c trace.c stats.c mem.c adapter.c pair_batch.c \
+                   watch.c schema.c value_log.c scan_view.c irk.c
+LOCAL_C_INCLUDES += external/zlib
+LOCAL_SHARED_LIBRARIES := libhardware libz
+
+# Android x86 ABI guarantees SSSE3, used by the address/UUID kernels in util.c.
+# AES-NI isn't guaranteed, irk.c checks for it at run time.
+ifeq ($(TARGET_ARCH),x86)
+LOCAL_CFLAGS += -mssse3 -maes
+endif
 LOCAL_MODULE_TAGS := eng
 LOCAL_MODULE := btctl
+LOCAL_MODULE_CLASS := EXECUTABLES
+
+# Assigned numbers tables, generated from assigned_numbers.txt
+intermediates := $(call local-intermediates-dir)
+GEN := $(intermediates)/assigned_numbers.c
+$(GEN): PRIVATE_PATH := $(LOCAL_PATH)
+$(GEN): PRIVATE_CUSTOM_TOOL = python $(PRIVATE_PATH)/gen_assigned_numbers.py $< > $@
+$(GEN): $(LOCAL_PATH)/assigned_numbers.txt $(LOCAL_PATH)/gen_assigned_numbers.py
+	$(transform-generated-source)
+LOCAL_GENERATED_SOURCES += $(GEN)
 
 include $(BUILD_EXECUTABLE)
+
+# Reader of the value logs written by the log command
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := btlog.c util.c
+LOCAL_C_INCLUDES += external/zlib
+LOCAL_SHARED_LIBRARIES := libz
+
+ifeq ($(TARGET_ARCH),x86)
+LOCAL_CFLAGS += -mssse3
+endif
+LOCAL_MODULE_TAGS := eng
+LOCAL_MODULE := btlog
+
+include $(BUILD_EXECUTABLE)
+
+# Differential test of the SSSE3 and table kernels of util.c, run on the host
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := util_test.c util.c
+LOCAL_C_INCLUDES += hardware/libhardware/include
+LOCAL_CFLAGS += -mssse3
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE := btctl_util_test
+
+include $(BUILD_HOST_EXECUTABLE)
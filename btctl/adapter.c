@@ -0,0 +1,163 @@
+/*
+ * Cached adapter properties
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "adapter.h"
+#include "util.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static adapter_info_t adapter;
+
+/* Copies the name property, which isn't always NUL terminated */
+static int update_name(const bt_property_t *prop) {
+    char tmp[ADAPTER_NAME_LEN];
+    int len = prop->len < ADAPTER_NAME_LEN - 1 ? prop->len :
+                                                 ADAPTER_NAME_LEN - 1;
+
+    memcpy(tmp, prop->val, len);
+    tmp[len] = 0;
+
+    if (strcmp(adapter.name, tmp) == 0)
+        return 0;
+
+    strcpy(adapter.name, tmp);
+    return 1;
+}
+
+/* Copies a property holding an array, keeping up to max elements. count is
+ * set to the number of elements reported. */
+static int update_array(void *arr, int *count, size_t elem_size, int max,
+                        const bt_property_t *prop) {
+    int n = prop->len / elem_size;
+    int kept = n < max ? n : max;
+    int diff;
+
+    diff = *count != n || memcmp(arr, prop->val, kept * elem_size) != 0;
+
+    memcpy(arr, prop->val, kept * elem_size);
+    *count = n;
+
+    return diff;
+}
+
+static int update_u32(uint32_t *dst, const bt_property_t *prop) {
+    uint32_t val;
+
+    if (prop->len < (int) sizeof(val))
+        return 0;
+
+    memcpy(&val, prop->val, sizeof(val));
+    if (*dst == val)
+        return 0;
+
+    *dst = val;
+    return 1;
+}
+
+int adapter_update(int num_properties, const bt_property_t *properties) {
+    int changed = 0;
+    int i;
+
+    pthread_mutex_lock(&lock);
+
+    for (i = 0; i < num_properties; i++) {
+        const bt_property_t *prop = &properties[i];
+        uint32_t val = 0;
+        int field = 0;
+        int diff = 0;
+
+        switch (prop->type) {
+            case BT_PROPERTY_BDNAME:
+                field = ADAPTER_HAS_NAME;
+                diff = update_name(prop);
+                break;
+
+            case BT_PROPERTY_BDADDR:
+                if (prop->len < (int) sizeof(bt_bdaddr_t))
+                    break;
+                field = ADAPTER_HAS_ADDR;
+                diff = memcmp(&adapter.addr, prop->val,
+                              sizeof(bt_bdaddr_t)) != 0;
+                memcpy(&adapter.addr, prop->val, sizeof(bt_bdaddr_t));
+                break;
+
+            case BT_PROPERTY_CLASS_OF_DEVICE:
+                field = ADAPTER_HAS_CLASS;
+                diff = update_u32(&adapter.cod, prop);
+                break;
+
+            case BT_PROPERTY_TYPE_OF_DEVICE:
+                field = ADAPTER_HAS_TYPE;
+                val = adapter.type;
+                diff = update_u32(&val, prop);
+                adapter.type = val;
+                break;
+
+            case BT_PROPERTY_ADAPTER_SCAN_MODE:
+                field = ADAPTER_HAS_SCAN_MODE;
+                val = adapter.scan_mode;
+                diff = update_u32(&val, prop);
+                adapter.scan_mode = val;
+                break;
+
+            case BT_PROPERTY_ADAPTER_DISCOVERY_TIMEOUT:
+                field = ADAPTER_HAS_TIMEOUT;
+                diff = update_u32(&adapter.discoverable_timeout, prop);
+                break;
+
+            case BT_PROPERTY_ADAPTER_BONDED_DEVICES:
+                field = ADAPTER_HAS_BONDED;
+                diff = update_array(adapter.bonded, &adapter.bonded_count,
+                                    sizeof(bt_bdaddr_t), ADAPTER_BONDED_MAX,
+                                    prop);
+                break;
+
+            case BT_PROPERTY_UUIDS:
+                field = ADAPTER_HAS_UUIDS;
+                diff = update_array(adapter.uuids, &adapter.uuids_count,
+                                    sizeof(bt_uuid_t), ADAPTER_UUIDS_MAX,
+                                    prop);
+                break;
+
+            default:
+                break;
+        }
+
+        /* a field received for the first time is always a change */
+        if (diff || !(adapter.fields & field))
+            changed |= field;
+        adapter.fields |= field;
+    }
+
+    if (changed)
+        adapter.updated_ms = monotonic_us() / 1000;
+
+    pthread_mutex_unlock(&lock);
+
+    return changed;
+}
+
+void adapter_get(adapter_info_t *info) {
+
+    pthread_mutex_lock(&lock);
+    memcpy(info, &adapter, sizeof(*info));
+    pthread_mutex_unlock(&lock);
+}
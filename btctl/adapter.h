@@ -0,0 +1,47 @@
+#ifndef __ADAPTER_H__
+#define __ADAPTER_H__
+
+#include <stdint.h>
+#include <hardware/bluetooth.h>
+
+/* Longest adapter name, plus the NUL */
+#define ADAPTER_NAME_LEN 249
+/* Bonded devices and UUIDs kept, the stack may report more */
+#define ADAPTER_BONDED_MAX 32
+#define ADAPTER_UUIDS_MAX 32
+
+/* Fields of adapter_info_t that have been received at least once */
+#define ADAPTER_HAS_NAME      (1 << 0)
+#define ADAPTER_HAS_ADDR      (1 << 1)
+#define ADAPTER_HAS_CLASS     (1 << 2)
+#define ADAPTER_HAS_TYPE      (1 << 3)
+#define ADAPTER_HAS_SCAN_MODE (1 << 4)
+#define ADAPTER_HAS_TIMEOUT   (1 << 5)
+#define ADAPTER_HAS_BONDED    (1 << 6)
+#define ADAPTER_HAS_UUIDS     (1 << 7)
+
+/* Copy of the adapter properties, kept up to date with what the stack
+ * reports, so they can be queried without a round trip to the stack */
+typedef struct adapter_info {
+    bt_bdaddr_t addr;
+    uint8_t fields; /* ADAPTER_HAS_* */
+    uint8_t type; /* bt_device_type_t */
+    uint8_t scan_mode; /* bt_scan_mode_t */
+    uint32_t cod;
+    uint32_t discoverable_timeout; /* seconds */
+    uint32_t updated_ms; /* last time a property changed */
+    int bonded_count; /* as reported, only ADAPTER_BONDED_MAX are kept */
+    int uuids_count; /* same, with ADAPTER_UUIDS_MAX */
+    bt_bdaddr_t bonded[ADAPTER_BONDED_MAX];
+    bt_uuid_t uuids[ADAPTER_UUIDS_MAX];
+    char name[ADAPTER_NAME_LEN];
+} adapter_info_t;
+
+/* Merges the properties of an adapter properties event into the copy. Returns
+ * the ADAPTER_HAS_* mask of fields that are new or changed. */
+int adapter_update(int num_properties, const bt_property_t *properties);
+
+/* Copies the adapter properties to info */
+void adapter_get(adapter_info_t *info);
+
+#endif /* __ADAPTER_H__ */
@@ -0,0 +1,25 @@
+#ifndef __ASSIGNED_NUMBERS_H__
+#define __ASSIGNED_NUMBERS_H__
+
+#include <stdint.h>
+#include <hardware/bluetooth.h>
+
+/* Names of Bluetooth SIG assigned numbers. The tables are generated at build
+ * time from assigned_numbers.txt by gen_assigned_numbers.py, see Android.mk.
+ * Lookups are binary searches on constant data: they never allocate and
+ * return NULL for unknown values. */
+
+/* 16-bit UUIDs: services, characteristics, descriptors and declarations */
+const char *uuid16_name(uint16_t uuid);
+/* Name of a 16-bit UUID on top of the Bluetooth base UUID */
+const char *uuid_name(const bt_uuid_t *uuid);
+/* Company identifiers, as used in manufacturer data and version info */
+const char *company_name(uint16_t id);
+/* GAP appearance. Unknown sub-categories get the name of their category. */
+const char *appearance_name(uint16_t appearance);
+/* Class of Device major device class (bits 8-12 of the CoD) */
+const char *cod_major_name(uint8_t major);
+/* Class of Device major service class, by bit number in the CoD */
+const char *cod_service_name(uint8_t bit);
+
+#endif /* __ASSIGNED_NUMBERS_H__ */
@@ -22,6 +22,11 @@
 #include <ctype.h>
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,31 +39,53 @@
 
 #include "util.h"
 #include "rl_helper.h"
+#include "rssi_history.h"
+#include "devices.h"
+#include "gatt_db.h"
+#include "assigned_numbers.h"
+#include "conn.h"
+#include "timeout.h"
+#include "scan_stats.h"
+#include "fleet.h"
+#include "file_xfer.h"
+#include "notif_sink.h"
+#include "record.h"
+#include "trace.h"
+#include "stats.h"
+#include "mem.h"
+#include "adapter.h"
+#include "pair_batch.h"
+#include "watch.h"
+#include "schema.h"
+#include "value_log.h"
+#include "scan_view.h"
+#include "irk.h"
 
 #define VERSION "0.3"
 
 #define MAX_LINE_SIZE 64
-#define MAX_SVCS_SIZE 128
-#define MAX_CHARS_SIZE 8
-
-/* AD types */
-#define AD_FLAGS              0x01
-#define AD_UUID16_SOME        0x02
-#define AD_UUID16_ALL         0x03
-#define AD_UUID128_SOME       0x06
-#define AD_UUID128_ALL        0x07
-#define AD_NAME_SHORT         0x08
-#define AD_NAME_COMPLETE      0x09
-#define AD_TX_POWER           0x0a
-#define AD_SLAVE_CONN_INT     0x12
-#define AD_SOLICIT_UUID16     0x14
-#define AD_SOLICIT_UUID128    0x15
-#define AD_SERVICE_DATA       0x16
-#define AD_PUBLIC_ADDRESS     0x17
-#define AD_RANDOM_ADDRESS     0x18
-#define AD_GAP_APPEARANCE     0x19
-#define AD_ADV_INTERVAL       0x1a
-#define AD_MANUFACTURER_DATA  0xff
+#define INPUT_CHUNK_SIZE 4096
+
+/* Appends " (name)" to a printed value when its assigned number is known */
+#define NAME_FMT "%s%s%s"
+#define NAME_ARG(name) (name) ? " (" : "", (name) ? (name) : "", \
+                       (name) ? ")" : ""
+
+/* Accounts and traces a stack callback, see stats and trace commands */
+#define CALLBACK_SCOPE(arg) \
+    STATS_SCOPE("callback", __func__); \
+    TRACE_CALLBACK(arg)
+
+/* Startup milestones, see startup_phase() */
+typedef enum {
+    PHASE_MODULE, /* HAL module opened */
+    PHASE_INIT, /* Bluetooth interface initialized */
+    PHASE_GATT, /* GATT interface initialized */
+    PHASE_THREAD, /* stack thread running */
+    PHASE_ENABLED, /* adapter on */
+    PHASE_REGISTERED, /* GATT client registered */
+    PHASE_COUNT,
+} startup_phase_t;
 
 typedef enum {
     NORMAL_PSTATE,
@@ -66,19 +93,6 @@ typedef enum {
     SSP_ENTRY_PSTATE
 } prompt_state_t;
 
-typedef struct char_info {
-    btgatt_char_id_t char_id;
-    bt_uuid_t *descrs;
-    uint8_t descr_count;
-} char_info_t;
-
-typedef struct service_info {
-    btgatt_srvc_id_t svc_id;
-    char_info_t *chars_buf;
-    uint8_t chars_buf_size;
-    uint8_t char_count;
-} service_info_t;
-
 /* Data that have to be acessable by the callbacks */
 struct userdata {
     const bt_interface_t *btiface;
@@ -89,23 +103,25 @@ struct userdata {
     bt_state_t adapter_state; /* The adapter is always OFF in the beginning */
     bt_discovery_state_t discovery_state;
     uint8_t scan_state;
+    /* scheduled scan, see cmd_scan */
+    unsigned int scan_window_ms;
+    unsigned int scan_period_ms;
+    int scan_period_timeout; /* 0 when no scan is scheduled */
+    int scan_window_timeout; /* 0 outside of scan windows */
+    bool scan_view_scan; /* scan started by the scan view */
     bool client_registered;
     int client_if;
-    bt_bdaddr_t remote_addr;
-    int conn_id;
+    conn_t *conn; /* connection used by GATT commands */
 
     prompt_state_t prompt_state;
     bt_bdaddr_t r_bd_addr; /* remote address when pairing */
 
-    /* When searching for services, we receive at search_result_cb a pointer
-     * for btgatt_srvc_id_t. But its value is replaced each time. So one option
-     * is to store these values and show a simpler ID to user.
-     *
-     * This static list limits the number of services that we can store, but it
-     * is simpler than using linked list.
-     */
-    service_info_t svcs[MAX_SVCS_SIZE];
-    int svcs_size;
+    /* startup, see --enable and --ready-fd */
+    bool auto_enable;
+    int ready_fd; /* -1 if not requested or already signaled */
+    bool ready;
+    uint64_t start_us;
+    uint64_t phase_us[PHASE_COUNT]; /* since start_us, 0 until reached */
 } u;
 
 /* Arbitrary UUID used to identify this application with the GATT library. The
@@ -149,39 +165,91 @@ void change_prompt_state(prompt_state_t new_state) {
     u.prompt_state = new_state;
 }
 
-/* clear any cache list of connected device */
-static void clear_list_cache() {
-    uint8_t i;
+/* Releases a connection, selecting another one for GATT commands if it was
+ * the current one */
+static void release_conn(conn_t *conn) {
+    int i;
+
+    xfer_conn_lost(conn);
+    conn_free(conn, -BT_STATUS_FAIL);
+
+    if (u.conn != conn)
+        return;
+
+    u.conn = NULL;
+    for (i = 0; i < CONN_MAX && u.conn == NULL; i++)
+        u.conn = conn_get(i);
+}
+
+/* Queues a GATT operation on the current connection */
+static void queue_op(const gatt_op_t *op) {
+    int ahead = conn_enqueue(u.conn, op);
+
+    if (ahead < 0)
+        rl_printf("Unable to queue operation: %d operations pending\n",
+                  conn_pending(u.conn));
+    else if (ahead > 0)
+        rl_printf("Queued, %d operation%s ahead\n", ahead,
+                  ahead == 1 ? "" : "s");
+}
+
+/* Completes the GATT operation in progress on a connection */
+static void gatt_op_done(int conn_id, int status, const void *result) {
+    conn_t *conn = conn_find(conn_id);
 
-    for (i = 0; i < u.svcs_size; i++)
-        u.svcs[i].char_count = 0;
-    u.svcs_size = 0;
+    if (conn != NULL)
+        conn_op_done(conn, status, result);
 }
 
-static int find_svc(btgatt_srvc_id_t *svc) {
-    uint8_t i;
+/* True if the results of the GATT operation in progress on a connection are
+ * reported by its done callback instead of being printed */
+static bool op_quiet(int conn_id) {
+    conn_t *conn = conn_find(conn_id);
+    const gatt_op_t *op = conn != NULL ? conn_current_op(conn) : NULL;
 
-    for (i = 0; i < u.svcs_size; i++)
-        if (u.svcs[i].svc_id.is_primary == svc->is_primary &&
-            u.svcs[i].svc_id.id.inst_id == svc->id.inst_id &&
-            !memcmp(&u.svcs[i].svc_id.id.uuid, &svc->id.uuid,
-                    sizeof(bt_uuid_t)))
-            return i;
-    return -1;
+    return op != NULL && op->quiet;
 }
 
-static int find_char(service_info_t *svc_info, btgatt_char_id_t *ch) {
-    uint8_t i;
+/* Checks the attribute IDs given to a GATT command: the service, the
+ * characteristic if levels > 1 and the descriptor if levels > 2. While other
+ * operations are queued the database of the connection can still change
+ * (eg. a search-svc in progress), so then IDs are checked only when the
+ * operation starts. */
+static bool check_ids(int levels, int svc_id, int char_id, int desc_id) {
+    gatt_db_t *db = &u.conn->db;
+
+    if (svc_id < 0 || (levels > 1 && char_id < 0) ||
+        (levels > 2 && desc_id < 0)) {
+        rl_printf("Invalid ID: IDs can't be negative\n");
+        return false;
+    }
+
+    if (conn_pending(u.conn) > 0)
+        return true;
+
+    if (db->svc_count <= 0) {
+        rl_printf("Run search-svc first to get all services list\n");
+        return false;
+    }
+
+    if (svc_id >= db->svc_count) {
+        rl_printf("Invalid serviceID: %i need to be between 0 and %i\n", svc_id,
+                  db->svc_count - 1);
+        return false;
+    }
 
-    for (i = 0; i < svc_info->char_count; i++) {
-        btgatt_char_id_t *char_id = &svc_info->chars_buf[i].char_id;
+    if (levels > 1 && char_id >= gatt_db_char_count(db, svc_id)) {
+        rl_printf("Invalid characteristicID, try to run characteristics "
+                  "command.\n");
+        return false;
+    }
 
-        if (char_id->inst_id == ch->inst_id &&
-            !memcmp(&char_id->uuid, &ch->uuid, sizeof(bt_uuid_t)))
-            return i;
+    if (levels > 2 && desc_id >= gatt_db_desc_count(db, svc_id, char_id)) {
+        rl_printf("Invalid descriptorID, try to run char-desc command.\n");
+        return false;
     }
 
-    return -1;
+    return true;
 }
 
 /* Clean blanks until a non-blank is found */
@@ -203,27 +271,115 @@ static void line_get_str(char **line, char *str) {
   *str = 0;
 }
 
+/* Takes the next word of line as a path, into str of len bytes. Prints an
+ * error and returns false if it doesn't fit. */
+static bool line_get_path(char **line, char *str, size_t len) {
+    size_t n;
+
+    line_skip_blanks(line);
+
+    n = strcspn(*line, " ");
+    if (n >= len) {
+        rl_printf("Path too long, at most %zu characters\n", len - 1);
+        return false;
+    }
+
+    memcpy(str, *line, n);
+    str[n] = 0;
+    *line += n;
+    return true;
+}
+
 static void cmd_quit(char *args) {
     u.quit = 1;
 }
 
+/* Records when a startup milestone is reached and signals readiness once the
+ * requested capabilities are up: commands can be used, and with --enable the
+ * adapter is on and the GATT client registered. Readiness is printed with the
+ * milestones, and "ready\n" is written to the --ready-fd descriptor, which is
+ * then closed. Milestones are reached from the main and stack threads. */
+static void startup_phase(startup_phase_t phase) {
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    static const char *names[] = {
+        [PHASE_MODULE] = "module",
+        [PHASE_INIT] = "init",
+        [PHASE_GATT] = "GATT",
+        [PHASE_THREAD] = "stack thread",
+        [PHASE_ENABLED] = "enabled",
+        [PHASE_REGISTERED] = "registered",
+    };
+    char times[128];
+    size_t n;
+    bool ready;
+    int i;
+
+    pthread_mutex_lock(&lock);
+
+    if (u.phase_us[phase] == 0)
+        u.phase_us[phase] = monotonic_us() - u.start_us;
+
+    if (u.auto_enable)
+        ready = u.phase_us[PHASE_REGISTERED] != 0;
+    else
+        ready = u.phase_us[PHASE_GATT] != 0 && u.phase_us[PHASE_THREAD] != 0;
+
+    if (!ready || u.ready) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    u.ready = true;
+
+    if (u.auto_enable || u.ready_fd >= 0) {
+        for (i = 0, n = 0; i < PHASE_COUNT && n < sizeof(times); i++)
+            if (u.phase_us[i] != 0)
+                n += snprintf(times + n, sizeof(times) - n, "%s%s %llu",
+                              n > 0 ? ", " : "", names[i],
+                              (unsigned long long) u.phase_us[i] / 1000);
+        rl_printf("Ready after %llu ms (%s ms)\n", (unsigned long long)
+                  u.phase_us[phase] / 1000, times);
+    }
+
+    if (u.ready_fd >= 0) {
+        if (write(u.ready_fd, "ready\n", 6) != 6)
+            rl_printf("Failed to signal readiness: %s\n", strerror(errno));
+        close(u.ready_fd);
+        u.ready_fd = -1;
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
 /* Called every time the adapter state changes */
 static void adapter_state_change_cb(bt_state_t state) {
+    CALLBACK_SCOPE(state);
 
     u.adapter_state = state;
     rl_printf("\nAdapter state changed: %i\n", state);
 
     if (state ==  BT_STATE_ON) {
+        bt_status_t status;
+
+        startup_phase(PHASE_ENABLED);
+
        /* Register as a GATT client with the stack
         *
 	* This has to be done here because it is the first available point we're
 	* sure the GATT interface is initialized and ready to be used, since
 	* there is callback for gattiface->init().
         */
-        bt_status_t status = u.gattiface->client->register_client(&app_uuid);
+        status = HAL_CALL(u.gattiface->client, register_client, &app_uuid);
         if (status != BT_STATUS_SUCCESS)
             rl_printf("Failed to register as a GATT client, status: %d\n",
                       status);
+    } else if (state == BT_STATE_OFF) {
+        /* the stack stops scanning, cancel the schedule too */
+        timeout_remove(u.scan_period_timeout);
+        timeout_remove(u.scan_window_timeout);
+        u.scan_period_timeout = u.scan_window_timeout = 0;
+        u.scan_state = 0;
+        scan_stats_end(NULL);
     }
 }
 
@@ -236,7 +392,7 @@ static void cmd_enable(char *args) {
         return;
     }
 
-    status = u.btiface->enable();
+    status = HAL_CALL(u.btiface, enable);
     if (status != BT_STATUS_SUCCESS)
         rl_printf("Failed to enable Bluetooth\n");
 }
@@ -251,25 +407,59 @@ static void cmd_disable(char *args) {
         return;
     }
 
-    result = u.gattiface->client->unregister_client(u.client_if);
+    fleet_stop();
+
+    result = HAL_CALL(u.gattiface->client, unregister_client, u.client_if);
     if (result != BT_STATUS_SUCCESS)
         rl_printf("Failed to unregister client, error: %u\n", result);
 
-    status = u.btiface->disable();
+    status = HAL_CALL(u.btiface, disable);
     if (status != BT_STATUS_SUCCESS)
         rl_printf("Failed to disable Bluetooth\n");
 }
 
+/* Formats a Class of Device as "0x5a020c (Phone; Networking, Telephony)" */
+static char *cod2str(uint32_t cod, char *str, size_t len) {
+    const char *major = cod_major_name((cod >> 8) & 0x1f);
+    const char *sep = "; ";
+    size_t n;
+    int bit;
+
+    n = snprintf(str, len, "0x%x (%s", cod, major ? major : "Reserved");
+
+    for (bit = 13; bit < 24 && n < len; bit++) {
+        const char *service;
+
+        if (!(cod & (1 << bit)))
+            continue;
+
+        service = cod_service_name(bit);
+        n += snprintf(str + n, len - n, "%s%s", sep,
+                      service ? service : "Reserved");
+        sep = ", ";
+    }
+
+    if (n < len)
+        snprintf(str + n, len - n, ")");
+
+    return str;
+}
+
 static void adapter_properties_cb(bt_status_t status, int num_properties,
                                   bt_property_t *properties) {
     char addr_str[BT_ADDRESS_STR_LEN];
+    char cod_str[128];
     int i;
 
+    CALLBACK_SCOPE(status);
+
     if (status != BT_STATUS_SUCCESS) {
         rl_printf("Failed to get adapter properties, error: %i\n", status);
         return;
     }
 
+    adapter_update(num_properties, properties);
+
     rl_printf("\nAdapter properties\n");
 
     while (num_properties--) {
@@ -286,8 +476,9 @@ static void adapter_properties_cb(bt_status_t status, int num_properties,
                 break;
 
             case BT_PROPERTY_CLASS_OF_DEVICE:
-                rl_printf("  Class of Device: 0x%x\n",
-                          ((uint32_t *) prop.val)[0]);
+                rl_printf("  Class of Device: %s\n",
+                          cod2str(((uint32_t *) prop.val)[0], cod_str,
+                                  sizeof(cod_str)));
                 break;
 
             case BT_PROPERTY_TYPE_OF_DEVICE:
@@ -320,69 +511,113 @@ static void adapter_properties_cb(bt_status_t status, int num_properties,
     }
 }
 
-static void device_found_cb(int num_properties, bt_property_t *properties) {
+static void print_device_property(const bt_property_t *prop) {
     char addr_str[BT_ADDRESS_STR_LEN];
+    char cod_str[128];
+    const char *name;
 
-    rl_printf("\nDevice found\n");
+    switch (prop->type) {
+        case BT_PROPERTY_BDNAME:
+            rl_printf("  name: %.*s\n", prop->len, (const char *) prop->val);
+            break;
 
-    while (num_properties--) {
-        bt_property_t prop = properties[num_properties];
+        case BT_PROPERTY_BDADDR:
+            rl_printf("  addr: %s\n", ba2str((uint8_t *) prop->val, addr_str));
+            break;
 
-        switch (prop.type) {
-            case BT_PROPERTY_BDNAME:
-                rl_printf("  name: %s\n", (const char *) prop.val);
-                break;
+        case BT_PROPERTY_CLASS_OF_DEVICE:
+            rl_printf("  class: %s\n", cod2str(((uint32_t *) prop->val)[0],
+                                                cod_str, sizeof(cod_str)));
+            break;
 
-            case BT_PROPERTY_BDADDR:
-                rl_printf("  addr: %s\n", ba2str((uint8_t *) prop.val,
-                          addr_str));
-                break;
+        case BT_PROPERTY_TYPE_OF_DEVICE:
+            switch ( ((bt_device_type_t *) prop->val)[0] ) {
+                case BT_DEVICE_DEVTYPE_BREDR:
+                    rl_printf("  type: BR/EDR only\n");
+                    break;
+                case BT_DEVICE_DEVTYPE_BLE:
+                    rl_printf("  type: LE only\n");
+                    break;
+                case BT_DEVICE_DEVTYPE_DUAL:
+                    rl_printf("  type: DUAL MODE\n");
+                    break;
+            }
+            break;
 
-            case BT_PROPERTY_CLASS_OF_DEVICE:
-                rl_printf("  class: 0x%x\n", ((uint32_t *) prop.val)[0]);
-                break;
+        case BT_PROPERTY_REMOTE_FRIENDLY_NAME:
+            rl_printf("  alias: %.*s\n", prop->len, (const char *) prop->val);
+            break;
 
-            case BT_PROPERTY_TYPE_OF_DEVICE:
-                switch ( ((bt_device_type_t *) prop.val)[0] ) {
-                    case BT_DEVICE_DEVTYPE_BREDR:
-                        rl_printf("  type: BR/EDR only\n");
-                        break;
-                    case BT_DEVICE_DEVTYPE_BLE:
-                        rl_printf("  type: LE only\n");
-                        break;
-                    case BT_DEVICE_DEVTYPE_DUAL:
-                        rl_printf("  type: DUAL MODE\n");
-                        break;
-                }
-                break;
+        case BT_PROPERTY_REMOTE_RSSI:
+            rl_printf("  rssi: %i\n", ((int8_t *) prop->val)[0]);
+            break;
 
-            case BT_PROPERTY_REMOTE_FRIENDLY_NAME:
-                rl_printf("  alias: %s\n", (const char *) prop.val);
-                break;
+        case BT_PROPERTY_REMOTE_VERSION_INFO:
+            rl_printf("  version info:\n");
+            rl_printf("    version: %d\n",
+                      ((bt_remote_version_t *) prop->val)->version);
+            rl_printf("    subversion: %d\n",
+                      ((bt_remote_version_t *) prop->val)->sub_ver);
+            name = company_name(((bt_remote_version_t *) prop->val)->
+                                manufacturer);
+            rl_printf("    manufacturer: %d" NAME_FMT "\n",
+                      ((bt_remote_version_t *) prop->val)->manufacturer,
+                      NAME_ARG(name));
+            break;
 
-            case BT_PROPERTY_REMOTE_RSSI:
-                rl_printf("  rssi: %i\n", ((uint8_t *) prop.val)[0]);
-                break;
+        default:
+            rl_printf("  Unknown property type:%i len:%i val:%p\n",
+                      prop->type, prop->len, prop->val);
+            break;
+    }
+}
 
-            case BT_PROPERTY_REMOTE_VERSION_INFO:
-                rl_printf("  version info:\n");
-                rl_printf("    version: %d\n",
-                          ((bt_remote_version_t *) prop.val)->version);
-                rl_printf("    subversion: %d\n",
-                          ((bt_remote_version_t *) prop.val)->sub_ver);
-                rl_printf("    manufacturer: %d\n",
-                          ((bt_remote_version_t *) prop.val)->manufacturer);
-                break;
+/* Inquiry results come in several events for the same device, each one with a
+ * partial set of properties. They are merged in the devices table and only
+ * what is new is printed. */
+static void device_found_cb(int num_properties, bt_property_t *properties) {
+    char addr_str[BT_ADDRESS_STR_LEN];
+    device_info_t dev;
+    int changed;
+    int i;
 
-            default:
-                rl_printf("  Unknown property type:%i len:%i val:%p\n",
-                          prop.type, prop.len, prop.val);
-                break;
-        }
+    CALLBACK_SCOPE(num_properties);
+
+    changed = devices_update(num_properties, properties, &dev);
+
+    if (changed < 0) {
+        rl_printf("\nDevice found\n");
+        for (i = 0; i < num_properties; i++)
+            print_device_property(&properties[i]);
+        return;
+    }
+
+    for (i = 0; i < num_properties; i++)
+        if (properties[i].type == BT_PROPERTY_REMOTE_RSSI)
+            rssi_history_add(&dev.addr, dev.rssi);
+
+    if (changed == 0)
+        return;
+
+    if (changed & DEVICE_NEW)
+        rl_printf("\nDevice found\n");
+    else
+        rl_printf("\nDevice updated\n");
+    rl_printf("  addr: %s\n", ba2str(dev.addr.address, addr_str));
+
+    for (i = 0; i < num_properties; i++) {
+        int field = devices_prop_field(properties[i].type);
+
+        if (properties[i].type == BT_PROPERTY_BDADDR)
+            continue;
+
+        if ((changed & DEVICE_NEW) || (changed & field))
+            print_device_property(&properties[i]);
     }
 }
 
 static void discovery_state_changed_cb(bt_discovery_state_t state) {
+    CALLBACK_SCOPE(state);
     u.discovery_state = state;
     rl_printf("\nDiscovery state changed: %i\n", state);
 }
@@ -411,7 +646,7 @@ static void cmd_discovery(char *args) {
             return;
         }
 
-        status = u.btiface->start_discovery();
+        status = HAL_CALL(u.btiface, start_discovery);
         if (status != BT_STATUS_SUCCESS)
             rl_printf("Failed to start discovery\n");
 
@@ -422,7 +657,7 @@ static void cmd_discovery(char *args) {
             return;
         }
 
-        status = u.btiface->cancel_discovery();
+        status = HAL_CALL(u.btiface, cancel_discovery);
         if (status != BT_STATUS_SUCCESS)
             rl_printf("Failed to stop discovery\n");
 
@@ -430,9 +665,212 @@ static void cmd_discovery(char *args) {
         rl_printf("Invalid argument \"%s\"\n", arg);
 }
 
+/* Adapter properties known to "adapter get" */
+static const char *adapter_props[] = {
+    "state", "discovery", "name", "address", "class", "type", "scan-mode",
+    "discoverable-timeout", "bonded", "uuids", NULL
+};
+
+static const char *scan_modes[] = {
+    "none", "connectable", "discoverable", NULL
+};
+
+/* Prints a property of the cached adapter properties, or all if prop is
+ * NULL */
+static void print_adapter_prop(const adapter_info_t *info, const char *prop) {
+    char addr_str[BT_ADDRESS_STR_LEN];
+    char uuid_str[UUID128_STR_LEN];
+    char cod_str[128];
+    bool all = prop == NULL;
+    int i, n;
+
+#define IS(name) (all || strcmp(prop, name) == 0)
+
+    if (IS("state"))
+        rl_printf("state: %s\n", u.adapter_state == BT_STATE_ON ? "on" :
+                                                                  "off");
+
+    if (IS("discovery"))
+        rl_printf("discovery: %s\n",
+                  u.discovery_state == BT_DISCOVERY_STARTED ? "started" :
+                                                              "stopped");
+
+    if (IS("name"))
+        rl_printf("name: %s\n", info->fields & ADAPTER_HAS_NAME ? info->name :
+                                                                  "?");
+
+    if (IS("address"))
+        rl_printf("address: %s\n", info->fields & ADAPTER_HAS_ADDR ?
+                  ba2str(info->addr.address, addr_str) : "?");
+
+    if (IS("class"))
+        rl_printf("class: %s\n", info->fields & ADAPTER_HAS_CLASS ?
+                  cod2str(info->cod, cod_str, sizeof(cod_str)) : "?");
+
+    if (IS("type"))
+        rl_printf("type: %s\n", !(info->fields & ADAPTER_HAS_TYPE) ? "?" :
+                  info->type == BT_DEVICE_DEVTYPE_BREDR ? "BR/EDR only" :
+                  info->type == BT_DEVICE_DEVTYPE_BLE ? "LE only" :
+                  info->type == BT_DEVICE_DEVTYPE_DUAL ? "DUAL MODE" : "?");
+
+    if (IS("scan-mode"))
+        rl_printf("scan-mode: %s\n",
+                  info->fields & ADAPTER_HAS_SCAN_MODE &&
+                  info->scan_mode <= BT_SCAN_MODE_CONNECTABLE_DISCOVERABLE ?
+                  scan_modes[info->scan_mode] : "?");
+
+    if (IS("discoverable-timeout")) {
+        if (info->fields & ADAPTER_HAS_TIMEOUT)
+            rl_printf("discoverable-timeout: %u\n",
+                      info->discoverable_timeout);
+        else
+            rl_printf("discoverable-timeout: ?\n");
+    }
+
+    if (IS("bonded")) {
+        n = info->bonded_count < ADAPTER_BONDED_MAX ? info->bonded_count :
+                                                      ADAPTER_BONDED_MAX;
+        if (info->fields & ADAPTER_HAS_BONDED)
+            rl_printf("bonded: %d\n", info->bonded_count);
+        else
+            rl_printf("bonded: ?\n");
+        for (i = 0; i < n; i++)
+            rl_printf("  %s\n", ba2str(info->bonded[i].address, addr_str));
+    }
+
+    if (IS("uuids")) {
+        n = info->uuids_count < ADAPTER_UUIDS_MAX ? info->uuids_count :
+                                                    ADAPTER_UUIDS_MAX;
+        if (info->fields & ADAPTER_HAS_UUIDS)
+            rl_printf("uuids: %d\n", info->uuids_count);
+        else
+            rl_printf("uuids: ?\n");
+        for (i = 0; i < n; i++)
+            rl_printf("  %s\n", uuid2str((bt_uuid_t *) &info->uuids[i],
+                                         uuid_str));
+    }
+
+#undef IS
+}
+
+/* Sets an adapter property, the cache is updated when the stack reports the
+ * change */
+static void set_adapter_prop(char *args) {
+    char arg[MAX_LINE_SIZE];
+    bt_property_t prop;
+    bt_scan_mode_t mode;
+    uint32_t timeout;
+    bt_status_t status;
+    char *end;
+    int i;
+
+    line_get_str(&args, arg);
+
+    if (strcmp(arg, "name") == 0) {
+        line_skip_blanks(&args);
+        if (args[0] == 0 || strlen(args) >= ADAPTER_NAME_LEN) {
+            rl_printf("Name must be 1-%d characters\n", ADAPTER_NAME_LEN - 1);
+            return;
+        }
+        prop.type = BT_PROPERTY_BDNAME;
+        prop.len = strlen(args);
+        prop.val = args;
+    } else if (strcmp(arg, "scan-mode") == 0) {
+        line_get_str(&args, arg);
+        i = str_in_list(scan_modes, arg);
+        if (i < 0) {
+            rl_printf("Scan mode must be none, connectable or "
+                      "discoverable\n");
+            return;
+        }
+        mode = i;
+        prop.type = BT_PROPERTY_ADAPTER_SCAN_MODE;
+        prop.len = sizeof(mode);
+        prop.val = &mode;
+    } else if (strcmp(arg, "discoverable-timeout") == 0) {
+        line_get_str(&args, arg);
+        timeout = strtoul(arg, &end, 10);
+        if (arg[0] == 0 || *end != 0) {
+            rl_printf("Usage: adapter set discoverable-timeout <seconds>\n");
+            return;
+        }
+        prop.type = BT_PROPERTY_ADAPTER_DISCOVERY_TIMEOUT;
+        prop.len = sizeof(timeout);
+        prop.val = &timeout;
+    } else {
+        rl_printf("Invalid argument \"%s\"\n", arg);
+        return;
+    }
+
+    if (u.adapter_state != BT_STATE_ON) {
+        rl_printf("Unable to set property: Adapter is down\n");
+        return;
+    }
+
+    status = HAL_CALL(u.btiface, set_adapter_property, &prop);
+    if (status != BT_STATUS_SUCCESS)
+        rl_printf("Failed to set adapter property, error: %d\n", status);
+}
+
+static void cmd_adapter(char *args) {
+    char arg[MAX_LINE_SIZE];
+    adapter_info_t info;
+    bt_status_t status;
+
+    line_get_str(&args, arg);
+
+    if (strcmp(arg, "help") == 0) {
+        rl_printf("adapter -- Shows and sets adapter properties\n");
+        rl_printf("Arguments:\n");
+        rl_printf("(none)              shows all properties\n");
+        rl_printf("get <property>      shows a property, one of state, "
+                  "discovery, name, address,\n"
+                  "                    class, type, scan-mode, "
+                  "discoverable-timeout, bonded, uuids\n");
+        rl_printf("set name <name>\n");
+        rl_printf("set scan-mode none|connectable|discoverable\n");
+        rl_printf("set discoverable-timeout <seconds>\n"
+                  "                    sets a property\n");
+        rl_printf("refresh             asks the stack for all properties "
+                  "again\n");
+        rl_printf("Properties are kept from what the stack reports, "
+                  "showing them doesn't query the\nstack. Unknown values "
+                  "are shown as \"?\".\n");
+        return;
+    }
+
+    if (arg[0] == 0 || strcmp(arg, "get") == 0) {
+        if (arg[0] != 0) {
+            line_get_str(&args, arg);
+            if (str_in_list(adapter_props, arg) < 0) {
+                rl_printf("Invalid argument \"%s\"\n", arg);
+                return;
+            }
+        }
+        adapter_get(&info);
+        print_adapter_prop(&info, arg[0] != 0 ? arg : NULL);
+    } else if (strcmp(arg, "set") == 0) {
+        set_adapter_prop(args);
+    } else if (strcmp(arg, "refresh") == 0) {
+        if (u.adapter_state != BT_STATE_ON) {
+            rl_printf("Unable to get properties: Adapter is down\n");
+            return;
+        }
+        status = HAL_CALL(u.btiface, get_adapter_properties);
+        if (status != BT_STATUS_SUCCESS)
+            rl_printf("Failed to get adapter properties, error: %d\n",
+                      status);
+    } else {
+        rl_printf("Invalid argument \"%s\"\n", arg);
+    }
+}
+
 static void parse_ad_data(uint8_t *data, uint8_t length) {
     uint8_t i = 0;
     uint8_t ad_type = data[i++];
+    const char *name;
+
+    STATS_SCOPE("decode", __func__);
 
     switch (ad_type) {
         uint8_t j;
@@ -485,9 +923,13 @@ static void parse_ad_data(uint8_t *data, uint8_t length) {
 
             rl_printf("%s%u entr%s\n", msg, count, count == 1 ? "y" : "ies");
 
-            for (j = 0; j < count; j++)
-                rl_printf("      0x%02X%02X\n", data[i+j*sizeof(uint16_t)+1],
-                          data[i+j*sizeof(uint16_t)]);
+            for (j = 0; j < count; j++) {
+                uint16_t uuid = data[i+j*sizeof(uint16_t)] |
+                                data[i+j*sizeof(uint16_t)+1] << 8;
+
+                name = uuid16_name(uuid);
+                rl_printf("      0x%04X" NAME_FMT "\n", uuid, NAME_ARG(name));
+            }
 
             break;
         }
@@ -560,6 +1002,13 @@ static void parse_ad_data(uint8_t *data, uint8_t length) {
         }
         case AD_SERVICE_DATA:
             rl_printf("    Service Data\n");
+            if (length >= 3) {
+                uint16_t uuid = data[i] | data[i+1] << 8;
+
+                name = uuid16_name(uuid);
+                rl_printf("      UUID: 0x%04X" NAME_FMT "\n", uuid,
+                          NAME_ARG(name));
+            }
             break;
         case AD_PUBLIC_ADDRESS:
         case AD_RANDOM_ADDRESS:
@@ -571,10 +1020,15 @@ static void parse_ad_data(uint8_t *data, uint8_t length) {
             rl_printf("      %02X:%02X:%02X:%02X:%02X:%02X\n", data[i+5],
                       data[i+4], data[i+3], data[i+2], data[i+1], data[i]);
             break;
-        case AD_GAP_APPEARANCE:
+        case AD_GAP_APPEARANCE: {
+            uint16_t appearance = data[i] | data[i+1] << 8;
+
+            name = appearance_name(appearance);
             rl_printf("    Appearance\n");
-            rl_printf("      0x%02X%02X\n", data[i+1], data[i]);
+            rl_printf("      0x%04X" NAME_FMT "\n", appearance,
+                      NAME_ARG(name));
             break;
+        }
         case AD_ADV_INTERVAL: {
             uint16_t adv_interval;
 
@@ -585,14 +1039,20 @@ static void parse_ad_data(uint8_t *data, uint8_t length) {
 
             break;
         }
-        case AD_MANUFACTURER_DATA:
+        case AD_MANUFACTURER_DATA: {
+            uint16_t company = data[i] | data[i+1] << 8;
+
+            name = company_name(company);
             rl_printf("    Manufacturer-specific data\n");
-            rl_printf("      Company ID: 0x%02X%02X\n", data[i+1], data[i]);
+            rl_printf("      Company ID: 0x%04X" NAME_FMT "\n", company,
+                      NAME_ARG(name));
             rl_printf("      Data:");
-            for (j = i+2; j < i+length; j++)
+            /* data[0] is the AD type, so the payload ends at data[length-1] */
+            for (j = i+2; j < length; j++)
                 rl_printf(" %02X", data[j]);
             rl_printf("\n");
             break;
+        }
         default:
             rl_printf("    Invalid data type 0x%02X\n", ad_type);
             break;
@@ -601,10 +1061,34 @@ static void parse_ad_data(uint8_t *data, uint8_t length) {
 
 static void scan_result_cb(bt_bdaddr_t *bda, int rssi, uint8_t *adv_data) {
     char addr_str[BT_ADDRESS_STR_LEN];
+    char name[IRK_NAME_LEN];
+    bt_bdaddr_t identity;
+    const bt_bdaddr_t *id = bda;
+    bool resolved;
     uint8_t i = 0;
 
+    CALLBACK_SCOPE(rssi);
+
+    /* devices with a known IRK are accounted by their identity */
+    resolved = irk_resolve(bda, &identity, name);
+    if (resolved)
+        id = &identity;
+
+    rssi_history_add(id, rssi);
+    scan_stats_add(id, rssi);
+    scan_view_add(id, rssi, adv_data);
+
+    /* scheduled scans only print a summary of each window, the scan view
+     * shows a table */
+    if (u.scan_period_timeout != 0 || scan_view_active())
+        return;
+
     rl_printf("\nBLE device found\n");
     rl_printf("  Address: %s\n", ba2str(bda->address, addr_str));
+    if (resolved)
+        rl_printf("  Identity: %s%s%s%s\n",
+                  ba2str(identity.address, addr_str),
+                  name[0] ? " (" : "", name, name[0] ? ")" : "");
     rl_printf("  RSSI: %d\n", rssi);
 
     rl_printf("  Advertising Data:\n");
@@ -618,6 +1102,93 @@ static void scan_result_cb(bt_bdaddr_t *bda, int rssi, uint8_t *adv_data) {
     }
 }
 
+/* Prints the summary of a scan window */
+static void print_scan_window(const scan_window_t *w) {
+    char addr_str[BT_ADDRESS_STR_LEN];
+
+    if (w->reports == 0) {
+        rl_printf("Scan window %u: no devices found\n", w->index);
+        return;
+    }
+
+    rl_printf("Scan window %u: %u reports from %s%u devices, %u new, %u ms\n",
+              w->index, w->reports, w->overflow ? "more than " : "",
+              w->devices, w->new_devices, w->duration_ms);
+    rl_printf("  RSSI min/avg/max: %d/%.1f/%d, strongest: %s\n", w->rssi_min,
+              w->rssi_mean, w->rssi_max,
+              ba2str(w->strongest.address, addr_str));
+}
+
+/* Closes the current window of a scheduled scan */
+static bool scan_window_end(void *user_data) {
+    scan_window_t w;
+
+    u.scan_window_timeout = 0;
+
+    if (u.scan_state == 1 &&
+        HAL_CALL(u.gattiface->client, scan, u.client_if, 0) !=
+        BT_STATUS_SUCCESS)
+        rl_printf("Failed to stop scan\n");
+    u.scan_state = 0;
+
+    if (scan_stats_end(&w))
+        print_scan_window(&w);
+
+    return false;
+}
+
+/* Opens a window of a scheduled scan, called every period */
+static bool scan_window_start(void *user_data) {
+
+    if (u.adapter_state != BT_STATE_ON) {
+        u.scan_period_timeout = 0;
+        return false;
+    }
+
+    if (HAL_CALL(u.gattiface->client, scan, u.client_if, 1) !=
+        BT_STATUS_SUCCESS) {
+        rl_printf("Failed to start scan window\n");
+        return true; /* try again in the next period */
+    }
+
+    u.scan_state = 1;
+    scan_stats_begin();
+
+    u.scan_window_timeout = timeout_add(u.scan_window_ms, scan_window_end,
+                                        NULL);
+    if (u.scan_window_timeout == 0) {
+        rl_printf("Unable to schedule end of scan window\n");
+        scan_window_end(NULL);
+    }
+
+    return true;
+}
+
+/* Cancels a scheduled scan, closing the current window */
+static void scan_schedule_stop() {
+
+    timeout_remove(u.scan_period_timeout);
+    u.scan_period_timeout = 0;
+
+    if (u.scan_window_timeout != 0) {
+        timeout_remove(u.scan_window_timeout);
+        scan_window_end(NULL);
+    }
+}
+
+/* Closes the scan view, stopping the scan if it was started by it */
+static void scan_view_end() {
+
+    scan_view_stop();
+
+    if (u.scan_view_scan && u.scan_state == 1 &&
+        u.scan_period_timeout == 0 &&
+        HAL_CALL(u.gattiface->client, scan, u.client_if, 0) ==
+        BT_STATUS_SUCCESS)
+        u.scan_state = 0;
+    u.scan_view_scan = false;
+}
+
 static void cmd_scan(char *args) {
     bt_status_t status;
     char arg[MAX_LINE_SIZE];
@@ -633,8 +1204,18 @@ static void cmd_scan(char *args) {
     if (arg[0] == 0 || strcmp(arg, "help") == 0) {
         rl_printf("scan -- Controls BLE scan of nearby devices\n");
         rl_printf("Arguments:\n");
-        rl_printf("start   starts a new scan session\n");
-        rl_printf("stop    interrupts an ongoing scan session\n");
+        rl_printf("start                      starts a new scan session\n");
+        rl_printf("stop                       interrupts an ongoing or "
+                  "scheduled scan session\n");
+        rl_printf("schedule <window> <period> scans during window ms every "
+                  "period ms, printing\n"
+                  "                           a summary of each window "
+                  "instead of every report\n");
+        rl_printf("status                     shows the scan mode and "
+                  "statistics of scheduled scans\n");
+        rl_printf("view                       shows a live table of the "
+                  "devices found, scanning if\n"
+                  "                           needed, until q is pressed\n");
 
     } else if (strcmp(arg, "start") == 0) {
 
@@ -643,12 +1224,12 @@ static void cmd_scan(char *args) {
             return;
         }
 
-        if (u.scan_state == 1) {
+        if (u.scan_state == 1 || u.scan_period_timeout != 0) {
             rl_printf("Scan is already running\n");
             return;
         }
 
-        status = u.gattiface->client->scan(u.client_if, 1);
+        status = HAL_CALL(u.gattiface->client, scan, u.client_if, 1);
         if (status != BT_STATUS_SUCCESS) {
             rl_printf("Failed to start discovery\n");
             return;
@@ -658,12 +1239,17 @@ static void cmd_scan(char *args) {
 
     } else if (strcmp(arg, "stop") == 0) {
 
+        if (u.scan_period_timeout != 0) {
+            scan_schedule_stop();
+            return;
+        }
+
         if (u.scan_state == 0) {
             rl_printf("Unable to stop scan: Scan is not running\n");
             return;
         }
 
-        status = u.gattiface->client->scan(u.client_if, 0);
+        status = HAL_CALL(u.gattiface->client, scan, u.client_if, 0);
         if (status != BT_STATUS_SUCCESS) {
             rl_printf("Failed to stop scan\n");
             return;
@@ -671,58 +1257,235 @@ static void cmd_scan(char *args) {
 
         u.scan_state = 0;
 
-    } else
-        rl_printf("Invalid argument \"%s\"\n", arg);
-}
+    } else if (strcmp(arg, "schedule") == 0) {
+        unsigned int window, period;
 
-static void connect_cb(int conn_id, int status, int client_if,
-                       bt_bdaddr_t *bda) {
-    char addr_str[BT_ADDRESS_STR_LEN];
+        line_get_str(&args, arg);
+        if (sscanf(arg, "%u", &window) != 1 || window == 0) {
+            rl_printf("Invalid window \"%s\"\n", arg);
+            return;
+        }
 
-    clear_list_cache();
+        line_get_str(&args, arg);
+        if (sscanf(arg, "%u", &period) != 1 || period <= window) {
+            rl_printf("Invalid period \"%s\": it must be longer than the "
+                      "window\n", arg);
+            return;
+        }
 
-    if (status != 0) {
-        rl_printf("Failed to connect to device %s, status: %i\n",
-                  ba2str(bda->address, addr_str), status);
-        return;
-    }
+        if (u.adapter_state != BT_STATE_ON) {
+            rl_printf("Unable to start discovery: Adapter is down\n");
+            return;
+        }
 
-    rl_printf("Connected to device %s, conn_id: %d, client_if: %d\n",
-              ba2str(bda->address, addr_str), conn_id, client_if);
-    u.conn_id = conn_id;
-}
+        if (u.scan_state == 1 || u.scan_period_timeout != 0) {
+            rl_printf("Scan is already running\n");
+            return;
+        }
+
+        u.scan_window_ms = window;
+        u.scan_period_ms = period;
+        u.scan_period_timeout = timeout_add(period, scan_window_start, NULL);
+        if (u.scan_period_timeout == 0) {
+            rl_printf("Unable to schedule scan\n");
+            return;
+        }
+
+        scan_stats_reset();
+        scan_window_start(NULL);
+
+    } else if (strcmp(arg, "status") == 0) {
+        scan_totals_t totals;
+
+        if (u.scan_period_timeout != 0)
+            rl_printf("Scheduled scan: %u ms every %u ms, %.1f%% duty "
+                      "cycle\n", u.scan_window_ms, u.scan_period_ms,
+                      100.0 * u.scan_window_ms / u.scan_period_ms);
+        else
+            rl_printf("Scan %s\n", u.scan_state ? "running" : "stopped");
+
+        scan_stats_totals(&totals);
+        if (totals.windows > 0)
+            rl_printf("Windows: %u, reports: %llu, scanning time: %llu ms, "
+                      "most devices in a window: %u\n", totals.windows,
+                      (unsigned long long) totals.reports,
+                      (unsigned long long) totals.scan_ms,
+                      totals.max_devices);
+
+    } else if (strcmp(arg, "view") == 0) {
+
+        if (u.adapter_state != BT_STATE_ON) {
+            rl_printf("Unable to start discovery: Adapter is down\n");
+            return;
+        }
+
+        /* any scan will do, scheduled ones included */
+        if (u.scan_state == 0 && u.scan_period_timeout == 0) {
+            status = HAL_CALL(u.gattiface->client, scan, u.client_if, 1);
+            if (status != BT_STATUS_SUCCESS) {
+                rl_printf("Failed to start discovery\n");
+                return;
+            }
+
+            u.scan_state = 1;
+            u.scan_view_scan = true;
+        }
+
+        if (!scan_view_start())
+            scan_view_end();
+
+    } else
+        rl_printf("Invalid argument \"%s\"\n", arg);
+}
+
+static void connect_cb(int conn_id, int status, int client_if,
+                       bt_bdaddr_t *bda) {
+    char addr_str[BT_ADDRESS_STR_LEN];
+    conn_t *conn = conn_find_addr(bda);
+
+    CALLBACK_SCOPE(conn_id);
+
+    /* connections of the poll engine are reported by it */
+    if (conn != NULL && fleet_connected(conn, conn_id, status))
+        return;
+
+    if (status != 0) {
+        rl_printf("Failed to connect to device %s, status: %i\n",
+                  ba2str(bda->address, addr_str), status);
+        if (conn != NULL)
+            release_conn(conn);
+        return;
+    }
+
+    /* not started by us, eg. a background connection */
+    if (conn == NULL)
+        conn = conn_new(bda);
+
+    if (conn == NULL) {
+        rl_printf("Connected to device %s, but there are already %d "
+                  "connections\n", ba2str(bda->address, addr_str), CONN_MAX);
+        return;
+    }
+
+    rl_printf("Connected to device %s, conn_id: %d, client_if: %d\n",
+              ba2str(bda->address, addr_str), conn_id, client_if);
+
+    if (u.conn == NULL)
+        u.conn = conn;
+    conn_connected(conn, conn_id);
+}
 
 static void disconnect_cb(int conn_id, int status, int client_if,
                           bt_bdaddr_t *bda) {
     char addr_str[BT_ADDRESS_STR_LEN];
+    conn_t *conn = conn_find(conn_id);
+
+    CALLBACK_SCOPE(conn_id);
+
+    if (conn != NULL && fleet_disconnected(conn))
+        return;
 
     rl_printf("Disconnected from device %s, conn_id: %d, client_if: %d, "
               "status: %d\n", ba2str(bda->address, addr_str), conn_id,
               client_if, status);
 
-    u.conn_id = 0;
+    if (conn != NULL)
+        release_conn(conn);
 }
 
 static void cmd_disconnect(char *args) {
+    char arg[MAX_LINE_SIZE];
     bt_status_t status;
+    bt_bdaddr_t addr;
+    conn_t *conn = u.conn;
+
+    line_get_str(&args, arg);
+    if (arg[0] != 0) {
+        if (str2ba(arg, &addr) != 0) {
+            rl_printf("Invalid bluetooth address: %s\n", arg);
+            return;
+        }
+        conn = conn_find_addr(&addr);
+    }
 
-    if (u.conn_id <= 0) {
+    if (conn == NULL) {
         rl_printf("Device not connected\n");
         return;
     }
 
-    status = u.gattiface->client->disconnect(u.client_if, &u.remote_addr,
-                                             u.conn_id);
+    if (fleet_owns(conn)) {
+        rl_printf("Connection used by poll, stop it first\n");
+        return;
+    }
+
+    /* with conn_id 0 the stack cancels a pending connection */
+    status = HAL_CALL(u.gattiface->client, disconnect, u.client_if, &conn->addr,
+                      conn->conn_id);
     if (status != BT_STATUS_SUCCESS) {
         rl_printf("Failed to disconnect, status: %d\n", status);
         return;
     }
+
+    if (conn->conn_id <= 0)
+        release_conn(conn);
+}
+
+static void cmd_conn(char *args) {
+    char arg[MAX_LINE_SIZE];
+    char addr_str[BT_ADDRESS_STR_LEN];
+    bt_bdaddr_t addr;
+    conn_t *conn;
+    int i, n = 0;
+
+    line_get_str(&args, arg);
+
+    if (strcmp(arg, "help") == 0) {
+        rl_printf("conn -- Lists connections and selects the one used by "
+                  "GATT commands\n");
+        rl_printf("Arguments:\n");
+        rl_printf("(none)     list connections, '*' marks the selected one\n");
+        rl_printf("<address>  select the connection to address\n");
+
+    } else if (arg[0] == 0) {
+
+        for (i = 0; i < CONN_MAX; i++) {
+            conn = conn_get(i);
+            if (conn == NULL)
+                continue;
+
+            rl_printf("%c %s conn_id: %d services: %d pending: %d\n",
+                      conn == u.conn ? '*' : ' ',
+                      ba2str(conn->addr.address, addr_str), conn->conn_id,
+                      conn->db.svc_count, conn_pending(conn));
+            n++;
+        }
+
+        if (n == 0)
+            rl_printf("No connections\n");
+
+    } else if (str2ba(arg, &addr) == 0) {
+
+        conn = conn_find_addr(&addr);
+        if (conn == NULL) {
+            rl_printf("Not connected to %s\n", arg);
+            return;
+        }
+
+        if (fleet_owns(conn)) {
+            rl_printf("Connection used by poll, stop it first\n");
+            return;
+        }
+
+        u.conn = conn;
+
+    } else
+        rl_printf("Invalid argument \"%s\"\n", arg);
 }
 
 void do_ssp_reply(const bt_bdaddr_t *bd_addr, bt_ssp_variant_t variant,
                   uint8_t accept, uint32_t passkey) {
-    bt_status_t status = u.btiface->ssp_reply(bd_addr, variant, accept,
-                                              passkey);
+    bt_status_t status = HAL_CALL(u.btiface, ssp_reply, bd_addr, variant,
+                                  accept, passkey);
 
     if (status != BT_STATUS_SUCCESS) {
         rl_printf("SSP Reply error: %u\n", status);
@@ -732,6 +1495,10 @@ void do_ssp_reply(const bt_bdaddr_t *bd_addr, bt_ssp_variant_t variant,
 
 void pin_request_cb(bt_bdaddr_t *remote_bd_addr, bt_bdname_t *bd_name,
                     uint32_t cod) {
+    CALLBACK_SCOPE(0);
+
+    if (batch_pin_request(remote_bd_addr))
+        return;
 
     /* ask user which PIN code is showed at remote device */
     memcpy(&u.r_bd_addr, remote_bd_addr, sizeof(u.r_bd_addr));
@@ -741,6 +1508,10 @@ void pin_request_cb(bt_bdaddr_t *remote_bd_addr, bt_bdname_t *bd_name,
 void ssp_request_cb(bt_bdaddr_t *remote_bd_addr, bt_bdname_t *bd_name,
                     uint32_t cod, bt_ssp_variant_t pairing_variant,
                     uint32_t pass_key) {
+    CALLBACK_SCOPE(pairing_variant);
+
+    if (batch_ssp_request(remote_bd_addr, pairing_variant, pass_key))
+        return;
 
     if (pairing_variant == BT_SSP_VARIANT_CONSENT) {
         /* we need to ask to user if he wants to bond */
@@ -764,6 +1535,8 @@ void ssp_request_cb(bt_bdaddr_t *remote_bd_addr, bt_bdname_t *bd_name,
 static void cmd_connect(char *args) {
     bt_status_t status;
     char arg[MAX_LINE_SIZE];
+    bt_bdaddr_t addr;
+    conn_t *conn;
     int ret;
 
     if (u.gattiface == NULL) {
@@ -783,19 +1556,35 @@ static void cmd_connect(char *args) {
 
     line_get_str(&args, arg);
 
-    ret = str2ba(arg, &u.remote_addr);
+    ret = str2ba(arg, &addr);
     if (ret != 0) {
         rl_printf("Unable to connect: Invalid bluetooth address: %s\n", arg);
         return;
     }
 
+    if (conn_find_addr(&addr) != NULL) {
+        rl_printf("Unable to connect: Already connected to %s\n", arg);
+        return;
+    }
+
+    conn = conn_new(&addr);
+    if (conn == NULL) {
+        rl_printf("Unable to connect: Too many connections (max %d)\n",
+                  CONN_MAX);
+        return;
+    }
+
     rl_printf("Connecting to: %s\n", arg);
 
-    status = u.gattiface->client->connect(u.client_if, &u.remote_addr, true);
+    status = HAL_CALL(u.gattiface->client, connect, u.client_if, &addr, true);
     if (status != BT_STATUS_SUCCESS) {
         rl_printf("Failed to connect, status: %d\n", status);
+        release_conn(conn);
         return;
     }
+
+    /* GATT commands go to the last device we connected to */
+    u.conn = conn;
 }
 
 static void bond_state_changed_cb(bt_status_t status, bt_bdaddr_t *bda,
@@ -803,6 +1592,11 @@ static void bond_state_changed_cb(bt_status_t status, bt_bdaddr_t *bda,
     char addr_str[BT_ADDRESS_STR_LEN];
     char state_str[32] = {0};
 
+    CALLBACK_SCOPE(state);
+
+    if (batch_bond_state(status, bda, state))
+        return;
+
     if (status != BT_STATUS_SUCCESS) {
         rl_printf("Failed to change bond state, status: %d\n", status);
         return;
@@ -880,21 +1674,21 @@ static void cmd_pair(char *args) {
 
     switch (arg_pos) {
         case 0:
-            status = u.btiface->create_bond(&addr);
+            status = HAL_CALL(u.btiface, create_bond, &addr);
             if (status != BT_STATUS_SUCCESS) {
                 rl_printf("Failed to create bond, status: %d\n", status);
                 return;
             }
             break;
         case 1:
-            status = u.btiface->cancel_bond(&addr);
+            status = HAL_CALL(u.btiface, cancel_bond, &addr);
             if (status != BT_STATUS_SUCCESS) {
                 rl_printf("Failed to cancel bond, status: %d\n", status);
                 return;
             }
             break;
         case 2:
-            status = u.btiface->remove_bond(&addr);
+            status = HAL_CALL(u.btiface, remove_bond, &addr);
             if (status != BT_STATUS_SUCCESS) {
                 rl_printf("Failed to remove bond, status: %d\n", status);
                 return;
@@ -903,32 +1697,135 @@ static void cmd_pair(char *args) {
     }
 }
 
+static void cmd_pair_batch(char *args) {
+    char arg[MAX_LINE_SIZE];
+    unsigned int ms;
+    int n;
+
+    line_get_str(&args, arg);
+
+    if (arg[0] == 0 || strcmp(arg, "help") == 0) {
+        rl_printf("pair-batch -- Pairs a list of devices, answering pairing "
+                  "requests from a policy\n");
+        rl_printf("Arguments:\n");
+        rl_printf("load <file>       loads devices and policy, one "
+                  "\"<address> [action]\" per line,\n");
+        rl_printf("                  \"default <action>\" and \"unknown "
+                  "<action>\" where action is\n");
+        rl_printf("                  accept, reject, pin <digits> or "
+                  "passkey <number>\n");
+        rl_printf("slots <n>         devices paired at the same time "
+                  "(1-%d, default 1)\n", BATCH_SLOTS_MAX);
+        rl_printf("timeout <ms>      limit for each device (default %d)\n",
+                  BATCH_TIMEOUT_DEFAULT);
+        rl_printf("start [file]      starts pairing, loading file first if "
+                  "given\n");
+        rl_printf("stop              cancels pairing\n");
+        rl_printf("status            shows the configuration and outcome "
+                  "of each device\n");
+        return;
+    }
+
+    if (strcmp(arg, "status") == 0) {
+        batch_print_status();
+        return;
+    }
+
+    if (strcmp(arg, "stop") == 0) {
+        if (!batch_stop())
+            rl_printf("Pairing is not running\n");
+        return;
+    }
+
+    /* everything else changes the configuration */
+    if (batch_running()) {
+        rl_printf("Pairing is running, stop it first\n");
+        return;
+    }
+
+    if (strcmp(arg, "start") == 0) {
+
+        if (u.btiface == NULL || u.adapter_state != BT_STATE_ON) {
+            rl_printf("Unable to pair: Adapter is down\n");
+            return;
+        }
+
+        line_get_str(&args, arg);
+        if (arg[0] != 0 && !batch_load(arg))
+            return;
+
+        batch_set_interface(u.btiface);
+        batch_start();
+
+    } else if (strcmp(arg, "load") == 0) {
+
+        line_get_str(&args, arg);
+        if (arg[0] == 0) {
+            rl_printf("Usage: pair-batch load <file>\n");
+            return;
+        }
+
+        batch_load(arg);
+
+    } else if (strcmp(arg, "slots") == 0) {
+
+        line_get_str(&args, arg);
+        if (sscanf(arg, "%d", &n) != 1 || !batch_set_slots(n))
+            rl_printf("Invalid number of slots \"%s\"\n", arg);
+
+    } else if (strcmp(arg, "timeout") == 0) {
+
+        line_get_str(&args, arg);
+        if (sscanf(arg, "%u", &ms) != 1 || !batch_set_timeout(ms))
+            rl_printf("Invalid timeout \"%s\"\n", arg);
+
+    } else
+        rl_printf("Invalid argument \"%s\"\n", arg);
+}
+
 /* called when search has finished */
 void search_complete_cb(int conn_id, int status) {
+    CALLBACK_SCOPE(conn_id);
 
-    rl_printf("Search complete, status: %u\n", status);
+    if (!op_quiet(conn_id))
+        rl_printf("Search complete, status: %u\n", status);
+    gatt_op_done(conn_id, status, NULL);
 }
 
 /* called for each search result */
 void search_result_cb(int conn_id, btgatt_srvc_id_t *srvc_id) {
     char uuid_str[UUID128_STR_LEN] = {0};
+    conn_t *conn = conn_find(conn_id);
+    const char *name;
+    int id;
 
-    if (u.svcs_size < MAX_SVCS_SIZE) {
-        /* srvc_id value is replaced each time, so we need to copy it */
-        memcpy(&u.svcs[u.svcs_size].svc_id, srvc_id, sizeof(btgatt_srvc_id_t));
-        u.svcs_size++;
+    CALLBACK_SCOPE(conn_id);
+
+    if (conn == NULL)
+        return;
+
+    /* srvc_id value is replaced each time, so we need to copy it */
+    id = gatt_db_add_svc(&conn->db, srvc_id);
+    if (id < 0) {
+        rl_printf("Failed to store service\n");
+        return;
     }
 
-    rl_printf("ID:%i %s UUID: %s instance:%i\n", u.svcs_size - 1,
+    if (op_quiet(conn_id))
+        return;
+
+    name = uuid_name(&srvc_id->id.uuid);
+    rl_printf("ID:%i %s UUID: %s instance:%i" NAME_FMT "\n", id,
               srvc_id->is_primary ? "Primary" : "Secondary",
-              uuid2str(&srvc_id->id.uuid, uuid_str), srvc_id->id.inst_id);
+              uuid2str(&srvc_id->id.uuid, uuid_str), srvc_id->id.inst_id,
+              NAME_ARG(name));
 }
 
 static void cmd_search_svc(char *args) {
     char arg[MAX_LINE_SIZE];
-    bt_status_t status;
+    gatt_op_t op;
 
-    if (u.conn_id <= 0) {
+    if (u.conn == NULL || u.conn->conn_id <= 0) {
         rl_printf("Not connected\n");
         return;
     }
@@ -938,28 +1835,24 @@ static void cmd_search_svc(char *args) {
         return;
     }
 
-    clear_list_cache();
+    memset(&op, 0, sizeof(op));
+    op.type = GATT_OP_SEARCH;
 
     line_get_str(&args, arg);
     if (strlen(arg) > 0) {
-            bt_uuid_t uuid;
-            if (!str2uuid(arg, &uuid)) {
+            if (!str2uuid(arg, &op.uuid)) {
                 rl_printf("Invalid format of UUID: %s\n", arg);
                 return;
             }
-
-            status = u.gattiface->client->search_service(u.conn_id, &uuid);
-    } else
-            status = u.gattiface->client->search_service(u.conn_id, NULL);
-
-    if (status != BT_STATUS_SUCCESS) {
-        rl_printf("Failed to search services\n");
-        return;
+            op.filter = true;
     }
+
+    queue_op(&op);
 }
 
 void get_included_service_cb(int conn_id, int status, btgatt_srvc_id_t *srvc_id,
                              btgatt_srvc_id_t *incl_srvc_id) {
+    CALLBACK_SCOPE(conn_id);
 
     if (status == 0) {
         bt_status_t ret;
@@ -972,22 +1865,25 @@ void get_included_service_cb(int conn_id, int status, btgatt_srvc_id_t *srvc_id,
          * service we need to call get_included_service again using incl_srvc_id
          * as parameter
          */
-        ret = u.gattiface->client->get_included_service(conn_id, srvc_id,
-                                                        incl_srvc_id);
+        ret = HAL_CALL(u.gattiface->client, get_included_service, conn_id,
+                       srvc_id, incl_srvc_id);
         if (ret != BT_STATUS_SUCCESS) {
             rl_printf("Failed to list included services\n");
+            gatt_op_done(conn_id, -ret, NULL);
             return;
         }
-    } else
+    } else {
         rl_printf("Included finished, status: %i\n", status);
+        gatt_op_done(conn_id, status == 0x85 ? 0 : status, NULL);
+    }
 }
 
 static void cmd_included(char *args) {
     char arg[MAX_LINE_SIZE];
-    bt_status_t status;
+    gatt_op_t op;
     int id;
 
-    if (u.conn_id <= 0) {
+    if (u.conn == NULL || u.conn->conn_id <= 0) {
         rl_printf("Not connected\n");
         return;
     }
@@ -997,11 +1893,6 @@ static void cmd_included(char *args) {
         return;
     }
 
-    if (u.svcs_size <= 0) {
-        rl_printf("Run search-svc first to get all services list\n");
-        return;
-    }
-
     line_get_str(&args, arg);
     if (strlen(arg) <= 0) {
         rl_printf("Usage: included ID\n");
@@ -1009,86 +1900,84 @@ static void cmd_included(char *args) {
     }
 
     id = atoi(arg);
-    if (id < 0 || id >= u.svcs_size) {
-        rl_printf("Invalid ID: %s need to be between 0 and %i\n", arg,
-                  u.svcs_size - 1);
+    if (!check_ids(1, id, 0, 0))
         return;
-    }
 
-    /* get first included service */
-    status = u.gattiface->client->get_included_service(u.conn_id,
-                                                       &u.svcs[id].svc_id,
-                                                       NULL);
-    if (status != BT_STATUS_SUCCESS) {
-        rl_printf("Failed to list included services\n");
-        return;
-    }
+    memset(&op, 0, sizeof(op));
+    op.type = GATT_OP_INCLUDED;
+    op.svc = id;
+    queue_op(&op);
 }
 
 void get_characteristic_cb(int conn_id, int status, btgatt_srvc_id_t *srvc_id,
                            btgatt_char_id_t *char_id, int char_prop) {
     bt_status_t ret;
     char uuid_str[UUID128_STR_LEN] = {0};
-    int svc_id;
-    service_info_t *svc_info;
+    const char *name;
+    conn_t *conn = conn_find(conn_id);
+    int svc_id, ch_id;
+    bool quiet;
+
+    CALLBACK_SCOPE(conn_id);
+
+    if (conn == NULL)
+        return;
+
+    quiet = op_quiet(conn_id);
 
     if (status != 0) {
         if (status == 0x85) { /* it's not really an error, just finished */
-            rl_printf("List characteristics finished\n");
+            if (!quiet)
+                rl_printf("List characteristics finished\n");
+            conn_op_done(conn, 0, NULL);
             return;
         }
 
-        rl_printf("List characteristics finished, status: %i %s\n", status,
-                  atterror2str(status));
+        if (!quiet)
+            rl_printf("List characteristics finished, status: %i %s\n",
+                      status, atterror2str(status));
+        conn_op_done(conn, status, NULL);
         return;
     }
 
-    svc_id = find_svc(srvc_id);
+    svc_id = gatt_db_find_svc(&conn->db, srvc_id);
 
     if (svc_id < 0) {
         rl_printf("Received invalid characteristic (service inexistent)\n");
+        conn_op_done(conn, -BT_STATUS_FAIL, NULL);
         return;
     }
-    svc_info = &u.svcs[svc_id];
-
-    rl_printf("ID:%i UUID: %s instance:%i properties:0x%x\n",
-              svc_info->char_count, uuid2str(&char_id->uuid, uuid_str),
-              char_id->inst_id, char_prop);
-
-    if (svc_info->char_count == svc_info->chars_buf_size) {
-        int i;
-
-        svc_info->chars_buf_size += MAX_CHARS_SIZE;
-        svc_info->chars_buf = realloc(svc_info->chars_buf, sizeof(char_info_t) *
-                                      svc_info->chars_buf_size);
-
-        for (i = svc_info->char_count; i < svc_info->chars_buf_size; i++) {
-            svc_info->chars_buf[i].descrs = NULL;
-            svc_info->chars_buf[i].descr_count = 0;
-        }
-    }
 
     /* copy characteristic data */
-    memcpy(&svc_info->chars_buf[svc_info->char_count].char_id, char_id,
-           sizeof(btgatt_char_id_t));
-    svc_info->chars_buf[svc_info->char_count].descr_count = 0;
+    ch_id = gatt_db_add_char(&conn->db, svc_id, char_id, char_prop);
+    if (ch_id < 0) {
+        rl_printf("Failed to store characteristic\n");
+        conn_op_done(conn, -BT_STATUS_NOMEM, NULL);
+        return;
+    }
 
-    svc_info->char_count++;
+    name = uuid_name(&char_id->uuid);
+    if (!quiet)
+        rl_printf("ID:%i UUID: %s instance:%i properties:0x%x" NAME_FMT "\n",
+                  ch_id, uuid2str(&char_id->uuid, uuid_str), char_id->inst_id,
+                  char_prop, NAME_ARG(name));
 
     /* get next characteristic */
-    ret = u.gattiface->client->get_characteristic(u.conn_id, srvc_id, char_id);
+    ret = HAL_CALL(u.gattiface->client, get_characteristic, conn_id, srvc_id,
+                   char_id);
     if (ret != BT_STATUS_SUCCESS) {
         rl_printf("Failed to list characteristics\n");
+        conn_op_done(conn, -ret, NULL);
         return;
     }
 }
 
 /* search all characteristics of specific service */
 static void cmd_chars(char *args) {
-    bt_status_t status;
+    gatt_op_t op;
     int id;
 
-    if (u.conn_id <= 0) {
+    if (u.conn == NULL || u.conn->conn_id <= 0) {
         rl_printf("Not connected\n");
         return;
     }
@@ -1099,54 +1988,50 @@ static void cmd_chars(char *args) {
         return;
     }
 
-    if (u.svcs_size <= 0) {
-        rl_printf("Run search-svc first to get all services list\n");
-        return;
-    }
-
     if (sscanf(args, " %i ", &id) != 1) {
         rl_printf("Usage: characteristics serviceID\n");
         return;
     }
 
-    if (id < 0 || id >= u.svcs_size) {
-        rl_printf("Invalid serviceID: %i need to be between 0 and %i\n", id,
-                  u.svcs_size - 1);
+    if (!check_ids(1, id, 0, 0))
         return;
-    }
-
-    if (u.svcs[id].chars_buf == NULL) {
-        int i;
 
-        u.svcs[id].chars_buf_size = MAX_CHARS_SIZE;
-        u.svcs[id].chars_buf = malloc(sizeof(char_info_t) *
-                                      u.svcs[id].chars_buf_size);
-
-        for (i = u.svcs[id].char_count; i < u.svcs[id].chars_buf_size; i++) {
-            u.svcs[id].chars_buf[i].descrs = NULL;
-            u.svcs[id].chars_buf[i].descr_count = 0;
-        }
-    } else if (u.svcs[id].char_count > 0)
-        u.svcs[id].char_count = 0;
-
-    /* get first characteristic of service */
-    status = u.gattiface->client->get_characteristic(u.conn_id,
-                                                     &u.svcs[id].svc_id, NULL);
-    if (status != BT_STATUS_SUCCESS) {
-        rl_printf("Failed to list characteristics\n");
-        return;
-    }
+    memset(&op, 0, sizeof(op));
+    op.type = GATT_OP_CHARS;
+    op.svc = id;
+    queue_op(&op);
 }
 
 void read_characteristic_cb(int conn_id, int status,
                             btgatt_read_params_t *p_data) {
     char uuid_str[UUID128_STR_LEN] = {0};
     char value_hexstr[BTGATT_MAX_ATTR_LEN * 3 + 1] = {0};
+    conn_t *conn = conn_find(conn_id);
     int i;
 
+    CALLBACK_SCOPE(conn_id);
+
+    /* values read by every command and engine are logged */
+    if (status == 0 && conn != NULL)
+        value_log_add(&conn->addr, &p_data->srvc_id, &p_data->char_id,
+                      VALUE_LOG_READ, p_data->value.value, p_data->value.len);
+
+    if (op_quiet(conn_id)) {
+        gatt_op_done(conn_id, status, p_data);
+        return;
+    }
+
     if (status != 0) {
         rl_printf("Read characteristic error, status:%i %s\n", status,
                   atterror2str(status));
+        gatt_op_done(conn_id, status, p_data);
+        return;
+    }
+
+    if (conn != NULL && watch_value(&conn->addr, &p_data->srvc_id,
+                                    &p_data->char_id, p_data->value.value,
+                                    p_data->value.len)) {
+        gatt_op_done(conn_id, status, p_data);
         return;
     }
 
@@ -1160,15 +2045,16 @@ void read_characteristic_cb(int conn_id, int status,
               uuid_str));
     rl_printf("  value_type:%i status:%i value(hex): %s\n", p_data->value_type,
               p_data->status, value_hexstr);
+    schema_print(&p_data->char_id.uuid, p_data->value.value,
+                 p_data->value.len);
+    gatt_op_done(conn_id, status, p_data);
 }
 
 static void cmd_read_char(char *args) {
-    bt_status_t status;
-    service_info_t *svc_info;
-    char_info_t *char_info;
+    gatt_op_t op;
     int svc_id, char_id, auth;
 
-    if (u.conn_id <= 0) {
+    if (u.conn == NULL || u.conn->conn_id <= 0) {
         rl_printf("Not connected\n");
         return;
     }
@@ -1178,85 +2064,211 @@ static void cmd_read_char(char *args) {
         return;
     }
 
-    if (u.svcs_size <= 0) {
-        rl_printf("Run search-svc first to get all services list\n");
-        return;
-    }
-
     if (sscanf(args, " %i %i %i ", &svc_id, &char_id, &auth) != 3) {
         rl_printf("Usage: read-char serviceID characteristicID auth\n");
         rl_printf("  auth - enable authentication (1) or not (0)\n");
         return;
     }
 
-    if (svc_id < 0 || svc_id >= u.svcs_size) {
-        rl_printf("Invalid serviceID: %i need to be between 0 and %i\n", svc_id,
-                  u.svcs_size - 1);
+    if (!check_ids(2, svc_id, char_id, 0))
         return;
-    }
 
-    svc_info = &u.svcs[svc_id];
-    if (char_id < 0 || char_id >= svc_info->char_count) {
-        rl_printf("Invalid characteristicID, try to run characteristics "
-                  "command.\n");
-        return;
-    }
+    memset(&op, 0, sizeof(op));
+    op.type = GATT_OP_READ_CHAR;
+    op.svc = svc_id;
+    op.ch = char_id;
+    op.auth = auth;
+    queue_op(&op);
+}
 
-    char_info = &svc_info->chars_buf[char_id];
-    status = u.gattiface->client->read_characteristic(u.conn_id,
-                                                      &svc_info->svc_id,
-                                                      &char_info->char_id,
-                                                      auth);
-    if (status != BT_STATUS_SUCCESS) {
-        rl_printf("Failed to read characteristic\n");
-        return;
+/* State of read-all. Only one read is outstanding on a connection at a time,
+ * so the next one is queued from the completion of the previous one: it
+ * starts right away, while other commands can still be queued in between. */
+static struct {
+    conn_t *conn; /* NULL when not running */
+    int svc; /* -1 for all services */
+    int auth;
+    int next_svc; /* next characteristic to consider */
+    int next_ch;
+    uint64_t start_us;
+    int reads;
+    int failed;
+    int bytes;
+} read_all;
+
+static void read_all_done(conn_t *conn, const gatt_op_t *op, int status,
+                          const void *result);
+
+/* Queues the read of the next readable characteristic. Returns false if there
+ * are no more or it can't be queued. */
+static bool read_all_next(conn_t *conn) {
+    gatt_db_t *db = &conn->db;
+    int last = read_all.svc < 0 ? db->svc_count - 1 : read_all.svc;
+    gatt_op_t op;
+    int ch;
+
+    for (; read_all.next_svc <= last; read_all.next_svc++) {
+        while (read_all.next_ch < gatt_db_char_count(db, read_all.next_svc)) {
+            ch = read_all.next_ch++;
+            if (!(gatt_db_char_prop(db, read_all.next_svc, ch) &
+                  GATT_CHAR_PROP_READ))
+                continue;
+
+            memset(&op, 0, sizeof(op));
+            op.type = GATT_OP_READ_CHAR;
+            op.svc = read_all.next_svc;
+            op.ch = ch;
+            op.auth = read_all.auth;
+            op.quiet = true;
+            op.done = read_all_done;
+
+            if (conn_enqueue(conn, &op) >= 0)
+                return true;
+
+            rl_printf("Unable to queue read: %d operations pending\n",
+                      conn_pending(conn));
+            return false;
+        }
+        read_all.next_ch = 0;
     }
+
+    return false;
 }
 
-void write_characteristic_cb(int conn_id, int status,
-                             btgatt_write_params_t *p_data) {
+static void read_all_done(conn_t *conn, const gatt_op_t *op, int status,
+                          const void *result) {
+    const btgatt_read_params_t *p = result;
     char uuid_str[UUID128_STR_LEN] = {0};
+    char value_hexstr[BTGATT_MAX_ATTR_LEN * 3 + 1] = {0};
+    btgatt_char_id_t char_id;
+    const char *name;
+    uint64_t ms;
+    int i;
 
-    if (status != 0) {
-        rl_printf("Write characteristic error, status:%i %s\n", status,
+    gatt_db_char_id(&conn->db, op->svc, op->ch, &char_id);
+    uuid2str(&char_id.uuid, uuid_str);
+    name = uuid_name(&char_id.uuid);
+
+    if (status != 0 || p == NULL) {
+        read_all.failed++;
+        rl_printf("  %d/%d %s" NAME_FMT ": error, status:%i %s\n", op->svc,
+                  op->ch, uuid_str, NAME_ARG(name), status,
                   atterror2str(status));
-        return;
+    } else {
+        read_all.reads++;
+        read_all.bytes += p->value.len;
+
+        for (i = 0; i < p->value.len; i++)
+            sprintf(&value_hexstr[i * 3], "%02hhx ", p->value.value[i]);
+
+        rl_printf("  %d/%d %s" NAME_FMT ": %s\n", op->svc, op->ch, uuid_str,
+                  NAME_ARG(name), value_hexstr);
+        schema_print(&char_id.uuid, p->value.value, p->value.len);
     }
 
-    rl_printf("Write characteristic success\n");
-    rl_printf("  Service UUID:        %s\n", uuid2str(&p_data->srvc_id.id.uuid,
-              uuid_str));
-    rl_printf("  Characteristic UUID: %s\n", uuid2str(&p_data->char_id.uuid,
-              uuid_str));
+    /* a negative status means the connection is going away */
+    if (status >= 0 && read_all_next(conn))
+        return;
+
+    ms = (monotonic_us() - read_all.start_us) / 1000;
+    rl_printf("Read %d characteristic%s, %d failed, %d bytes in %llu ms\n",
+              read_all.reads, read_all.reads == 1 ? "" : "s", read_all.failed,
+              read_all.bytes, (unsigned long long) ms);
+    read_all.conn = NULL;
 }
 
-/*
- * @param write_type 1 -> Write Command
- *                   2 -> Write Request
- *                   3 -> Prepare Write
- */
-void write_char(int write_type, const char *cmd, char *args) {
-    bt_status_t status;
-    service_info_t *svc_info;
-    char_info_t *char_info;
-    char *saveptr = NULL, *tok;
-    int params = 0;
-    int svc_id, char_id, auth;
-    char new_value[BTGATT_MAX_ATTR_LEN];
-    int new_value_len = 0;
+static void cmd_read_all(char *args) {
+    char arg[MAX_LINE_SIZE];
+    int svc_id = -1, auth = 0;
 
-    if (u.conn_id <= 0) {
+    if (u.conn == NULL || u.conn->conn_id <= 0) {
         rl_printf("Not connected\n");
         return;
     }
 
     if (u.gattiface == NULL) {
-        rl_printf("Unable to BLE %s: GATT interface not avaiable\n", cmd);
+        rl_printf("Unable to BLE read-all: GATT interface not avaiable\n");
         return;
     }
 
-    if (u.svcs_size <= 0) {
-        rl_printf("Run search-svc first to get all services list\n");
+    line_get_str(&args, arg);
+    if ((strcmp(arg, "*") != 0 && sscanf(arg, "%i", &svc_id) != 1) ||
+        (sscanf(args, " %i", &auth) != 1 && args[strspn(args, " ")] != 0)) {
+        rl_printf("Usage: read-all serviceID|* [auth]\n");
+        rl_printf("  reads every readable characteristic of a service, or "
+                  "of all services\n");
+        rl_printf("  auth - enable authentication (1) or not (0)\n");
+        return;
+    }
+
+    if (read_all.conn != NULL) {
+        rl_printf("Unable to read-all: already running\n");
+        return;
+    }
+
+    if (svc_id >= 0 && !check_ids(1, svc_id, 0, 0))
+        return;
+
+    memset(&read_all, 0, sizeof(read_all));
+    read_all.conn = u.conn;
+    read_all.svc = svc_id;
+    read_all.auth = auth;
+    read_all.next_svc = svc_id < 0 ? 0 : svc_id;
+    read_all.start_us = monotonic_us();
+
+    if (!read_all_next(u.conn)) {
+        rl_printf("No readable characteristics, run characteristics "
+                  "first\n");
+        read_all.conn = NULL;
+    }
+}
+
+void write_characteristic_cb(int conn_id, int status,
+                             btgatt_write_params_t *p_data) {
+    char uuid_str[UUID128_STR_LEN] = {0};
+
+    CALLBACK_SCOPE(conn_id);
+
+    if (op_quiet(conn_id)) {
+        gatt_op_done(conn_id, status, p_data);
+        return;
+    }
+
+    if (status != 0) {
+        rl_printf("Write characteristic error, status:%i %s\n", status,
+                  atterror2str(status));
+        gatt_op_done(conn_id, status, p_data);
+        return;
+    }
+
+    rl_printf("Write characteristic success\n");
+    rl_printf("  Service UUID:        %s\n", uuid2str(&p_data->srvc_id.id.uuid,
+              uuid_str));
+    rl_printf("  Characteristic UUID: %s\n", uuid2str(&p_data->char_id.uuid,
+              uuid_str));
+    gatt_op_done(conn_id, status, p_data);
+}
+
+/*
+ * @param write_type 1 -> Write Command
+ *                   2 -> Write Request
+ *                   3 -> Prepare Write
+ */
+void write_char(int write_type, const char *cmd, char *args) {
+    gatt_op_t op;
+    char *saveptr = NULL, *tok;
+    int params = 0;
+    int svc_id, char_id, auth;
+    char new_value[BTGATT_MAX_ATTR_LEN];
+    int new_value_len = 0;
+
+    if (u.conn == NULL || u.conn->conn_id <= 0) {
+        rl_printf("Not connected\n");
+        return;
+    }
+
+    if (u.gattiface == NULL) {
+        rl_printf("Unable to BLE %s: GATT interface not avaiable\n", cmd);
         return;
     }
 
@@ -1311,31 +2323,19 @@ void write_char(int write_type, const char *cmd, char *args) {
         return;
     }
 
-    if (svc_id < 0 || svc_id >= u.svcs_size) {
-        rl_printf("Invalid serviceID: %i need to be between 0 and %i\n", svc_id,
-                  u.svcs_size - 1);
-        return;
-    }
-
-    svc_info = &u.svcs[svc_id];
-    if (char_id < 0 || char_id >= svc_info->char_count) {
-        rl_printf("Invalid characteristicID, try to run characteristics "
-                  "command.\n");
+    if (!check_ids(2, svc_id, char_id, 0))
         return;
-    }
 
     rl_printf("Writing %i bytes\n", new_value_len);
-    char_info = &svc_info->chars_buf[char_id];
-    status = u.gattiface->client->write_characteristic(u.conn_id,
-                                                       &svc_info->svc_id,
-                                                       &char_info->char_id,
-                                                       write_type,
-                                                       new_value_len,
-                                                       auth, new_value);
-    if (status != BT_STATUS_SUCCESS) {
-        rl_printf("Failed to write characteristic\n");
-        return;
-    }
+    memset(&op, 0, sizeof(op));
+    op.type = GATT_OP_WRITE_CHAR;
+    op.svc = svc_id;
+    op.ch = char_id;
+    op.auth = auth;
+    op.write_type = write_type;
+    op.len = new_value_len;
+    op.value = new_value;
+    queue_op(&op);
 }
 
 static void cmd_write_req_char(char *args) {
@@ -1352,67 +2352,76 @@ void get_descriptor_cb(int conn_id, int status, btgatt_srvc_id_t *srvc_id,
                        btgatt_char_id_t *char_id, bt_uuid_t *descr_id) {
     bt_status_t ret;
     char uuid_str[UUID128_STR_LEN] = {0};
-    int svc_id, ch_id;
-    service_info_t *svc_info = NULL;
-    char_info_t *char_info = NULL;
+    const char *name;
+    conn_t *conn = conn_find(conn_id);
+    int svc_id, ch_id, desc_id;
+    bool quiet;
+
+    CALLBACK_SCOPE(conn_id);
+
+    if (conn == NULL)
+        return;
+
+    quiet = op_quiet(conn_id);
 
     if (status != 0) {
         if (status == 0x85) { /* it's not really an error, just finished */
-            rl_printf("List characteristics descriptors finished\n");
+            if (!quiet)
+                rl_printf("List characteristics descriptors finished\n");
+            conn_op_done(conn, 0, NULL);
             return;
         }
 
-        rl_printf("List characteristic descriptors finished, status: %i %s\n",
-                  status, atterror2str(status));
+        if (!quiet)
+            rl_printf("List characteristic descriptors finished, status: "
+                      "%i %s\n", status, atterror2str(status));
+        conn_op_done(conn, status, NULL);
         return;
     }
 
-    svc_id = find_svc(srvc_id);
+    svc_id = gatt_db_find_svc(&conn->db, srvc_id);
     if (svc_id < 0) {
         rl_printf("Received invalid descriptor (service inexistent)\n");
+        conn_op_done(conn, -BT_STATUS_FAIL, NULL);
         return;
     }
-    svc_info = &u.svcs[svc_id];
 
-    ch_id = find_char(svc_info, char_id);
+    ch_id = gatt_db_find_char(&conn->db, svc_id, char_id);
     if (ch_id < 0) {
         rl_printf("Received invalid descriptor (characteristic inexistent)\n");
+        conn_op_done(conn, -BT_STATUS_FAIL, NULL);
         return;
     }
-    char_info = &svc_info->chars_buf[ch_id];
 
-    rl_printf("ID:%i UUID: %s\n", char_info->descr_count,
-              uuid2str(descr_id, uuid_str));
+    name = uuid_name(descr_id);
+    if (!quiet)
+        rl_printf("ID:%i UUID: %s" NAME_FMT "\n",
+                  gatt_db_desc_count(&conn->db, svc_id, ch_id),
+                  uuid2str(descr_id, uuid_str), NAME_ARG(name));
 
-    if (char_info->descr_count == 255) {
+    /* copy descriptor data */
+    desc_id = gatt_db_add_desc(&conn->db, svc_id, ch_id, descr_id);
+    if (desc_id < 0) {
         rl_printf("Max descriptors overflow error\n");
+        conn_op_done(conn, -BT_STATUS_NOMEM, NULL);
         return;
     }
 
-    char_info->descr_count++;
-    char_info->descrs = realloc(char_info->descrs, char_info->descr_count *
-                                sizeof(char_info->descrs[0]));
-
-    /* copy descriptor data */
-    memcpy(&char_info->descrs[char_info->descr_count - 1], descr_id,
-           sizeof(*descr_id));
-
     /* get next descriptor */
-    ret = u.gattiface->client->get_descriptor(u.conn_id, srvc_id, char_id,
-                                              descr_id);
+    ret = HAL_CALL(u.gattiface->client, get_descriptor, conn_id, srvc_id,
+                   char_id, descr_id);
     if (ret != BT_STATUS_SUCCESS) {
         rl_printf("Failed to list descriptors\n");
+        conn_op_done(conn, -ret, NULL);
         return;
     }
 }
 
 static void cmd_char_desc(char *args) {
-    bt_status_t status;
-    service_info_t *svc_info;
-    char_info_t *char_info;
+    gatt_op_t op;
     int svc_id, char_id;
 
-    if (u.conn_id <= 0) {
+    if (u.conn == NULL || u.conn->conn_id <= 0) {
         rl_printf("Not connected\n");
         return;
     }
@@ -1422,47 +2431,36 @@ static void cmd_char_desc(char *args) {
         return;
     }
 
-    if (u.svcs_size <= 0) {
-        rl_printf("Run search-svc first to get all services list\n");
-        return;
-    }
-
     if (sscanf(args, " %i %i ", &svc_id, &char_id) != 2) {
         rl_printf("Usage: char-desc serviceID characteristicID\n");
         return;
     }
 
-    if (svc_id < 0 || svc_id >= u.svcs_size) {
-        rl_printf("Invalid serviceID: %i need to be between 0 and %i\n", svc_id,
-                  u.svcs_size - 1);
-        return;
-    }
-
-    svc_info = &u.svcs[svc_id];
-    if (char_id < 0 || char_id >= svc_info->char_count) {
-        rl_printf("Invalid characteristicID, try to run characteristics "
-                  "command.\n");
+    if (!check_ids(2, svc_id, char_id, 0))
         return;
-    }
 
-    char_info = &svc_info->chars_buf[char_id];
-    char_info->descr_count = 0;
-    /* get first descriptor */
-    status = u.gattiface->client->get_descriptor(u.conn_id, &svc_info->svc_id,
-                                                 &char_info->char_id, NULL);
-    if (status != BT_STATUS_SUCCESS) {
-        rl_printf("Failed to list characteristic descriptors\n");
-        return;
-    }
+    memset(&op, 0, sizeof(op));
+    op.type = GATT_OP_DESCS;
+    op.svc = svc_id;
+    op.ch = char_id;
+    queue_op(&op);
 }
 
 void write_descriptor_cb(int conn_id, int status,
                          btgatt_write_params_t *p_data) {
     char uuid_str[UUID128_STR_LEN] = {0};
 
+    CALLBACK_SCOPE(conn_id);
+
+    if (op_quiet(conn_id)) {
+        gatt_op_done(conn_id, status, p_data);
+        return;
+    }
+
     if (status != 0) {
         rl_printf("Write descriptor error, status:%i %s\n", status,
                   atterror2str(status));
+        gatt_op_done(conn_id, status, p_data);
         return;
     }
 
@@ -1473,20 +2471,18 @@ void write_descriptor_cb(int conn_id, int status,
               uuid_str));
     rl_printf("  Descriptor UUID:     %s\n", uuid2str(&p_data->descr_id,
               uuid_str));
+    gatt_op_done(conn_id, status, p_data);
 }
 
 static void cmd_write_desc(char *args) {
-    bt_status_t status;
-    service_info_t *svc_info;
-    char_info_t *char_info;
-    bt_uuid_t *descr_uuid;
+    gatt_op_t op;
     char *saveptr = NULL, *tok;
     int params = 0;
     int svc_id, char_id, desc_id, auth;
     char new_value[BTGATT_MAX_ATTR_LEN];
     int new_value_len = 0;
 
-    if (u.conn_id <= 0) {
+    if (u.conn == NULL || u.conn->conn_id <= 0) {
         rl_printf("Not connected\n");
         return;
     }
@@ -1496,11 +2492,6 @@ static void cmd_write_desc(char *args) {
         return;
     }
 
-    if (u.svcs_size <= 0) {
-        rl_printf("Run search-svc first to get all services list\n");
-        return;
-    }
-
     tok = strtok_r(args, " ", &saveptr);
     while (tok != NULL) {
         switch (params) {
@@ -1559,37 +2550,20 @@ static void cmd_write_desc(char *args) {
         return;
     }
 
-    if (svc_id < 0 || svc_id >= u.svcs_size) {
-        rl_printf("Invalid serviceID: %i need to be between 0 and %i\n", svc_id,
-                  u.svcs_size - 1);
-        return;
-    }
-
-    svc_info = &u.svcs[svc_id];
-    if (char_id < 0 || char_id >= svc_info->char_count) {
-        rl_printf("Invalid characteristicID, try to run characteristics "
-                  "command.\n");
-        return;
-    }
-
-    char_info = &svc_info->chars_buf[char_id];
-    if (desc_id < 0 || desc_id >= char_info->descr_count) {
-        rl_printf("Invalid descriptorID, try to run char-desc command.\n");
+    if (!check_ids(3, svc_id, char_id, desc_id))
         return;
-    }
-    descr_uuid = &char_info->descrs[desc_id];
 
     rl_printf("Writing %i bytes\n", new_value_len);
-    status = u.gattiface->client->write_descriptor(u.conn_id, &svc_info->svc_id,
-                                                   &char_info->char_id,
-                                                   descr_uuid,
-                                                   2 /* Write Request */,
-                                                   new_value_len, auth,
-                                                   new_value);
-    if (status != BT_STATUS_SUCCESS) {
-        rl_printf("Failed to write descriptor\n");
-        return;
-    }
+    memset(&op, 0, sizeof(op));
+    op.type = GATT_OP_WRITE_DESC;
+    op.svc = svc_id;
+    op.ch = char_id;
+    op.desc = desc_id;
+    op.auth = auth;
+    op.write_type = 2; /* Write Request */
+    op.len = new_value_len;
+    op.value = new_value;
+    queue_op(&op);
 }
 
 void read_descriptor_cb(int conn_id, int status, btgatt_read_params_t *p_data) {
@@ -1597,9 +2571,17 @@ void read_descriptor_cb(int conn_id, int status, btgatt_read_params_t *p_data) {
     char value_hexstr[BTGATT_MAX_ATTR_LEN * 3 + 1] = {0};
     int i;
 
+    CALLBACK_SCOPE(conn_id);
+
+    if (op_quiet(conn_id)) {
+        gatt_op_done(conn_id, status, p_data);
+        return;
+    }
+
     if (status != 0) {
         rl_printf("Read descriptor error, status:%i %s\n", status,
                   atterror2str(status));
+        gatt_op_done(conn_id, status, p_data);
         return;
     }
 
@@ -1615,16 +2597,14 @@ void read_descriptor_cb(int conn_id, int status, btgatt_read_params_t *p_data) {
               uuid_str));
     rl_printf("  value_type:%i status:%i value(hex): %s\n", p_data->value_type,
               p_data->status, value_hexstr);
+    gatt_op_done(conn_id, status, p_data);
 }
 
 static void cmd_read_desc(char *args) {
-    bt_status_t status;
-    service_info_t *svc_info;
-    char_info_t *char_info;
-    bt_uuid_t *descr_uuid;
+    gatt_op_t op;
     int svc_id, char_id, desc_id, auth;
 
-    if (u.conn_id <= 0) {
+    if (u.conn == NULL || u.conn->conn_id <= 0) {
         rl_printf("Not connected\n");
         return;
     }
@@ -1634,11 +2614,6 @@ static void cmd_read_desc(char *args) {
         return;
     }
 
-    if (u.svcs_size <= 0) {
-        rl_printf("Run search-svc first to get all services list\n");
-        return;
-    }
-
     if (sscanf(args, " %i %i %i %i ", &svc_id, &char_id, &desc_id,
                &auth) != 4) {
         rl_printf("Usage: read-desc serviceID characteristicID descriptorID "
@@ -1647,33 +2622,16 @@ static void cmd_read_desc(char *args) {
         return;
     }
 
-    if (svc_id < 0 || svc_id >= u.svcs_size) {
-        rl_printf("Invalid serviceID: %i need to be between 0 and %i\n", svc_id,
-                  u.svcs_size - 1);
-        return;
-    }
-
-    svc_info = &u.svcs[svc_id];
-    if (char_id < 0 || char_id >= svc_info->char_count) {
-        rl_printf("Invalid characteristicID, try to run characteristics "
-                  "command.\n");
-        return;
-    }
-
-    char_info = &svc_info->chars_buf[char_id];
-    if (desc_id < 0 || desc_id >= char_info->descr_count) {
-        rl_printf("Invalid descriptorID, try to run char-desc command.\n");
+    if (!check_ids(3, svc_id, char_id, desc_id))
         return;
-    }
-    descr_uuid = &char_info->descrs[desc_id];
 
-    status = u.gattiface->client->read_descriptor(u.conn_id, &svc_info->svc_id,
-                                                  &char_info->char_id,
-                                                  descr_uuid, auth);
-    if (status != BT_STATUS_SUCCESS) {
-        rl_printf("Failed to read descriptor\n");
-        return;
-    }
+    memset(&op, 0, sizeof(op));
+    op.type = GATT_OP_READ_DESC;
+    op.svc = svc_id;
+    op.ch = char_id;
+    op.desc = desc_id;
+    op.auth = auth;
+    queue_op(&op);
 }
 
 void register_for_notification_cb(int conn_id, int registered, int status,
@@ -1681,9 +2639,17 @@ void register_for_notification_cb(int conn_id, int registered, int status,
                                   btgatt_char_id_t *char_id) {
     char uuid_str[UUID128_STR_LEN] = {0};
 
+    CALLBACK_SCOPE(conn_id);
+
+    if (op_quiet(conn_id)) {
+        gatt_op_done(conn_id, status, NULL);
+        return;
+    }
+
     if (status != 0) {
         rl_printf("Un/register for characteristic notification status: %i %s\n",
                   status, atterror2str(status));
+        gatt_op_done(conn_id, status, NULL);
         return;
     }
 
@@ -1693,13 +2659,32 @@ void register_for_notification_cb(int conn_id, int registered, int status,
               uuid_str));
     rl_printf("  Characteristic UUID: %s\n", uuid2str(&char_id->uuid,
               uuid_str));
+    gatt_op_done(conn_id, status, NULL);
 }
 
 void notify_cb(int conn_id, btgatt_notify_params_t *p_data) {
     char uuid_str[UUID128_STR_LEN] = {0};
     char value_hexstr[BTGATT_MAX_ATTR_LEN * 3 + 1] = {0};
+    conn_t *conn = conn_find(conn_id);
     int i;
 
+    CALLBACK_SCOPE(conn_id);
+
+    /* acknowledgements of send-file */
+    if (conn != NULL && xfer_notify(conn, p_data))
+        return;
+
+    value_log_add(&p_data->bda, &p_data->srvc_id, &p_data->char_id,
+                  p_data->is_notify ? VALUE_LOG_NOTIFY : VALUE_LOG_INDICATE,
+                  p_data->value, p_data->len);
+
+    if (sink_notify(conn_id, p_data))
+        return;
+
+    if (watch_value(&p_data->bda, &p_data->srvc_id, &p_data->char_id,
+                    p_data->value, p_data->len))
+        return;
+
     for (i = 0; i < p_data->len; i++)
         sprintf(&value_hexstr[i * 3], "%02hhx ", p_data->value[i]);
 
@@ -1710,187 +2695,1020 @@ void notify_cb(int conn_id, btgatt_notify_params_t *p_data) {
               uuid_str));
     rl_printf("  is_notify:%i value(hex): %s\n", p_data->is_notify,
               value_hexstr);
+    schema_print(&p_data->char_id.uuid, p_data->value, p_data->len);
 }
 
-static void cmd_reg_notification(char *args) {
-    bt_status_t status;
-    service_info_t *svc_info;
-    char_info_t *char_info;
-    int svc_id, char_id;
+static void cmd_notif_sink(char *args) {
+    char arg[MAX_LINE_SIZE];
+    char target[MAX_LINE_SIZE];
+    bool add;
+    int svc_id, char_id, n = 0;
 
-    if (u.conn_id <= 0) {
-        rl_printf("Not connected\n");
-        return;
-    }
+    line_get_str(&args, arg);
 
-    if (u.gattiface == NULL) {
-        rl_printf("Unable to register notification/indication: GATT interface "
-                  "not available\n");
+    if (arg[0] == 0 || strcmp(arg, "help") == 0) {
+        rl_printf("notif-sink -- Writes notifications to a FIFO, file or "
+                  "socket\n");
+        rl_printf("Arguments:\n");
+        rl_printf("add <serviceID> <characteristicID> <path|fd>\n"
+                  "                    writes notifications of the "
+                  "characteristic to path, or\n"
+                  "                    to an inherited file descriptor, "
+                  "instead of printing them\n");
+        rl_printf("remove <serviceID> <characteristicID>\n"
+                  "                    prints notifications of the "
+                  "characteristic again\n");
+        rl_printf("clear               removes all characteristics and "
+                  "closes the sinks\n");
+        rl_printf("status              shows sinks and counters\n");
+        rl_printf("Each notification is a record of a 64-bit timestamp in "
+                  "microseconds, 16-bit\nconn_id, service ID, characteristic "
+                  "ID and value length, followed by the\nvalue, in host byte "
+                  "order.\n");
         return;
     }
 
-    if (u.svcs_size <= 0) {
-        rl_printf("Run search-svc first to get all services list\n");
+    if (strcmp(arg, "status") == 0) {
+        sink_print_status();
         return;
     }
 
-    if (sscanf(args, " %i %i ", &svc_id, &char_id) != 2) {
-        rl_printf("Usage: reg-notif serviceID characteristicID\n");
+    if (strcmp(arg, "clear") == 0) {
+        sink_clear();
         return;
     }
 
-    if (svc_id < 0 || svc_id >= u.svcs_size) {
-        rl_printf("Invalid serviceID: %i need to be between 0 and %i\n", svc_id,
-                  u.svcs_size - 1);
+    if (strcmp(arg, "add") != 0 && strcmp(arg, "remove") != 0) {
+        rl_printf("Invalid argument \"%s\"\n", arg);
         return;
     }
 
-    svc_info = &u.svcs[svc_id];
-    if (char_id < 0 || char_id >= svc_info->char_count) {
-        rl_printf("Invalid characteristicID, try to run characteristics "
-                  "command\n");
+    add = strcmp(arg, "add") == 0;
+
+    if (u.conn == NULL || u.conn->conn_id <= 0) {
+        rl_printf("Not connected\n");
         return;
     }
 
-    char_info = &svc_info->chars_buf[char_id];
-    status = u.gattiface->client->register_for_notification(u.client_if,
-                                                           &u.remote_addr,
-                                                           &svc_info->svc_id,
-                                                           &char_info->char_id);
-    if (status != BT_STATUS_SUCCESS)
-        rl_printf("Failed to register for characteristic "
-                  "notification/indication\n");
-}
-
-static void cmd_unreg_notification(char *args) {
-    bt_status_t status;
-    service_info_t *svc_info;
-    char_info_t *char_info;
-    int svc_id, char_id;
+    /* n stays 0 unless both IDs are read */
+    target[0] = 0;
+    if (sscanf(args, " %i %i%n", &svc_id, &char_id, &n) == 2) {
+        args += n;
+        if (add && !line_get_path(&args, target, sizeof(target)))
+            return;
+    }
 
-    if (u.conn_id <= 0) {
-        rl_printf("Not connected\n");
+    if (n == 0 || (add && target[0] == 0)) {
+        if (add)
+            rl_printf("Usage: notif-sink add serviceID characteristicID "
+                      "path|fd\n");
+        else
+            rl_printf("Usage: notif-sink remove serviceID "
+                      "characteristicID\n");
         return;
     }
 
-    if (u.gattiface == NULL) {
-        rl_printf("Unable to unregister notification/indication: GATT interface"
-                  " not available\n");
+    if (!check_ids(2, svc_id, char_id, 0))
         return;
-    }
 
-    if (u.svcs_size <= 0) {
-        rl_printf("Run search-svc first to get all services list\n");
+    if (!add) {
+        if (!sink_remove(u.conn, svc_id, char_id))
+            rl_printf("Characteristic not written to a sink\n");
         return;
     }
 
-    if (sscanf(args, " %i %i ", &svc_id, &char_id) != 2) {
-        rl_printf("Usage: unreg-notif serviceID characteristicID\n");
+    if (sink_add(u.conn, svc_id, char_id, target))
+        rl_printf("Notifications of service %d characteristic %d written to "
+                  "%s\n", svc_id, char_id, target);
+}
+
+static void cmd_watch(char *args) {
+    char arg[MAX_LINE_SIZE];
+    watch_range_t ignore[WATCH_IGNORE_MAX];
+    int ignore_count = 0;
+    bool delta = false, add;
+    int svc_id = -1, char_id;
+    unsigned int from, to;
+
+    line_get_str(&args, arg);
+
+    if (arg[0] == 0 || strcmp(arg, "help") == 0) {
+        rl_printf("watch -- Prints characteristic values only when they "
+                  "change\n");
+        rl_printf("Arguments:\n");
+        rl_printf("add <serviceID> <characteristicID> [delta] "
+                  "[ignore <from>[-<to>]]...\n"
+                  "                    prints reads and notifications of the "
+                  "characteristic on one\n"
+                  "                    line when the value changes, as the "
+                  "XOR with the last value\n"
+                  "                    with delta, leaving out of the "
+                  "comparison the byte offsets\n"
+                  "                    given with ignore (up to %d "
+                  "ranges)\n", WATCH_IGNORE_MAX);
+        rl_printf("remove <serviceID> <characteristicID>\n"
+                  "                    prints every value of the "
+                  "characteristic again\n");
+        rl_printf("clear               removes all watches\n");
+        rl_printf("status              shows watches and counters\n");
         return;
     }
 
-    if (svc_id < 0 || svc_id >= u.svcs_size) {
-        rl_printf("Invalid serviceID: %i need to be between 0 and %i\n", svc_id,
-                  u.svcs_size - 1);
+    if (strcmp(arg, "status") == 0) {
+        watch_print_status();
         return;
     }
 
-    svc_info = &u.svcs[svc_id];
-    if (char_id < 0 || char_id >= svc_info->char_count) {
-        rl_printf("Invalid characteristicID, try to run characteristics "
-                  "command\n");
+    if (strcmp(arg, "clear") == 0) {
+        watch_clear();
         return;
     }
 
-    char_info = &svc_info->chars_buf[char_id];
-    status = u.gattiface->client->deregister_for_notification(u.client_if,
-                                                           &u.remote_addr,
-                                                           &svc_info->svc_id,
-                                                           &char_info->char_id);
-    if (status != BT_STATUS_SUCCESS)
-        rl_printf("Failed to unregister for characteristic "
-                  "notification/indication\n");
-}
-
-void read_remote_rssi_cb(int client_if, bt_bdaddr_t *bda, int rssi,
-                         int status) {
-    char addr_str[BT_ADDRESS_STR_LEN];
-
-    if (status != 0) {
-        rl_printf("Read RSSI error, status:%i %s\n", status,
-                  atterror2str(status));
+    if (strcmp(arg, "add") != 0 && strcmp(arg, "remove") != 0) {
+        rl_printf("Invalid argument \"%s\"\n", arg);
         return;
     }
 
-    rl_printf("Address: %s RSSI: %i\n", ba2str(bda->address, addr_str), rssi);
-}
-
-static void cmd_rssi(char *args) {
-    bt_status_t status;
+    add = strcmp(arg, "add") == 0;
 
-    if (u.conn_id <= 0) {
+    if (u.conn == NULL || u.conn->conn_id <= 0) {
         rl_printf("Not connected\n");
         return;
     }
 
-    if (u.gattiface == NULL) {
-        rl_printf("Unable to BLE RSSI: GATT interface not avaiable\n");
-        return;
+    line_get_str(&args, arg);
+    if (sscanf(arg, "%i", &svc_id) == 1) {
+        line_get_str(&args, arg);
+        if (sscanf(arg, "%i", &char_id) != 1)
+            svc_id = -1;
     }
 
-    status = u.gattiface->client->read_remote_rssi(u.client_if, &u.remote_addr);
-    if (status != BT_STATUS_SUCCESS) {
-        rl_printf("Failed to request RSSI, status: %d\n", status);
+    if (svc_id < 0 || arg[0] == 0) {
+        if (add)
+            rl_printf("Usage: watch add serviceID characteristicID [delta] "
+                      "[ignore from[-to]]...\n");
+        else
+            rl_printf("Usage: watch remove serviceID characteristicID\n");
         return;
     }
-}
-
-/* List of available user commands */
-static const cmd_t cmd_list[] = {
-    { "quit", "        Exits", cmd_quit },
-    { "enable", "      Enables the Bluetooth adapter", cmd_enable },
-    { "disable", "     Disables the Bluetooth adapter", cmd_disable },
-    { "discovery", "   Controls discovery of nearby devices", cmd_discovery },
-    { "scan", "        Controls BLE scan of nearby devices", cmd_scan },
-    { "connect", "     Create a connection to a remote device", cmd_connect },
-    { "pair", "        Pair with remote device", cmd_pair },
-    { "disconnect", "  Disconnect from remote device", cmd_disconnect },
-    { "search-svc", "  Search services on remote device", cmd_search_svc },
-    { "included", "    List included services of a service", cmd_included },
-    { "characteristics", "List characteristics of a service", cmd_chars },
-    { "read-char", "   Read a characteristic of a service", cmd_read_char },
-    { "write-req-char", "Write a characteristic (Write Request)",
-                                                           cmd_write_req_char },
-    { "write-cmd-char", "Write a characteristic (No response)",
-                                                           cmd_write_cmd_char },
-    { "char-desc", "   List descriptors from a characteristic", cmd_char_desc },
-    { "write-desc", "  Write on characteristic descriptor", cmd_write_desc },
-    { "read-desc", "   Read a characteristic descriptor", cmd_read_desc },
-    { "reg-notif", "   Register to receive characteristic "
-                   "notification/indicaton", cmd_reg_notification },
-    { "unreg-notif", " Unregister a previous request to receive "
-                     "notification/indicaton", cmd_unreg_notification },
-    { "rssi", "        Request RSSI for connected device", cmd_rssi },
-    { NULL, NULL, NULL }
-};
-
-/* Parses a command and calls the respective handler */
-static void cmd_process(char *line) {
-    char cmd[MAX_LINE_SIZE];
-    int i;
 
-    if (line[0] == 0)
+    if (!check_ids(2, svc_id, char_id, 0))
         return;
 
-    if (u.prompt_state == SSP_ENTRY_PSTATE) {
-        bt_status_t status = u.btiface->pin_reply(&u.r_bd_addr, true,
-                                                  strlen(line),
-                                                  (bt_pin_code_t *) line);
-        change_prompt_state(NORMAL_PSTATE);
+    if (!add) {
+        if (!watch_remove(u.conn, svc_id, char_id))
+            rl_printf("Characteristic not watched\n");
         return;
     }
 
-    line_get_str(&line, cmd);
+    for (line_get_str(&args, arg); arg[0] != 0; line_get_str(&args, arg)) {
+        if (strcmp(arg, "delta") == 0) {
+            delta = true;
+            continue;
+        }
+
+        if (strcmp(arg, "ignore") != 0) {
+            rl_printf("Invalid argument \"%s\"\n", arg);
+            return;
+        }
+
+        line_get_str(&args, arg);
+        switch (sscanf(arg, "%u-%u", &from, &to)) {
+            case 1:
+                to = from;
+                /* fall through */
+            case 2:
+                if (from <= to && to < BTGATT_MAX_ATTR_LEN)
+                    break;
+                /* fall through */
+            default:
+                rl_printf("Invalid byte range \"%s\"\n", arg);
+                return;
+        }
+
+        if (ignore_count == WATCH_IGNORE_MAX) {
+            rl_printf("Too many ignored ranges (max %d)\n",
+                      WATCH_IGNORE_MAX);
+            return;
+        }
+
+        ignore[ignore_count].start = from;
+        ignore[ignore_count++].len = to - from + 1;
+    }
+
+    if (watch_add(u.conn, svc_id, char_id, ignore, ignore_count, delta))
+        rl_printf("Watching service %d characteristic %d\n", svc_id,
+                  char_id);
+}
+
+static void cmd_schema(char *args) {
+    char arg[MAX_LINE_SIZE];
+    bt_uuid_t uuid;
+
+    line_get_str(&args, arg);
+
+    if (arg[0] == 0 || strcmp(arg, "help") == 0) {
+        rl_printf("schema -- Decodes characteristic values into named "
+                  "fields\n");
+        rl_printf("Arguments:\n");
+        rl_printf("add <uuid> <type> <name>[/<div>|*<mul>], ...\n"
+                  "                    decodes values of the characteristic "
+                  "with the fields given,\n"
+                  "                    type is u8, i8, u16le, u16be, i16le, "
+                  "i16be, u24le, i24le,\n"
+                  "                    u32le, u32be, i32le or i32be, and "
+                  "\"skip <n>\" skips bytes\n");
+        rl_printf("load <file>         adds the schemas in file, one per "
+                  "line\n");
+        rl_printf("remove <uuid>       removes the schema of a "
+                  "characteristic\n");
+        rl_printf("clear               removes all schemas\n");
+        rl_printf("format text|json    prints fields as name=value pairs or "
+                  "JSON\n");
+        rl_printf("status              lists the schemas\n");
+        return;
+    }
+
+    if (strcmp(arg, "add") == 0)
+        schema_add(args, NULL);
+    else if (strcmp(arg, "load") == 0) {
+        line_get_str(&args, arg);
+        if (arg[0] == 0) {
+            rl_printf("Usage: schema load <file>\n");
+            return;
+        }
+
+        schema_load(arg);
+    } else if (strcmp(arg, "remove") == 0) {
+        line_get_str(&args, arg);
+        if (!str2uuid(arg, &uuid)) {
+            rl_printf("Invalid format of UUID: %s\n", arg);
+            return;
+        }
+
+        if (!schema_remove(&uuid))
+            rl_printf("No schema for %s\n", arg);
+    } else if (strcmp(arg, "clear") == 0)
+        schema_clear();
+    else if (strcmp(arg, "format") == 0) {
+        line_get_str(&args, arg);
+        if (strcmp(arg, "text") == 0)
+            schema_set_json(false);
+        else if (strcmp(arg, "json") == 0)
+            schema_set_json(true);
+        else
+            rl_printf("Invalid format \"%s\"\n", arg);
+    } else if (strcmp(arg, "status") == 0)
+        schema_print_status();
+    else
+        rl_printf("Invalid argument \"%s\"\n", arg);
+}
+
+static void cmd_irk(char *args) {
+    char arg[MAX_LINE_SIZE];
+    char addr_str[BT_ADDRESS_STR_LEN];
+    char name[IRK_NAME_LEN];
+    bt_bdaddr_t addr, identity;
+
+    line_get_str(&args, arg);
+
+    if (arg[0] == 0 || strcmp(arg, "help") == 0) {
+        rl_printf("irk -- Resolves private addresses of scanned devices\n");
+        rl_printf("Arguments:\n");
+        rl_printf("add <irk> <address> [name]\n"
+                  "                    resolves private addresses generated "
+                  "with irk, 32 hex digits\n"
+                  "                    most significant first, to the "
+                  "identity address\n");
+        rl_printf("load <file>         adds the keys in file, one per line\n");
+        rl_printf("clear               removes all keys\n");
+        rl_printf("resolve <address>   resolves an address\n");
+        rl_printf("status              shows the keys and resolution "
+                  "statistics\n");
+        return;
+    }
+
+    if (strcmp(arg, "add") == 0)
+        irk_add(args, NULL);
+    else if (strcmp(arg, "load") == 0) {
+        line_get_str(&args, arg);
+        if (arg[0] == 0) {
+            rl_printf("Usage: irk load <file>\n");
+            return;
+        }
+
+        irk_load(arg);
+    } else if (strcmp(arg, "clear") == 0)
+        irk_clear();
+    else if (strcmp(arg, "resolve") == 0) {
+        line_get_str(&args, arg);
+        if (str2ba(arg, &addr) != 0) {
+            rl_printf("Invalid bluetooth address %s\n", arg);
+            return;
+        }
+
+        if (irk_resolve(&addr, &identity, name))
+            rl_printf("%s resolves to %s%s%s%s\n", arg,
+                      ba2str(identity.address, addr_str),
+                      name[0] ? " (" : "", name, name[0] ? ")" : "");
+        else
+            rl_printf("%s is not resolved by any key\n", arg);
+    } else if (strcmp(arg, "status") == 0)
+        irk_print_status();
+    else
+        rl_printf("Invalid argument \"%s\"\n", arg);
+}
+
+static void cmd_log(char *args) {
+    char arg[MAX_LINE_SIZE];
+
+    line_get_str(&args, arg);
+
+    if (arg[0] == 0 || strcmp(arg, "help") == 0) {
+        rl_printf("log -- Logs characteristic values to a file\n");
+        rl_printf("Arguments:\n");
+        rl_printf("start <file>        appends every value read or notified "
+                  "to file, in compressed\n"
+                  "                    blocks which can be extracted with "
+                  "btlog\n");
+        rl_printf("stop                writes what is pending and stops "
+                  "logging\n");
+        rl_printf("status              shows the file and counters\n");
+        return;
+    }
+
+    if (strcmp(arg, "start") == 0) {
+        line_get_str(&args, arg);
+        if (arg[0] == 0) {
+            rl_printf("Usage: log start <file>\n");
+            return;
+        }
+
+        if (value_log_open(arg))
+            rl_printf("Logging values to %s\n", arg);
+    } else if (strcmp(arg, "stop") == 0) {
+        if (!value_log_enabled()) {
+            rl_printf("Not logging\n");
+            return;
+        }
+
+        value_log_close();
+    } else if (strcmp(arg, "status") == 0)
+        value_log_print_status();
+    else
+        rl_printf("Invalid argument \"%s\"\n", arg);
+}
+
+static void cmd_reg_notification(char *args) {
+    gatt_op_t op;
+    int svc_id, char_id;
+
+    if (u.conn == NULL || u.conn->conn_id <= 0) {
+        rl_printf("Not connected\n");
+        return;
+    }
+
+    if (u.gattiface == NULL) {
+        rl_printf("Unable to register notification/indication: GATT interface "
+                  "not available\n");
+        return;
+    }
+
+    if (sscanf(args, " %i %i ", &svc_id, &char_id) != 2) {
+        rl_printf("Usage: reg-notif serviceID characteristicID\n");
+        return;
+    }
+
+    if (!check_ids(2, svc_id, char_id, 0))
+        return;
+
+    memset(&op, 0, sizeof(op));
+    op.type = GATT_OP_REG_NOTIF;
+    op.svc = svc_id;
+    op.ch = char_id;
+    queue_op(&op);
+}
+
+static void cmd_unreg_notification(char *args) {
+    gatt_op_t op;
+    int svc_id, char_id;
+
+    if (u.conn == NULL || u.conn->conn_id <= 0) {
+        rl_printf("Not connected\n");
+        return;
+    }
+
+    if (u.gattiface == NULL) {
+        rl_printf("Unable to unregister notification/indication: GATT interface"
+                  " not available\n");
+        return;
+    }
+
+    if (sscanf(args, " %i %i ", &svc_id, &char_id) != 2) {
+        rl_printf("Usage: unreg-notif serviceID characteristicID\n");
+        return;
+    }
+
+    if (!check_ids(2, svc_id, char_id, 0))
+        return;
+
+    memset(&op, 0, sizeof(op));
+    op.type = GATT_OP_UNREG_NOTIF;
+    op.svc = svc_id;
+    op.ch = char_id;
+    queue_op(&op);
+}
+
+void read_remote_rssi_cb(int client_if, bt_bdaddr_t *bda, int rssi,
+                         int status) {
+    char addr_str[BT_ADDRESS_STR_LEN];
+
+    CALLBACK_SCOPE(rssi);
+
+    if (status != 0) {
+        rl_printf("Read RSSI error, status:%i %s\n", status,
+                  atterror2str(status));
+        return;
+    }
+
+    rssi_history_add(bda, rssi);
+    rl_printf("Address: %s RSSI: %i\n", ba2str(bda->address, addr_str), rssi);
+}
+
+static void cmd_rssi(char *args) {
+    bt_status_t status;
+
+    if (u.conn == NULL || u.conn->conn_id <= 0) {
+        rl_printf("Not connected\n");
+        return;
+    }
+
+    if (u.gattiface == NULL) {
+        rl_printf("Unable to BLE RSSI: GATT interface not avaiable\n");
+        return;
+    }
+
+    status = HAL_CALL(u.gattiface->client, read_remote_rssi, u.client_if,
+                      &u.conn->addr);
+    if (status != BT_STATUS_SUCCESS) {
+        rl_printf("Failed to request RSSI, status: %d\n", status);
+        return;
+    }
+}
+
+static void cmd_rssi_history(char *args) {
+    char arg[MAX_LINE_SIZE];
+    char addr_str[BT_ADDRESS_STR_LEN];
+    uint32_t now = monotonic_us() / 1000;
+    rssi_stats_t stats[RSSI_HISTORY_DEVS];
+    rssi_sample_t samples[RSSI_HISTORY_SAMPLES];
+    bt_bdaddr_t addr;
+    int i, n;
+
+    line_get_str(&args, arg);
+
+    if (strcmp(arg, "help") == 0) {
+        rl_printf("rssi-history -- Shows RSSI history of remote devices\n");
+        rl_printf("Arguments:\n");
+        rl_printf("(none)         list tracked devices\n");
+        rl_printf("<address>      show statistics and samples of a device\n");
+        rl_printf("alpha [value]  show or set the moving average factor "
+                  "(0 < value <= 1)\n");
+        rl_printf("clear          forget all devices\n");
+
+    } else if (arg[0] == 0) {
+
+        n = rssi_history_list(stats, RSSI_HISTORY_DEVS);
+        rl_printf("%i device(s) tracked\n", n);
+        for (i = 0; i < n; i++)
+            rl_printf("  %s last:%i ewma:%.1f min:%i max:%i samples:%u "
+                      "seen:%.1fs ago\n", ba2str(stats[i].addr.address,
+                      addr_str), stats[i].last, stats[i].ewma, stats[i].min,
+                      stats[i].max, stats[i].total,
+                      (now - stats[i].last_seen_ms) / 1000.0);
+
+    } else if (strcmp(arg, "alpha") == 0) {
+        float alpha;
+
+        line_get_str(&args, arg);
+        if (arg[0] == 0) {
+            rl_printf("EWMA alpha: %.3f\n", rssi_history_get_alpha());
+            return;
+        }
+
+        if (sscanf(arg, "%f", &alpha) != 1 || !rssi_history_set_alpha(alpha))
+            rl_printf("Invalid alpha: %s\n", arg);
+
+    } else if (strcmp(arg, "clear") == 0) {
+
+        rssi_history_clear();
+
+    } else if (str2ba(arg, &addr) == 0) {
+
+        n = rssi_history_get(&addr, &stats[0], samples, RSSI_HISTORY_SAMPLES);
+        if (n < 0) {
+            rl_printf("No RSSI history for %s\n", arg);
+            return;
+        }
+
+        rl_printf("Address: %s\n", ba2str(addr.address, addr_str));
+        rl_printf("  last:%i ewma:%.1f min:%i max:%i\n", stats[0].last,
+                  stats[0].ewma, stats[0].min, stats[0].max);
+        rl_printf("  samples:%u first seen:%.1fs ago last seen:%.1fs ago\n",
+                  stats[0].total, (now - stats[0].first_seen_ms) / 1000.0,
+                  (now - stats[0].last_seen_ms) / 1000.0);
+        rl_printf("  Last %i samples (age, rssi):\n", n);
+        for (i = 0; i < n; i++)
+            rl_printf("    %8.3fs %4i\n", (now - samples[i].time_ms) / 1000.0,
+                      samples[i].rssi);
+
+    } else
+        rl_printf("Invalid argument \"%s\"\n", arg);
+}
+
+static void cmd_devices(char *args) {
+    char arg[MAX_LINE_SIZE];
+    char addr_str[BT_ADDRESS_STR_LEN];
+    uint32_t now = monotonic_us() / 1000;
+    devices_sort_t sort = DEVICES_SORT_LAST_SEEN;
+    device_info_t *devs;
+    int i, n;
+
+    line_get_str(&args, arg);
+
+    if (strcmp(arg, "help") == 0) {
+        rl_printf("devices -- Lists devices found during discovery\n");
+        rl_printf("Arguments:\n");
+        rl_printf("(none)  sorted by last seen\n");
+        rl_printf("seen    sorted by last seen\n");
+        rl_printf("rssi    sorted by RSSI\n");
+        rl_printf("clear   forget all devices\n");
+        return;
+    } else if (strcmp(arg, "clear") == 0) {
+        devices_clear();
+        return;
+    } else if (strcmp(arg, "rssi") == 0)
+        sort = DEVICES_SORT_RSSI;
+    else if (arg[0] != 0 && strcmp(arg, "seen") != 0) {
+        rl_printf("Invalid argument \"%s\"\n", arg);
+        return;
+    }
+
+    devs = mem_alloc(MEM_SCAN, DEVICES_MAX * sizeof(devs[0]));
+    if (devs == NULL)
+        return;
+
+    n = devices_list(devs, DEVICES_MAX, sort);
+    rl_printf("%i device(s)\n", n);
+
+    for (i = 0; i < n; i++) {
+        device_info_t *dev = &devs[i];
+        char rssi_str[8] = "?";
+
+        if (dev->fields & DEVICE_HAS_RSSI)
+            sprintf(rssi_str, "%i", dev->rssi);
+
+        rl_printf("  %s rssi:%-4s class:0x%06x type:%u seen:%.1fs ago (%u) "
+                  "%s\n", ba2str(dev->addr.address, addr_str), rssi_str,
+                  dev->cod, dev->type, (now - dev->last_seen_ms) / 1000.0,
+                  dev->seen_count, dev->fields & DEVICE_HAS_ALIAS ?
+                  dev->alias : dev->name);
+
+        if (dev->fields & DEVICE_HAS_VERSION)
+            rl_printf("    version:%u subversion:%u manufacturer:%u\n",
+                      dev->version, dev->sub_version, dev->manufacturer);
+    }
+
+    mem_free(devs);
+}
+
+/* Adds the devices listed in a file, one address per line */
+static void poll_load(const char *path) {
+    char line[MAX_LINE_SIZE];
+    bt_bdaddr_t addr;
+    FILE *f;
+    char *p, *end;
+    int n = 0, lineno = 0;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        rl_printf("Unable to open %s: %s\n", path, strerror(errno));
+        return;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+
+        p = line;
+        while (isspace(*p))
+            p++;
+        end = p + strlen(p);
+        while (end > p && isspace(end[-1]))
+            *--end = 0;
+
+        if (*p == 0 || *p == '#')
+            continue;
+
+        if (str2ba(p, &addr) != 0) {
+            rl_printf("%s:%d: invalid address \"%s\"\n", path, lineno, p);
+            continue;
+        }
+
+        if (fleet_add_dev(&addr))
+            n++;
+    }
+
+    fclose(f);
+    rl_printf("Added %d devices\n", n);
+}
+
+static void cmd_poll(char *args) {
+    char arg[MAX_LINE_SIZE];
+    bt_bdaddr_t addr;
+    bt_uuid_t uuid;
+    unsigned int ms;
+    int n;
+
+    line_get_str(&args, arg);
+
+    if (arg[0] == 0 || strcmp(arg, "help") == 0) {
+        rl_printf("poll -- Reads characteristics from a list of devices in "
+                  "turn\n");
+        rl_printf("Arguments:\n");
+        rl_printf("add <address>...  adds devices to the list\n");
+        rl_printf("load <file>       adds the devices listed in file, one "
+                  "address per line\n");
+        rl_printf("char <uuid>...    adds characteristics to read from "
+                  "every device\n");
+        rl_printf("slots <n>         connections used at the same time "
+                  "(1-%d, default 1)\n", CONN_MAX);
+        rl_printf("timeout <ms>      limit for each device (default %d)\n",
+                  FLEET_TIMEOUT_DEFAULT);
+        rl_printf("clear             empties the device and characteristic "
+                  "lists\n");
+        rl_printf("start             starts polling, cycles over the list "
+                  "repeat until stopped\n");
+        rl_printf("stop              stops polling\n");
+        rl_printf("status            shows the configuration and "
+                  "statistics\n");
+        return;
+    }
+
+    if (strcmp(arg, "status") == 0) {
+        fleet_print_status();
+        return;
+    }
+
+    if (strcmp(arg, "stop") == 0) {
+        if (!fleet_stop())
+            rl_printf("Polling is not running\n");
+        return;
+    }
+
+    /* everything else changes the configuration */
+    if (fleet_running()) {
+        rl_printf("Polling is running, stop it first\n");
+        return;
+    }
+
+    if (strcmp(arg, "start") == 0) {
+
+        if (u.adapter_state != BT_STATE_ON || !u.client_registered) {
+            rl_printf("Unable to poll: Adapter is down\n");
+            return;
+        }
+
+        fleet_start();
+
+    } else if (strcmp(arg, "add") == 0) {
+
+        for (line_get_str(&args, arg); arg[0] != 0;
+             line_get_str(&args, arg)) {
+            if (str2ba(arg, &addr) != 0)
+                rl_printf("Invalid bluetooth address: %s\n", arg);
+            else if (!fleet_add_dev(&addr))
+                rl_printf("Unable to add %s: duplicated or too many "
+                          "devices\n", arg);
+        }
+
+    } else if (strcmp(arg, "load") == 0) {
+
+        line_get_str(&args, arg);
+        if (arg[0] == 0) {
+            rl_printf("Usage: poll load <file>\n");
+            return;
+        }
+
+        poll_load(arg);
+
+    } else if (strcmp(arg, "char") == 0) {
+
+        for (line_get_str(&args, arg); arg[0] != 0;
+             line_get_str(&args, arg)) {
+            if (!str2uuid(arg, &uuid))
+                rl_printf("Invalid format of UUID: %s\n", arg);
+            else if (!fleet_add_char(&uuid))
+                rl_printf("Unable to add %s: duplicated or too many "
+                          "characteristics\n", arg);
+        }
+
+    } else if (strcmp(arg, "slots") == 0) {
+
+        line_get_str(&args, arg);
+        if (sscanf(arg, "%d", &n) != 1 || !fleet_set_slots(n))
+            rl_printf("Invalid number of slots \"%s\"\n", arg);
+
+    } else if (strcmp(arg, "timeout") == 0) {
+
+        line_get_str(&args, arg);
+        if (sscanf(arg, "%u", &ms) != 1 || !fleet_set_timeout(ms))
+            rl_printf("Invalid timeout \"%s\"\n", arg);
+
+    } else if (strcmp(arg, "clear") == 0)
+        fleet_clear();
+    else
+        rl_printf("Invalid argument \"%s\"\n", arg);
+}
+
+static void cmd_send_file(char *args) {
+    char arg[MAX_LINE_SIZE];
+    char path[MAX_LINE_SIZE];
+    unsigned int n;
+    unsigned long offset = 0;
+    int svc_id, char_id, pos = 0;
+
+    line_get_str(&args, arg);
+
+    if (arg[0] == 0 || strcmp(arg, "help") == 0) {
+        rl_printf("send-file -- Streams a file to a characteristic with "
+                  "Write Commands\n");
+        rl_printf("Arguments:\n");
+        rl_printf("start <serviceID> <characteristicID> <file> [offset]\n"
+                  "                    sends file, from offset (default "
+                  "0)\n");
+        rl_printf("resume              continues the last transfer where it "
+                  "stopped\n");
+        rl_printf("stop                interrupts the transfer\n");
+        rl_printf("status              shows settings and progress\n");
+        rl_printf("chunk <bytes>       bytes per write, ATT MTU - 3 "
+                  "(default %d)\n", XFER_CHUNK_DEFAULT);
+        rl_printf("window <n>          writes queued ahead, or chunks "
+                  "unacknowledged with ack\n"
+                  "                    (1-%d, default %d)\n",
+                  XFER_WINDOW_MAX, XFER_WINDOW_DEFAULT);
+        rl_printf("ack <serviceID> <characteristicID>\n"
+                  "                    the device acknowledges with "
+                  "notifications of this\n"
+                  "                    characteristic, carrying the file "
+                  "offset received\n"
+                  "                    (32-bit little-endian)\n");
+        rl_printf("ack off             don't wait for acknowledgements "
+                  "(default)\n");
+        return;
+    }
+
+    if (strcmp(arg, "status") == 0) {
+        xfer_print_status();
+        return;
+    }
+
+    if (strcmp(arg, "stop") == 0) {
+        if (!xfer_stop())
+            rl_printf("No transfer running\n");
+        return;
+    }
+
+    if (strcmp(arg, "chunk") == 0) {
+        line_get_str(&args, arg);
+        if (sscanf(arg, "%u", &n) != 1)
+            rl_printf("Invalid chunk size \"%s\"\n", arg);
+        else
+            xfer_set_chunk(n);
+        return;
+    }
+
+    if (strcmp(arg, "window") == 0) {
+        line_get_str(&args, arg);
+        if (sscanf(arg, "%u", &n) != 1)
+            rl_printf("Invalid window \"%s\"\n", arg);
+        else
+            xfer_set_window(n);
+        return;
+    }
+
+    if (strcmp(arg, "ack") == 0) {
+        line_get_str(&args, arg);
+        if (strcmp(arg, "off") == 0)
+            svc_id = char_id = -1;
+        else if (sscanf(arg, "%i", &svc_id) != 1 ||
+                 sscanf(args, " %i", &char_id) != 1 || svc_id < 0) {
+            rl_printf("Usage: send-file ack serviceID characteristicID\n");
+            return;
+        }
+
+        xfer_set_ack(svc_id, char_id);
+        return;
+    }
+
+    if (strcmp(arg, "start") != 0 && strcmp(arg, "resume") != 0) {
+        rl_printf("Invalid argument \"%s\"\n", arg);
+        return;
+    }
+
+    if (u.conn == NULL || u.conn->conn_id <= 0) {
+        rl_printf("Not connected\n");
+        return;
+    }
+
+    if (u.gattiface == NULL) {
+        rl_printf("Unable to BLE send-file: GATT interface not avaiable\n");
+        return;
+    }
+
+    if (strcmp(arg, "resume") == 0) {
+        xfer_resume(u.conn);
+        return;
+    }
+
+    /* pos stays 0 unless both IDs are read */
+    path[0] = 0;
+    if (sscanf(args, " %i %i%n", &svc_id, &char_id, &pos) == 2) {
+        args += pos;
+        if (!line_get_path(&args, path, sizeof(path)))
+            return;
+        sscanf(args, " %lu", &offset);
+    }
+
+    if (pos == 0 || path[0] == 0) {
+        rl_printf("Usage: send-file start serviceID characteristicID file "
+                  "[offset]\n");
+        return;
+    }
+
+    if (!check_ids(2, svc_id, char_id, 0))
+        return;
+
+    xfer_start(u.conn, svc_id, char_id, path, offset);
+}
+
+static void cmd_trace(char *args) {
+    char arg[MAX_LINE_SIZE];
+
+    line_get_str(&args, arg);
+
+    if (arg[0] == 0 || strcmp(arg, "help") == 0) {
+        rl_printf("trace -- Records commands, HAL calls and callbacks\n");
+        rl_printf("Arguments:\n");
+        rl_printf("on                  starts recording\n");
+        rl_printf("off                 stops recording, keeping what was "
+                  "recorded\n");
+        rl_printf("clear               forgets what was recorded\n");
+        rl_printf("status              shows the events recorded by each "
+                  "thread\n");
+        rl_printf("dump <file>         writes the last %d events of each "
+                  "thread as Chrome\n"
+                  "                    trace JSON, for chrome://tracing or "
+                  "Perfetto\n", TRACE_RING_SIZE);
+        return;
+    }
+
+    if (strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0) {
+        trace_enable(strcmp(arg, "on") == 0);
+    } else if (strcmp(arg, "clear") == 0) {
+        trace_clear();
+    } else if (strcmp(arg, "status") == 0) {
+        trace_print_status();
+    } else if (strcmp(arg, "dump") == 0) {
+        line_get_str(&args, arg);
+        if (arg[0] == 0) {
+            rl_printf("Usage: trace dump <file>\n");
+            return;
+        }
+        trace_dump(arg);
+    } else {
+        rl_printf("Invalid argument \"%s\"\n", arg);
+    }
+}
+
+static void cmd_stats(char *args) {
+    char arg[MAX_LINE_SIZE];
+
+    line_get_str(&args, arg);
+
+    if (strcmp(arg, "help") == 0) {
+        rl_printf("stats -- Shows the time spent in callbacks and commands\n");
+        rl_printf("Arguments:\n");
+        rl_printf("[callback|command|decode]\n"
+                  "                    shows calls, total, average and "
+                  "longest time and the time\n"
+                  "                    spent printing, of all or one type\n");
+        rl_printf("clear               resets the counters\n");
+        return;
+    }
+
+    if (arg[0] == 0) {
+        stats_print(NULL);
+    } else if (strcmp(arg, "clear") == 0) {
+        stats_clear();
+    } else if (strcmp(arg, "callback") == 0 || strcmp(arg, "command") == 0 ||
+               strcmp(arg, "decode") == 0) {
+        stats_print(arg);
+    } else {
+        rl_printf("Invalid argument \"%s\"\n", arg);
+    }
+}
+
+static void cmd_mem(char *args) {
+    char arg[MAX_LINE_SIZE];
+
+    line_get_str(&args, arg);
+
+    if (strcmp(arg, "help") == 0) {
+        rl_printf("mem -- Shows heap memory in use\n");
+        rl_printf("Shows, for each use of memory, the bytes in use, the most "
+                  "ever in use, the\nblocks allocated and the allocations "
+                  "and frees so far.\n");
+        return;
+    }
+
+    if (arg[0] != 0) {
+        rl_printf("Invalid argument \"%s\"\n", arg);
+        return;
+    }
+
+    mem_print();
+}
+
+/* List of available user commands */
+static const cmd_t cmd_list[] = {
+    { "quit", "        Exits", cmd_quit },
+    { "enable", "      Enables the Bluetooth adapter", cmd_enable },
+    { "disable", "     Disables the Bluetooth adapter", cmd_disable },
+    { "adapter", "     Show and set adapter properties", cmd_adapter },
+    { "discovery", "   Controls discovery of nearby devices", cmd_discovery },
+    { "devices", "     List devices found during discovery", cmd_devices },
+    { "scan", "        Controls BLE scan of nearby devices", cmd_scan },
+    { "irk", "         Resolve private addresses of scanned devices",
+      cmd_irk },
+    { "connect", "     Create a connection to a remote device", cmd_connect },
+    { "pair", "        Pair with remote device", cmd_pair },
+    { "pair-batch", "  Pair a list of devices unattended", cmd_pair_batch },
+    { "disconnect", "  Disconnect from remote device", cmd_disconnect },
+    { "conn", "        List connections and select one", cmd_conn },
+    { "search-svc", "  Search services on remote device", cmd_search_svc },
+    { "included", "    List included services of a service", cmd_included },
+    { "characteristics", "List characteristics of a service", cmd_chars },
+    { "read-char", "   Read a characteristic of a service", cmd_read_char },
+    { "read-all", "    Read all readable characteristics of a service",
+      cmd_read_all },
+    { "write-req-char", "Write a characteristic (Write Request)",
+                                                           cmd_write_req_char },
+    { "write-cmd-char", "Write a characteristic (No response)",
+                                                           cmd_write_cmd_char },
+    { "char-desc", "   List descriptors from a characteristic", cmd_char_desc },
+    { "write-desc", "  Write on characteristic descriptor", cmd_write_desc },
+    { "read-desc", "   Read a characteristic descriptor", cmd_read_desc },
+    { "send-file", "   Stream a file to a characteristic", cmd_send_file },
+    { "reg-notif", "   Register to receive characteristic "
+                   "notification/indicaton", cmd_reg_notification },
+    { "unreg-notif", " Unregister a previous request to receive "
+                     "notification/indicaton", cmd_unreg_notification },
+    { "notif-sink", "  Write notifications to a FIFO, file or socket",
+      cmd_notif_sink },
+    { "watch", "       Print characteristic values only on change",
+      cmd_watch },
+    { "schema", "      Decode characteristic values into named fields",
+      cmd_schema },
+    { "log", "         Log characteristic values to a file", cmd_log },
+    { "rssi", "        Request RSSI for connected device", cmd_rssi },
+    { "rssi-history", "RSSI history of remote devices", cmd_rssi_history },
+    { "poll", "        Read characteristics from a list of devices",
+                                                                    cmd_poll },
+    { "trace", "       Trace commands, HAL calls and callbacks", cmd_trace },
+    { "stats", "       Time spent in callbacks and commands", cmd_stats },
+    { "mem", "         Heap memory in use", cmd_mem },
+    { NULL, NULL, NULL }
+};
+
+/* Parses a command and calls the respective handler */
+static void cmd_process(char *line) {
+    static stats_site_t cmd_stats[sizeof(cmd_list) / sizeof(cmd_list[0])];
+    char cmd[MAX_LINE_SIZE];
+    int i;
+
+    if (line[0] == 0)
+        return;
+
+    record_command(line);
+
+    if (u.prompt_state == SSP_ENTRY_PSTATE) {
+        bt_status_t status = HAL_CALL(u.btiface, pin_reply, &u.r_bd_addr, true,
+                                      strlen(line), (bt_pin_code_t *) line);
+        change_prompt_state(NORMAL_PSTATE);
+        return;
+    }
+
+    line_get_str(&line, cmd);
 
     if (strcmp(cmd, "help") == 0) {
         for (i = 0; cmd_list[i].name != NULL; i++)
@@ -1900,6 +3718,9 @@ static void cmd_process(char *line) {
 
     for (i = 0; cmd_list[i].name != NULL; i++)
         if (strcmp(cmd, cmd_list[i].name) == 0) {
+            STATS_SITE_SCOPE(&cmd_stats[i], "command", cmd_list[i].name);
+            TRACE_SCOPE("command", cmd_list[i].name, 0);
+
             cmd_list[i].handler(line);
             return;
         }
@@ -1910,6 +3731,7 @@ static void cmd_process(char *line) {
 
 static void register_client_cb(int status, int client_if,
                                bt_uuid_t *app_uuid) {
+    CALLBACK_SCOPE(client_if);
 
     if (status != BT_STATUS_SUCCESS) {
         rl_printf("Failed to register client, status: %d\n", status);
@@ -1917,9 +3739,12 @@ static void register_client_cb(int status, int client_if,
     }
 
     rl_printf("Registered!, client_if: %d\n", client_if);
+    startup_phase(PHASE_REGISTERED);
 
     u.client_if = client_if;
     u.client_registered = true;
+    conn_set_client(u.gattiface->client, client_if);
+    fleet_set_client(u.gattiface->client, client_if);
 }
 
 /* GATT client callbacks */
@@ -1950,6 +3775,40 @@ static const btgatt_callbacks_t gattcbs = {
     NULL  /* btgatt_server_callbacks_t */
 };
 
+/* Initializes the GATT interface. This is done once the stack thread runs, or
+ * right after the Bluetooth interface is initialized with --enable, so it
+ * happens once from whichever thread comes first. */
+static void gatt_init() {
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    static bool done = false;
+    bt_status_t status;
+
+    pthread_mutex_lock(&lock);
+
+    if (done) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    done = true;
+
+    u.gattiface = u.btiface->get_profile_interface(BT_PROFILE_GATT_ID);
+    if (u.gattiface != NULL) {
+        status = HAL_CALL(u.gattiface, init, &gattcbs);
+        if (status != BT_STATUS_SUCCESS) {
+            rl_printf("Failed to initialize Bluetooth GATT interface, "
+                      "status: %d\n", status);
+            u.gattiface = NULL;
+        } else {
+            u.gattiface_initialized = 1;
+            startup_phase(PHASE_GATT);
+        }
+    } else
+        rl_printf("Failed to get Bluetooth GATT Interface\n");
+
+    pthread_mutex_unlock(&lock);
+}
+
 /* This callback is used by the thread that handles Bluetooth interface (btif)
  * to send events for its users. At the moment there are two events defined:
  *
@@ -1960,22 +3819,13 @@ static const btgatt_callbacks_t gattcbs = {
  * be associated or dessociated with the JVM
  */
 static void thread_event_cb(bt_cb_thread_evt event) {
+    CALLBACK_SCOPE(event);
     rl_printf("\nBluetooth interface %s\n",
               event == ASSOCIATE_JVM ? "ready" : "finished");
     if (event == ASSOCIATE_JVM) {
         u.btiface_initialized = 1;
-
-        u.gattiface = u.btiface->get_profile_interface(BT_PROFILE_GATT_ID);
-        if (u.gattiface != NULL) {
-            bt_status_t status = u.gattiface->init(&gattcbs);
-            if (status != BT_STATUS_SUCCESS) {
-                rl_printf("Failed to initialize Bluetooth GATT interface, "
-                          "status: %d\n", status);
-                u.gattiface = NULL;
-            } else
-                u.gattiface_initialized = 1;
-        } else
-            rl_printf("Failed to get Bluetooth GATT Interface\n");
+        startup_phase(PHASE_THREAD);
+        gatt_init();
     } else
         u.btiface_initialized = 0;
 }
@@ -2007,7 +3857,14 @@ static void bt_init() {
     u.btiface_initialized = 0;
     u.quit = 0;
     u.adapter_state = BT_STATE_OFF; /* The adapter is OFF in the beginning */
-    u.conn_id = 0;
+    u.conn = NULL;
+
+    /* Callbacks come from a recording, HAL calls go nowhere */
+    if (replay_enabled()) {
+        u.btiface = replay_bt_interface();
+        HAL_CALL(u.btiface, init, &btcbs);
+        return;
+    }
 
     /* Get the Bluetooth module from libhardware */
     status = hw_get_module(BT_STACK_MODULE_ID, (hw_module_t const**) &module);
@@ -2035,11 +3892,25 @@ static void bt_init() {
     u.btiface = btdev->get_bluetooth_interface();
     if (u.btiface == NULL)
         err(3, "Failed to get the Bluetooth interface");
+    u.btiface = record_bt_interface(u.btiface);
+    startup_phase(PHASE_MODULE);
 
     /* Init the Bluetooth interface, setting a callback for each operation */
-    status = u.btiface->init(&btcbs);
+    status = HAL_CALL(u.btiface, init, &btcbs);
     if (status != BT_STATUS_SUCCESS && status != BT_STATUS_DONE)
         err(4, "Failed to initialize the Bluetooth interface");
+    startup_phase(PHASE_INIT);
+
+    /* The interfaces can be used as soon as init() returns. Rather than
+     * waiting for the stack thread and a command, initialize GATT right away
+     * and start enabling the adapter, the longest step, while the stack thread
+     * starts. The client is registered as soon as the adapter is on. */
+    if (u.auto_enable) {
+        gatt_init();
+        status = HAL_CALL(u.btiface, enable);
+        if (status != BT_STATUS_SUCCESS)
+            rl_printf("Failed to enable Bluetooth\n");
+    }
 }
 
 /* simple tab completer */
@@ -2058,32 +3929,197 @@ const char *tab_completer_cb(char *line, int pos) {
     return NULL;
 }
 
+static void usage(const char *name) {
+
+    printf("Usage: %s [options]\n", name);
+    printf("Options:\n");
+    printf("  -H, --history-file FILE   keep command history in FILE "
+           "(default ~/.btctl_history)\n");
+    printf("  -n, --no-history-file     don't keep command history in a "
+           "file\n");
+    printf("  -s, --history-size BYTES  memory used for command history\n");
+    printf("  -r, --record FILE         record the callbacks of the stack and "
+           "the commands\n                            to FILE\n");
+    printf("  -p, --replay FILE         replay a recording instead of using "
+           "the stack\n");
+    printf("  -S, --replay-speed FACTOR replay FACTOR times faster, 0 as fast "
+           "as possible\n                            (default 1)\n");
+    printf("  -e, --enable              enable the adapter and register the "
+           "GATT client at\n                            startup\n");
+    printf("  -R, --ready-fd FD         write \"ready\" to FD and close it "
+           "once started, and\n                            with --enable once "
+           "the GATT client is registered\n");
+    printf("  -h, --help                show this help\n");
+}
+
 int main(int argc, char *argv[]) {
+    static const struct option options[] = {
+        { "history-file", required_argument, NULL, 'H' },
+        { "no-history-file", no_argument, NULL, 'n' },
+        { "history-size", required_argument, NULL, 's' },
+        { "record", required_argument, NULL, 'r' },
+        { "replay", required_argument, NULL, 'p' },
+        { "replay-speed", required_argument, NULL, 'S' },
+        { "enable", no_argument, NULL, 'e' },
+        { "ready-fd", required_argument, NULL, 'R' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    char history_path[PATH_MAX] = "";
+    const char *record_path = NULL, *replay_path = NULL;
+    double replay_speed = 1;
+    bool history_file = true;
+    bool input_closed = false;
+    int opt;
+
+    u.start_us = monotonic_us();
+    u.ready_fd = -1;
+
+    while ((opt = getopt_long(argc, argv, "H:ns:r:p:S:eR:h", options,
+                              NULL)) != -1) {
+        switch (opt) {
+            case 'H':
+                snprintf(history_path, sizeof(history_path), "%s", optarg);
+                break;
+            case 'n':
+                history_file = false;
+                break;
+            case 's':
+                rl_set_history_size(strtoul(optarg, NULL, 0));
+                break;
+            case 'r':
+                record_path = optarg;
+                break;
+            case 'p':
+                replay_path = optarg;
+                break;
+            case 'S':
+                replay_speed = strtod(optarg, NULL);
+                break;
+            case 'e':
+                u.auto_enable = true;
+                break;
+            case 'R':
+                u.ready_fd = atoi(optarg);
+                if (fcntl(u.ready_fd, F_SETFD, FD_CLOEXEC) < 0) {
+                    fprintf(stderr, "Invalid ready descriptor %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (record_path != NULL && replay_path != NULL) {
+        fprintf(stderr, "Can't record and replay at the same time\n");
+        return 1;
+    }
+
+    if (history_path[0] == 0 && getenv("HOME") != NULL)
+        snprintf(history_path, sizeof(history_path), "%s/.btctl_history",
+                 getenv("HOME"));
+
     rl_init(cmd_process);
     change_prompt_state(NORMAL_PSTATE);
     rl_set_tab_completer(tab_completer_cb);
 
     rl_printf("Android Bluetooth control tool version " VERSION "\n");
 
+    if (history_file && history_path[0] != 0 &&
+        !rl_set_history_file(history_path))
+        rl_printf("Unable to open history file %s\n", history_path);
+
+    if (record_path != NULL && !record_open(record_path))
+        return 1;
+
+    if (replay_path != NULL) {
+        if (!replay_open(replay_path, replay_speed, cmd_process))
+            return 1;
+        rl_printf("Replaying %s\n", replay_path);
+    }
+
     bt_init();
 
     while (!u.quit) {
-        int c = getchar();
-
-        /* if we are in consent bonding process, we need only a char */
-        if (u.prompt_state == SSP_CONSENT_PSTATE) {
-            c = toupper(c);
-            if (c == 'Y' || c == 'N') {
-                bt_status_t status;
-                printf("%c\n", c); /* user feedback */
-                do_ssp_reply(&u.r_bd_addr, BT_SSP_VARIANT_CONSENT,
-                             c == 'Y' ? true : false, 0);
+        struct pollfd pfds[2] = {
+            { .fd = input_closed ? -1 : STDIN_FILENO, .events = POLLIN },
+            { .fd = timeout_fd(), .events = POLLIN },
+        };
+        struct pollfd pfd = pfds[0];
+        unsigned char buf[INPUT_CHUNK_SIZE];
+        ssize_t len, i;
+
+        if (poll(pfds, 2, timeout_poll_ms()) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        timeout_dispatch();
+
+        /* without input, a replay goes on until the end of the recording */
+        if (input_closed && !replay_running())
+            break;
+
+        if (!(pfds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+            continue;
+
+        /* Read everything available at once. Pasted or piped commands are
+         * processed without redrawing the prompt after each character. */
+        len = read(STDIN_FILENO, buf, sizeof(buf));
+        if (len < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (len <= 0) {
+            /* end of input */
+            if (replay_running()) {
+                input_closed = true;
+                continue;
+            }
+            record_command("quit");
+            break;
+        }
+
+        rl_defer_redraw(true);
+
+        for (i = 0; i < len && !u.quit; i++) {
+            int c = buf[i];
+
+            /* keys of the scan view aren't commands */
+            if (scan_view_active()) {
+                if (!scan_view_key(c))
+                    scan_view_end();
+            } else if (u.prompt_state == SSP_CONSENT_PSTATE) {
+                c = toupper(c);
+                if (c == 'Y' || c == 'N') {
+                    printf("%c\n", c); /* user feedback */
+                    do_ssp_reply(&u.r_bd_addr, BT_SSP_VARIANT_CONSENT,
+                                 c == 'Y' ? true : false, 0);
+                }
+                change_prompt_state(NORMAL_PSTATE);
+            } else if (!rl_feed(c)) {
+                record_command("quit");
+                u.quit = 1; /* user pressed ctrl-d */
+                break;
             }
-            change_prompt_state(NORMAL_PSTATE);
-        } else if (!rl_feed(c))
-            break; /* user pressed ctrl-d */
+        }
+
+        /* repaint only when input goes idle */
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN))
+            rl_defer_redraw(false);
     }
 
+    rl_defer_redraw(false);
+
+    /* give the terminal back */
+    if (scan_view_active())
+        scan_view_end();
+
     /* Disable adapter on exit */
     if (u.adapter_state == BT_STATE_ON)
         cmd_disable(NULL);
@@ -2094,6 +4130,9 @@ int main(int argc, char *argv[]) {
     while (u.btiface_initialized)
         usleep(10000);
 
+    record_close();
+    value_log_close();
+
     rl_quit();
     return 0;
 }
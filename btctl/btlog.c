@@ -0,0 +1,425 @@
+/*
+ * Extracts samples from value logs written by btctl
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "util.h"
+#include "value_log.h"
+
+/* Filters given on the command line */
+static uint64_t from_us = 0;
+static uint64_t to_us = UINT64_MAX;
+static bool has_addr = false;
+static bt_bdaddr_t addr;
+static bool has_uuid = false;
+static bt_uuid_t uuid;
+static bool summary = false;
+
+/* Characteristics seen, for the summary */
+typedef struct {
+    uint8_t key[VALUE_LOG_KEY_LEN];
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t first_us;
+    uint64_t last_us;
+} total_t;
+
+static total_t *totals;
+static int totals_count;
+
+static const char *kinds[] = {
+    [VALUE_LOG_READ] = "read",
+    [VALUE_LOG_NOTIFY] = "notify",
+    [VALUE_LOG_INDICATE] = "indicate",
+    [3] = "unknown",
+};
+
+/* Buffers reused for every block */
+static uint8_t *compressed;
+static size_t compressed_cap;
+static uint8_t *payload;
+static size_t payload_cap;
+
+static uint64_t get_le(const uint8_t *buf, int bytes) {
+    uint64_t v = 0;
+    int i;
+
+    for (i = bytes - 1; i >= 0; i--)
+        v = v << 8 | buf[i];
+
+    return v;
+}
+
+/* Decodes a varint from [*p, end), returns false if it's truncated */
+static bool get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+    int shift = 0;
+
+    *v = 0;
+    while (*p < end && shift < 64) {
+        *v |= (uint64_t) (**p & 0x7f) << shift;
+        if (!(*(*p)++ & 0x80))
+            return true;
+        shift += 7;
+    }
+
+    return false;
+}
+
+/* Splits a column off [*p, end) */
+static bool get_column(const uint8_t **p, const uint8_t *end,
+                       const uint8_t **col, const uint8_t **col_end) {
+    uint64_t len;
+
+    if (!get_varint(p, end, &len) || len > (uint64_t) (end - *p))
+        return false;
+
+    *col = *p;
+    *col_end = *p + len;
+    *p += len;
+
+    return true;
+}
+
+static bool key_matches(const uint8_t *key) {
+    bt_uuid_t char_uuid;
+
+    if (has_addr && memcmp(key, addr.address, 6))
+        return false;
+
+    if (has_uuid) {
+        memcpy(char_uuid.uu, key + 23, 16);
+        if (memcmp(&char_uuid, &uuid, sizeof(uuid)))
+            return false;
+    }
+
+    return true;
+}
+
+static void print_key(const uint8_t *key) {
+    char addr_str[BT_ADDRESS_STR_LEN];
+    char svc_str[UUID128_STR_LEN];
+    char char_str[UUID128_STR_LEN];
+    bt_uuid_t u;
+
+    memcpy(u.uu, key + 6, 16);
+    uuid2str(&u, svc_str);
+    memcpy(u.uu, key + 23, 16);
+    uuid2str(&u, char_str);
+
+    printf("%s,%s,%u,%s,%u", ba2str(key, addr_str), svc_str, key[22],
+           char_str, key[39]);
+}
+
+static void add_total(const uint8_t *key, uint64_t t, uint64_t len) {
+    total_t *total = NULL;
+    int i;
+
+    for (i = 0; i < totals_count && total == NULL; i++)
+        if (!memcmp(totals[i].key, key, VALUE_LOG_KEY_LEN))
+            total = &totals[i];
+
+    if (total == NULL) {
+        total = realloc(totals, (totals_count + 1) * sizeof(total_t));
+        if (total == NULL)
+            return;
+        totals = total;
+        total = &totals[totals_count++];
+        memset(total, 0, sizeof(*total));
+        memcpy(total->key, key, VALUE_LOG_KEY_LEN);
+        total->first_us = t;
+    }
+
+    total->count++;
+    total->bytes += len;
+    total->last_us = t;
+}
+
+/* Prints the samples of an uncompressed block that pass the filters. Returns
+ * false if the block is malformed. */
+static bool print_block(const uint8_t *p, size_t len, uint64_t first_us,
+                        uint32_t count) {
+    const uint8_t *end = p + len;
+    const uint8_t *keys, *keys_end, *times, *times_end, *sources;
+    const uint8_t *sources_end, *lengths, *lengths_end, *values, *values_end;
+    bool matches[VALUE_LOG_BLOCK_KEYS];
+    uint64_t keys_count, delta, source, n, t = first_us;
+    const uint8_t *key;
+    uint32_t i, j;
+
+    if (!get_column(&p, end, &keys, &keys_end) ||
+        !get_column(&p, end, &times, &times_end) ||
+        !get_column(&p, end, &sources, &sources_end) ||
+        !get_column(&p, end, &lengths, &lengths_end) ||
+        !get_column(&p, end, &values, &values_end))
+        return false;
+
+    if (!get_varint(&keys, keys_end, &keys_count) ||
+        keys_count > VALUE_LOG_BLOCK_KEYS ||
+        keys_count * VALUE_LOG_KEY_LEN != (uint64_t) (keys_end - keys))
+        return false;
+
+    /* filters are checked once per key, not per sample */
+    for (i = 0; i < keys_count; i++)
+        matches[i] = key_matches(keys + i * VALUE_LOG_KEY_LEN);
+
+    for (i = 0; i < count; i++) {
+        if (!get_varint(&times, times_end, &delta) ||
+            !get_varint(&sources, sources_end, &source) ||
+            !get_varint(&lengths, lengths_end, &n) ||
+            (source >> 2) >= keys_count ||
+            n > (uint64_t) (values_end - values))
+            return false;
+
+        t += delta;
+        key = keys + (source >> 2) * VALUE_LOG_KEY_LEN;
+
+        if (matches[source >> 2] && t >= from_us && t <= to_us) {
+            if (summary)
+                add_total(key, t, n);
+            else {
+                printf("%llu.%06llu,", (unsigned long long) t / 1000000,
+                       (unsigned long long) t % 1000000);
+                print_key(key);
+                printf(",%s,", kinds[source & 3]);
+                for (j = 0; j < n; j++)
+                    printf("%02x", values[j]);
+                printf("\n");
+            }
+        }
+
+        values += n;
+    }
+
+    return true;
+}
+
+static bool grow(uint8_t **buf, size_t *cap, size_t need) {
+    uint8_t *p;
+
+    if (need <= *cap)
+        return true;
+
+    p = realloc(*buf, need);
+    if (p == NULL)
+        return false;
+
+    *buf = p;
+    *cap = need;
+    return true;
+}
+
+/* Prints the samples of a log. Returns false on errors, after printing what
+ * could be read. */
+static bool read_log(const char *path) {
+    uint8_t hdr[VALUE_LOG_HEADER_LEN];
+    char magic[VALUE_LOG_MAGIC_LEN];
+    uint32_t comp_len, raw_len, count, crc;
+    uint64_t first_us, last_us;
+    uLongf len;
+    int block = 0;
+    size_t n;
+    FILE *f;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+        memcmp(magic, VALUE_LOG_MAGIC, VALUE_LOG_MAGIC_LEN)) {
+        fprintf(stderr, "%s is not a value log\n", path);
+        fclose(f);
+        return false;
+    }
+
+    while ((n = fread(hdr, 1, sizeof(hdr), f)) == sizeof(hdr)) {
+        comp_len = get_le(hdr, 4);
+        raw_len = get_le(hdr + 4, 4);
+        count = get_le(hdr + 8, 4);
+        first_us = get_le(hdr + 12, 8);
+        last_us = get_le(hdr + 20, 8);
+        crc = get_le(hdr + 28, 4);
+
+        /* blocks outside the time range aren't even read */
+        if (last_us < from_us || first_us > to_us) {
+            if (fseek(f, comp_len, SEEK_CUR) < 0)
+                break;
+            block++;
+            continue;
+        }
+
+        if (!grow(&compressed, &compressed_cap, comp_len) ||
+            !grow(&payload, &payload_cap, raw_len)) {
+            fprintf(stderr, "Out of memory\n");
+            fclose(f);
+            return false;
+        }
+
+        n = fread(compressed, 1, comp_len, f);
+        if (n != comp_len)
+            break;
+
+        len = raw_len;
+        if (crc32(0, compressed, comp_len) != crc ||
+            uncompress(payload, &len, compressed, comp_len) != Z_OK ||
+            len != raw_len || !print_block(payload, len, first_us, count)) {
+            fprintf(stderr, "%s: block %d is corrupted\n", path, block);
+            fclose(f);
+            return false;
+        }
+
+        block++;
+    }
+
+    fclose(f);
+
+    /* a log being written or cut by a crash ends with a partial block */
+    if (n != 0)
+        fprintf(stderr, "%s: block %d is truncated\n", path, block);
+
+    return true;
+}
+
+static void print_summary() {
+    int i;
+
+    printf("address,service,instance,characteristic,instance,samples,bytes,"
+           "first,last\n");
+
+    for (i = 0; i < totals_count; i++) {
+        print_key(totals[i].key);
+        printf(",%llu,%llu,%llu.%06llu,%llu.%06llu\n",
+               (unsigned long long) totals[i].count,
+               (unsigned long long) totals[i].bytes,
+               (unsigned long long) totals[i].first_us / 1000000,
+               (unsigned long long) totals[i].first_us % 1000000,
+               (unsigned long long) totals[i].last_us / 1000000,
+               (unsigned long long) totals[i].last_us % 1000000);
+    }
+}
+
+/* Parses seconds since the epoch, with a fraction */
+static bool parse_time(const char *str, uint64_t *us) {
+    char *end;
+    double t;
+
+    errno = 0;
+    t = strtod(str, &end);
+    if (*str == 0 || *end != 0 || errno != 0 || t < 0)
+        return false;
+
+    *us = t * 1000000;
+    return true;
+}
+
+static void usage(const char *name) {
+
+    printf("Usage: %s [options] LOG...\n", name);
+    printf("Prints the samples of value logs written by btctl as CSV: time, "
+           "address,\nservice, instance, characteristic, instance, kind and "
+           "value.\n");
+    printf("Options:\n");
+    printf("  -f, --from TIME           only samples at or after TIME, in "
+           "seconds since\n                            the epoch\n");
+    printf("  -t, --to TIME             only samples at or before TIME\n");
+    printf("  -d, --device ADDRESS      only samples of a device\n");
+    printf("  -c, --char UUID           only samples of a characteristic\n");
+    printf("  -s, --summary             print the number of samples of each "
+           "characteristic\n                            instead\n");
+    printf("  -h, --help                show this help\n");
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option options[] = {
+        { "from", required_argument, NULL, 'f' },
+        { "to", required_argument, NULL, 't' },
+        { "device", required_argument, NULL, 'd' },
+        { "char", required_argument, NULL, 'c' },
+        { "summary", no_argument, NULL, 's' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    bool ok = true;
+    int opt, i;
+
+    while ((opt = getopt_long(argc, argv, "f:t:d:c:sh", options,
+                              NULL)) != -1) {
+        switch (opt) {
+            case 'f':
+            case 't':
+                if (!parse_time(optarg, opt == 'f' ? &from_us : &to_us)) {
+                    fprintf(stderr, "Invalid time %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'd':
+                if (str2ba(optarg, &addr) != 0) {
+                    fprintf(stderr, "Invalid bluetooth address %s\n", optarg);
+                    return 1;
+                }
+                has_addr = true;
+                break;
+            case 'c':
+                if (!str2uuid(optarg, &uuid)) {
+                    fprintf(stderr, "Invalid format of UUID %s\n", optarg);
+                    return 1;
+                }
+                has_uuid = true;
+                break;
+            case 's':
+                summary = true;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (!summary)
+        printf("time,address,service,instance,characteristic,instance,kind,"
+               "value\n");
+
+    for (i = optind; i < argc; i++)
+        if (!read_log(argv[i]))
+            ok = false;
+
+    if (summary)
+        print_summary();
+
+    free(totals);
+    free(compressed);
+    free(payload);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,379 @@
+/*
+ * Connections and their GATT operation queues
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "conn.h"
+#include "mem.h"
+#include "rl_helper.h"
+#include "trace.h"
+
+/* Operations are queued from the main thread and completed from the stack
+ * callback thread, so queues and slots are protected by a lock. It is never
+ * held while calling the HAL or a done callback. */
+static pthread_mutex_t conn_lock = PTHREAD_MUTEX_INITIALIZER;
+static conn_t conns[CONN_MAX];
+
+static const btgatt_client_interface_t *gatt_client = NULL;
+static int gatt_client_if = 0;
+
+/* used in "Failed to ..." messages */
+static const char *op_names[] = {
+    [GATT_OP_SEARCH] = "search services",
+    [GATT_OP_INCLUDED] = "list included services",
+    [GATT_OP_CHARS] = "list characteristics",
+    [GATT_OP_DESCS] = "list characteristic descriptors",
+    [GATT_OP_READ_CHAR] = "read characteristic",
+    [GATT_OP_WRITE_CHAR] = "write characteristic",
+    [GATT_OP_READ_DESC] = "read descriptor",
+    [GATT_OP_WRITE_DESC] = "write descriptor",
+    [GATT_OP_REG_NOTIF] = "register for characteristic "
+                          "notification/indication",
+    [GATT_OP_UNREG_NOTIF] = "unregister for characteristic "
+                            "notification/indication",
+};
+
+void conn_set_client(const btgatt_client_interface_t *client, int client_if) {
+
+    gatt_client = client;
+    gatt_client_if = client_if;
+}
+
+conn_t *conn_new(const bt_bdaddr_t *addr) {
+    conn_t *conn = NULL;
+    int i;
+
+    pthread_mutex_lock(&conn_lock);
+
+    for (i = 0; i < CONN_MAX; i++) {
+        if (conns[i].used)
+            continue;
+
+        conn = &conns[i];
+        memset(conn, 0, sizeof(*conn));
+        memcpy(&conn->addr, addr, sizeof(conn->addr));
+        conn->used = true;
+        break;
+    }
+
+    pthread_mutex_unlock(&conn_lock);
+
+    return conn;
+}
+
+/* Removes the first operation of the queue, returns false if it is empty */
+static bool pop_op(conn_t *conn, gatt_op_t *op) {
+    bool ret = false;
+
+    pthread_mutex_lock(&conn_lock);
+
+    if (conn->count > 0) {
+        memcpy(op, &conn->ops[conn->head], sizeof(*op));
+        conn->head = (conn->head + 1) % CONN_QUEUE_SIZE;
+        conn->count--;
+        conn->busy = false;
+        ret = true;
+    }
+
+    pthread_mutex_unlock(&conn_lock);
+
+    return ret;
+}
+
+static void finish_op(conn_t *conn, gatt_op_t *op, int status,
+                      const void *result) {
+
+    if (op->done != NULL)
+        op->done(conn, op, status, result);
+
+    if (!op->shared_value)
+        mem_free(op->value);
+}
+
+void conn_free(conn_t *conn, int status) {
+    gatt_op_t op;
+
+    while (pop_op(conn, &op))
+        finish_op(conn, &op, status, NULL);
+
+    gatt_db_free(&conn->db);
+
+    pthread_mutex_lock(&conn_lock);
+    conn->used = false;
+    conn->conn_id = 0;
+    pthread_mutex_unlock(&conn_lock);
+}
+
+conn_t *conn_find(int conn_id) {
+    conn_t *conn = NULL;
+    int i;
+
+    pthread_mutex_lock(&conn_lock);
+
+    for (i = 0; i < CONN_MAX; i++)
+        if (conns[i].used && conns[i].conn_id == conn_id) {
+            conn = &conns[i];
+            break;
+        }
+
+    pthread_mutex_unlock(&conn_lock);
+
+    return conn;
+}
+
+conn_t *conn_find_addr(const bt_bdaddr_t *addr) {
+    conn_t *conn = NULL;
+    int i;
+
+    pthread_mutex_lock(&conn_lock);
+
+    for (i = 0; i < CONN_MAX; i++)
+        if (conns[i].used &&
+            !memcmp(&conns[i].addr, addr, sizeof(bt_bdaddr_t))) {
+            conn = &conns[i];
+            break;
+        }
+
+    pthread_mutex_unlock(&conn_lock);
+
+    return conn;
+}
+
+conn_t *conn_get(int i) {
+
+    if (i < 0 || i >= CONN_MAX || !conns[i].used)
+        return NULL;
+
+    return &conns[i];
+}
+
+/* Starts op on the HAL, checking the attribute IDs against the database */
+static bt_status_t start_op(conn_t *conn, gatt_op_t *op) {
+    gatt_db_t *db = &conn->db;
+    btgatt_srvc_id_t srvc;
+    btgatt_char_id_t ch;
+    bt_uuid_t descr;
+
+    if (op->type != GATT_OP_SEARCH) {
+        if (op->svc >= db->svc_count)
+            return BT_STATUS_PARM_INVALID;
+        gatt_db_svc_id(db, op->svc, &srvc);
+    }
+
+    if (op->type > GATT_OP_CHARS) {
+        if (op->ch >= gatt_db_char_count(db, op->svc))
+            return BT_STATUS_PARM_INVALID;
+        gatt_db_char_id(db, op->svc, op->ch, &ch);
+    }
+
+    if (op->type == GATT_OP_READ_DESC || op->type == GATT_OP_WRITE_DESC) {
+        if (op->desc >= gatt_db_desc_count(db, op->svc, op->ch))
+            return BT_STATUS_PARM_INVALID;
+        gatt_db_desc_uuid(db, op->svc, op->ch, op->desc, &descr);
+    }
+
+    switch (op->type) {
+        case GATT_OP_SEARCH:
+            gatt_db_clear(db);
+            return HAL_CALL(gatt_client, search_service, conn->conn_id,
+                            op->filter ? &op->uuid : NULL);
+        case GATT_OP_INCLUDED:
+            return HAL_CALL(gatt_client, get_included_service, conn->conn_id,
+                            &srvc, NULL);
+        case GATT_OP_CHARS:
+            gatt_db_reset_chars(db, op->svc);
+            return HAL_CALL(gatt_client, get_characteristic, conn->conn_id,
+                            &srvc, NULL);
+        case GATT_OP_DESCS:
+            gatt_db_reset_descs(db, op->svc, op->ch);
+            return HAL_CALL(gatt_client, get_descriptor, conn->conn_id, &srvc,
+                            &ch, NULL);
+        case GATT_OP_READ_CHAR:
+            return HAL_CALL(gatt_client, read_characteristic, conn->conn_id,
+                            &srvc, &ch, op->auth);
+        case GATT_OP_WRITE_CHAR:
+            return HAL_CALL(gatt_client, write_characteristic, conn->conn_id,
+                            &srvc, &ch, op->write_type, op->len, op->auth,
+                            op->value);
+        case GATT_OP_READ_DESC:
+            return HAL_CALL(gatt_client, read_descriptor, conn->conn_id, &srvc,
+                            &ch, &descr, op->auth);
+        case GATT_OP_WRITE_DESC:
+            return HAL_CALL(gatt_client, write_descriptor, conn->conn_id, &srvc,
+                            &ch, &descr, op->write_type, op->len, op->auth,
+                            op->value);
+        case GATT_OP_REG_NOTIF:
+            return HAL_CALL(gatt_client, register_for_notification,
+                            gatt_client_if, &conn->addr, &srvc, &ch);
+        case GATT_OP_UNREG_NOTIF:
+            return HAL_CALL(gatt_client, deregister_for_notification,
+                            gatt_client_if, &conn->addr, &srvc, &ch);
+    }
+
+    return BT_STATUS_UNSUPPORTED;
+}
+
+/* Starts queued operations until one is accepted by the HAL */
+static void dispatch(conn_t *conn) {
+    bt_status_t status;
+    gatt_op_t *op, failed;
+
+    while (true) {
+        pthread_mutex_lock(&conn_lock);
+
+        if (!conn->used || conn->conn_id <= 0 || conn->busy ||
+            conn->count == 0 || gatt_client == NULL) {
+            pthread_mutex_unlock(&conn_lock);
+            return;
+        }
+
+        /* the slot stays valid until the operation is popped */
+        op = &conn->ops[conn->head];
+        conn->busy = true;
+
+        pthread_mutex_unlock(&conn_lock);
+
+        status = start_op(conn, op);
+        if (status == BT_STATUS_SUCCESS)
+            return;
+
+        if (status == BT_STATUS_PARM_INVALID)
+            rl_printf("Failed to %s: attribute no longer in the database\n",
+                      op_names[op->type]);
+        else
+            rl_printf("Failed to %s\n", op_names[op->type]);
+
+        if (pop_op(conn, &failed))
+            finish_op(conn, &failed, -status, NULL);
+    }
+}
+
+void conn_connected(conn_t *conn, int conn_id) {
+
+    pthread_mutex_lock(&conn_lock);
+    conn->conn_id = conn_id;
+    pthread_mutex_unlock(&conn_lock);
+
+    dispatch(conn);
+}
+
+int conn_enqueue(conn_t *conn, const gatt_op_t *op) {
+    gatt_op_t *slot;
+    char *value = NULL;
+    int ahead;
+
+    if (op->shared_value)
+        value = op->value;
+    else if (op->len > 0) {
+        value = mem_alloc(MEM_GATT_OPS, op->len);
+        if (value == NULL)
+            return -1;
+        memcpy(value, op->value, op->len);
+    }
+
+    pthread_mutex_lock(&conn_lock);
+
+    if (!conn->used || conn->count == CONN_QUEUE_SIZE) {
+        pthread_mutex_unlock(&conn_lock);
+        if (!op->shared_value)
+            mem_free(value);
+        return -1;
+    }
+
+    slot = &conn->ops[(conn->head + conn->count) % CONN_QUEUE_SIZE];
+    memcpy(slot, op, sizeof(*slot));
+    slot->value = value;
+    ahead = conn->count++;
+
+    pthread_mutex_unlock(&conn_lock);
+
+    dispatch(conn);
+
+    return ahead;
+}
+
+int conn_flush(conn_t *conn, gatt_op_done_cb done, int status) {
+    gatt_op_t removed[CONN_QUEUE_SIZE];
+    int i, first, kept = 0, n = 0;
+
+    pthread_mutex_lock(&conn_lock);
+
+    /* the operation in progress stays */
+    first = conn->busy ? 1 : 0;
+    kept = first;
+
+    for (i = first; i < conn->count; i++) {
+        gatt_op_t *op = &conn->ops[(conn->head + i) % CONN_QUEUE_SIZE];
+
+        if (op->done == done)
+            memcpy(&removed[n++], op, sizeof(*op));
+        else
+            memmove(&conn->ops[(conn->head + kept++) % CONN_QUEUE_SIZE], op,
+                    sizeof(*op));
+    }
+
+    conn->count = kept;
+
+    pthread_mutex_unlock(&conn_lock);
+
+    for (i = 0; i < n; i++)
+        finish_op(conn, &removed[i], status, NULL);
+
+    return n;
+}
+
+const gatt_op_t *conn_current_op(conn_t *conn) {
+    const gatt_op_t *op = NULL;
+
+    pthread_mutex_lock(&conn_lock);
+    if (conn->busy)
+        op = &conn->ops[conn->head];
+    pthread_mutex_unlock(&conn_lock);
+
+    return op;
+}
+
+void conn_op_done(conn_t *conn, int status, const void *result) {
+    gatt_op_t op;
+    bool busy;
+
+    pthread_mutex_lock(&conn_lock);
+    busy = conn->busy;
+    pthread_mutex_unlock(&conn_lock);
+
+    /* completion of something that wasn't queued, eg. a notification
+     * registration done before the connection was up */
+    if (!busy || !pop_op(conn, &op))
+        return;
+
+    finish_op(conn, &op, status, result);
+    dispatch(conn);
+}
+
+int conn_pending(conn_t *conn) {
+    int count;
+
+    pthread_mutex_lock(&conn_lock);
+    count = conn->count;
+    pthread_mutex_unlock(&conn_lock);
+
+    return count;
+}
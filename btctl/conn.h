@@ -0,0 +1,102 @@
+#ifndef __CONN_H__
+#define __CONN_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <hardware/bluetooth.h>
+#include <hardware/bt_gatt.h>
+
+#include "gatt_db.h"
+
+/* Maximum number of simultaneous connections */
+#define CONN_MAX 8
+/* Maximum number of GATT operations waiting on a connection */
+#define CONN_QUEUE_SIZE 64
+
+typedef enum {
+    GATT_OP_SEARCH,
+    GATT_OP_INCLUDED,
+    GATT_OP_CHARS,
+    GATT_OP_DESCS,
+    GATT_OP_READ_CHAR,
+    GATT_OP_WRITE_CHAR,
+    GATT_OP_READ_DESC,
+    GATT_OP_WRITE_DESC,
+    GATT_OP_REG_NOTIF,
+    GATT_OP_UNREG_NOTIF,
+} gatt_op_type_t;
+
+struct conn;
+struct gatt_op;
+
+/* Called when an operation finishes. status is the ATT status reported by the
+ * stack, or a negative bt_status_t if the operation couldn't be started.
+ * result points to the HAL parameters of the completion callback
+ * (btgatt_read_params_t for reads), or is NULL. */
+typedef void (*gatt_op_done_cb)(struct conn *conn, const struct gatt_op *op,
+                                int status, const void *result);
+
+/* A GATT client operation. Attributes are referenced by their IDs in the
+ * database of the connection, which are checked when the operation starts. */
+typedef struct gatt_op {
+    gatt_op_type_t type;
+    uint16_t svc;
+    uint16_t ch;
+    uint8_t desc;
+    uint8_t auth;
+    uint8_t write_type;
+    bool filter; /* GATT_OP_SEARCH: only services with this uuid */
+    bool quiet; /* results are left to the done callback, not printed */
+    bt_uuid_t uuid;
+    uint16_t len;
+    char *value; /* writes, copied when the operation is queued... */
+    bool shared_value; /* ...unless set: the caller keeps it valid */
+    gatt_op_done_cb done;
+    void *user_data;
+} gatt_op_t;
+
+/* A connection and its queue of GATT operations. Only one operation is
+ * outstanding on each connection at a time, the next one is started as soon
+ * as the current one completes. Different connections progress in parallel. */
+typedef struct conn {
+    bool used;
+    int conn_id; /* 0 while connecting */
+    bt_bdaddr_t addr;
+    gatt_db_t db;
+
+    gatt_op_t ops[CONN_QUEUE_SIZE];
+    uint8_t head;
+    uint8_t count;
+    bool busy; /* ops[head] was started and didn't complete yet */
+} conn_t;
+
+/* Sets the GATT client used to start operations */
+void conn_set_client(const btgatt_client_interface_t *client, int client_if);
+
+/* Allocates a connection to addr, returns NULL if all are in use */
+conn_t *conn_new(const bt_bdaddr_t *addr);
+/* Fails all queued operations with status (a negative bt_status_t) and
+ * releases the connection */
+void conn_free(conn_t *conn, int status);
+/* Marks a connection as established and starts queued operations */
+void conn_connected(conn_t *conn, int conn_id);
+
+conn_t *conn_find(int conn_id);
+conn_t *conn_find_addr(const bt_bdaddr_t *addr);
+/* Returns the i-th connection slot, or NULL if it is unused */
+conn_t *conn_get(int i);
+
+/* Queues a copy of op. Returns the number of operations ahead of it, or -1 if
+ * the queue is full. */
+int conn_enqueue(conn_t *conn, const gatt_op_t *op);
+/* Fails the queued operations that have done as callback and weren't started
+ * yet, with status (a negative bt_status_t). Returns how many were removed. */
+int conn_flush(conn_t *conn, gatt_op_done_cb done, int status);
+/* Returns the operation in progress, or NULL */
+const gatt_op_t *conn_current_op(conn_t *conn);
+/* Completes the operation in progress and starts the next one */
+void conn_op_done(conn_t *conn, int status, const void *result);
+/* Number of queued operations, including the one in progress */
+int conn_pending(conn_t *conn);
+
+#endif /* __CONN_H__ */
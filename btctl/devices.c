@@ -0,0 +1,226 @@
+/*
+ * Table of remote devices found during discovery
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "devices.h"
+#include "util.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static device_info_t devs[DEVICES_MAX];
+static int devs_count = 0;
+
+static device_info_t *find_dev(const bt_bdaddr_t *addr) {
+    int i;
+
+    for (i = 0; i < devs_count; i++)
+        if (!memcmp(&devs[i].addr, addr, sizeof(*addr)))
+            return &devs[i];
+
+    return NULL;
+}
+
+/* Returns an empty record, recycling the least recently seen one if needed */
+static device_info_t *new_dev(const bt_bdaddr_t *addr, uint32_t now) {
+    device_info_t *dev;
+    int i;
+
+    if (devs_count < DEVICES_MAX)
+        dev = &devs[devs_count++];
+    else {
+        dev = &devs[0];
+        for (i = 1; i < devs_count; i++)
+            if (now - devs[i].last_seen_ms > now - dev->last_seen_ms)
+                dev = &devs[i];
+    }
+
+    memset(dev, 0, sizeof(*dev));
+    memcpy(&dev->addr, addr, sizeof(*addr));
+    dev->first_seen_ms = now;
+
+    return dev;
+}
+
+/* Copies a property string, which isn't always NUL terminated */
+static int update_str(char *dst, const bt_property_t *prop) {
+    char tmp[DEVICE_NAME_LEN];
+    int len = prop->len < DEVICE_NAME_LEN - 1 ? prop->len : DEVICE_NAME_LEN - 1;
+
+    memcpy(tmp, prop->val, len);
+    tmp[len] = 0;
+
+    if (strcmp(dst, tmp) == 0)
+        return 0;
+
+    strcpy(dst, tmp);
+    return 1;
+}
+
+int devices_prop_field(bt_property_type_t type) {
+
+    switch (type) {
+        case BT_PROPERTY_BDNAME:
+            return DEVICE_HAS_NAME;
+        case BT_PROPERTY_REMOTE_FRIENDLY_NAME:
+            return DEVICE_HAS_ALIAS;
+        case BT_PROPERTY_CLASS_OF_DEVICE:
+            return DEVICE_HAS_CLASS;
+        case BT_PROPERTY_TYPE_OF_DEVICE:
+            return DEVICE_HAS_TYPE;
+        case BT_PROPERTY_REMOTE_RSSI:
+            return DEVICE_HAS_RSSI;
+        case BT_PROPERTY_REMOTE_VERSION_INFO:
+            return DEVICE_HAS_VERSION;
+        default:
+            return 0;
+    }
+}
+
+int devices_update(int num_properties, const bt_property_t *properties,
+                   device_info_t *info) {
+    uint32_t now = monotonic_us() / 1000;
+    const bt_bdaddr_t *addr = NULL;
+    device_info_t *dev;
+    int changed = 0;
+    int i;
+
+    for (i = 0; i < num_properties; i++)
+        if (properties[i].type == BT_PROPERTY_BDADDR)
+            addr = properties[i].val;
+
+    if (addr == NULL)
+        return -1;
+
+    pthread_mutex_lock(&lock);
+
+    dev = find_dev(addr);
+    if (dev == NULL) {
+        dev = new_dev(addr, now);
+        changed = DEVICE_NEW;
+    }
+
+    for (i = 0; i < num_properties; i++) {
+        const bt_property_t *prop = &properties[i];
+        int field = devices_prop_field(prop->type);
+        int diff = 0;
+
+        switch (prop->type) {
+            case BT_PROPERTY_BDNAME:
+                diff = update_str(dev->name, prop);
+                break;
+
+            case BT_PROPERTY_REMOTE_FRIENDLY_NAME:
+                diff = update_str(dev->alias, prop);
+                break;
+
+            case BT_PROPERTY_CLASS_OF_DEVICE: {
+                uint32_t cod = ((uint32_t *) prop->val)[0];
+
+                diff = dev->cod != cod;
+                dev->cod = cod;
+                break;
+            }
+            case BT_PROPERTY_TYPE_OF_DEVICE: {
+                uint8_t type = ((bt_device_type_t *) prop->val)[0];
+
+                diff = dev->type != type;
+                dev->type = type;
+                break;
+            }
+            case BT_PROPERTY_REMOTE_RSSI: {
+                int8_t rssi = ((int8_t *) prop->val)[0];
+
+                diff = dev->rssi != rssi;
+                dev->rssi = rssi;
+                break;
+            }
+            case BT_PROPERTY_REMOTE_VERSION_INFO: {
+                const bt_remote_version_t *v = prop->val;
+
+                diff = dev->version != v->version ||
+                       dev->sub_version != v->sub_ver ||
+                       dev->manufacturer != v->manufacturer;
+                dev->version = v->version;
+                dev->sub_version = v->sub_ver;
+                dev->manufacturer = v->manufacturer;
+                break;
+            }
+            default:
+                break;
+        }
+
+        /* a field received for the first time is always a change */
+        if (diff || !(dev->fields & field))
+            changed |= field;
+        dev->fields |= field;
+    }
+
+    dev->last_seen_ms = now;
+    dev->seen_count++;
+
+    if (info != NULL)
+        memcpy(info, dev, sizeof(*info));
+
+    pthread_mutex_unlock(&lock);
+
+    return changed;
+}
+
+static int cmp_last_seen(const void *a, const void *b) {
+    const device_info_t *da = a, *db = b;
+
+    if (da->last_seen_ms == db->last_seen_ms)
+        return 0;
+
+    return (int32_t) (db->last_seen_ms - da->last_seen_ms) < 0 ? -1 : 1;
+}
+
+static int cmp_rssi(const void *a, const void *b) {
+    const device_info_t *da = a, *db = b;
+    int ra = da->fields & DEVICE_HAS_RSSI ? da->rssi : -128;
+    int rb = db->fields & DEVICE_HAS_RSSI ? db->rssi : -128;
+
+    if (ra == rb)
+        return cmp_last_seen(a, b);
+
+    return rb - ra;
+}
+
+int devices_list(device_info_t *list, int max, devices_sort_t sort) {
+    int n;
+
+    pthread_mutex_lock(&lock);
+    n = devs_count < max ? devs_count : max;
+    memcpy(list, devs, n * sizeof(list[0]));
+    pthread_mutex_unlock(&lock);
+
+    qsort(list, n, sizeof(list[0]),
+          sort == DEVICES_SORT_RSSI ? cmp_rssi : cmp_last_seen);
+
+    return n;
+}
+
+void devices_clear() {
+
+    pthread_mutex_lock(&lock);
+    devs_count = 0;
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,56 @@
+#ifndef __DEVICES_H__
+#define __DEVICES_H__
+
+#include <stdint.h>
+#include <hardware/bluetooth.h>
+
+/* Maximum number of devices kept, the least recently seen is dropped */
+#define DEVICES_MAX 128
+#define DEVICE_NAME_LEN 48
+
+/* Fields of device_info_t that have been received at least once */
+#define DEVICE_HAS_NAME     (1 << 0)
+#define DEVICE_HAS_ALIAS    (1 << 1)
+#define DEVICE_HAS_CLASS    (1 << 2)
+#define DEVICE_HAS_TYPE     (1 << 3)
+#define DEVICE_HAS_RSSI     (1 << 4)
+#define DEVICE_HAS_VERSION  (1 << 5)
+
+typedef struct device_info {
+    bt_bdaddr_t addr;
+    uint8_t fields; /* DEVICE_HAS_* */
+    uint8_t type; /* bt_device_type_t */
+    int8_t rssi;
+    uint8_t version;
+    uint16_t sub_version;
+    uint16_t manufacturer;
+    uint32_t cod;
+    uint32_t first_seen_ms;
+    uint32_t last_seen_ms;
+    uint32_t seen_count;
+    char name[DEVICE_NAME_LEN];
+    char alias[DEVICE_NAME_LEN];
+} device_info_t;
+
+typedef enum {
+    DEVICES_SORT_LAST_SEEN,
+    DEVICES_SORT_RSSI,
+} devices_sort_t;
+
+/* Merges the properties of a device found event into the table. The merged
+ * record is copied to dev (if not NULL). Returns the DEVICE_HAS_* mask of
+ * fields that are new or changed, DEVICE_NEW for a device not seen before or
+ * -1 if there is no address among the properties. */
+#define DEVICE_NEW 0x100
+int devices_update(int num_properties, const bt_property_t *properties,
+                   device_info_t *dev);
+
+/* Returns the DEVICE_HAS_* flag for a property type, 0 if not stored */
+int devices_prop_field(bt_property_type_t type);
+
+/* Copies up to max records to devs, sorted. Returns the number copied. */
+int devices_list(device_info_t *devs, int max, devices_sort_t sort);
+
+void devices_clear();
+
+#endif /* __DEVICES_H__ */
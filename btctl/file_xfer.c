@@ -0,0 +1,655 @@
+/*
+ * File transfers to a characteristic
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "file_xfer.h"
+#include "gatt_db.h"
+#include "rl_helper.h"
+#include "util.h"
+
+typedef enum {
+    XFER_IDLE,
+    XFER_SETUP, /* enabling acknowledgement notifications */
+    XFER_SENDING,
+} xfer_state_t;
+
+/* Settings for the next transfer */
+static unsigned int cfg_chunk = XFER_CHUNK_DEFAULT;
+static unsigned int cfg_window = XFER_WINDOW_DEFAULT;
+static int cfg_ack_svc = -1;
+static int cfg_ack_ch;
+
+/* The transfer is driven from write completions and notifications on the
+ * stack callback thread, and started or stopped from commands, so its state
+ * is protected by a lock. Operations are never queued with the lock held,
+ * since a write that fails to start completes right away. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+    xfer_state_t state;
+    conn_t *conn;
+    bt_bdaddr_t addr;
+    int svc;
+    int ch;
+    int ack_svc; /* < 0 without acknowledgements */
+    int ack_ch;
+    unsigned int chunk;
+    unsigned int window;
+    char path[PATH_MAX];
+
+    uint8_t *data; /* mapping of the file, NULL once unmapped */
+    size_t size;
+    size_t next; /* offset of the next chunk to queue */
+    size_t written; /* end of the completed writes */
+    size_t acked; /* end of the acknowledged data */
+    size_t resume; /* where the last transfer stopped */
+    unsigned int in_flight; /* queued writes */
+
+    /* writes are queued by one thread at a time, so they stay in order */
+    bool filling;
+
+    size_t start_offset;
+    uint64_t start_us;
+    int progress; /* last tenth of the file reported */
+} x = { .ack_svc = -1 };
+
+static void write_done(conn_t *conn, const gatt_op_t *op, int status,
+                       const void *result);
+
+bool xfer_set_chunk(unsigned int bytes) {
+
+    if (x.state != XFER_IDLE) {
+        rl_printf("A transfer is running, stop it first\n");
+        return false;
+    }
+
+    if (bytes == 0 || bytes > BTGATT_MAX_ATTR_LEN) {
+        rl_printf("Chunk size must be 1-%d bytes\n", BTGATT_MAX_ATTR_LEN);
+        return false;
+    }
+
+    cfg_chunk = bytes;
+    return true;
+}
+
+bool xfer_set_window(unsigned int chunks) {
+
+    if (x.state != XFER_IDLE) {
+        rl_printf("A transfer is running, stop it first\n");
+        return false;
+    }
+
+    if (chunks == 0 || chunks > XFER_WINDOW_MAX) {
+        rl_printf("Window must be 1-%d chunks\n", XFER_WINDOW_MAX);
+        return false;
+    }
+
+    cfg_window = chunks;
+    return true;
+}
+
+bool xfer_set_ack(int svc, int ch) {
+
+    if (x.state != XFER_IDLE) {
+        rl_printf("A transfer is running, stop it first\n");
+        return false;
+    }
+
+    cfg_ack_svc = svc;
+    cfg_ack_ch = ch;
+    return true;
+}
+
+/* Takes the mapping once the transfer is over and no write refers to it.
+ * Must be called with the lock held, the caller unmaps it. */
+static uint8_t *take_map() {
+    uint8_t *data = NULL;
+
+    if (x.state == XFER_IDLE && x.in_flight == 0) {
+        data = x.data;
+        x.data = NULL;
+    }
+
+    return data;
+}
+
+/* Offset to resume from. Must be called with the lock held. */
+static size_t confirmed() {
+
+    return x.ack_svc >= 0 ? x.acked : x.written;
+}
+
+/* Queues a GATT operation of the transfer, besides the data writes */
+static void queue(gatt_op_type_t type, int svc, int ch, int desc,
+                  gatt_op_done_cb done) {
+    static char cccd_notify[] = { 0x01, 0x00 };
+    gatt_op_t op;
+
+    memset(&op, 0, sizeof(op));
+    op.type = type;
+    op.svc = svc;
+    op.ch = ch;
+    op.desc = desc;
+    op.quiet = true;
+    op.done = done;
+
+    if (type == GATT_OP_WRITE_DESC) {
+        op.write_type = 2; /* Write Request */
+        op.len = sizeof(cccd_notify);
+        op.value = cccd_notify;
+    }
+
+    conn_enqueue(x.conn, &op);
+}
+
+/* Ends the transfer with the lock held, returning the mapping to release.
+ * Writes still queued must be flushed by the caller, without the lock. */
+static uint8_t *end_locked() {
+
+    x.state = XFER_IDLE;
+    x.resume = confirmed();
+    return take_map();
+}
+
+/* Cleans up after end_locked(): drops the writes still queued on conn and
+ * disables acknowledgements if unreg is set. Must be called without the
+ * lock. */
+static void cleanup(conn_t *conn, bool unreg, uint8_t *data) {
+
+    conn_flush(conn, write_done, -BT_STATUS_FAIL);
+
+    if (unreg && x.ack_svc >= 0)
+        queue(GATT_OP_UNREG_NOTIF, x.ack_svc, x.ack_ch, 0, NULL);
+
+    if (data != NULL)
+        munmap(data, x.size);
+}
+
+/* Checks the end of the transfer. Must be called with the lock held.
+ * Returns true if it completed, and then the caller must call cleanup(). */
+static bool check_complete(uint8_t **data) {
+    uint64_t ms;
+    size_t sent;
+
+    if (x.state != XFER_SENDING || confirmed() < x.size || x.in_flight > 0)
+        return false;
+
+    *data = end_locked();
+
+    ms = (monotonic_us() - x.start_us) / 1000;
+    sent = x.size - x.start_offset;
+    rl_printf("File sent: %zu bytes in %llu ms, %.1f kB/s\n", sent,
+              (unsigned long long) ms, ms > 0 ? sent / (double) ms : 0.0);
+
+    return true;
+}
+
+/* Reports progress every tenth of the file. Must be called with the lock
+ * held. */
+static void report_progress() {
+    int tenth = (uint64_t) confirmed() * 10 / x.size;
+    uint64_t ms;
+
+    if (tenth <= x.progress || tenth >= 10)
+        return;
+
+    x.progress = tenth;
+    ms = (monotonic_us() - x.start_us) / 1000;
+    rl_printf("Sent %d%% (%zu of %zu bytes), %.1f kB/s\n", tenth * 10,
+              confirmed(), x.size,
+              ms > 0 ? (confirmed() - x.start_offset) / (double) ms : 0.0);
+}
+
+/* Queues writes until the window is full */
+static void fill() {
+    gatt_op_t op;
+    conn_t *conn;
+    size_t off;
+    unsigned int len;
+
+    pthread_mutex_lock(&lock);
+
+    /* the thread already queueing checks the window again after each
+     * write, with the lock held */
+    if (x.filling) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    x.filling = true;
+
+    while (true) {
+        if (x.state != XFER_SENDING || x.next >= x.size ||
+            x.in_flight >= x.window ||
+            (x.ack_svc >= 0 &&
+             x.next - x.acked >= (size_t) x.window * x.chunk))
+            break;
+
+        off = x.next;
+        len = x.size - off < x.chunk ? x.size - off : x.chunk;
+        x.next += len;
+        x.in_flight++;
+        conn = x.conn;
+
+        pthread_mutex_unlock(&lock);
+
+        memset(&op, 0, sizeof(op));
+        op.type = GATT_OP_WRITE_CHAR;
+        op.svc = x.svc;
+        op.ch = x.ch;
+        op.write_type = 1; /* Write Command */
+        op.len = len;
+        op.value = (char *) x.data + off;
+        op.shared_value = true;
+        op.quiet = true;
+        op.done = write_done;
+
+        if (conn_enqueue(conn, &op) < 0) {
+            pthread_mutex_lock(&lock);
+
+            /* nothing was queued after it, take it back */
+            x.next -= len;
+            x.in_flight--;
+
+            if (x.in_flight == 0 && x.state == XFER_SENDING) {
+                /* no completion will come to queue it again */
+                uint8_t *data = end_locked();
+
+                x.filling = false;
+                pthread_mutex_unlock(&lock);
+                rl_printf("Transfer stopped at offset %zu: connection queue "
+                          "is full\n", x.resume);
+                cleanup(conn, true, data);
+                return;
+            }
+
+            break;
+        }
+
+        pthread_mutex_lock(&lock);
+    }
+
+    x.filling = false;
+    pthread_mutex_unlock(&lock);
+}
+
+static void write_done(conn_t *conn, const gatt_op_t *op, int status,
+                       const void *result) {
+    uint8_t *data = NULL;
+    bool done = false;
+
+    pthread_mutex_lock(&lock);
+
+    x.in_flight--;
+
+    if (x.state != XFER_SENDING) {
+        /* stopped while it was queued */
+        data = take_map();
+        pthread_mutex_unlock(&lock);
+        if (data != NULL)
+            munmap(data, x.size);
+        return;
+    }
+
+    if (status != 0) {
+        data = end_locked();
+        rl_printf("Transfer stopped at offset %zu: write failed, status: "
+                  "%d\n", x.resume, status);
+        done = true;
+    } else {
+        x.written += op->len;
+        report_progress();
+        done = check_complete(&data);
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    /* the connection may be going away, leave it alone then */
+    if (done)
+        cleanup(conn, status != -BT_STATUS_FAIL, data);
+    else
+        fill();
+}
+
+/* Done callback of the operations enabling acknowledgements */
+static void setup_done(conn_t *conn, const gatt_op_t *op, int status,
+                       const void *result) {
+    bt_uuid_t uuid, cccd;
+    uint8_t *data;
+    int i, n;
+
+    pthread_mutex_lock(&lock);
+
+    if (x.state != XFER_SETUP) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    if (status != 0) {
+        data = end_locked();
+        pthread_mutex_unlock(&lock);
+        rl_printf("Unable to enable acknowledgements, status: %d\n", status);
+        cleanup(conn, status != -BT_STATUS_FAIL, data);
+        return;
+    }
+
+    switch (op->type) {
+        case GATT_OP_REG_NOTIF:
+            pthread_mutex_unlock(&lock);
+            return;
+
+        case GATT_OP_DESCS:
+            /* enable notifications, if the device lets us */
+            str2uuid("0x2902", &cccd);
+            n = gatt_db_desc_count(&conn->db, x.ack_svc, x.ack_ch);
+            for (i = 0; i < n; i++) {
+                gatt_db_desc_uuid(&conn->db, x.ack_svc, x.ack_ch, i, &uuid);
+                if (!memcmp(&uuid, &cccd, sizeof(uuid)))
+                    break;
+            }
+
+            pthread_mutex_unlock(&lock);
+
+            if (i < n) {
+                queue(GATT_OP_WRITE_DESC, x.ack_svc, x.ack_ch, i, setup_done);
+                return;
+            }
+            break;
+
+        default:
+            pthread_mutex_unlock(&lock);
+            break;
+    }
+
+    pthread_mutex_lock(&lock);
+    x.state = XFER_SENDING;
+    x.start_us = monotonic_us();
+    pthread_mutex_unlock(&lock);
+
+    fill();
+}
+
+/* Maps the file of the transfer. Prints the reason and returns false on
+ * failure. */
+static bool map_file(const char *path, size_t *size) {
+    struct stat st;
+    void *data;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        rl_printf("Unable to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        rl_printf("Unable to send %s: empty or unreadable file\n", path);
+        close(fd);
+        return false;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        rl_printf("Unable to map %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    /* chunks are read once, in order */
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    x.data = data;
+    *size = st.st_size;
+    return true;
+}
+
+/* Starts the transfer set up in x from offset */
+static void begin(conn_t *conn, size_t offset) {
+    bool ack = x.ack_svc >= 0;
+
+    x.conn = conn;
+    memcpy(&x.addr, &conn->addr, sizeof(x.addr));
+    x.next = x.written = x.acked = x.start_offset = offset;
+    x.in_flight = 0;
+    x.progress = offset * 10 / x.size;
+    x.start_us = monotonic_us();
+
+    rl_printf("Sending %s: %zu bytes from offset %zu, %u byte chunks, window "
+              "%u%s\n", x.path, x.size - offset, offset, x.chunk, x.window,
+              ack ? ", acknowledged" : "");
+
+    if (!ack) {
+        x.state = XFER_SENDING;
+        fill();
+        return;
+    }
+
+    x.state = XFER_SETUP;
+    queue(GATT_OP_REG_NOTIF, x.ack_svc, x.ack_ch, 0, setup_done);
+    queue(GATT_OP_DESCS, x.ack_svc, x.ack_ch, 0, setup_done);
+}
+
+bool xfer_start(conn_t *conn, int svc, int ch, const char *path,
+                size_t offset) {
+    size_t size;
+
+    if (x.state != XFER_IDLE || x.data != NULL) {
+        rl_printf("A transfer is already running\n");
+        return false;
+    }
+
+    if (!map_file(path, &size))
+        return false;
+
+    if (offset >= size) {
+        rl_printf("Invalid offset %zu: the file has %zu bytes\n", offset,
+                  size);
+        munmap(x.data, size);
+        x.data = NULL;
+        return false;
+    }
+
+    x.size = size;
+    x.svc = svc;
+    x.ch = ch;
+    x.ack_svc = cfg_ack_svc;
+    x.ack_ch = cfg_ack_ch;
+    x.chunk = cfg_chunk;
+    x.window = cfg_window;
+    snprintf(x.path, sizeof(x.path), "%s", path);
+
+    begin(conn, offset);
+    return true;
+}
+
+bool xfer_resume(conn_t *conn) {
+    size_t size;
+
+    if (x.state != XFER_IDLE || x.data != NULL) {
+        rl_printf("A transfer is already running\n");
+        return false;
+    }
+
+    if (x.path[0] == 0 || x.resume >= x.size) {
+        rl_printf("No transfer to resume\n");
+        return false;
+    }
+
+    if (memcmp(&conn->addr, &x.addr, sizeof(x.addr))) {
+        char addr_str[BT_ADDRESS_STR_LEN];
+
+        rl_printf("The transfer was to %s, select that connection\n",
+                  ba2str(x.addr.address, addr_str));
+        return false;
+    }
+
+    if (!map_file(x.path, &size))
+        return false;
+
+    if (size != x.size) {
+        rl_printf("%s changed size, start the transfer again\n", x.path);
+        munmap(x.data, size);
+        x.data = NULL;
+        return false;
+    }
+
+    begin(conn, x.resume);
+    return true;
+}
+
+bool xfer_stop() {
+    uint8_t *data;
+    conn_t *conn;
+
+    pthread_mutex_lock(&lock);
+
+    if (x.state == XFER_IDLE) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+
+    data = end_locked();
+    conn = x.conn;
+
+    pthread_mutex_unlock(&lock);
+
+    rl_printf("Transfer stopped at offset %zu\n", x.resume);
+    cleanup(conn, true, data);
+
+    return true;
+}
+
+void xfer_conn_lost(conn_t *conn) {
+    uint8_t *data;
+
+    pthread_mutex_lock(&lock);
+
+    if (x.state == XFER_IDLE || x.conn != conn) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    data = end_locked();
+
+    pthread_mutex_unlock(&lock);
+
+    rl_printf("Transfer stopped at offset %zu: disconnected\n", x.resume);
+    cleanup(conn, false, data);
+}
+
+void xfer_print_status() {
+    char addr_str[BT_ADDRESS_STR_LEN];
+    uint64_t ms;
+
+    pthread_mutex_lock(&lock);
+
+    rl_printf("Chunk: %u bytes, window: %u, ack: ", cfg_chunk, cfg_window);
+    if (cfg_ack_svc >= 0)
+        rl_printf("service %d characteristic %d\n", cfg_ack_svc, cfg_ack_ch);
+    else
+        rl_printf("off\n");
+
+    if (x.path[0] == 0) {
+        rl_printf("No transfer\n");
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    if (x.state == XFER_IDLE && x.resume == x.size) {
+        rl_printf("Transfer of %s to %s completed\n", x.path,
+                  ba2str(x.addr.address, addr_str));
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    if (x.state == XFER_IDLE) {
+        rl_printf("Transfer of %s to %s stopped at offset %zu of %zu\n",
+                  x.path, ba2str(x.addr.address, addr_str), x.resume, x.size);
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    ms = (monotonic_us() - x.start_us) / 1000;
+    rl_printf("Sending %s to %s%s\n", x.path,
+              ba2str(x.addr.address, addr_str),
+              x.state == XFER_SETUP ? ", enabling acknowledgements" : "");
+    rl_printf("  written: %zu acked: %zu of %zu bytes, %u writes queued, "
+              "%.1f kB/s\n", x.written, x.acked, x.size, x.in_flight,
+              ms > 0 ? (confirmed() - x.start_offset) / (double) ms : 0.0);
+
+    pthread_mutex_unlock(&lock);
+}
+
+bool xfer_notify(conn_t *conn, const btgatt_notify_params_t *p) {
+    btgatt_srvc_id_t srvc;
+    btgatt_char_id_t ch;
+    uint8_t *data = NULL;
+    size_t off;
+    bool done;
+
+    pthread_mutex_lock(&lock);
+
+    if (x.state == XFER_IDLE || x.ack_svc < 0 || conn != x.conn) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+
+    gatt_db_svc_id(&conn->db, x.ack_svc, &srvc);
+    gatt_db_char_id(&conn->db, x.ack_svc, x.ack_ch, &ch);
+    if (memcmp(&srvc.id.uuid, &p->srvc_id.id.uuid, sizeof(bt_uuid_t)) ||
+        memcmp(&ch.uuid, &p->char_id.uuid, sizeof(bt_uuid_t)) ||
+        ch.inst_id != p->char_id.inst_id) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+
+    if (p->len >= 4)
+        off = p->value[0] | p->value[1] << 8 | p->value[2] << 16 |
+              (uint32_t) p->value[3] << 24;
+    else
+        off = x.written;
+
+    /* the device can't have more than what was queued */
+    if (off > x.next)
+        off = x.next;
+    if (off > x.acked)
+        x.acked = off;
+
+    report_progress();
+    done = check_complete(&data);
+
+    pthread_mutex_unlock(&lock);
+
+    if (done)
+        cleanup(conn, true, data);
+    else
+        fill();
+
+    return true;
+}
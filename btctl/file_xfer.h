@@ -0,0 +1,54 @@
+#ifndef __FILE_XFER_H__
+#define __FILE_XFER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <hardware/bluetooth.h>
+#include <hardware/bt_gatt.h>
+
+#include "conn.h"
+
+/* Default ATT MTU (23) minus the header of a Write Command */
+#define XFER_CHUNK_DEFAULT 20
+#define XFER_WINDOW_DEFAULT 8
+/* Leaves room in the connection queue for other commands */
+#define XFER_WINDOW_MAX (CONN_QUEUE_SIZE / 2)
+
+/* File transfers to a characteristic with Write Commands (write without
+ * response). The file is memory-mapped and written in chunks straight from
+ * the mapping. Up to window chunks are queued on the connection, so the next
+ * write starts as soon as the stack completes the previous one.
+ *
+ * With an ack characteristic, the device acknowledges what it received with
+ * notifications carrying the file offset as a little-endian 32-bit value
+ * (shorter notifications acknowledge everything written). At most window
+ * chunks are then sent beyond the last acknowledged offset, and transfers
+ * resume from it. Without ack, they resume after the last completed write. */
+
+/* Settings for the next transfer, only while none is running. They print
+ * the reason and return false on failure. */
+bool xfer_set_chunk(unsigned int bytes);
+bool xfer_set_window(unsigned int chunks);
+/* Notifications of characteristic ch of service svc acknowledge data.
+ * svc < 0 disables acknowledgements. */
+bool xfer_set_ack(int svc, int ch);
+
+/* Starts sending a file to characteristic ch of service svc, from offset.
+ * Prints the reason and returns false on failure. */
+bool xfer_start(conn_t *conn, int svc, int ch, const char *path,
+                size_t offset);
+/* Restarts the last transfer where it stopped, on conn */
+bool xfer_resume(conn_t *conn);
+/* Returns false if no transfer is running */
+bool xfer_stop();
+
+void xfer_print_status();
+
+/* Stops the transfer if it is running on conn, which is going away */
+void xfer_conn_lost(conn_t *conn);
+
+/* Handles a notification. Returns true if it was an acknowledgement of the
+ * running transfer, which shouldn't be printed. */
+bool xfer_notify(conn_t *conn, const btgatt_notify_params_t *p);
+
+#endif /* __FILE_XFER_H__ */
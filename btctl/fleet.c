@@ -0,0 +1,832 @@
+/*
+ * Round-robin polling of a fleet of devices
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "fleet.h"
+#include "gatt_db.h"
+#include "rl_helper.h"
+#include "timeout.h"
+#include "util.h"
+#include "trace.h"
+
+#define RESULT_LEN 256
+/* Time given to the stack to confirm a cancelled connection */
+#define CANCEL_TIMEOUT 1000
+/* The state machine also runs this often while polling. It retries what a
+ * full timeout table lost and paces cycles that couldn't poll any device. */
+#define TICK_MS 1000
+/* Wait before looking for a free connection again */
+#define CONN_RETRY_MS 100
+
+typedef enum {
+    SLOT_IDLE,
+    SLOT_CONNECTING,
+    SLOT_SEARCHING,
+    SLOT_LISTING,
+    SLOT_READING,
+    SLOT_DISCONNECTING,
+} slot_state_t;
+
+typedef struct fleet_dev {
+    bt_bdaddr_t addr;
+    /* db is the database found on a previous poll, and svc/ch the position
+     * of each characteristic in it (svc is -1 if the device doesn't have
+     * it). It is moved to the connection while the device is polled. */
+    bool cached;
+    gatt_db_t db;
+    int16_t svc[FLEET_CHARS_MAX];
+    uint16_t ch[FLEET_CHARS_MAX];
+
+    uint32_t polls;
+    uint32_t failures;
+    uint32_t last_ms;
+    uint64_t total_ms; /* of successful polls */
+} fleet_dev_t;
+
+/* A connection slot, polling one device */
+typedef struct slot {
+    slot_state_t state; /* only changed by the main loop */
+    int dev;
+    conn_t *conn;
+    uint64_t start_us;
+    int deadline; /* timeout ID, 0 if it couldn't be armed */
+    uint64_t deadline_us; /* checked by the tick, 0 if not armed */
+    const char *error; /* why the poll failed, NULL if it didn't */
+
+    /* events, set from the stack callback thread */
+    bool connected;
+    bool disconnected;
+    bool expired;
+    int pending; /* queued operations not completed yet */
+    int status; /* first failed operation, 0 if none */
+    int result_len;
+    char result[RESULT_LEN];
+} slot_t;
+
+/* The state machine runs on the main loop. Stack callbacks only record
+ * events in the slots, under the lock, and schedule a run. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static bool run_pending = false;
+
+static const btgatt_client_interface_t *gatt_client = NULL;
+static int gatt_client_if = 0;
+
+static fleet_dev_t devs[FLEET_DEVS_MAX];
+static int devs_count = 0;
+static gatt_uuid_t chars[FLEET_CHARS_MAX];
+static int chars_count = 0;
+static int slots_count = 1;
+static unsigned int timeout_ms = FLEET_TIMEOUT_DEFAULT;
+static slot_t slots[CONN_MAX];
+
+static bool running = false;
+static bool stopping = false;
+static int tick_timeout = 0;
+static int retry_timeout = 0; /* only one retry is armed at a time */
+static bool cycle_polled; /* a connection was started in the cycle */
+static int next_dev; /* next device to poll in the current cycle */
+static uint32_t cycles;
+static uint64_t start_us, cycle_start_us;
+static int cycle_ok, cycle_failed;
+static uint64_t total_ok, total_failed;
+
+static bool run(void *user_data);
+static bool retry_run(void *user_data);
+
+/* Schedules a run of the state machine. Must be called with the lock held.
+ * If the timeout table is full the tick runs it instead. */
+static void schedule_run() {
+
+    if (!run_pending && timeout_add(0, run, NULL) > 0)
+        run_pending = true;
+}
+
+static void uuid_short(gatt_uuid_t ref, char *str, size_t len) {
+    bt_uuid_t uuid;
+
+    if (gatt_uuid_is16(ref)) {
+        snprintf(str, len, "%04x", ref);
+        return;
+    }
+
+    gatt_uuid_get(ref, &uuid);
+    uuid2str(&uuid, str);
+}
+
+/* Appends to the result line of a slot. Must be called with the lock held. */
+static void append(slot_t *s, const char *fmt, ...) {
+    va_list ap;
+    int n;
+
+    if (s->result_len >= RESULT_LEN - 1)
+        return;
+
+    va_start(ap, fmt);
+    n = vsnprintf(s->result + s->result_len, RESULT_LEN - s->result_len, fmt,
+                  ap);
+    va_end(ap);
+
+    if (n > 0)
+        s->result_len += n;
+    if (s->result_len > RESULT_LEN - 1)
+        s->result_len = RESULT_LEN - 1;
+}
+
+void fleet_set_client(const btgatt_client_interface_t *client, int client_if) {
+
+    gatt_client = client;
+    gatt_client_if = client_if;
+}
+
+bool fleet_add_dev(const bt_bdaddr_t *addr) {
+    int i;
+
+    if (running || devs_count == FLEET_DEVS_MAX)
+        return false;
+
+    for (i = 0; i < devs_count; i++)
+        if (!memcmp(&devs[i].addr, addr, sizeof(*addr)))
+            return false;
+
+    memset(&devs[devs_count], 0, sizeof(fleet_dev_t));
+    memcpy(&devs[devs_count].addr, addr, sizeof(*addr));
+    devs_count++;
+
+    return true;
+}
+
+bool fleet_add_char(const bt_uuid_t *uuid) {
+    gatt_uuid_t ref = gatt_uuid_ref(uuid);
+    int i;
+
+    if (running || chars_count == FLEET_CHARS_MAX || ref == GATT_UUID_INVALID)
+        return false;
+
+    for (i = 0; i < chars_count; i++)
+        if (chars[i] == ref)
+            return false;
+
+    chars[chars_count++] = ref;
+
+    /* the resolved positions don't include the new one */
+    for (i = 0; i < devs_count; i++)
+        devs[i].cached = false;
+
+    return true;
+}
+
+bool fleet_set_slots(int n) {
+
+    if (running || n < 1 || n > CONN_MAX)
+        return false;
+
+    slots_count = n;
+    return true;
+}
+
+bool fleet_set_timeout(unsigned int ms) {
+
+    if (running || ms == 0)
+        return false;
+
+    timeout_ms = ms;
+    return true;
+}
+
+bool fleet_clear() {
+    int i;
+
+    if (running)
+        return false;
+
+    for (i = 0; i < devs_count; i++)
+        gatt_db_free(&devs[i].db);
+
+    devs_count = 0;
+    chars_count = 0;
+    return true;
+}
+
+static slot_t *find_slot(conn_t *conn) {
+    int i;
+
+    for (i = 0; i < CONN_MAX; i++)
+        if (slots[i].state != SLOT_IDLE && slots[i].conn == conn)
+            return &slots[i];
+
+    return NULL;
+}
+
+bool fleet_owns(conn_t *conn) {
+    bool ret;
+
+    pthread_mutex_lock(&lock);
+    ret = find_slot(conn) != NULL;
+    pthread_mutex_unlock(&lock);
+
+    return ret;
+}
+
+bool fleet_connected(conn_t *conn, int conn_id, int status) {
+    slot_t *s;
+
+    if (!fleet_owns(conn))
+        return false;
+
+    /* the state machine needs the conn_id, set it first */
+    if (status == 0)
+        conn_connected(conn, conn_id);
+
+    pthread_mutex_lock(&lock);
+
+    s = find_slot(conn);
+    if (s != NULL) {
+        if (status == 0)
+            s->connected = true;
+        else {
+            s->disconnected = true;
+            s->status = status;
+        }
+        schedule_run();
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return true;
+}
+
+bool fleet_disconnected(conn_t *conn) {
+    slot_t *s;
+
+    pthread_mutex_lock(&lock);
+
+    s = find_slot(conn);
+    if (s != NULL) {
+        s->disconnected = true;
+        schedule_run();
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return s != NULL;
+}
+
+static bool expire(void *user_data) {
+    slot_t *s = user_data;
+
+    pthread_mutex_lock(&lock);
+    s->deadline = 0;
+    s->deadline_us = 0;
+    s->expired = true;
+    schedule_run();
+    pthread_mutex_unlock(&lock);
+
+    return false;
+}
+
+/* Without a timeout the tick expires the slot, later but not never */
+static void arm_deadline(slot_t *s, unsigned int ms) {
+
+    timeout_remove(s->deadline);
+
+    pthread_mutex_lock(&lock);
+    s->deadline_us = monotonic_us() + (uint64_t) ms * 1000;
+    pthread_mutex_unlock(&lock);
+
+    s->deadline = timeout_add(ms, expire, s);
+}
+
+/* Done callback of every operation queued by the engine */
+static void op_done(conn_t *conn, const gatt_op_t *op, int status,
+                    const void *result) {
+    const btgatt_read_params_t *p = result;
+    slot_t *s = op->user_data;
+    char uuid_str[UUID128_STR_LEN];
+    int i;
+
+    pthread_mutex_lock(&lock);
+
+    if (status != 0 && s->status == 0)
+        s->status = status;
+
+    if (op->type == GATT_OP_READ_CHAR) {
+        uuid_short(chars[op->desc], uuid_str, sizeof(uuid_str));
+        append(s, " %s=", uuid_str);
+
+        if (status != 0 || p == NULL)
+            append(s, "error(%d)", status);
+        else
+            for (i = 0; i < p->value.len; i++)
+                append(s, "%02x", p->value.value[i]);
+    }
+
+    if (--s->pending == 0)
+        schedule_run();
+
+    pthread_mutex_unlock(&lock);
+}
+
+/* Queues an operation of the engine on the connection of a slot */
+static void queue(slot_t *s, gatt_op_type_t type, int svc, int ch, int idx) {
+    gatt_op_t op;
+
+    memset(&op, 0, sizeof(op));
+    op.type = type;
+    op.svc = svc;
+    op.ch = ch;
+    op.desc = idx; /* reads: index in chars[], to name the result */
+    op.quiet = true;
+    op.done = op_done;
+    op.user_data = s;
+
+    pthread_mutex_lock(&lock);
+    s->pending++;
+    pthread_mutex_unlock(&lock);
+
+    if (conn_enqueue(s->conn, &op) < 0) {
+        pthread_mutex_lock(&lock);
+        s->pending--;
+        if (s->status == 0)
+            s->status = -BT_STATUS_NOMEM;
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+/* Finds the configured characteristics in the database of a device */
+static void resolve(fleet_dev_t *dev, const gatt_db_t *db) {
+    int i, svc, ch;
+
+    for (i = 0; i < chars_count; i++) {
+        dev->svc[i] = -1;
+
+        for (svc = 0; svc < db->svc_count && dev->svc[i] < 0; svc++)
+            for (ch = 0; ch < gatt_db_char_count(db, svc); ch++)
+                if (db->char_uuid[db->svc_char_first[svc] + ch] == chars[i]) {
+                    dev->svc[i] = svc;
+                    dev->ch[i] = ch;
+                    break;
+                }
+    }
+
+    dev->cached = true;
+}
+
+static void start_reads(slot_t *s) {
+    fleet_dev_t *dev = &devs[s->dev];
+    char uuid_str[UUID128_STR_LEN];
+    int i;
+
+    s->state = SLOT_READING;
+
+    for (i = 0; i < chars_count; i++) {
+        if (dev->svc[i] >= 0) {
+            queue(s, GATT_OP_READ_CHAR, dev->svc[i], dev->ch[i], i);
+            continue;
+        }
+
+        uuid_short(chars[i], uuid_str, sizeof(uuid_str));
+        pthread_mutex_lock(&lock);
+        append(s, " %s=not found", uuid_str);
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+/* Starts polling the next device of the cycle on a free slot */
+static void start_slot(slot_t *s) {
+    fleet_dev_t *dev = &devs[next_dev];
+    char addr_str[BT_ADDRESS_STR_LEN];
+    bt_status_t status;
+
+    if (conn_find_addr(&dev->addr) != NULL) {
+        rl_printf("%s skipped: already connected\n",
+                  ba2str(dev->addr.address, addr_str));
+        dev->polls++;
+        dev->failures++;
+        cycle_failed++;
+        total_failed++;
+        next_dev++;
+        return;
+    }
+
+    s->conn = conn_new(&dev->addr);
+    if (s->conn == NULL)
+        return; /* all connections in use, try again later */
+
+    /* the database found on the previous poll, or memory to reuse */
+    memcpy(&s->conn->db, &dev->db, sizeof(gatt_db_t));
+    memset(&dev->db, 0, sizeof(gatt_db_t));
+
+    pthread_mutex_lock(&lock);
+    s->dev = next_dev++;
+    s->connected = s->disconnected = s->expired = false;
+    s->pending = 0;
+    s->status = 0;
+    s->result_len = 0;
+    s->result[0] = 0;
+    s->error = NULL;
+    s->state = SLOT_CONNECTING;
+    pthread_mutex_unlock(&lock);
+
+    s->start_us = monotonic_us();
+    arm_deadline(s, timeout_ms);
+    cycle_polled = true;
+
+    status = HAL_CALL(gatt_client, connect, gatt_client_if, &dev->addr, true);
+    if (status != BT_STATUS_SUCCESS) {
+        pthread_mutex_lock(&lock);
+        s->disconnected = true;
+        s->status = -status;
+        schedule_run();
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+/* Completes the poll of a slot, successful unless an error was recorded */
+static void finish_slot(slot_t *s) {
+    fleet_dev_t *dev = &devs[s->dev];
+    char addr_str[BT_ADDRESS_STR_LEN];
+    uint32_t ms = (monotonic_us() - s->start_us) / 1000;
+
+    timeout_remove(s->deadline);
+    s->deadline = 0;
+    s->deadline_us = 0;
+
+    /* keep the database for the next poll */
+    if (dev->cached) {
+        memcpy(&dev->db, &s->conn->db, sizeof(gatt_db_t));
+        memset(&s->conn->db, 0, sizeof(gatt_db_t));
+    }
+
+    /* fails the operations still queued, so nothing refers to the slot */
+    conn_free(s->conn, -BT_STATUS_FAIL);
+
+    dev->polls++;
+    dev->last_ms = ms;
+
+    if (s->error == NULL) {
+        dev->total_ms += ms;
+        cycle_ok++;
+        total_ok++;
+        rl_printf("%s ok %u ms:%s\n", ba2str(dev->addr.address, addr_str), ms,
+                  s->result);
+    } else {
+        dev->failures++;
+        cycle_failed++;
+        total_failed++;
+        if (s->status != 0)
+            rl_printf("%s failed after %u ms: %s, status: %d\n",
+                      ba2str(dev->addr.address, addr_str), ms, s->error,
+                      s->status);
+        else
+            rl_printf("%s failed after %u ms: %s\n",
+                      ba2str(dev->addr.address, addr_str), ms, s->error);
+    }
+
+    pthread_mutex_lock(&lock);
+    s->state = SLOT_IDLE;
+    s->conn = NULL;
+    pthread_mutex_unlock(&lock);
+}
+
+/* Disconnects the device of a slot, failing the poll with error if set */
+static void stop_slot(slot_t *s, const char *error) {
+    bt_status_t status;
+
+    if (s->error == NULL)
+        s->error = error;
+
+    /* with conn_id 0 the stack cancels a pending connection. It may still
+     * complete, so wait for the stack either way. */
+    status = HAL_CALL(gatt_client, disconnect, gatt_client_if, &s->conn->addr,
+                      s->conn->conn_id);
+    if (status != BT_STATUS_SUCCESS) {
+        finish_slot(s);
+        return;
+    }
+
+    s->state = SLOT_DISCONNECTING;
+    arm_deadline(s, s->conn->conn_id > 0 ? timeout_ms : CANCEL_TIMEOUT);
+}
+
+/* Advances the state machine of a slot after an event */
+static void step_slot(slot_t *s) {
+    fleet_dev_t *dev = &devs[s->dev];
+    bool connected, disconnected, expired;
+    int pending, status, i;
+
+    pthread_mutex_lock(&lock);
+    connected = s->connected;
+    disconnected = s->disconnected;
+    expired = s->expired;
+    pending = s->pending;
+    status = s->status;
+    s->connected = s->expired = false;
+    pthread_mutex_unlock(&lock);
+
+    if (disconnected) {
+        if (s->state == SLOT_CONNECTING)
+            s->error = "unable to connect";
+        else if (s->state != SLOT_DISCONNECTING)
+            s->error = "connection lost";
+        finish_slot(s);
+        return;
+    }
+
+    if (expired) {
+        /* no answer to the disconnection either, give up on it */
+        if (s->state == SLOT_DISCONNECTING)
+            finish_slot(s);
+        else
+            stop_slot(s, "timeout");
+        return;
+    }
+
+    if (s->state == SLOT_DISCONNECTING) {
+        /* a cancelled connection completed anyway */
+        if (connected)
+            HAL_CALL(gatt_client, disconnect, gatt_client_if, &s->conn->addr,
+                     s->conn->conn_id);
+        return;
+    }
+
+    if (stopping) {
+        stop_slot(s, "stopped");
+        return;
+    }
+
+    switch (s->state) {
+        case SLOT_CONNECTING:
+            if (!connected)
+                break;
+
+            if (dev->cached)
+                start_reads(s);
+            else {
+                s->state = SLOT_SEARCHING;
+                queue(s, GATT_OP_SEARCH, 0, 0, 0);
+            }
+            break;
+
+        case SLOT_SEARCHING:
+            if (pending > 0)
+                break;
+
+            if (status != 0 || s->conn->db.svc_count == 0) {
+                stop_slot(s, "service discovery failed");
+                break;
+            }
+
+            s->state = SLOT_LISTING;
+            for (i = 0; i < s->conn->db.svc_count; i++)
+                queue(s, GATT_OP_CHARS, i, 0, 0);
+            break;
+
+        case SLOT_LISTING:
+            if (pending > 0)
+                break;
+
+            if (status != 0) {
+                stop_slot(s, "characteristic discovery failed");
+                break;
+            }
+
+            resolve(dev, &s->conn->db);
+            start_reads(s);
+            break;
+
+        case SLOT_READING:
+            if (pending > 0)
+                break;
+
+            /* the device may have changed, discover it again next time */
+            if (status != 0)
+                dev->cached = false;
+
+            stop_slot(s, status != 0 ? "read failed" : NULL);
+            break;
+
+        default:
+            break;
+    }
+
+    /* reads may have completed right away, eg. no characteristic found */
+    if (s->state == SLOT_READING) {
+        pthread_mutex_lock(&lock);
+        pending = s->pending;
+        status = s->status;
+        pthread_mutex_unlock(&lock);
+
+        if (pending == 0) {
+            if (status != 0)
+                dev->cached = false;
+            stop_slot(s, status != 0 ? "read failed" : NULL);
+        }
+    }
+}
+
+static void end_cycle() {
+    uint64_t now = monotonic_us();
+    uint64_t ms = (now - cycle_start_us) / 1000;
+
+    cycles++;
+    rl_printf("Cycle %u: %d of %d devices polled in %llu ms, %.1f "
+              "devices/min\n", cycles, cycle_ok, cycle_ok + cycle_failed,
+              (unsigned long long) ms,
+              ms > 0 ? cycle_ok * 60000.0 / ms : 0.0);
+
+    cycle_start_us = now;
+    cycle_ok = cycle_failed = 0;
+    next_dev = 0;
+}
+
+static bool run(void *user_data) {
+    bool busy = false;
+    int i;
+
+    pthread_mutex_lock(&lock);
+    run_pending = false;
+    pthread_mutex_unlock(&lock);
+
+    if (!running)
+        return false;
+
+    for (i = 0; i < slots_count; i++)
+        if (slots[i].state != SLOT_IDLE)
+            step_slot(&slots[i]);
+
+    for (i = 0; i < slots_count; i++) {
+        if (!stopping && slots[i].state == SLOT_IDLE && next_dev < devs_count)
+            start_slot(&slots[i]);
+        if (slots[i].state != SLOT_IDLE)
+            busy = true;
+    }
+
+    if (busy)
+        return false;
+
+    if (stopping) {
+        running = stopping = false;
+        timeout_remove(tick_timeout);
+        timeout_remove(retry_timeout);
+        tick_timeout = retry_timeout = 0;
+        rl_printf("Polling stopped\n");
+        return false;
+    }
+
+    /* a free connection couldn't be found, wait for one (or the tick) */
+    if (next_dev < devs_count) {
+        if (retry_timeout == 0)
+            retry_timeout = timeout_add(CONN_RETRY_MS, retry_run, NULL);
+        return false;
+    }
+
+    end_cycle();
+
+    /* every device was skipped, leave the next cycle to the tick instead
+     * of spinning */
+    if (!cycle_polled)
+        return false;
+    cycle_polled = false;
+
+    pthread_mutex_lock(&lock);
+    schedule_run();
+    pthread_mutex_unlock(&lock);
+
+    return false;
+}
+
+static bool retry_run(void *user_data) {
+
+    retry_timeout = 0;
+    run(NULL);
+
+    return false;
+}
+
+/* Expires the slots whose deadline couldn't be armed, then runs the state
+ * machine in case a scheduled run couldn't be either */
+static bool tick(void *user_data) {
+    uint64_t now = monotonic_us();
+    int i;
+
+    pthread_mutex_lock(&lock);
+    for (i = 0; i < slots_count; i++)
+        if (slots[i].state != SLOT_IDLE && slots[i].deadline == 0 &&
+            slots[i].deadline_us != 0 && now >= slots[i].deadline_us) {
+            slots[i].deadline_us = 0;
+            slots[i].expired = true;
+        }
+    pthread_mutex_unlock(&lock);
+
+    run(NULL);
+
+    return running;
+}
+
+bool fleet_start() {
+
+    if (running || gatt_client == NULL)
+        return false;
+
+    if (devs_count == 0 || chars_count == 0) {
+        rl_printf("Add devices and characteristics first\n");
+        return false;
+    }
+
+    tick_timeout = timeout_add(TICK_MS, tick, NULL);
+    if (tick_timeout == 0) {
+        rl_printf("Unable to poll: No timeout available\n");
+        return false;
+    }
+
+    running = true;
+    cycle_polled = false;
+    stopping = false;
+    next_dev = 0;
+    cycles = 0;
+    cycle_ok = cycle_failed = 0;
+    total_ok = total_failed = 0;
+    start_us = cycle_start_us = monotonic_us();
+
+    pthread_mutex_lock(&lock);
+    schedule_run();
+    pthread_mutex_unlock(&lock);
+
+    return true;
+}
+
+bool fleet_stop() {
+
+    if (!running || stopping)
+        return false;
+
+    stopping = true;
+
+    pthread_mutex_lock(&lock);
+    schedule_run();
+    pthread_mutex_unlock(&lock);
+
+    return true;
+}
+
+bool fleet_running() {
+
+    return running;
+}
+
+void fleet_print_status() {
+    char addr_str[BT_ADDRESS_STR_LEN];
+    char uuid_str[UUID128_STR_LEN];
+    uint64_t ms;
+    int i;
+
+    rl_printf("Polling %s, %d slot%s, timeout %u ms\n",
+              running ? (stopping ? "stopping" : "running") : "stopped",
+              slots_count, slots_count == 1 ? "" : "s", timeout_ms);
+
+    rl_printf("Characteristics:");
+    for (i = 0; i < chars_count; i++) {
+        uuid_short(chars[i], uuid_str, sizeof(uuid_str));
+        rl_printf(" %s", uuid_str);
+    }
+    rl_printf("\n");
+
+    if (running) {
+        ms = (monotonic_us() - start_us) / 1000;
+        rl_printf("Cycles: %u, polls: %llu ok, %llu failed, %.1f "
+                  "devices/min\n", cycles, (unsigned long long) total_ok,
+                  (unsigned long long) total_failed,
+                  ms > 0 ? total_ok * 60000.0 / ms : 0.0);
+    }
+
+    for (i = 0; i < devs_count; i++) {
+        fleet_dev_t *dev = &devs[i];
+        uint32_t ok = dev->polls - dev->failures;
+
+        rl_printf("%s polls: %u failures: %u last: %u ms avg: %u ms%s\n",
+                  ba2str(dev->addr.address, addr_str), dev->polls,
+                  dev->failures, dev->last_ms,
+                  ok > 0 ? (uint32_t) (dev->total_ms / ok) : 0,
+                  dev->cached ? " (cached)" : "");
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef __FLEET_H__
+#define __FLEET_H__
+
+#include <stdbool.h>
+#include <hardware/bluetooth.h>
+#include <hardware/bt_gatt.h>
+
+#include "conn.h"
+
+/* Maximum number of devices polled in turn */
+#define FLEET_DEVS_MAX 256
+/* Maximum number of characteristics read from each device */
+#define FLEET_CHARS_MAX 8
+/* Default limit for a whole connect, read and disconnect sequence */
+#define FLEET_TIMEOUT_DEFAULT 10000
+
+/* Fleet polling: devices are connected in turn, using up to a number of
+ * connection slots at the same time. The configured characteristics are read
+ * by UUID and the device is disconnected. The services and characteristics
+ * found on the first poll of a device are kept, so later polls only read.
+ * Every pass over the device list is a cycle, and cycles repeat until
+ * stopped. Results are printed from the main loop. */
+
+void fleet_set_client(const btgatt_client_interface_t *client, int client_if);
+
+/* Configuration, only while stopped. Return false if full, a duplicate or
+ * running. */
+bool fleet_add_dev(const bt_bdaddr_t *addr);
+bool fleet_add_char(const bt_uuid_t *uuid);
+bool fleet_set_slots(int slots);
+bool fleet_set_timeout(unsigned int ms);
+bool fleet_clear();
+
+/* Starts polling. Prints why and returns false if it can't. */
+bool fleet_start();
+/* Aborts the devices being polled. Returns false if not running. */
+bool fleet_stop();
+bool fleet_running();
+
+/* Prints configuration, totals and per-device statistics */
+void fleet_print_status();
+
+/* Stack events of connections started by the engine. They return false for
+ * connections the engine doesn't own, which are left to the caller. */
+bool fleet_owns(conn_t *conn);
+bool fleet_connected(conn_t *conn, int conn_id, int status);
+bool fleet_disconnected(conn_t *conn);
+
+#endif /* __FLEET_H__ */
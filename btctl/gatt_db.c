@@ -0,0 +1,472 @@
+/*
+ * Compact GATT database of remote devices
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gatt_db.h"
+#include "mem.h"
+
+/* Bluetooth base UUID (00000000-0000-1000-8000-00805f9b34fb) without the
+ * 32-bit value, in the byte order used by bt_uuid_t */
+static const uint8_t base_uuid[12] = {
+    0xfb, 0x34, 0x9b, 0x5f, 0x80, 0x00, 0x00, 0x80, 0x00, 0x10, 0x00, 0x00
+};
+
+/* Interned 128-bit UUIDs. They are added from the stack callback thread and
+ * expanded from the main thread, so the table is protected by a lock. The
+ * hash table holds index + 1 of each entry, 0 means empty. */
+static pthread_mutex_t uuid_lock = PTHREAD_MUTEX_INITIALIZER;
+static bt_uuid_t *uuids = NULL;
+static uint32_t uuids_count = 0;
+static uint32_t uuids_cap = 0;
+static uint32_t *uuids_hash = NULL;
+
+static uint32_t uuid_hash(const bt_uuid_t *uuid) {
+    uint32_t h = 2166136261u; /* FNV-1a */
+    int i;
+
+    for (i = 0; i < 16; i++)
+        h = (h ^ uuid->uu[i]) * 16777619u;
+
+    return h;
+}
+
+/* Returns the inline reference of a base UUID, or GATT_UUID_INVALID */
+static gatt_uuid_t uuid_inline(const bt_uuid_t *uuid) {
+    gatt_uuid_t v;
+
+    if (memcmp(uuid->uu, base_uuid, sizeof(base_uuid)) != 0)
+        return GATT_UUID_INVALID;
+
+    v = uuid->uu[12] | uuid->uu[13] << 8 | uuid->uu[14] << 16 |
+        (uint32_t) uuid->uu[15] << 24;
+
+    /* the top bit is reserved for interned references */
+    return v & GATT_UUID_INTERNED ? GATT_UUID_INVALID : v;
+}
+
+/* Looks for an interned UUID. If it isn't found *slot is set to the hash
+ * table position where it should be inserted. */
+static gatt_uuid_t uuid_lookup(const bt_uuid_t *uuid, uint32_t *slot) {
+    uint32_t mask = uuids_cap * 2 - 1;
+    uint32_t i;
+
+    if (uuids_cap == 0)
+        return GATT_UUID_INVALID;
+
+    for (i = uuid_hash(uuid) & mask; uuids_hash[i] != 0; i = (i + 1) & mask)
+        if (!memcmp(&uuids[uuids_hash[i] - 1], uuid, sizeof(*uuid)))
+            return (uuids_hash[i] - 1) | GATT_UUID_INTERNED;
+
+    *slot = i;
+    return GATT_UUID_INVALID;
+}
+
+/* Doubles the intern table, the hash table is kept half empty */
+static bool uuid_grow() {
+    uint32_t cap = uuids_cap ? uuids_cap * 2 : 16;
+    uint32_t *hash;
+    bt_uuid_t *tmp;
+    uint32_t i, j;
+
+    if (cap >= GATT_UUID_INTERNED / 2)
+        return false;
+
+    tmp = mem_realloc(MEM_GATT_DB, uuids, cap * sizeof(uuids[0]));
+    if (tmp == NULL)
+        return false;
+    uuids = tmp;
+
+    hash = mem_calloc(MEM_GATT_DB, cap * 2, sizeof(hash[0]));
+    if (hash == NULL)
+        return false;
+
+    for (i = 0; i < uuids_count; i++) {
+        for (j = uuid_hash(&uuids[i]) & (cap * 2 - 1); hash[j] != 0;
+             j = (j + 1) & (cap * 2 - 1))
+            ;
+        hash[j] = i + 1;
+    }
+
+    mem_free(uuids_hash);
+    uuids_hash = hash;
+    uuids_cap = cap;
+
+    return true;
+}
+
+gatt_uuid_t gatt_uuid_ref(const bt_uuid_t *uuid) {
+    gatt_uuid_t ref = uuid_inline(uuid);
+    uint32_t slot;
+
+    if (ref != GATT_UUID_INVALID)
+        return ref;
+
+    pthread_mutex_lock(&uuid_lock);
+
+    ref = uuid_lookup(uuid, &slot);
+    if (ref == GATT_UUID_INVALID) {
+        if (uuids_count == uuids_cap) {
+            if (!uuid_grow())
+                goto done;
+            uuid_lookup(uuid, &slot);
+        }
+
+        memcpy(&uuids[uuids_count], uuid, sizeof(*uuid));
+        uuids_hash[slot] = uuids_count + 1;
+        ref = uuids_count | GATT_UUID_INTERNED;
+        uuids_count++;
+    }
+
+done:
+    pthread_mutex_unlock(&uuid_lock);
+    return ref;
+}
+
+gatt_uuid_t gatt_uuid_find(const bt_uuid_t *uuid) {
+    gatt_uuid_t ref = uuid_inline(uuid);
+    uint32_t slot;
+
+    if (ref != GATT_UUID_INVALID)
+        return ref;
+
+    pthread_mutex_lock(&uuid_lock);
+    ref = uuid_lookup(uuid, &slot);
+    pthread_mutex_unlock(&uuid_lock);
+
+    return ref;
+}
+
+void gatt_uuid_get(gatt_uuid_t ref, bt_uuid_t *uuid) {
+    uint32_t i = ref & ~GATT_UUID_INTERNED;
+
+    if (!(ref & GATT_UUID_INTERNED)) {
+        memcpy(uuid->uu, base_uuid, sizeof(base_uuid));
+        uuid->uu[12] = ref;
+        uuid->uu[13] = ref >> 8;
+        uuid->uu[14] = ref >> 16;
+        uuid->uu[15] = ref >> 24;
+        return;
+    }
+
+    pthread_mutex_lock(&uuid_lock);
+    if (i < uuids_count)
+        memcpy(uuid, &uuids[i], sizeof(*uuid));
+    else
+        memset(uuid, 0, sizeof(*uuid));
+    pthread_mutex_unlock(&uuid_lock);
+}
+
+static bool resize(void **arr, size_t elem_size, size_t cap) {
+    void *tmp = mem_realloc(MEM_GATT_DB, *arr, elem_size * cap);
+
+    if (tmp == NULL)
+        return false;
+
+    *arr = tmp;
+    return true;
+}
+
+#define RESIZE(arr, cap) resize((void **) &(arr), sizeof(*(arr)), cap)
+
+/* Returns the capacity to grow an array to, 0 if it can't grow */
+static uint16_t next_cap(uint16_t count, uint16_t cap, uint16_t need) {
+    uint32_t new_cap = cap ? cap : 8;
+
+    if ((uint32_t) count + need <= cap)
+        return cap;
+
+    while (new_cap < (uint32_t) count + need)
+        new_cap *= 2;
+
+    if (new_cap > UINT16_MAX)
+        new_cap = UINT16_MAX;
+
+    return new_cap >= (uint32_t) count + need ? new_cap : 0;
+}
+
+static bool reserve_svcs(gatt_db_t *db, uint16_t need) {
+    uint16_t cap = next_cap(db->svc_count, db->svc_cap, need);
+
+    if (cap == db->svc_cap)
+        return true;
+
+    if (cap == 0 || !RESIZE(db->svc_uuid, cap) || !RESIZE(db->svc_inst, cap) ||
+        !RESIZE(db->svc_primary, cap) || !RESIZE(db->svc_char_first, cap) ||
+        !RESIZE(db->svc_char_count, cap))
+        return false;
+
+    db->svc_cap = cap;
+    return true;
+}
+
+static bool reserve_chars(gatt_db_t *db, uint16_t need) {
+    uint16_t cap = next_cap(db->char_count, db->char_cap, need);
+
+    if (cap == db->char_cap)
+        return true;
+
+    if (cap == 0 || !RESIZE(db->char_uuid, cap) ||
+        !RESIZE(db->char_inst, cap) || !RESIZE(db->char_prop, cap) ||
+        !RESIZE(db->char_desc_first, cap) || !RESIZE(db->char_desc_count, cap))
+        return false;
+
+    db->char_cap = cap;
+    return true;
+}
+
+static bool reserve_descs(gatt_db_t *db, uint16_t need) {
+    uint16_t cap = next_cap(db->desc_count, db->desc_cap, need);
+
+    if (cap == db->desc_cap)
+        return true;
+
+    if (cap == 0 || !RESIZE(db->desc_uuid, cap))
+        return false;
+
+    db->desc_cap = cap;
+    return true;
+}
+
+#define MOVE_DOWN(arr, first, n, count) \
+    memmove(&(arr)[first], &(arr)[(first) + (n)], \
+            ((count) - (first) - (n)) * sizeof((arr)[0]))
+
+/* Removes a range of descriptors, fixing the ranges that come after it */
+static void remove_descs(gatt_db_t *db, uint16_t first, uint16_t n) {
+    int i;
+
+    if (n == 0)
+        return;
+
+    MOVE_DOWN(db->desc_uuid, first, n, db->desc_count);
+    db->desc_count -= n;
+
+    for (i = 0; i < db->char_count; i++)
+        if (db->char_desc_first[i] > first)
+            db->char_desc_first[i] -= n;
+}
+
+/* Removes a range of characteristics, fixing the ranges that come after it.
+ * Their descriptors are removed too, unless they were moved elsewhere. */
+static void remove_chars(gatt_db_t *db, uint16_t first, uint16_t n,
+                         bool with_descs) {
+    int i;
+
+    if (n == 0)
+        return;
+
+    for (i = first; with_descs && i < first + n; i++) {
+        remove_descs(db, db->char_desc_first[i], db->char_desc_count[i]);
+        db->char_desc_count[i] = 0;
+    }
+
+    MOVE_DOWN(db->char_uuid, first, n, db->char_count);
+    MOVE_DOWN(db->char_inst, first, n, db->char_count);
+    MOVE_DOWN(db->char_prop, first, n, db->char_count);
+    MOVE_DOWN(db->char_desc_first, first, n, db->char_count);
+    MOVE_DOWN(db->char_desc_count, first, n, db->char_count);
+    db->char_count -= n;
+
+    for (i = 0; i < db->svc_count; i++)
+        if (db->svc_char_first[i] > first)
+            db->svc_char_first[i] -= n;
+}
+
+void gatt_db_clear(gatt_db_t *db) {
+
+    db->svc_count = 0;
+    db->char_count = 0;
+    db->desc_count = 0;
+}
+
+void gatt_db_free(gatt_db_t *db) {
+
+    mem_free(db->svc_uuid);
+    mem_free(db->svc_inst);
+    mem_free(db->svc_primary);
+    mem_free(db->svc_char_first);
+    mem_free(db->svc_char_count);
+    mem_free(db->char_uuid);
+    mem_free(db->char_inst);
+    mem_free(db->char_prop);
+    mem_free(db->char_desc_first);
+    mem_free(db->char_desc_count);
+    mem_free(db->desc_uuid);
+    memset(db, 0, sizeof(*db));
+}
+
+int gatt_db_add_svc(gatt_db_t *db, const btgatt_srvc_id_t *srvc_id) {
+    gatt_uuid_t ref = gatt_uuid_ref(&srvc_id->id.uuid);
+    int svc = db->svc_count;
+
+    if (ref == GATT_UUID_INVALID || !reserve_svcs(db, 1))
+        return -1;
+
+    db->svc_uuid[svc] = ref;
+    db->svc_inst[svc] = srvc_id->id.inst_id;
+    db->svc_primary[svc] = srvc_id->is_primary;
+    db->svc_char_first[svc] = db->char_count;
+    db->svc_char_count[svc] = 0;
+    db->svc_count++;
+
+    return svc;
+}
+
+int gatt_db_find_svc(const gatt_db_t *db, const btgatt_srvc_id_t *srvc_id) {
+    gatt_uuid_t ref = gatt_uuid_find(&srvc_id->id.uuid);
+    int i;
+
+    if (ref == GATT_UUID_INVALID)
+        return -1;
+
+    for (i = 0; i < db->svc_count; i++)
+        if (db->svc_uuid[i] == ref &&
+            db->svc_inst[i] == srvc_id->id.inst_id &&
+            db->svc_primary[i] == srvc_id->is_primary)
+            return i;
+
+    return -1;
+}
+
+void gatt_db_svc_id(const gatt_db_t *db, int svc, btgatt_srvc_id_t *srvc_id) {
+
+    memset(srvc_id, 0, sizeof(*srvc_id));
+    gatt_uuid_get(db->svc_uuid[svc], &srvc_id->id.uuid);
+    srvc_id->id.inst_id = db->svc_inst[svc];
+    srvc_id->is_primary = db->svc_primary[svc];
+}
+
+void gatt_db_reset_chars(gatt_db_t *db, int svc) {
+
+    remove_chars(db, db->svc_char_first[svc], db->svc_char_count[svc], true);
+    db->svc_char_first[svc] = db->char_count;
+    db->svc_char_count[svc] = 0;
+}
+
+int gatt_db_add_char(gatt_db_t *db, int svc, const btgatt_char_id_t *char_id,
+                     int prop) {
+    gatt_uuid_t ref = gatt_uuid_ref(&char_id->uuid);
+    uint16_t first = db->svc_char_first[svc];
+    uint16_t n = db->svc_char_count[svc];
+    int i;
+
+    if (ref == GATT_UUID_INVALID || !reserve_chars(db, n + 1))
+        return -1;
+
+    /* Characteristics of another service were added meanwhile, move the ones
+     * of this service to the end so it stays contiguous. */
+    if (first + n != db->char_count) {
+        uint16_t end = db->char_count;
+
+        for (i = 0; i < n; i++) {
+            db->char_uuid[end + i] = db->char_uuid[first + i];
+            db->char_inst[end + i] = db->char_inst[first + i];
+            db->char_prop[end + i] = db->char_prop[first + i];
+            db->char_desc_first[end + i] = db->char_desc_first[first + i];
+            db->char_desc_count[end + i] = db->char_desc_count[first + i];
+        }
+        db->char_count += n;
+        db->svc_char_first[svc] = end;
+        remove_chars(db, first, n, false);
+        first = db->svc_char_first[svc];
+    }
+
+    i = db->char_count;
+    db->char_uuid[i] = ref;
+    db->char_inst[i] = char_id->inst_id;
+    db->char_prop[i] = prop;
+    db->char_desc_first[i] = db->desc_count;
+    db->char_desc_count[i] = 0;
+    db->char_count++;
+    db->svc_char_count[svc]++;
+
+    return n;
+}
+
+int gatt_db_find_char(const gatt_db_t *db, int svc,
+                      const btgatt_char_id_t *char_id) {
+    gatt_uuid_t ref = gatt_uuid_find(&char_id->uuid);
+    int first = db->svc_char_first[svc];
+    int i;
+
+    if (ref == GATT_UUID_INVALID)
+        return -1;
+
+    for (i = 0; i < db->svc_char_count[svc]; i++)
+        if (db->char_uuid[first + i] == ref &&
+            db->char_inst[first + i] == char_id->inst_id)
+            return i;
+
+    return -1;
+}
+
+void gatt_db_char_id(const gatt_db_t *db, int svc, int ch,
+                     btgatt_char_id_t *char_id) {
+    int i = db->svc_char_first[svc] + ch;
+
+    memset(char_id, 0, sizeof(*char_id));
+    gatt_uuid_get(db->char_uuid[i], &char_id->uuid);
+    char_id->inst_id = db->char_inst[i];
+}
+
+void gatt_db_reset_descs(gatt_db_t *db, int svc, int ch) {
+    int i = db->svc_char_first[svc] + ch;
+
+    remove_descs(db, db->char_desc_first[i], db->char_desc_count[i]);
+    db->char_desc_first[i] = db->desc_count;
+    db->char_desc_count[i] = 0;
+}
+
+int gatt_db_add_desc(gatt_db_t *db, int svc, int ch, const bt_uuid_t *uuid) {
+    gatt_uuid_t ref = gatt_uuid_ref(uuid);
+    int c = db->svc_char_first[svc] + ch;
+    uint16_t first = db->char_desc_first[c];
+    uint16_t n = db->char_desc_count[c];
+    int i;
+
+    if (ref == GATT_UUID_INVALID || n == UINT8_MAX ||
+        !reserve_descs(db, n + 1))
+        return -1;
+
+    /* keep the descriptors of the characteristic contiguous */
+    if (first + n != db->desc_count) {
+        uint16_t end = db->desc_count;
+
+        for (i = 0; i < n; i++)
+            db->desc_uuid[end + i] = db->desc_uuid[first + i];
+        db->desc_count += n;
+        db->char_desc_first[c] = end;
+        remove_descs(db, first, n);
+    }
+
+    db->desc_uuid[db->desc_count++] = ref;
+    db->char_desc_count[c]++;
+
+    return n;
+}
+
+void gatt_db_desc_uuid(const gatt_db_t *db, int svc, int ch, int desc,
+                       bt_uuid_t *uuid) {
+    int c = db->svc_char_first[svc] + ch;
+
+    gatt_uuid_get(db->desc_uuid[db->char_desc_first[c] + desc], uuid);
+}
@@ -0,0 +1,120 @@
+#ifndef __GATT_DB_H__
+#define __GATT_DB_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <hardware/bluetooth.h>
+#include <hardware/bt_gatt.h>
+
+/* Compact reference to a UUID. UUIDs built on top of the Bluetooth base UUID
+ * are stored inline as their 16 or 32-bit value. Any other UUID is interned in
+ * a table shared by all databases and referenced by its index, with
+ * GATT_UUID_INTERNED set. */
+typedef uint32_t gatt_uuid_t;
+
+#define GATT_UUID_INTERNED 0x80000000
+#define GATT_UUID_INVALID  0xffffffff
+
+/* Returns the reference of uuid, interning it if needed. Returns
+ * GATT_UUID_INVALID if the intern table can't grow. */
+gatt_uuid_t gatt_uuid_ref(const bt_uuid_t *uuid);
+/* Same as gatt_uuid_ref(), but never interns. Returns GATT_UUID_INVALID for
+ * an UUID that was never seen. */
+gatt_uuid_t gatt_uuid_find(const bt_uuid_t *uuid);
+/* Expands a reference back to the full 128-bit UUID */
+void gatt_uuid_get(gatt_uuid_t ref, bt_uuid_t *uuid);
+/* True for 16-bit UUIDs on top of the Bluetooth base UUID */
+static inline bool gatt_uuid_is16(gatt_uuid_t ref) {
+    return ref <= 0xffff;
+}
+
+/* Characteristic properties, from the characteristic declaration */
+#define GATT_CHAR_PROP_READ         0x02
+#define GATT_CHAR_PROP_WRITE_NO_RSP 0x04
+#define GATT_CHAR_PROP_WRITE        0x08
+#define GATT_CHAR_PROP_NOTIFY       0x10
+#define GATT_CHAR_PROP_INDICATE     0x20
+
+/* GATT database of a remote device, laid out as parallel arrays.
+ *
+ * Characteristics of a service are contiguous in the char_* arrays, starting
+ * at svc_char_first[svc]. In the same way, descriptors of a characteristic
+ * are contiguous in the desc_* arrays. Commands and callbacks refer to
+ * characteristics by their position inside the service and to descriptors by
+ * their position inside the characteristic.
+ */
+typedef struct gatt_db {
+    /* services */
+    uint16_t svc_count;
+    uint16_t svc_cap;
+    gatt_uuid_t *svc_uuid;
+    uint8_t *svc_inst;
+    uint8_t *svc_primary;
+    uint16_t *svc_char_first;
+    uint16_t *svc_char_count;
+
+    /* characteristics of all services */
+    uint16_t char_count;
+    uint16_t char_cap;
+    gatt_uuid_t *char_uuid;
+    uint8_t *char_inst;
+    uint8_t *char_prop; /* GATT_CHAR_PROP_* */
+    uint16_t *char_desc_first;
+    uint8_t *char_desc_count;
+
+    /* descriptors of all characteristics */
+    uint16_t desc_count;
+    uint16_t desc_cap;
+    gatt_uuid_t *desc_uuid;
+} gatt_db_t;
+
+/* Drops all entries, keeping the memory for the next use */
+void gatt_db_clear(gatt_db_t *db);
+/* Releases the memory used by the database */
+void gatt_db_free(gatt_db_t *db);
+
+/* Appends a service, returns its index or -1 on failure */
+int gatt_db_add_svc(gatt_db_t *db, const btgatt_srvc_id_t *srvc_id);
+/* Returns the index of a service or -1 if it isn't in the database */
+int gatt_db_find_svc(const gatt_db_t *db, const btgatt_srvc_id_t *srvc_id);
+/* Builds the HAL service ID of a service */
+void gatt_db_svc_id(const gatt_db_t *db, int svc, btgatt_srvc_id_t *srvc_id);
+
+/* Forgets the characteristics of a service (and their descriptors) */
+void gatt_db_reset_chars(gatt_db_t *db, int svc);
+/* Appends a characteristic to a service with its properties, returns its index
+ * inside the service or -1 on failure */
+int gatt_db_add_char(gatt_db_t *db, int svc, const btgatt_char_id_t *char_id,
+                     int prop);
+/* Returns the index of a characteristic inside a service, or -1 */
+int gatt_db_find_char(const gatt_db_t *db, int svc,
+                      const btgatt_char_id_t *char_id);
+/* Builds the HAL characteristic ID of a characteristic */
+void gatt_db_char_id(const gatt_db_t *db, int svc, int ch,
+                     btgatt_char_id_t *char_id);
+
+/* Forgets the descriptors of a characteristic */
+void gatt_db_reset_descs(gatt_db_t *db, int svc, int ch);
+/* Appends a descriptor to a characteristic, returns its index inside the
+ * characteristic or -1 on failure */
+int gatt_db_add_desc(gatt_db_t *db, int svc, int ch, const bt_uuid_t *uuid);
+/* Builds the HAL descriptor ID of a descriptor */
+void gatt_db_desc_uuid(const gatt_db_t *db, int svc, int ch, int desc,
+                       bt_uuid_t *uuid);
+
+/* Number of characteristics of a service */
+static inline int gatt_db_char_count(const gatt_db_t *db, int svc) {
+    return db->svc_char_count[svc];
+}
+
+/* Properties of a characteristic, as reported when it was listed */
+static inline int gatt_db_char_prop(const gatt_db_t *db, int svc, int ch) {
+    return db->char_prop[db->svc_char_first[svc] + ch];
+}
+
+/* Number of descriptors of a characteristic */
+static inline int gatt_db_desc_count(const gatt_db_t *db, int svc, int ch) {
+    return db->char_desc_count[db->svc_char_first[svc] + ch];
+}
+
+#endif /* __GATT_DB_H__ */
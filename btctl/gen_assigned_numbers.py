@@ -0,0 +1,194 @@
+#!/usr/bin/env python
+#
+# Generates the assigned numbers lookup tables of btctl
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+#
+# Usage: gen_assigned_numbers.py assigned_numbers.txt > assigned_numbers.c
+#
+# Every section of the input becomes a sorted array of 16-bit keys and a
+# parallel array of offsets into a single string pool, searched by
+# <section>_lookup(). The keys of a table are packed together so a lookup
+# touches a few cache lines, and the pool avoids one pointer (and one
+# relocation) per entry.
+
+from __future__ import print_function
+
+import sys
+
+SECTIONS = ['uuid16', 'company', 'appearance', 'cod_major', 'cod_service']
+
+HEADER = '''\
+/* Generated by gen_assigned_numbers.py from assigned_numbers.txt.
+ * Do not edit, changes will be lost. */
+
+#include <string.h>
+
+#include "assigned_numbers.h"
+
+/* Returns the name of key in a sorted table, or NULL */
+static const char *lookup(const uint16_t *keys, const uint16_t *names,
+                          unsigned int count, const char *pool, uint16_t key) {
+    const uint16_t *base = keys;
+
+    if (count == 0)
+        return NULL;
+
+    while (count > 1) {
+        unsigned int half = count / 2;
+
+        if (base[half] <= key)
+            base += half;
+        count -= half;
+    }
+
+    return *base == key ? pool + names[base - keys] : NULL;
+}
+'''
+
+FOOTER = '''
+const char *uuid16_name(uint16_t uuid) {
+
+    return uuid16_lookup(uuid);
+}
+
+const char *uuid_name(const bt_uuid_t *uuid) {
+    static const uint8_t base_uuid[12] = {
+        0xfb, 0x34, 0x9b, 0x5f, 0x80, 0x00, 0x00, 0x80, 0x00, 0x10, 0x00, 0x00
+    };
+
+    if (memcmp(uuid->uu, base_uuid, sizeof(base_uuid)) != 0 ||
+        uuid->uu[14] != 0 || uuid->uu[15] != 0)
+        return NULL;
+
+    return uuid16_lookup(uuid->uu[12] | uuid->uu[13] << 8);
+}
+
+const char *company_name(uint16_t id) {
+
+    return company_lookup(id);
+}
+
+const char *appearance_name(uint16_t appearance) {
+    const char *name = appearance_lookup(appearance);
+
+    if (name == NULL)
+        name = appearance_lookup(appearance & ~0x3f);
+
+    return name;
+}
+
+const char *cod_major_name(uint8_t major) {
+
+    return cod_major_lookup(major);
+}
+
+const char *cod_service_name(uint8_t bit) {
+
+    return cod_service_lookup(bit);
+}
+'''
+
+
+def parse(path):
+    tables = {}
+    table = None
+
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.strip()
+            if not line or line.startswith('#'):
+                continue
+
+            if line.startswith('['):
+                name = line.strip('[]')
+                if name not in SECTIONS:
+                    sys.exit('%s:%d: unknown section %s' % (path, lineno, name))
+                table = tables.setdefault(name, {})
+                continue
+
+            if table is None:
+                sys.exit('%s:%d: entry outside of a section' % (path, lineno))
+
+            fields = line.split(None, 1)
+            if len(fields) != 2:
+                sys.exit('%s:%d: expected "value name"' % (path, lineno))
+
+            value = int(fields[0], 0)
+            if value < 0 or value > 0xffff:
+                sys.exit('%s:%d: value out of range' % (path, lineno))
+            if value in table:
+                sys.exit('%s:%d: duplicated value %s' % (path, lineno,
+                                                          fields[0]))
+            table[value] = fields[1]
+
+    return tables
+
+
+def c_string(s):
+    return '"%s\\0"' % s.replace('\\', '\\\\').replace('"', '\\"')
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit('Usage: %s assigned_numbers.txt' % sys.argv[0])
+
+    tables = parse(sys.argv[1])
+    pool = []
+    pool_size = 0
+    offsets = {}
+    out = [HEADER]
+
+    # identical names share the same pool entry
+    for section in SECTIONS:
+        for value in sorted(tables.get(section, {})):
+            name = tables[section][value]
+            if name not in offsets:
+                offsets[name] = pool_size
+                pool.append(name)
+                pool_size += len(name) + 1
+
+    if pool_size > 0xffff:
+        sys.exit('string pool too big for 16-bit offsets')
+
+    out.append('static const char pool[] =')
+    out.extend('    %s' % c_string(name) for name in pool)
+    out[-1] += ';'
+
+    for section in SECTIONS:
+        entries = sorted(tables.get(section, {}).items())
+
+        out.append('')
+        out.append('static const uint16_t %s_keys[] = {' % section)
+        out.extend('    0x%04x,' % value for value, name in entries)
+        out.append('};')
+        out.append('')
+        out.append('static const uint16_t %s_names[] = {' % section)
+        out.extend('    %d, /* %s */' % (offsets[name], name.replace('*/', ''))
+                   for value, name in entries)
+        out.append('};')
+        out.append('')
+        out.append('static const char *%s_lookup(uint16_t value) {' % section)
+        out.append('')
+        out.append('    return lookup(%s_keys, %s_names, %d, pool, value);' %
+                   (section, section, len(entries)))
+        out.append('}')
+
+    out.append(FOOTER)
+    sys.stdout.write('\n'.join(out))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,542 @@
+/*
+ * Resolution of resolvable private addresses
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __AES__
+#include <cpuid.h>
+#include <wmmintrin.h>
+#endif
+
+#include "irk.h"
+#include "mem.h"
+#include "rl_helper.h"
+#include "util.h"
+
+#define LINE_LEN 256
+/* AES-128 has 11 round keys of 16 bytes */
+#define ROUND_KEYS_LEN 176
+/* The cache is set associative, sets are chosen by a hash of the address */
+#define CACHE_WAYS 4
+#define CACHE_SETS (IRK_CACHE_SIZE / CACHE_WAYS)
+/* Keys encrypted at once with AES-NI, enough to hide the latency of aesenc */
+#define AESNI_BATCH 8
+
+/* Round keys of a key, as bytes for AES-NI or big endian words for the
+ * tables */
+typedef union {
+    uint8_t bytes[ROUND_KEYS_LEN];
+    uint32_t words[ROUND_KEYS_LEN / 4];
+} round_keys_t;
+
+typedef struct {
+    bt_bdaddr_t addr;
+    uint8_t used;
+    int32_t key; /* index of the key, -1 if none resolves the address */
+} cache_entry_t;
+
+/* Keys are added from the main loop while reports are resolved in the stack
+ * callback thread, so everything is protected by a lock */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Keys, as parallel arrays */
+static round_keys_t *round_keys;
+static bt_bdaddr_t *identities;
+static char (*names)[IRK_NAME_LEN];
+static int keys_count;
+static int keys_size;
+
+static cache_entry_t cache[CACHE_SETS][CACHE_WAYS];
+static uint8_t cache_victim[CACHE_SETS]; /* next way replaced in each set */
+static uint32_t cache_used;
+
+static uint64_t lookups; /* RPAs looked up */
+static uint64_t hits; /* lookups answered by the cache */
+static uint64_t resolved; /* lookups that found a key */
+static uint64_t resolve_us; /* time spent trying keys */
+
+/* AES tables, built when the first key is added */
+static bool tables_ready = false;
+static bool use_aesni = false;
+static uint8_t sbox[256];
+static uint32_t te[4][256];
+
+static char *trim(char *str) {
+    char *end;
+
+    while (isspace((unsigned char) *str))
+        str++;
+
+    end = str + strlen(str);
+    while (end > str && isspace((unsigned char) end[-1]))
+        end--;
+    *end = 0;
+
+    return str;
+}
+
+/* Splits the first word off *str */
+static char *next_word(char **str) {
+    char *word = *str;
+
+    *str += strcspn(*str, " \t");
+    if (**str != 0)
+        *(*str)++ = 0;
+    *str = trim(*str);
+
+    return word;
+}
+
+static uint32_t hash_addr(const bt_bdaddr_t *addr) {
+    uint32_t h = 2166136261u;
+    int i;
+
+    for (i = 0; i < 6; i++)
+        h = (h ^ addr->address[i]) * 16777619u;
+
+    return h;
+}
+
+static uint8_t xtime(uint8_t x) {
+
+    return x << 1 ^ (x & 0x80 ? 0x1b : 0);
+}
+
+static uint8_t rotl8(uint8_t x, int n) {
+
+    return x << n | x >> (8 - n);
+}
+
+static void init_tables() {
+    uint8_t p = 1, q = 1, s;
+    uint32_t w;
+    int i;
+
+    /* p runs over the powers of 3 and q over the powers of its inverse, so q
+     * is always the inverse of p */
+    do {
+        p ^= xtime(p);
+
+        q ^= q << 1;
+        q ^= q << 2;
+        q ^= q << 4;
+        if (q & 0x80)
+            q ^= 0x09;
+
+        sbox[p] = q ^ rotl8(q, 1) ^ rotl8(q, 2) ^ rotl8(q, 3) ^ rotl8(q, 4) ^
+                  0x63;
+    } while (p != 1);
+    sbox[0] = 0x63;
+
+    /* SubBytes and MixColumns of each byte of a column */
+    for (i = 0; i < 256; i++) {
+        s = sbox[i];
+        w = (uint32_t) xtime(s) << 24 | s << 16 | s << 8 | (xtime(s) ^ s);
+        te[0][i] = w;
+        te[1][i] = w >> 8 | w << 24;
+        te[2][i] = w >> 16 | w << 16;
+        te[3][i] = w >> 24 | w << 8;
+    }
+
+#ifdef __AES__
+    {
+        unsigned int eax, ebx, ecx, edx;
+
+        use_aesni = __get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+                    (ecx & bit_AES);
+    }
+#endif
+
+    tables_ready = true;
+}
+
+static void expand_key(const uint8_t *key, round_keys_t *rk) {
+    uint8_t *b = rk->bytes;
+    uint8_t rcon = 1, t[4], u;
+    int i, j;
+
+    memcpy(b, key, 16);
+
+    for (i = 16; i < ROUND_KEYS_LEN; i += 4) {
+        memcpy(t, b + i - 4, 4);
+        if (i % 16 == 0) {
+            u = t[0];
+            t[0] = sbox[t[1]] ^ rcon;
+            t[1] = sbox[t[2]];
+            t[2] = sbox[t[3]];
+            t[3] = sbox[u];
+            rcon = xtime(rcon);
+        }
+
+        for (j = 0; j < 4; j++)
+            b[i + j] = b[i + j - 16] ^ t[j];
+    }
+
+    if (use_aesni)
+        return;
+
+    for (i = 0; i < ROUND_KEYS_LEN / 4; i++)
+        rk->words[i] = (uint32_t) b[4 * i] << 24 | b[4 * i + 1] << 16 |
+                       b[4 * i + 2] << 8 | b[4 * i + 3];
+}
+
+/* The plaintext of ah() is prand in its 3 last bytes and the hash is the 3
+ * last bytes of the ciphertext, ie. the last column of the state. Returns the
+ * index of the first key giving hash, -1 if none. */
+static int match_tables(uint32_t prand, uint32_t hash) {
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+    const uint32_t *rk;
+    int i, r;
+
+    for (i = 0; i < keys_count; i++) {
+        rk = round_keys[i].words;
+        s0 = rk[0];
+        s1 = rk[1];
+        s2 = rk[2];
+        s3 = rk[3] ^ prand;
+
+        for (r = 1; r < 10; r++) {
+            rk += 4;
+            t0 = te[0][s0 >> 24] ^ te[1][s1 >> 16 & 0xff] ^
+                 te[2][s2 >> 8 & 0xff] ^ te[3][s3 & 0xff] ^ rk[0];
+            t1 = te[0][s1 >> 24] ^ te[1][s2 >> 16 & 0xff] ^
+                 te[2][s3 >> 8 & 0xff] ^ te[3][s0 & 0xff] ^ rk[1];
+            t2 = te[0][s2 >> 24] ^ te[1][s3 >> 16 & 0xff] ^
+                 te[2][s0 >> 8 & 0xff] ^ te[3][s1 & 0xff] ^ rk[2];
+            t3 = te[0][s3 >> 24] ^ te[1][s0 >> 16 & 0xff] ^
+                 te[2][s1 >> 8 & 0xff] ^ te[3][s2 & 0xff] ^ rk[3];
+            s0 = t0;
+            s1 = t1;
+            s2 = t2;
+            s3 = t3;
+        }
+
+        /* the last round only computes the bytes of the hash */
+        t3 = (uint32_t) sbox[s0 >> 16 & 0xff] << 16 |
+             sbox[s1 >> 8 & 0xff] << 8 | sbox[s2 & 0xff];
+        if (((t3 ^ rk[7]) & 0xffffff) == hash)
+            return i;
+    }
+
+    return -1;
+}
+
+#ifdef __AES__
+/* Encrypts block with n keys from first. Inlined with a constant n, so the
+ * states stay in registers and the aesenc of different keys overlap. */
+static inline __attribute__((always_inline))
+int aesni_batch(__m128i block, uint32_t hash, int first, int n) {
+    const round_keys_t *rk = &round_keys[first];
+    __m128i s[AESNI_BATCH];
+    int j, r;
+
+    for (j = 0; j < n; j++)
+        s[j] = _mm_xor_si128(block,
+                             _mm_loadu_si128((const __m128i *) rk[j].bytes));
+
+    for (r = 1; r < 10; r++)
+        for (j = 0; j < n; j++)
+            s[j] = _mm_aesenc_si128(s[j], _mm_loadu_si128(
+                                    (const __m128i *) (rk[j].bytes + 16 * r)));
+
+    for (j = 0; j < n; j++)
+        s[j] = _mm_aesenclast_si128(s[j], _mm_loadu_si128(
+                                    (const __m128i *) (rk[j].bytes + 160)));
+
+    /* bytes 13 to 15 of the ciphertext */
+    for (j = 0; j < n; j++)
+        if ((uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(s[j], 12)) >> 8 ==
+            hash)
+            return first + j;
+
+    return -1;
+}
+
+/* Same as match_tables(), hash is little endian here */
+static int match_aesni(uint32_t prand, uint32_t hash) {
+    __m128i block = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                  prand >> 16, prand >> 8, prand);
+    int i, key = -1;
+
+    for (i = 0; i + AESNI_BATCH <= keys_count && key < 0; i += AESNI_BATCH)
+        key = aesni_batch(block, hash, i, AESNI_BATCH);
+
+    for (; i < keys_count && key < 0; i++)
+        key = aesni_batch(block, hash, i, 1);
+
+    return key;
+}
+#endif
+
+/* Must be called with the lock held */
+static void clear_cache() {
+
+    memset(cache, 0, sizeof(cache));
+    memset(cache_victim, 0, sizeof(cache_victim));
+    cache_used = 0;
+}
+
+static bool parse_key(const char *str, uint8_t *key) {
+    int i;
+
+    if (strlen(str) != 32)
+        return false;
+
+    for (i = 0; i < 32; i++)
+        if (!isxdigit((unsigned char) str[i]))
+            return false;
+
+    for (i = 0; i < 16; i++)
+        sscanf(str + 2 * i, "%2hhx", &key[i]);
+
+    return true;
+}
+
+/* Must be called with the lock held */
+static bool grow_keys() {
+    int size = keys_size > 0 ? keys_size * 2 : 64;
+    void *p;
+
+    p = mem_realloc(MEM_IRK, round_keys, size * sizeof(*round_keys));
+    if (p == NULL)
+        return false;
+    round_keys = p;
+
+    p = mem_realloc(MEM_IRK, identities, size * sizeof(*identities));
+    if (p == NULL)
+        return false;
+    identities = p;
+
+    p = mem_realloc(MEM_IRK, names, size * sizeof(*names));
+    if (p == NULL)
+        return false;
+    names = p;
+
+    keys_size = size;
+
+    return true;
+}
+
+bool irk_add(const char *spec, const char *where) {
+    char line[LINE_LEN];
+    const char *error = NULL;
+    char *p, *key_str, *addr_str;
+    bt_bdaddr_t identity;
+    uint8_t key[16];
+    int i;
+
+    if (strlen(spec) >= sizeof(line)) {
+        error = "line too long";
+        goto failed;
+    }
+
+    strcpy(line, spec);
+    p = trim(line);
+
+    key_str = next_word(&p);
+    if (!parse_key(key_str, key)) {
+        error = "the key must be 32 hex digits";
+        goto failed;
+    }
+
+    addr_str = next_word(&p);
+    if (str2ba(addr_str, &identity) != 0) {
+        error = "invalid identity address";
+        goto failed;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    if (!tables_ready)
+        init_tables();
+
+    for (i = 0; i < keys_count; i++)
+        if (!memcmp(&identities[i], &identity, sizeof(identity)))
+            break;
+
+    if (i == keys_count) {
+        if (keys_count == keys_size && !grow_keys()) {
+            pthread_mutex_unlock(&lock);
+            error = "out of memory";
+            goto failed;
+        }
+        keys_count++;
+    }
+
+    expand_key(key, &round_keys[i]);
+    memcpy(&identities[i], &identity, sizeof(identity));
+    snprintf(names[i], IRK_NAME_LEN, "%s", p);
+
+    /* addresses that didn't resolve may now */
+    clear_cache();
+
+    pthread_mutex_unlock(&lock);
+
+    return true;
+
+failed:
+    if (where != NULL)
+        rl_printf("%s: %s\n", where, error);
+    else
+        rl_printf("Unable to add key: %s\n", error);
+    return false;
+}
+
+bool irk_load(const char *path) {
+    char line[LINE_LEN];
+    char where[LINE_LEN];
+    int lineno = 0, added = 0;
+    char *p;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        rl_printf("Unable to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+
+        p = strchr(line, '#');
+        if (p != NULL)
+            *p = 0;
+
+        p = trim(line);
+        if (*p == 0)
+            continue;
+
+        snprintf(where, sizeof(where), "%s:%d", path, lineno);
+        if (irk_add(p, where))
+            added++;
+    }
+
+    fclose(f);
+
+    rl_printf("Added %d keys\n", added);
+
+    return added > 0;
+}
+
+void irk_clear() {
+
+    pthread_mutex_lock(&lock);
+
+    mem_free(round_keys);
+    mem_free(identities);
+    mem_free(names);
+    round_keys = NULL;
+    identities = NULL;
+    names = NULL;
+    keys_count = keys_size = 0;
+    clear_cache();
+
+    pthread_mutex_unlock(&lock);
+}
+
+void irk_print_status() {
+    uint64_t misses;
+
+    pthread_mutex_lock(&lock);
+
+    if (!tables_ready)
+        init_tables();
+
+    misses = lookups - hits;
+    rl_printf("Keys: %d, AES: %s\n", keys_count,
+              use_aesni ? "AES-NI" : "tables");
+    rl_printf("Cache: %u of %u addresses\n", cache_used, IRK_CACHE_SIZE);
+    rl_printf("Lookups: %llu, cache hits: %llu, resolved: %llu\n",
+              (unsigned long long) lookups, (unsigned long long) hits,
+              (unsigned long long) resolved);
+    if (misses > 0)
+        rl_printf("Resolutions: %llu, %.1f us each\n",
+                  (unsigned long long) misses,
+                  (double) resolve_us / misses);
+
+    pthread_mutex_unlock(&lock);
+}
+
+bool irk_resolve(const bt_bdaddr_t *addr, bt_bdaddr_t *identity,
+                 char *name) {
+    const uint8_t *a = addr->address;
+    cache_entry_t *e = NULL;
+    uint32_t set;
+    uint64_t start_us;
+    int i, key;
+
+    /* RPAs have 01 as their two most significant bits */
+    if ((a[0] & 0xc0) != 0x40)
+        return false;
+
+    pthread_mutex_lock(&lock);
+
+    if (keys_count == 0) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+
+    lookups++;
+
+    set = hash_addr(addr) & (CACHE_SETS - 1);
+    for (i = 0; i < CACHE_WAYS && e == NULL; i++)
+        if (cache[set][i].used &&
+            !memcmp(&cache[set][i].addr, addr, sizeof(*addr)))
+            e = &cache[set][i];
+
+    if (e != NULL) {
+        hits++;
+        key = e->key;
+    } else {
+        start_us = monotonic_us();
+#ifdef __AES__
+        if (use_aesni)
+            key = match_aesni(a[0] << 16 | a[1] << 8 | a[2],
+                              a[3] | a[4] << 8 | a[5] << 16);
+        else
+#endif
+            key = match_tables(a[0] << 16 | a[1] << 8 | a[2],
+                               a[3] << 16 | a[4] << 8 | a[5]);
+        resolve_us += monotonic_us() - start_us;
+
+        e = &cache[set][cache_victim[set]];
+        cache_victim[set] = (cache_victim[set] + 1) % CACHE_WAYS;
+        if (!e->used)
+            cache_used++;
+        memcpy(&e->addr, addr, sizeof(*addr));
+        e->used = 1;
+        e->key = key;
+    }
+
+    if (key >= 0) {
+        resolved++;
+        memcpy(identity, &identities[key], sizeof(*identity));
+        if (name != NULL)
+            memcpy(name, names[key], IRK_NAME_LEN);
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return key >= 0;
+}
@@ -0,0 +1,44 @@
+#ifndef __IRK_H__
+#define __IRK_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <hardware/bluetooth.h>
+
+/* Resolutions remembered, by resolvable private address */
+#define IRK_CACHE_SIZE 1024
+/* Longest device name, plus the NUL */
+#define IRK_NAME_LEN 32
+
+/* Resolution of resolvable private addresses (RPAs) to the identity of the
+ * device that generated them, given its Identity Resolving Key (IRK).
+ *
+ * An RPA is prand (the 3 most significant bytes, top bits 01) and hash (the 3
+ * least significant bytes), with hash = ah(IRK, prand): the 3 least
+ * significant bytes of AES-128(IRK, prand padded with zeros). Resolving means
+ * finding the key that gives the hash, so every key is tried. Round keys are
+ * expanded when keys are added, and AES-NI encrypts 8 keys at once when the
+ * CPU has it (the x86 ABI doesn't guarantee it, so it's checked at run time);
+ * otherwise a T-table implementation is used. Results, misses included, are
+ * cached by address since devices keep their RPA for minutes.
+ *
+ * Keys are given as 32 hex digits, most significant byte first, followed by
+ * the identity address and an optional name:
+ *   ec0234a357c8ad05341010a60a397d9b 00:11:22:33:44:55 sensor 1 */
+
+/* Adds the key in spec, replacing the key of the same identity. Prints the
+ * reason, prefixed with where if not NULL, and returns false if it is
+ * invalid. */
+bool irk_add(const char *spec, const char *where);
+/* Adds the keys in a file, one per line, # starts a comment */
+bool irk_load(const char *path);
+void irk_clear();
+
+void irk_print_status();
+
+/* Returns true if addr is an RPA generated with one of the keys, copying the
+ * identity and name (if not NULL, IRK_NAME_LEN bytes) of its device. Can be
+ * called from any thread. */
+bool irk_resolve(const bt_bdaddr_t *addr, bt_bdaddr_t *identity, char *name);
+
+#endif /* __IRK_H__ */
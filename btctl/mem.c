@@ -0,0 +1,171 @@
+/*
+ * Heap allocation accounting
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem.h"
+#include "rl_helper.h"
+
+/* Put in front of each block, keeping the alignment malloc() gives */
+typedef union {
+    struct {
+        size_t size;
+        mem_tag_t tag;
+    } h;
+    long double align;
+    void *align_ptr;
+    uint64_t align_u64;
+} mem_hdr_t;
+
+typedef struct {
+    volatile size_t live; /* bytes */
+    volatile size_t peak;
+    volatile uint64_t allocs;
+    volatile uint64_t frees;
+} mem_count_t;
+
+static mem_count_t counts[MEM_TAG_COUNT];
+
+static const char *tag_names[MEM_TAG_COUNT] = {
+    [MEM_HISTORY] = "history",
+    [MEM_GATT_DB] = "gatt cache",
+    [MEM_GATT_OPS] = "gatt ops",
+    [MEM_SCAN] = "scan tables",
+    [MEM_OUTPUT] = "output",
+    [MEM_TRACE] = "trace",
+    [MEM_REPLAY] = "replay",
+    [MEM_LOG] = "value log",
+    [MEM_IRK] = "irks",
+    [MEM_STATS] = "stats",
+};
+
+static void account(mem_tag_t tag, size_t add, size_t sub) {
+    mem_count_t *c = &counts[tag];
+    size_t live, peak;
+
+    if (add >= sub) {
+        live = __sync_add_and_fetch(&c->live, add - sub);
+    } else {
+        __sync_sub_and_fetch(&c->live, sub - add);
+        return;
+    }
+
+    peak = c->peak;
+    while (live > peak && !__sync_bool_compare_and_swap(&c->peak, peak, live))
+        peak = c->peak;
+}
+
+void *mem_alloc(mem_tag_t tag, size_t size) {
+    mem_hdr_t *hdr;
+
+    if (size > SIZE_MAX - sizeof(*hdr))
+        return NULL;
+
+    hdr = malloc(sizeof(*hdr) + size);
+    if (hdr == NULL)
+        return NULL;
+
+    hdr->h.size = size;
+    hdr->h.tag = tag;
+
+    __sync_fetch_and_add(&counts[tag].allocs, 1);
+    account(tag, size, 0);
+
+    return hdr + 1;
+}
+
+void *mem_calloc(mem_tag_t tag, size_t count, size_t size) {
+    void *ptr;
+
+    if (size != 0 && count > SIZE_MAX / size)
+        return NULL;
+
+    ptr = mem_alloc(tag, count * size);
+    if (ptr != NULL)
+        memset(ptr, 0, count * size);
+
+    return ptr;
+}
+
+void *mem_realloc(mem_tag_t tag, void *ptr, size_t size) {
+    mem_hdr_t *hdr;
+    size_t old;
+
+    if (ptr == NULL)
+        return mem_alloc(tag, size);
+
+    if (size > SIZE_MAX - sizeof(*hdr))
+        return NULL;
+
+    hdr = (mem_hdr_t *) ptr - 1;
+    old = hdr->h.size;
+
+    hdr = realloc(hdr, sizeof(*hdr) + size);
+    if (hdr == NULL)
+        return NULL;
+
+    hdr->h.size = size;
+    account(hdr->h.tag, size, old);
+
+    return hdr + 1;
+}
+
+void mem_free(void *ptr) {
+    mem_hdr_t *hdr;
+
+    if (ptr == NULL)
+        return;
+
+    hdr = (mem_hdr_t *) ptr - 1;
+
+    __sync_fetch_and_add(&counts[hdr->h.tag].frees, 1);
+    account(hdr->h.tag, 0, hdr->h.size);
+
+    free(hdr);
+}
+
+void mem_print() {
+    size_t live = 0, peak = 0;
+    uint64_t allocs = 0, frees = 0;
+    int i;
+
+    rl_printf("%-12s %12s %12s %8s %10s %10s\n", "Tag", "Live bytes",
+              "Peak bytes", "Blocks", "Allocs", "Frees");
+
+    for (i = 0; i < MEM_TAG_COUNT; i++) {
+        mem_count_t c = counts[i];
+
+        rl_printf("%-12s %12zu %12zu %8llu %10llu %10llu\n", tag_names[i],
+                  c.live, c.peak, (unsigned long long) (c.allocs - c.frees),
+                  (unsigned long long) c.allocs,
+                  (unsigned long long) c.frees);
+
+        live += c.live;
+        peak += c.peak;
+        allocs += c.allocs;
+        frees += c.frees;
+    }
+
+    /* peaks of different tags may not have happened at the same time */
+    rl_printf("%-12s %12zu %12zu %8llu %10llu %10llu\n", "total", live, peak,
+              (unsigned long long) (allocs - frees),
+              (unsigned long long) allocs, (unsigned long long) frees);
+}
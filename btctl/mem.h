@@ -0,0 +1,34 @@
+#ifndef __MEM_H__
+#define __MEM_H__
+
+#include <stddef.h>
+
+/* What heap memory is used for, see mem_print() */
+typedef enum {
+    MEM_HISTORY, /* command history ring */
+    MEM_GATT_DB, /* GATT databases and the UUID intern table */
+    MEM_GATT_OPS, /* values of queued GATT operations */
+    MEM_SCAN, /* copies of the scan tables being listed */
+    MEM_OUTPUT, /* notification sink backlogs */
+    MEM_TRACE, /* trace rings */
+    MEM_REPLAY, /* replay buffers */
+    MEM_LOG, /* value log blocks */
+    MEM_IRK, /* identity resolving keys */
+    MEM_STATS, /* per-thread print times and sorted stats listings */
+    MEM_TAG_COUNT
+} mem_tag_t;
+
+/* Heap allocation with accounting by tag: bytes in use, the most ever in
+ * use, and allocation counts, so what grows during long runs can be found.
+ * Same semantics as malloc(), calloc(), realloc() and free(). Blocks keep
+ * the tag they were allocated with, mem_realloc() only uses tag for NULL.
+ * Can be called from any thread. */
+void *mem_alloc(mem_tag_t tag, size_t size);
+void *mem_calloc(mem_tag_t tag, size_t count, size_t size);
+void *mem_realloc(mem_tag_t tag, void *ptr, size_t size);
+void mem_free(void *ptr);
+
+/* Prints the accounting of every tag */
+void mem_print();
+
+#endif /* __MEM_H__ */
@@ -0,0 +1,530 @@
+/*
+ * Binary sinks for notifications
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "notif_sink.h"
+#include "mem.h"
+#include "rl_helper.h"
+#include "timeout.h"
+#include "util.h"
+
+typedef struct {
+    int fd; /* -1 if unused */
+    char name[64];
+    const char *kind;
+    int routes;
+
+    /* ring of bytes not written yet, always ending with a whole record */
+    uint8_t *backlog;
+    size_t head;
+    size_t count;
+
+    uint64_t records;
+    uint64_t bytes;
+    uint64_t dropped;
+} sink_t;
+
+typedef struct {
+    bool used;
+    bt_bdaddr_t addr;
+    btgatt_srvc_id_t srvc_id;
+    btgatt_char_id_t char_id;
+    uint16_t svc;
+    uint16_t ch;
+    sink_t *sink;
+    uint64_t records;
+} route_t;
+
+/* Notifications arrive on the stack callback thread, routes are changed from
+ * commands and the backlog is retried from the main loop */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static sink_t sinks[SINK_MAX] = {
+    [0 ... SINK_MAX - 1] = { .fd = -1 },
+};
+static route_t routes[SINK_ROUTES_MAX];
+static int retry_timeout = 0;
+
+static bool same_char(const route_t *r, const bt_bdaddr_t *addr,
+                      const btgatt_srvc_id_t *srvc_id,
+                      const btgatt_char_id_t *char_id) {
+
+    return !memcmp(&r->addr, addr, sizeof(*addr)) &&
+           r->srvc_id.is_primary == srvc_id->is_primary &&
+           r->srvc_id.id.inst_id == srvc_id->id.inst_id &&
+           !memcmp(&r->srvc_id.id.uuid, &srvc_id->id.uuid,
+                   sizeof(bt_uuid_t)) &&
+           r->char_id.inst_id == char_id->inst_id &&
+           !memcmp(&r->char_id.uuid, &char_id->uuid, sizeof(bt_uuid_t));
+}
+
+static route_t *find_route(const bt_bdaddr_t *addr,
+                           const btgatt_srvc_id_t *srvc_id,
+                           const btgatt_char_id_t *char_id) {
+    int i;
+
+    for (i = 0; i < SINK_ROUTES_MAX; i++)
+        if (routes[i].used && same_char(&routes[i], addr, srvc_id, char_id))
+            return &routes[i];
+
+    return NULL;
+}
+
+static bool is_number(const char *str) {
+
+    if (*str == 0)
+        return false;
+
+    for (; *str != 0; str++)
+        if (*str < '0' || *str > '9')
+            return false;
+
+    return true;
+}
+
+/* Opens target for writing without blocking, prints the reason on failure */
+static int open_target(const char *target, const char **kind) {
+    struct sockaddr_un sun;
+    struct stat st;
+    int fd;
+
+    if (is_number(target)) {
+        fd = fcntl(atoi(target), F_DUPFD_CLOEXEC, 0);
+        *kind = "descriptor";
+    } else if (stat(target, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        if (strlen(target) >= sizeof(sun.sun_path)) {
+            rl_printf("Socket path too long\n");
+            return -1;
+        }
+
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strcpy(sun.sun_path, target);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *) &sun, sizeof(sun)) < 0) {
+            close(fd);
+            fd = -1;
+        }
+        *kind = "socket";
+    } else {
+        /* a FIFO without reader fails with ENXIO instead of blocking */
+        fd = open(target, O_WRONLY | O_CREAT | O_APPEND | O_NONBLOCK |
+                  O_CLOEXEC, 0644);
+        *kind = fd >= 0 && fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode) ?
+                "FIFO" : "file";
+    }
+
+    if (fd < 0) {
+        if (errno == ENXIO)
+            rl_printf("No reader on FIFO %s\n", target);
+        else
+            rl_printf("Failed to open %s: %s\n", target, strerror(errno));
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    return fd;
+}
+
+static sink_t *get_sink(const char *target) {
+    sink_t *sink = NULL;
+    const char *kind;
+    int i, fd;
+
+    for (i = 0; i < SINK_MAX; i++) {
+        if (sinks[i].fd >= 0 && !strcmp(sinks[i].name, target))
+            return &sinks[i];
+
+        if (sinks[i].fd < 0 && sink == NULL)
+            sink = &sinks[i];
+    }
+
+    if (sink == NULL) {
+        rl_printf("Too many sinks\n");
+        return NULL;
+    }
+
+    sink->backlog = mem_alloc(MEM_OUTPUT, SINK_BACKLOG_SIZE);
+    if (sink->backlog == NULL) {
+        rl_printf("Out of memory\n");
+        return NULL;
+    }
+
+    fd = open_target(target, &kind);
+    if (fd < 0) {
+        mem_free(sink->backlog);
+        sink->backlog = NULL;
+        return NULL;
+    }
+
+    /* a reader going away must not kill us, writes fail with EPIPE */
+    signal(SIGPIPE, SIG_IGN);
+
+    sink->fd = fd;
+    snprintf(sink->name, sizeof(sink->name), "%s", target);
+    sink->kind = kind;
+    sink->routes = 0;
+    sink->head = 0;
+    sink->count = 0;
+    sink->records = 0;
+    sink->bytes = 0;
+    sink->dropped = 0;
+
+    return sink;
+}
+
+static void close_sink(sink_t *sink) {
+
+    close(sink->fd);
+    sink->fd = -1;
+    mem_free(sink->backlog);
+    sink->backlog = NULL;
+}
+
+static void put_route(route_t *r) {
+
+    r->used = false;
+    if (--r->sink->routes == 0)
+        close_sink(r->sink);
+}
+
+/* Closes a sink that failed, with its routes */
+static void fail_sink(sink_t *sink, int err) {
+    int i;
+
+    rl_printf("Notification sink %s closed: %s\n", sink->name, strerror(err));
+
+    for (i = 0; i < SINK_ROUTES_MAX; i++)
+        if (routes[i].used && routes[i].sink == sink)
+            routes[i].used = false;
+
+    close_sink(sink);
+}
+
+/* Fills iov with the backlog, returns the number of entries used */
+static int backlog_iov(const sink_t *sink, struct iovec *iov) {
+    size_t first = SINK_BACKLOG_SIZE - sink->head;
+
+    if (sink->count == 0)
+        return 0;
+
+    iov[0].iov_base = sink->backlog + sink->head;
+    if (sink->count <= first) {
+        iov[0].iov_len = sink->count;
+        return 1;
+    }
+
+    iov[0].iov_len = first;
+    iov[1].iov_base = sink->backlog;
+    iov[1].iov_len = sink->count - first;
+    return 2;
+}
+
+static void backlog_append(sink_t *sink, const uint8_t *data, size_t len) {
+    size_t tail, n;
+
+    while (len > 0) {
+        tail = (sink->head + sink->count) % SINK_BACKLOG_SIZE;
+        n = SINK_BACKLOG_SIZE - tail;
+        if (n > len)
+            n = len;
+
+        memcpy(sink->backlog + tail, data, n);
+        sink->count += n;
+        data += n;
+        len -= n;
+    }
+}
+
+/* Writes iov, returns the number of bytes written, or -1 if the sink failed
+ * and was closed */
+static ssize_t write_iov(sink_t *sink, const struct iovec *iov, int count) {
+    ssize_t n;
+
+    do
+        n = writev(sink->fd, iov, count);
+    while (n < 0 && errno == EINTR);
+
+    if (n < 0 && errno != EAGAIN) {
+        fail_sink(sink, errno);
+        return -1;
+    }
+
+    return n < 0 ? 0 : n;
+}
+
+static void arm_retry();
+
+/* Writes a record after the backlog, in one system call. What the sink
+ * doesn't take is added to the backlog, or the record is dropped if it
+ * doesn't fit. */
+static void write_record(sink_t *sink, const sink_record_t *rec,
+                         const uint8_t *value) {
+    size_t len = sizeof(*rec) + rec->len;
+    size_t done, n;
+    struct iovec iov[4];
+    ssize_t ret;
+    int count;
+
+    count = backlog_iov(sink, iov);
+
+    /* a record is only started if its end can be kept in the backlog */
+    if (sink->count + len <= SINK_BACKLOG_SIZE) {
+        iov[count].iov_base = (void *) rec;
+        iov[count++].iov_len = sizeof(*rec);
+        if (rec->len > 0) {
+            iov[count].iov_base = (void *) value;
+            iov[count++].iov_len = rec->len;
+        }
+    }
+
+    ret = write_iov(sink, iov, count);
+    if (ret < 0)
+        return;
+
+    done = ret;
+    n = done < sink->count ? done : sink->count;
+    sink->head = (sink->head + n) % SINK_BACKLOG_SIZE;
+    sink->count -= n;
+    sink->bytes += n;
+    done -= n;
+
+    if (sink->count > 0 && sink->count + len > SINK_BACKLOG_SIZE) {
+        sink->dropped++;
+        arm_retry();
+        return;
+    }
+
+    sink->records++;
+    sink->bytes += done;
+
+    /* the rest of the record, header first */
+    if (done < sizeof(*rec)) {
+        backlog_append(sink, (const uint8_t *) rec + done,
+                       sizeof(*rec) - done);
+        done = sizeof(*rec);
+    }
+
+    if (done < len)
+        backlog_append(sink, value + done - sizeof(*rec), len - done);
+
+    if (sink->count > 0)
+        arm_retry();
+}
+
+static bool retry(void *user_data) {
+    struct iovec iov[2];
+    bool pending = false;
+    ssize_t ret;
+    int i, count;
+
+    pthread_mutex_lock(&lock);
+
+    for (i = 0; i < SINK_MAX; i++) {
+        sink_t *sink = &sinks[i];
+
+        if (sink->fd < 0 || sink->count == 0)
+            continue;
+
+        count = backlog_iov(sink, iov);
+        ret = write_iov(sink, iov, count);
+        if (ret < 0)
+            continue;
+
+        sink->head = (sink->head + ret) % SINK_BACKLOG_SIZE;
+        sink->count -= ret;
+        sink->bytes += ret;
+
+        if (sink->count > 0)
+            pending = true;
+    }
+
+    if (!pending)
+        retry_timeout = 0;
+
+    pthread_mutex_unlock(&lock);
+
+    return pending;
+}
+
+/* Must be called with the lock held */
+static void arm_retry() {
+
+    if (retry_timeout == 0)
+        retry_timeout = timeout_add(SINK_RETRY_MS, retry, NULL);
+}
+
+bool sink_add(conn_t *conn, int svc, int ch, const char *target) {
+    btgatt_srvc_id_t srvc_id;
+    btgatt_char_id_t char_id;
+    route_t *r;
+    sink_t *sink;
+    int i;
+
+    gatt_db_svc_id(&conn->db, svc, &srvc_id);
+    gatt_db_char_id(&conn->db, svc, ch, &char_id);
+
+    pthread_mutex_lock(&lock);
+
+    sink = get_sink(target);
+    if (sink == NULL) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+
+    /* routing again moves the characteristic to the new sink */
+    sink->routes++;
+    r = find_route(&conn->addr, &srvc_id, &char_id);
+    if (r != NULL)
+        put_route(r);
+
+    for (i = 0; i < SINK_ROUTES_MAX && r == NULL; i++)
+        if (!routes[i].used)
+            r = &routes[i];
+
+    if (r == NULL) {
+        rl_printf("Too many characteristics routed\n");
+        if (--sink->routes == 0)
+            close_sink(sink);
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->used = true;
+    memcpy(&r->addr, &conn->addr, sizeof(r->addr));
+    memcpy(&r->srvc_id, &srvc_id, sizeof(srvc_id));
+    memcpy(&r->char_id, &char_id, sizeof(char_id));
+    r->svc = svc;
+    r->ch = ch;
+    r->sink = sink;
+
+    pthread_mutex_unlock(&lock);
+
+    return true;
+}
+
+bool sink_remove(conn_t *conn, int svc, int ch) {
+    btgatt_srvc_id_t srvc_id;
+    btgatt_char_id_t char_id;
+    route_t *r;
+
+    gatt_db_svc_id(&conn->db, svc, &srvc_id);
+    gatt_db_char_id(&conn->db, svc, ch, &char_id);
+
+    pthread_mutex_lock(&lock);
+
+    r = find_route(&conn->addr, &srvc_id, &char_id);
+    if (r != NULL)
+        put_route(r);
+
+    pthread_mutex_unlock(&lock);
+
+    return r != NULL;
+}
+
+void sink_clear() {
+    int i;
+
+    pthread_mutex_lock(&lock);
+
+    for (i = 0; i < SINK_ROUTES_MAX; i++)
+        if (routes[i].used)
+            put_route(&routes[i]);
+
+    if (retry_timeout != 0) {
+        timeout_remove(retry_timeout);
+        retry_timeout = 0;
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+void sink_print_status() {
+    char addr_str[BT_ADDRESS_STR_LEN];
+    bool any = false;
+    int i, j;
+
+    pthread_mutex_lock(&lock);
+
+    for (i = 0; i < SINK_MAX; i++) {
+        const sink_t *sink = &sinks[i];
+
+        if (sink->fd < 0)
+            continue;
+
+        any = true;
+        rl_printf("%s (%s): %llu records, %llu bytes, %llu dropped, %zu bytes "
+                  "pending\n", sink->name, sink->kind,
+                  (unsigned long long) sink->records,
+                  (unsigned long long) sink->bytes,
+                  (unsigned long long) sink->dropped, sink->count);
+
+        for (j = 0; j < SINK_ROUTES_MAX; j++)
+            if (routes[j].used && routes[j].sink == sink)
+                rl_printf("  %s service %d characteristic %d: %llu records\n",
+                          ba2str(routes[j].addr.address, addr_str),
+                          routes[j].svc, routes[j].ch,
+                          (unsigned long long) routes[j].records);
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    if (!any)
+        rl_printf("No notification sinks\n");
+}
+
+bool sink_notify(int conn_id, const btgatt_notify_params_t *p) {
+    sink_record_t rec;
+    route_t *r;
+
+    pthread_mutex_lock(&lock);
+
+    r = find_route(&p->bda, &p->srvc_id, &p->char_id);
+    if (r == NULL) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+
+    rec.timestamp_us = monotonic_us();
+    rec.conn_id = conn_id;
+    rec.svc = r->svc;
+    rec.ch = r->ch;
+    rec.len = p->len;
+
+    r->records++;
+    write_record(r->sink, &rec, p->value);
+
+    pthread_mutex_unlock(&lock);
+
+    return true;
+}
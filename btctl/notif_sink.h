@@ -0,0 +1,52 @@
+#ifndef __NOTIF_SINK_H__
+#define __NOTIF_SINK_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <hardware/bluetooth.h>
+#include <hardware/bt_gatt.h>
+
+#include "conn.h"
+
+/* Maximum number of open sinks */
+#define SINK_MAX 4
+/* Maximum number of characteristics routed to sinks */
+#define SINK_ROUTES_MAX 16
+/* Records waiting for a slow reader, per sink */
+#define SINK_BACKLOG_SIZE (64 * 1024)
+/* Interval between attempts to write the backlog */
+#define SINK_RETRY_MS 20
+
+/* Header of the record written to a sink for each notification, followed by
+ * len bytes of value. Fields are in host byte order. */
+typedef struct {
+    uint64_t timestamp_us; /* CLOCK_MONOTONIC */
+    uint16_t conn_id;
+    uint16_t svc; /* IDs in the database of the connection */
+    uint16_t ch;
+    uint16_t len;
+} sink_record_t;
+
+/* Notifications of selected characteristics are written as binary records to
+ * a FIFO, file, Unix socket or inherited descriptor instead of the terminal.
+ * Each record is written with a single writev() straight from the buffer of
+ * the stack. Sinks are non-blocking: what a slow reader can't take yet is kept
+ * in a backlog, written with the next records, and records are dropped when
+ * it is full. Characteristics are identified by the address of the device and
+ * their service and characteristic IDs, so routes outlive reconnections. */
+
+/* Routes notifications of characteristic ch of service svc on conn to target:
+ * a path, or a descriptor number. Prints the reason and returns false on
+ * failure. */
+bool sink_add(conn_t *conn, int svc, int ch, const char *target);
+/* Returns false if the characteristic isn't routed */
+bool sink_remove(conn_t *conn, int svc, int ch);
+/* Removes all routes and closes the sinks */
+void sink_clear();
+
+void sink_print_status();
+
+/* Writes a notification to its sink. Returns false if it isn't routed. */
+bool sink_notify(int conn_id, const btgatt_notify_params_t *p);
+
+#endif /* __NOTIF_SINK_H__ */
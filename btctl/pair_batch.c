@@ -0,0 +1,806 @@
+/*
+ * Batch pairing driven by a policy file
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pair_batch.h"
+#include "adapter.h"
+#include "rl_helper.h"
+#include "timeout.h"
+#include "trace.h"
+#include "util.h"
+
+#define LINE_LEN 128
+/* Wait before trying again when the stack is busy with another bond */
+#define BUSY_RETRY_MS 100
+/* The state machine also runs this often while pairing, to retry what a full
+ * timeout table lost */
+#define TICK_MS 1000
+
+typedef enum {
+    ACTION_ACCEPT,
+    ACTION_REJECT,
+    ACTION_PIN,
+    ACTION_PASSKEY,
+} action_t;
+
+typedef struct {
+    action_t action;
+    uint32_t passkey;
+    uint8_t pin_len;
+    bt_pin_code_t pin;
+} policy_t;
+
+typedef enum {
+    DEV_PENDING,
+    DEV_PAIRING,
+    DEV_PAIRED,
+    DEV_BONDED, /* already bonded, skipped */
+    DEV_FAILED,
+} dev_state_t;
+
+typedef struct batch_dev {
+    bt_bdaddr_t addr;
+    bool own_policy;
+    policy_t policy;
+
+    dev_state_t state;
+    const char *method; /* last request answered, NULL if none */
+    bool rejected; /* a request was rejected by the policy */
+    const char *error;
+    int status;
+    uint32_t ms;
+} batch_dev_t;
+
+/* A device being paired */
+typedef struct slot {
+    int dev; /* -1 if idle, only changed by the main loop */
+    uint64_t start_us;
+    int deadline; /* timeout ID, 0 if it couldn't be armed */
+    uint64_t deadline_us; /* checked by the tick, 0 if not armed */
+
+    /* events, set from the stack callback thread */
+    bool bonded;
+    bool failed;
+    bool expired;
+    int status;
+} slot_t;
+
+/* The state machine runs on the main loop. Stack callbacks answer requests
+ * from the policy, record events in the slots under the lock and schedule a
+ * run. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static bool run_pending = false;
+
+static const bt_interface_t *bt_iface = NULL;
+
+static batch_dev_t devs[BATCH_DEVS_MAX];
+static int devs_count = 0;
+static policy_t default_policy = { ACTION_ACCEPT, 0, 0, { { 0 } } };
+static policy_t unknown_policy = { ACTION_REJECT, 0, 0, { { 0 } } };
+static int slots_count = 1;
+static unsigned int timeout_ms = BATCH_TIMEOUT_DEFAULT;
+static slot_t slots[BATCH_SLOTS_MAX];
+
+static bool running = false; /* changed with the lock held */
+static bool stopping = false;
+static int tick_timeout = 0;
+static int retry_timeout = 0; /* only one retry is armed at a time */
+static int next_dev;
+static uint64_t start_us;
+static int paired, bonded, failed;
+
+static const char *action_names[] = {
+    [ACTION_ACCEPT] = "accept",
+    [ACTION_REJECT] = "reject",
+    [ACTION_PIN] = "pin",
+    [ACTION_PASSKEY] = "passkey",
+};
+
+static bool run(void *user_data);
+static bool retry_run(void *user_data);
+
+/* Schedules a run of the state machine. Must be called with the lock held.
+ * If the timeout table is full the tick runs it instead. */
+static void schedule_run() {
+
+    if (!run_pending && timeout_add(0, run, NULL) > 0)
+        run_pending = true;
+}
+
+void batch_set_interface(const bt_interface_t *iface) {
+
+    bt_iface = iface;
+}
+
+/* Parses an action starting with tok, from the tokens left in a line */
+static bool parse_policy(char *tok, char **save, policy_t *policy) {
+    char *end;
+    size_t len;
+
+    memset(policy, 0, sizeof(*policy));
+
+    if (tok == NULL)
+        return false;
+
+    if (strcmp(tok, "accept") == 0)
+        policy->action = ACTION_ACCEPT;
+    else if (strcmp(tok, "reject") == 0)
+        policy->action = ACTION_REJECT;
+    else if (strcmp(tok, "pin") == 0) {
+        policy->action = ACTION_PIN;
+        tok = strtok_r(NULL, " \t", save);
+        if (tok == NULL)
+            return false;
+        len = strlen(tok);
+        if (len == 0 || len > sizeof(policy->pin.pin) ||
+            strspn(tok, "0123456789") != len)
+            return false;
+        memcpy(policy->pin.pin, tok, len);
+        policy->pin_len = len;
+    } else if (strcmp(tok, "passkey") == 0) {
+        policy->action = ACTION_PASSKEY;
+        tok = strtok_r(NULL, " \t", save);
+        if (tok == NULL)
+            return false;
+        errno = 0;
+        policy->passkey = strtoul(tok, &end, 10);
+        if (*end != 0 || errno != 0 || policy->passkey > 999999)
+            return false;
+    } else
+        return false;
+
+    /* nothing may follow */
+    return strtok_r(NULL, " \t", save) == NULL;
+}
+
+bool batch_load(const char *path) {
+    char line[LINE_LEN];
+    char addr_str[BT_ADDRESS_STR_LEN];
+    bt_bdaddr_t addr;
+    policy_t policy;
+    char *p, *tok, *save;
+    int lineno = 0, i;
+    bool own;
+    FILE *f;
+
+    if (running) {
+        rl_printf("Pairing is running, stop it first\n");
+        return false;
+    }
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        rl_printf("Unable to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    devs_count = 0;
+    memset(&default_policy, 0, sizeof(default_policy));
+    default_policy.action = ACTION_ACCEPT;
+    memset(&unknown_policy, 0, sizeof(unknown_policy));
+    unknown_policy.action = ACTION_REJECT;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+
+        p = strchr(line, '#');
+        if (p != NULL)
+            *p = 0;
+        line[strcspn(line, "\r\n")] = 0;
+
+        tok = strtok_r(line, " \t", &save);
+        if (tok == NULL)
+            continue;
+
+        if (strcmp(tok, "default") == 0 || strcmp(tok, "unknown") == 0) {
+            if (!parse_policy(strtok_r(NULL, " \t", &save), &save,
+                              &policy)) {
+                rl_printf("%s:%d: invalid action\n", path, lineno);
+                continue;
+            }
+            if (strcmp(tok, "default") == 0)
+                default_policy = policy;
+            else
+                unknown_policy = policy;
+            continue;
+        }
+
+        if (str2ba(tok, &addr) != 0) {
+            rl_printf("%s:%d: invalid address \"%s\"\n", path, lineno, tok);
+            continue;
+        }
+
+        tok = strtok_r(NULL, " \t", &save);
+        own = tok != NULL;
+        if (own && !parse_policy(tok, &save, &policy)) {
+            rl_printf("%s:%d: invalid action\n", path, lineno);
+            continue;
+        }
+
+        for (i = 0; i < devs_count; i++)
+            if (!memcmp(&devs[i].addr, &addr, sizeof(addr)))
+                break;
+
+        if (i < devs_count) {
+            rl_printf("%s:%d: duplicated address %s\n", path, lineno,
+                      ba2str(addr.address, addr_str));
+            continue;
+        }
+
+        if (devs_count == BATCH_DEVS_MAX) {
+            rl_printf("%s:%d: too many devices (max %d)\n", path, lineno,
+                      BATCH_DEVS_MAX);
+            break;
+        }
+
+        memset(&devs[devs_count], 0, sizeof(batch_dev_t));
+        memcpy(&devs[devs_count].addr, &addr, sizeof(addr));
+        devs[devs_count].own_policy = own;
+        if (own)
+            devs[devs_count].policy = policy;
+        devs_count++;
+    }
+
+    fclose(f);
+
+    rl_printf("Loaded %d devices\n", devs_count);
+
+    return devs_count > 0;
+}
+
+bool batch_set_slots(int n) {
+
+    if (running || n < 1 || n > BATCH_SLOTS_MAX)
+        return false;
+
+    slots_count = n;
+    return true;
+}
+
+bool batch_set_timeout(unsigned int ms) {
+
+    if (running || ms == 0)
+        return false;
+
+    timeout_ms = ms;
+    return true;
+}
+
+/* Returns the device of the batch with addr, NULL if not in the batch */
+static batch_dev_t *find_dev(const bt_bdaddr_t *addr) {
+    int i;
+
+    for (i = 0; i < devs_count; i++)
+        if (!memcmp(&devs[i].addr, addr, sizeof(*addr)))
+            return &devs[i];
+
+    return NULL;
+}
+
+static slot_t *find_slot(const bt_bdaddr_t *addr) {
+    int i;
+
+    for (i = 0; i < BATCH_SLOTS_MAX; i++)
+        if (slots[i].dev >= 0 &&
+            !memcmp(&devs[slots[i].dev].addr, addr, sizeof(*addr)))
+            return &slots[i];
+
+    return NULL;
+}
+
+/* Returns the policy for requests of addr and records the method used on its
+ * device. Must be called with the lock held. */
+static const policy_t *request_policy(const bt_bdaddr_t *addr,
+                                      const char *method, bool *known) {
+    batch_dev_t *dev = find_dev(addr);
+
+    *known = dev != NULL;
+    if (dev == NULL)
+        return &unknown_policy;
+
+    dev->method = method;
+    return dev->own_policy ? &dev->policy : &default_policy;
+}
+
+/* Records a request rejected by the policy. Must be called with the lock
+ * held. */
+static void rejected(const bt_bdaddr_t *addr, bool known) {
+    char addr_str[BT_ADDRESS_STR_LEN];
+    batch_dev_t *dev;
+
+    if (!known) {
+        rl_printf("Rejected pairing request of %s, not in the batch\n",
+                  ba2str(addr->address, addr_str));
+        return;
+    }
+
+    dev = find_dev(addr);
+    dev->rejected = true;
+}
+
+bool batch_ssp_request(const bt_bdaddr_t *addr, bt_ssp_variant_t variant,
+                       uint32_t passkey) {
+    char addr_str[BT_ADDRESS_STR_LEN];
+    const policy_t *policy;
+    policy_t p;
+    bool accept = false, known;
+    const char *method;
+
+    switch (variant) {
+        case BT_SSP_VARIANT_CONSENT:
+            method = "consent";
+            break;
+        case BT_SSP_VARIANT_PASSKEY_CONFIRMATION:
+            method = "numeric comparison";
+            break;
+        case BT_SSP_VARIANT_PASSKEY_ENTRY:
+            method = "passkey entry";
+            break;
+        default:
+            method = "passkey notification";
+            break;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    if (!running) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+
+    policy = request_policy(addr, method, &known);
+    memcpy(&p, policy, sizeof(p));
+
+    switch (variant) {
+        case BT_SSP_VARIANT_CONSENT:
+            accept = p.action == ACTION_ACCEPT;
+            break;
+        case BT_SSP_VARIANT_PASSKEY_CONFIRMATION:
+            accept = p.action == ACTION_ACCEPT ||
+                     (p.action == ACTION_PASSKEY && p.passkey == passkey);
+            break;
+        case BT_SSP_VARIANT_PASSKEY_ENTRY:
+            accept = p.action == ACTION_PASSKEY;
+            passkey = p.passkey;
+            break;
+        default:
+            /* the peer enters it, nothing to reply */
+            accept = p.action != ACTION_REJECT;
+            if (accept)
+                rl_printf("Enter passkey on %s: %06u\n",
+                          ba2str(addr->address, addr_str), passkey);
+            break;
+    }
+
+    if (!accept)
+        rejected(addr, known);
+
+    pthread_mutex_unlock(&lock);
+
+    if (variant != BT_SSP_VARIANT_PASSKEY_NOTIFICATION || !accept)
+        HAL_CALL(bt_iface, ssp_reply, addr, variant, accept, passkey);
+
+    return true;
+}
+
+bool batch_pin_request(const bt_bdaddr_t *addr) {
+    const policy_t *policy;
+    policy_t p;
+    bool known;
+
+    pthread_mutex_lock(&lock);
+
+    if (!running) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+
+    policy = request_policy(addr, "pin", &known);
+    memcpy(&p, policy, sizeof(p));
+
+    if (p.action != ACTION_PIN)
+        rejected(addr, known);
+
+    pthread_mutex_unlock(&lock);
+
+    HAL_CALL(bt_iface, pin_reply, addr, p.action == ACTION_PIN, p.pin_len,
+             &p.pin);
+
+    return true;
+}
+
+bool batch_bond_state(bt_status_t status, const bt_bdaddr_t *addr,
+                      bt_bond_state_t state) {
+    slot_t *s;
+
+    pthread_mutex_lock(&lock);
+
+    s = running ? find_slot(addr) : NULL;
+    if (s != NULL) {
+        if (state == BT_BOND_STATE_BONDED && status == BT_STATUS_SUCCESS)
+            s->bonded = true;
+        else if (state == BT_BOND_STATE_NONE ||
+                 status != BT_STATUS_SUCCESS) {
+            s->failed = true;
+            s->status = status;
+        }
+        schedule_run();
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return s != NULL;
+}
+
+static bool expire(void *user_data) {
+    slot_t *s = user_data;
+
+    pthread_mutex_lock(&lock);
+    s->deadline = 0;
+    s->deadline_us = 0;
+    s->expired = true;
+    schedule_run();
+    pthread_mutex_unlock(&lock);
+
+    return false;
+}
+
+/* True if the adapter reports addr among its bonded devices */
+static bool is_bonded(const bt_bdaddr_t *addr) {
+    static adapter_info_t info; /* large, only used on the main loop */
+    int i, n;
+
+    adapter_get(&info);
+    if (!(info.fields & ADAPTER_HAS_BONDED))
+        return false;
+
+    n = info.bonded_count < ADAPTER_BONDED_MAX ? info.bonded_count :
+                                                 ADAPTER_BONDED_MAX;
+    for (i = 0; i < n; i++)
+        if (!memcmp(&info.bonded[i], addr, sizeof(*addr)))
+            return true;
+
+    return false;
+}
+
+/* Prints the outcome of a device */
+static void print_dev(const batch_dev_t *dev) {
+    char addr_str[BT_ADDRESS_STR_LEN];
+
+    ba2str(dev->addr.address, addr_str);
+
+    switch (dev->state) {
+        case DEV_PENDING:
+            rl_printf("%s pending\n", addr_str);
+            break;
+        case DEV_PAIRING:
+            rl_printf("%s pairing\n", addr_str);
+            break;
+        case DEV_PAIRED:
+            rl_printf("%s paired in %u ms (%s)\n", addr_str, dev->ms,
+                      dev->method ? dev->method : "just works");
+            break;
+        case DEV_BONDED:
+            rl_printf("%s already bonded\n", addr_str);
+            break;
+        case DEV_FAILED:
+            if (dev->status != 0)
+                rl_printf("%s failed after %u ms: %s, status: %d\n",
+                          addr_str, dev->ms, dev->error, dev->status);
+            else
+                rl_printf("%s failed after %u ms: %s\n", addr_str, dev->ms,
+                          dev->error);
+            break;
+    }
+}
+
+/* Starts pairing the next device on a free slot. Returns false if the stack
+ * is busy and it must be tried again later. */
+static bool start_slot(slot_t *s) {
+    batch_dev_t *dev = &devs[next_dev];
+    bt_status_t status;
+
+    if (is_bonded(&dev->addr)) {
+        dev->state = DEV_BONDED;
+        bonded++;
+        next_dev++;
+        print_dev(dev);
+        return true;
+    }
+
+    pthread_mutex_lock(&lock);
+    dev->method = NULL;
+    dev->rejected = false;
+    s->dev = next_dev;
+    s->bonded = s->failed = s->expired = false;
+    s->status = 0;
+    pthread_mutex_unlock(&lock);
+
+    s->start_us = monotonic_us();
+
+    status = HAL_CALL(bt_iface, create_bond, &dev->addr);
+    if (status == BT_STATUS_BUSY) {
+        pthread_mutex_lock(&lock);
+        s->dev = -1;
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+
+    next_dev++;
+
+    if (status != BT_STATUS_SUCCESS) {
+        pthread_mutex_lock(&lock);
+        s->dev = -1;
+        pthread_mutex_unlock(&lock);
+
+        dev->state = DEV_FAILED;
+        dev->error = "unable to start pairing";
+        dev->status = status;
+        dev->ms = 0;
+        failed++;
+        print_dev(dev);
+        return true;
+    }
+
+    dev->state = DEV_PAIRING;
+
+    /* without a timeout the tick expires the slot */
+    pthread_mutex_lock(&lock);
+    s->deadline_us = s->start_us + (uint64_t) timeout_ms * 1000;
+    pthread_mutex_unlock(&lock);
+    s->deadline = timeout_add(timeout_ms, expire, s);
+
+    return true;
+}
+
+/* Completes the device of a slot, paired unless error is set */
+static void finish_slot(slot_t *s, const char *error, int status) {
+    batch_dev_t *dev = &devs[s->dev];
+
+    timeout_remove(s->deadline);
+    s->deadline = 0;
+    s->deadline_us = 0;
+
+    dev->ms = (monotonic_us() - s->start_us) / 1000;
+    dev->error = error;
+    dev->status = status;
+
+    if (error == NULL) {
+        dev->state = DEV_PAIRED;
+        paired++;
+    } else {
+        dev->state = DEV_FAILED;
+        failed++;
+    }
+
+    print_dev(dev);
+
+    pthread_mutex_lock(&lock);
+    s->dev = -1;
+    pthread_mutex_unlock(&lock);
+}
+
+/* Advances a slot after an event */
+static void step_slot(slot_t *s) {
+    batch_dev_t *dev = &devs[s->dev];
+    bool is_bonded, is_failed, expired, rejected;
+    int status;
+
+    pthread_mutex_lock(&lock);
+    is_bonded = s->bonded;
+    is_failed = s->failed;
+    expired = s->expired;
+    status = s->status;
+    rejected = dev->rejected;
+    pthread_mutex_unlock(&lock);
+
+    if (is_bonded)
+        finish_slot(s, NULL, 0);
+    else if (is_failed)
+        finish_slot(s, rejected ? "rejected by policy" : "pairing failed",
+                    status);
+    else if (expired || stopping) {
+        HAL_CALL(bt_iface, cancel_bond, &dev->addr);
+        finish_slot(s, expired ? "timeout" : "stopped", 0);
+    }
+}
+
+static bool run(void *user_data) {
+    bool busy = false, retry = false;
+    uint64_t ms;
+    int i;
+
+    pthread_mutex_lock(&lock);
+    run_pending = false;
+    pthread_mutex_unlock(&lock);
+
+    if (!running)
+        return false;
+
+    for (i = 0; i < slots_count; i++)
+        if (slots[i].dev >= 0)
+            step_slot(&slots[i]);
+
+    for (i = 0; i < slots_count; i++) {
+        while (!stopping && !retry && slots[i].dev < 0 &&
+               next_dev < devs_count)
+            retry = !start_slot(&slots[i]);
+        if (slots[i].dev >= 0)
+            busy = true;
+    }
+
+    /* or the tick, if the timeout can't be armed */
+    if (retry && retry_timeout == 0)
+        retry_timeout = timeout_add(BUSY_RETRY_MS, retry_run, NULL);
+
+    if (busy || retry)
+        return false;
+
+    ms = (monotonic_us() - start_us) / 1000;
+
+    if (stopping)
+        rl_printf("Pairing stopped: %d of %d devices paired in %llu ms\n",
+                  paired, devs_count, (unsigned long long) ms);
+    else
+        rl_printf("Pairing finished: %d of %d devices paired, %d already "
+                  "bonded, %d failed in %llu ms, %.1f devices/min\n", paired,
+                  devs_count, bonded, failed, (unsigned long long) ms,
+                  ms > 0 ? paired * 60000.0 / ms : 0.0);
+
+    pthread_mutex_lock(&lock);
+    running = stopping = false;
+    pthread_mutex_unlock(&lock);
+
+    timeout_remove(tick_timeout);
+    timeout_remove(retry_timeout);
+    tick_timeout = retry_timeout = 0;
+
+    return false;
+}
+
+static bool retry_run(void *user_data) {
+
+    retry_timeout = 0;
+    run(NULL);
+
+    return false;
+}
+
+/* Expires the slots whose deadline couldn't be armed, then runs the state
+ * machine in case a scheduled run couldn't be either */
+static bool tick(void *user_data) {
+    uint64_t now = monotonic_us();
+    int i;
+
+    pthread_mutex_lock(&lock);
+    for (i = 0; i < slots_count; i++)
+        if (slots[i].dev >= 0 && slots[i].deadline == 0 &&
+            slots[i].deadline_us != 0 && now >= slots[i].deadline_us) {
+            slots[i].deadline_us = 0;
+            slots[i].expired = true;
+        }
+    pthread_mutex_unlock(&lock);
+
+    run(NULL);
+
+    return running;
+}
+
+bool batch_start() {
+    int i;
+
+    if (running || bt_iface == NULL)
+        return false;
+
+    if (devs_count == 0) {
+        rl_printf("Load devices first\n");
+        return false;
+    }
+
+    tick_timeout = timeout_add(TICK_MS, tick, NULL);
+    if (tick_timeout == 0) {
+        rl_printf("Unable to pair: No timeout available\n");
+        return false;
+    }
+
+    for (i = 0; i < devs_count; i++) {
+        devs[i].state = DEV_PENDING;
+        devs[i].method = NULL;
+        devs[i].error = NULL;
+        devs[i].status = 0;
+        devs[i].ms = 0;
+    }
+
+    for (i = 0; i < BATCH_SLOTS_MAX; i++)
+        slots[i].dev = -1;
+
+    stopping = false;
+    next_dev = 0;
+    paired = bonded = failed = 0;
+    start_us = monotonic_us();
+
+    pthread_mutex_lock(&lock);
+    running = true;
+    schedule_run();
+    pthread_mutex_unlock(&lock);
+
+    return true;
+}
+
+bool batch_stop() {
+
+    if (!running || stopping)
+        return false;
+
+    stopping = true;
+
+    pthread_mutex_lock(&lock);
+    schedule_run();
+    pthread_mutex_unlock(&lock);
+
+    return true;
+}
+
+bool batch_running() {
+
+    return running;
+}
+
+static void print_policy(const char *name, const policy_t *policy) {
+
+    switch (policy->action) {
+        case ACTION_PIN:
+            rl_printf("%s: pin %.*s\n", name, policy->pin_len,
+                      (const char *) policy->pin.pin);
+            break;
+        case ACTION_PASSKEY:
+            rl_printf("%s: passkey %06u\n", name, policy->passkey);
+            break;
+        default:
+            rl_printf("%s: %s\n", name, action_names[policy->action]);
+            break;
+    }
+}
+
+void batch_print_status() {
+    uint64_t ms;
+    int i;
+
+    rl_printf("Pairing %s, %d slot%s, timeout %u ms\n",
+              running ? (stopping ? "stopping" : "running") : "stopped",
+              slots_count, slots_count == 1 ? "" : "s", timeout_ms);
+
+    print_policy("Default", &default_policy);
+    print_policy("Unknown devices", &unknown_policy);
+
+    if (running) {
+        ms = (monotonic_us() - start_us) / 1000;
+        rl_printf("Progress: %d of %d devices done, %d paired, %d failed, "
+                  "%.1f devices/min\n", paired + bonded + failed, devs_count,
+                  paired, failed, ms > 0 ? paired * 60000.0 / ms : 0.0);
+    }
+
+    for (i = 0; i < devs_count; i++)
+        print_dev(&devs[i]);
+}
@@ -0,0 +1,56 @@
+#ifndef __PAIR_BATCH_H__
+#define __PAIR_BATCH_H__
+
+#include <stdbool.h>
+#include <hardware/bluetooth.h>
+
+/* Maximum number of devices in a batch */
+#define BATCH_DEVS_MAX 256
+/* Maximum number of devices paired at the same time */
+#define BATCH_SLOTS_MAX 4
+/* Default limit for pairing one device */
+#define BATCH_TIMEOUT_DEFAULT 30000
+
+/* Batch pairing: the devices of a policy file are bonded, up to a number at
+ * the same time, and the pairing requests of the stack are answered from the
+ * policy instead of asking the user. The outcome and time of each device are
+ * printed from the main loop as it completes.
+ *
+ * A policy file has one entry per line, # starts a comment:
+ *   <address> [action]   pairs the device, with its own action
+ *   default <action>     action of devices without their own (accept)
+ *   unknown <action>     action for requests of devices not in the file
+ *                        while the batch runs (reject)
+ * where action is one of
+ *   accept               accepts consent and numeric comparison requests
+ *   reject               rejects every request
+ *   pin <digits>         replies to PIN requests, 1 to 16 digits
+ *   passkey <number>     replies to passkey entry requests, and accepts
+ *                        numeric comparison only for this value */
+
+void batch_set_interface(const bt_interface_t *iface);
+
+/* Configuration, only while stopped. batch_load() replaces the devices and
+ * policy, printing errors, and returns false if nothing could be loaded. */
+bool batch_load(const char *path);
+bool batch_set_slots(int slots);
+bool batch_set_timeout(unsigned int ms);
+
+/* Starts pairing. Prints why and returns false if it can't. */
+bool batch_start();
+/* Cancels the devices being paired. Returns false if not running. */
+bool batch_stop();
+bool batch_running();
+
+/* Prints configuration, progress and the outcome of each device */
+void batch_print_status();
+
+/* Stack events. While the batch runs, they are handled and true is returned;
+ * otherwise they are left to the caller. */
+bool batch_bond_state(bt_status_t status, const bt_bdaddr_t *addr,
+                      bt_bond_state_t state);
+bool batch_ssp_request(const bt_bdaddr_t *addr, bt_ssp_variant_t variant,
+                       uint32_t passkey);
+bool batch_pin_request(const bt_bdaddr_t *addr);
+
+#endif /* __PAIR_BATCH_H__ */
@@ -0,0 +1,1597 @@
+/*
+ * Recording and replay of Bluetooth stack callbacks
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <hardware/bluetooth.h>
+#include <hardware/bt_gatt.h>
+#include <hardware/bt_gatt_client.h>
+
+#include "record.h"
+#include "mem.h"
+#include "rl_helper.h"
+#include "timeout.h"
+#include "util.h"
+
+/* Size of the stdio buffer of the recording */
+#define RECORD_BUFFER_SIZE (64 * 1024)
+/* Most properties in a properties callback */
+#define PROPERTIES_MAX 32
+
+typedef enum {
+    EV_COMMAND = 1,
+    EV_ADAPTER_STATE,
+    EV_ADAPTER_PROPERTIES,
+    EV_REMOTE_PROPERTIES,
+    EV_DEVICE_FOUND,
+    EV_DISCOVERY_STATE,
+    EV_PIN_REQUEST,
+    EV_SSP_REQUEST,
+    EV_BOND_STATE,
+    EV_ACL_STATE,
+    EV_THREAD_EVENT,
+    EV_REGISTER_CLIENT,
+    EV_SCAN_RESULT,
+    EV_OPEN,
+    EV_CLOSE,
+    EV_SEARCH_COMPLETE,
+    EV_SEARCH_RESULT,
+    EV_GET_CHAR,
+    EV_GET_DESC,
+    EV_GET_INCLUDED,
+    EV_REG_NOTIF,
+    EV_NOTIFY,
+    EV_READ_CHAR,
+    EV_WRITE_CHAR,
+    EV_READ_DESC,
+    EV_WRITE_DESC,
+    EV_EXECUTE_WRITE,
+    EV_RSSI,
+} event_type_t;
+
+/* Length of the advertising data of scan results */
+#define ADV_DATA_LEN 62
+
+/* Encodes v as a varint in buf, returns the number of bytes used */
+static size_t varint(uint8_t *buf, uint64_t v) {
+    size_t n = 0;
+
+    do {
+        buf[n] = v & 0x7f;
+        v >>= 7;
+        if (v != 0)
+            buf[n] |= 0x80;
+        n++;
+    } while (v != 0);
+
+    return n;
+}
+
+/*
+ * Recording
+ */
+
+/* Callbacks arrive on the stack thread and commands on the main thread, the
+ * lock keeps events whole and in order */
+static pthread_mutex_t rec_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *rec_file = NULL;
+static uint64_t rec_last_us;
+static unsigned int rec_dropped;
+static int rec_flush_timeout = 0;
+
+/* event being encoded */
+static struct {
+    uint8_t type;
+    uint8_t data[RECORD_EVENT_MAX];
+    size_t len;
+    bool overflow;
+} ev;
+
+static const bt_interface_t *real_iface;
+static bt_interface_t rec_iface;
+static const bt_callbacks_t *app_cbs;
+static bt_callbacks_t rec_cbs;
+
+static const btgatt_interface_t *real_gatt;
+static btgatt_interface_t rec_gatt;
+static const btgatt_client_callbacks_t *app_gatt_client;
+static btgatt_client_callbacks_t rec_gatt_client;
+static btgatt_callbacks_t rec_gatt_cbs;
+
+static void put(const void *data, size_t len) {
+
+    if (ev.overflow || ev.len + len > sizeof(ev.data)) {
+        ev.overflow = true;
+        return;
+    }
+
+    memcpy(ev.data + ev.len, data, len);
+    ev.len += len;
+}
+
+static void put_varint(uint64_t v) {
+    uint8_t buf[10];
+
+    put(buf, varint(buf, v));
+}
+
+static void put_int(int64_t v) {
+
+    put_varint(((uint64_t) v << 1) ^ (uint64_t) (v >> 63));
+}
+
+static void put_ptr(const void *p, size_t len) {
+
+    if (p == NULL) {
+        put_varint(0);
+        return;
+    }
+
+    put_varint(len + 1);
+    put(p, len);
+}
+
+static void put_props(int num, const bt_property_t *props) {
+    int i;
+
+    if (props == NULL)
+        num = 0;
+
+    put_int(num);
+    for (i = 0; i < num; i++) {
+        put_int(props[i].type);
+        put_ptr(props[i].val, props[i].len);
+    }
+}
+
+/* Starts an event, returns false if not recording. On success the lock is
+ * held until ev_end(). */
+static bool ev_begin(event_type_t type) {
+
+    pthread_mutex_lock(&rec_lock);
+
+    if (rec_file == NULL) {
+        pthread_mutex_unlock(&rec_lock);
+        return false;
+    }
+
+    ev.type = type;
+    ev.len = 0;
+    ev.overflow = false;
+
+    return true;
+}
+
+static void ev_end() {
+    uint64_t now = monotonic_us();
+    uint8_t hdr[21];
+    size_t n;
+
+    if (ev.overflow) {
+        rec_dropped++;
+        pthread_mutex_unlock(&rec_lock);
+        return;
+    }
+
+    n = varint(hdr, now - rec_last_us);
+    hdr[n++] = ev.type;
+    n += varint(hdr + n, ev.len);
+    rec_last_us = now;
+
+    if (fwrite(hdr, 1, n, rec_file) != n ||
+        fwrite(ev.data, 1, ev.len, rec_file) != ev.len)
+        rec_dropped++;
+
+    pthread_mutex_unlock(&rec_lock);
+}
+
+static void rec_adapter_state_cb(bt_state_t state) {
+
+    if (ev_begin(EV_ADAPTER_STATE)) {
+        put_int(state);
+        ev_end();
+    }
+
+    app_cbs->adapter_state_changed_cb(state);
+}
+
+static void rec_adapter_properties_cb(bt_status_t status, int num_properties,
+                                      bt_property_t *properties) {
+
+    if (ev_begin(EV_ADAPTER_PROPERTIES)) {
+        put_int(status);
+        put_props(num_properties, properties);
+        ev_end();
+    }
+
+    app_cbs->adapter_properties_cb(status, num_properties, properties);
+}
+
+static void rec_remote_properties_cb(bt_status_t status, bt_bdaddr_t *bd_addr,
+                                     int num_properties,
+                                     bt_property_t *properties) {
+
+    if (ev_begin(EV_REMOTE_PROPERTIES)) {
+        put_int(status);
+        put_ptr(bd_addr, sizeof(*bd_addr));
+        put_props(num_properties, properties);
+        ev_end();
+    }
+
+    app_cbs->remote_device_properties_cb(status, bd_addr, num_properties,
+                                         properties);
+}
+
+static void rec_device_found_cb(int num_properties,
+                                bt_property_t *properties) {
+
+    if (ev_begin(EV_DEVICE_FOUND)) {
+        put_props(num_properties, properties);
+        ev_end();
+    }
+
+    app_cbs->device_found_cb(num_properties, properties);
+}
+
+static void rec_discovery_state_cb(bt_discovery_state_t state) {
+
+    if (ev_begin(EV_DISCOVERY_STATE)) {
+        put_int(state);
+        ev_end();
+    }
+
+    app_cbs->discovery_state_changed_cb(state);
+}
+
+static void rec_pin_request_cb(bt_bdaddr_t *remote_bd_addr,
+                               bt_bdname_t *bd_name, uint32_t cod) {
+
+    if (ev_begin(EV_PIN_REQUEST)) {
+        put_ptr(remote_bd_addr, sizeof(*remote_bd_addr));
+        put_ptr(bd_name, sizeof(*bd_name));
+        put_int(cod);
+        ev_end();
+    }
+
+    app_cbs->pin_request_cb(remote_bd_addr, bd_name, cod);
+}
+
+static void rec_ssp_request_cb(bt_bdaddr_t *remote_bd_addr,
+                               bt_bdname_t *bd_name, uint32_t cod,
+                               bt_ssp_variant_t pairing_variant,
+                               uint32_t pass_key) {
+
+    if (ev_begin(EV_SSP_REQUEST)) {
+        put_ptr(remote_bd_addr, sizeof(*remote_bd_addr));
+        put_ptr(bd_name, sizeof(*bd_name));
+        put_int(cod);
+        put_int(pairing_variant);
+        put_int(pass_key);
+        ev_end();
+    }
+
+    app_cbs->ssp_request_cb(remote_bd_addr, bd_name, cod, pairing_variant,
+                            pass_key);
+}
+
+static void rec_bond_state_cb(bt_status_t status, bt_bdaddr_t *remote_bd_addr,
+                              bt_bond_state_t state) {
+
+    if (ev_begin(EV_BOND_STATE)) {
+        put_int(status);
+        put_ptr(remote_bd_addr, sizeof(*remote_bd_addr));
+        put_int(state);
+        ev_end();
+    }
+
+    app_cbs->bond_state_changed_cb(status, remote_bd_addr, state);
+}
+
+static void rec_acl_state_cb(bt_status_t status, bt_bdaddr_t *remote_bd_addr,
+                             bt_acl_state_t state) {
+
+    if (ev_begin(EV_ACL_STATE)) {
+        put_int(status);
+        put_ptr(remote_bd_addr, sizeof(*remote_bd_addr));
+        put_int(state);
+        ev_end();
+    }
+
+    app_cbs->acl_state_changed_cb(status, remote_bd_addr, state);
+}
+
+static void rec_thread_event_cb(bt_cb_thread_evt evt) {
+
+    if (ev_begin(EV_THREAD_EVENT)) {
+        put_int(evt);
+        ev_end();
+    }
+
+    app_cbs->thread_evt_cb(evt);
+}
+
+static void rec_register_client_cb(int status, int client_if,
+                                   bt_uuid_t *app_uuid) {
+
+    if (ev_begin(EV_REGISTER_CLIENT)) {
+        put_int(status);
+        put_int(client_if);
+        put_ptr(app_uuid, sizeof(*app_uuid));
+        ev_end();
+    }
+
+    app_gatt_client->register_client_cb(status, client_if, app_uuid);
+}
+
+static void rec_scan_result_cb(bt_bdaddr_t *bda, int rssi, uint8_t *adv_data) {
+
+    if (ev_begin(EV_SCAN_RESULT)) {
+        put_ptr(bda, sizeof(*bda));
+        put_int(rssi);
+        put_ptr(adv_data, ADV_DATA_LEN);
+        ev_end();
+    }
+
+    app_gatt_client->scan_result_cb(bda, rssi, adv_data);
+}
+
+static void rec_open_cb(int conn_id, int status, int client_if,
+                        bt_bdaddr_t *bda) {
+
+    if (ev_begin(EV_OPEN)) {
+        put_int(conn_id);
+        put_int(status);
+        put_int(client_if);
+        put_ptr(bda, sizeof(*bda));
+        ev_end();
+    }
+
+    app_gatt_client->open_cb(conn_id, status, client_if, bda);
+}
+
+static void rec_close_cb(int conn_id, int status, int client_if,
+                         bt_bdaddr_t *bda) {
+
+    if (ev_begin(EV_CLOSE)) {
+        put_int(conn_id);
+        put_int(status);
+        put_int(client_if);
+        put_ptr(bda, sizeof(*bda));
+        ev_end();
+    }
+
+    app_gatt_client->close_cb(conn_id, status, client_if, bda);
+}
+
+static void rec_search_complete_cb(int conn_id, int status) {
+
+    if (ev_begin(EV_SEARCH_COMPLETE)) {
+        put_int(conn_id);
+        put_int(status);
+        ev_end();
+    }
+
+    app_gatt_client->search_complete_cb(conn_id, status);
+}
+
+static void rec_search_result_cb(int conn_id, btgatt_srvc_id_t *srvc_id) {
+
+    if (ev_begin(EV_SEARCH_RESULT)) {
+        put_int(conn_id);
+        put_ptr(srvc_id, sizeof(*srvc_id));
+        ev_end();
+    }
+
+    app_gatt_client->search_result_cb(conn_id, srvc_id);
+}
+
+static void rec_get_char_cb(int conn_id, int status, btgatt_srvc_id_t *srvc_id,
+                            btgatt_char_id_t *char_id, int char_prop) {
+
+    if (ev_begin(EV_GET_CHAR)) {
+        put_int(conn_id);
+        put_int(status);
+        put_ptr(srvc_id, sizeof(*srvc_id));
+        put_ptr(char_id, sizeof(*char_id));
+        put_int(char_prop);
+        ev_end();
+    }
+
+    app_gatt_client->get_characteristic_cb(conn_id, status, srvc_id, char_id,
+                                           char_prop);
+}
+
+static void rec_get_desc_cb(int conn_id, int status, btgatt_srvc_id_t *srvc_id,
+                            btgatt_char_id_t *char_id, bt_uuid_t *descr_id) {
+
+    if (ev_begin(EV_GET_DESC)) {
+        put_int(conn_id);
+        put_int(status);
+        put_ptr(srvc_id, sizeof(*srvc_id));
+        put_ptr(char_id, sizeof(*char_id));
+        put_ptr(descr_id, sizeof(*descr_id));
+        ev_end();
+    }
+
+    app_gatt_client->get_descriptor_cb(conn_id, status, srvc_id, char_id,
+                                       descr_id);
+}
+
+static void rec_get_included_cb(int conn_id, int status,
+                                btgatt_srvc_id_t *srvc_id,
+                                btgatt_srvc_id_t *incl_srvc_id) {
+
+    if (ev_begin(EV_GET_INCLUDED)) {
+        put_int(conn_id);
+        put_int(status);
+        put_ptr(srvc_id, sizeof(*srvc_id));
+        put_ptr(incl_srvc_id, sizeof(*incl_srvc_id));
+        ev_end();
+    }
+
+    app_gatt_client->get_included_service_cb(conn_id, status, srvc_id,
+                                             incl_srvc_id);
+}
+
+static void rec_reg_notif_cb(int conn_id, int registered, int status,
+                             btgatt_srvc_id_t *srvc_id,
+                             btgatt_char_id_t *char_id) {
+
+    if (ev_begin(EV_REG_NOTIF)) {
+        put_int(conn_id);
+        put_int(registered);
+        put_int(status);
+        put_ptr(srvc_id, sizeof(*srvc_id));
+        put_ptr(char_id, sizeof(*char_id));
+        ev_end();
+    }
+
+    app_gatt_client->register_for_notification_cb(conn_id, registered, status,
+                                                  srvc_id, char_id);
+}
+
+static void rec_notify_cb(int conn_id, btgatt_notify_params_t *p_data) {
+
+    if (ev_begin(EV_NOTIFY)) {
+        put_int(conn_id);
+        put_ptr(&p_data->bda, sizeof(p_data->bda));
+        put_ptr(&p_data->srvc_id, sizeof(p_data->srvc_id));
+        put_ptr(&p_data->char_id, sizeof(p_data->char_id));
+        put_int(p_data->is_notify);
+        put_ptr(p_data->value, p_data->len);
+        ev_end();
+    }
+
+    app_gatt_client->notify_cb(conn_id, p_data);
+}
+
+static void put_read_params(const btgatt_read_params_t *p) {
+
+    put_ptr(&p->srvc_id, sizeof(p->srvc_id));
+    put_ptr(&p->char_id, sizeof(p->char_id));
+    put_ptr(&p->descr_id, sizeof(p->descr_id));
+    put_int(p->value_type);
+    put_int(p->status);
+    put_ptr(p->value.value, p->value.len);
+}
+
+static void put_write_params(const btgatt_write_params_t *p) {
+
+    put_ptr(&p->srvc_id, sizeof(p->srvc_id));
+    put_ptr(&p->char_id, sizeof(p->char_id));
+    put_ptr(&p->descr_id, sizeof(p->descr_id));
+    put_int(p->status);
+}
+
+static void rec_read_char_cb(int conn_id, int status,
+                             btgatt_read_params_t *p_data) {
+
+    if (ev_begin(EV_READ_CHAR)) {
+        put_int(conn_id);
+        put_int(status);
+        put_read_params(p_data);
+        ev_end();
+    }
+
+    app_gatt_client->read_characteristic_cb(conn_id, status, p_data);
+}
+
+static void rec_write_char_cb(int conn_id, int status,
+                              btgatt_write_params_t *p_data) {
+
+    if (ev_begin(EV_WRITE_CHAR)) {
+        put_int(conn_id);
+        put_int(status);
+        put_write_params(p_data);
+        ev_end();
+    }
+
+    app_gatt_client->write_characteristic_cb(conn_id, status, p_data);
+}
+
+static void rec_read_desc_cb(int conn_id, int status,
+                             btgatt_read_params_t *p_data) {
+
+    if (ev_begin(EV_READ_DESC)) {
+        put_int(conn_id);
+        put_int(status);
+        put_read_params(p_data);
+        ev_end();
+    }
+
+    app_gatt_client->read_descriptor_cb(conn_id, status, p_data);
+}
+
+static void rec_write_desc_cb(int conn_id, int status,
+                              btgatt_write_params_t *p_data) {
+
+    if (ev_begin(EV_WRITE_DESC)) {
+        put_int(conn_id);
+        put_int(status);
+        put_write_params(p_data);
+        ev_end();
+    }
+
+    app_gatt_client->write_descriptor_cb(conn_id, status, p_data);
+}
+
+static void rec_execute_write_cb(int conn_id, int status) {
+
+    if (ev_begin(EV_EXECUTE_WRITE)) {
+        put_int(conn_id);
+        put_int(status);
+        ev_end();
+    }
+
+    app_gatt_client->execute_write_cb(conn_id, status);
+}
+
+static void rec_rssi_cb(int client_if, bt_bdaddr_t *bda, int rssi,
+                        int status) {
+
+    if (ev_begin(EV_RSSI)) {
+        put_int(client_if);
+        put_ptr(bda, sizeof(*bda));
+        put_int(rssi);
+        put_int(status);
+        ev_end();
+    }
+
+    app_gatt_client->read_remote_rssi_cb(client_if, bda, rssi, status);
+}
+
+/* Wraps the callbacks set by the application, leaving unset ones unset */
+#define WRAP(table, app, field, wrapper) \
+    ((table).field = (app)->field != NULL ? (wrapper) : NULL)
+
+static bt_status_t rec_gatt_init(const btgatt_callbacks_t *callbacks) {
+
+    memcpy(&rec_gatt_cbs, callbacks, sizeof(rec_gatt_cbs));
+
+    if (callbacks->client != NULL) {
+        app_gatt_client = callbacks->client;
+        memcpy(&rec_gatt_client, app_gatt_client, sizeof(rec_gatt_client));
+        WRAP(rec_gatt_client, app_gatt_client, register_client_cb,
+             rec_register_client_cb);
+        WRAP(rec_gatt_client, app_gatt_client, scan_result_cb,
+             rec_scan_result_cb);
+        WRAP(rec_gatt_client, app_gatt_client, open_cb, rec_open_cb);
+        WRAP(rec_gatt_client, app_gatt_client, close_cb, rec_close_cb);
+        WRAP(rec_gatt_client, app_gatt_client, search_complete_cb,
+             rec_search_complete_cb);
+        WRAP(rec_gatt_client, app_gatt_client, search_result_cb,
+             rec_search_result_cb);
+        WRAP(rec_gatt_client, app_gatt_client, get_characteristic_cb,
+             rec_get_char_cb);
+        WRAP(rec_gatt_client, app_gatt_client, get_descriptor_cb,
+             rec_get_desc_cb);
+        WRAP(rec_gatt_client, app_gatt_client, get_included_service_cb,
+             rec_get_included_cb);
+        WRAP(rec_gatt_client, app_gatt_client, register_for_notification_cb,
+             rec_reg_notif_cb);
+        WRAP(rec_gatt_client, app_gatt_client, notify_cb, rec_notify_cb);
+        WRAP(rec_gatt_client, app_gatt_client, read_characteristic_cb,
+             rec_read_char_cb);
+        WRAP(rec_gatt_client, app_gatt_client, write_characteristic_cb,
+             rec_write_char_cb);
+        WRAP(rec_gatt_client, app_gatt_client, read_descriptor_cb,
+             rec_read_desc_cb);
+        WRAP(rec_gatt_client, app_gatt_client, write_descriptor_cb,
+             rec_write_desc_cb);
+        WRAP(rec_gatt_client, app_gatt_client, execute_write_cb,
+             rec_execute_write_cb);
+        WRAP(rec_gatt_client, app_gatt_client, read_remote_rssi_cb,
+             rec_rssi_cb);
+        rec_gatt_cbs.client = &rec_gatt_client;
+    }
+
+    return real_gatt->init(&rec_gatt_cbs);
+}
+
+static const void *rec_get_profile_interface(const char *profile_id) {
+    const void *profile = real_iface->get_profile_interface(profile_id);
+
+    if (profile == NULL || strcmp(profile_id, BT_PROFILE_GATT_ID) != 0)
+        return profile;
+
+    real_gatt = profile;
+    memcpy(&rec_gatt, real_gatt, sizeof(rec_gatt));
+    rec_gatt.size = sizeof(rec_gatt);
+    rec_gatt.init = rec_gatt_init;
+
+    return &rec_gatt;
+}
+
+static int rec_init(bt_callbacks_t *callbacks) {
+
+    app_cbs = callbacks;
+    memcpy(&rec_cbs, callbacks, sizeof(rec_cbs));
+    WRAP(rec_cbs, app_cbs, adapter_state_changed_cb, rec_adapter_state_cb);
+    WRAP(rec_cbs, app_cbs, adapter_properties_cb, rec_adapter_properties_cb);
+    WRAP(rec_cbs, app_cbs, remote_device_properties_cb,
+         rec_remote_properties_cb);
+    WRAP(rec_cbs, app_cbs, device_found_cb, rec_device_found_cb);
+    WRAP(rec_cbs, app_cbs, discovery_state_changed_cb, rec_discovery_state_cb);
+    WRAP(rec_cbs, app_cbs, pin_request_cb, rec_pin_request_cb);
+    WRAP(rec_cbs, app_cbs, ssp_request_cb, rec_ssp_request_cb);
+    WRAP(rec_cbs, app_cbs, bond_state_changed_cb, rec_bond_state_cb);
+    WRAP(rec_cbs, app_cbs, acl_state_changed_cb, rec_acl_state_cb);
+    WRAP(rec_cbs, app_cbs, thread_evt_cb, rec_thread_event_cb);
+
+    return real_iface->init(&rec_cbs);
+}
+
+/* Writes the buffered events. On failure recording stops. */
+static bool rec_flush(void *user_data) {
+    FILE *f = NULL;
+    int err = 0;
+
+    pthread_mutex_lock(&rec_lock);
+    if (rec_file != NULL && fflush(rec_file) != 0) {
+        err = errno;
+        f = rec_file;
+        rec_file = NULL;
+    }
+    pthread_mutex_unlock(&rec_lock);
+
+    if (f == NULL)
+        return true;
+
+    fclose(f);
+    rec_flush_timeout = 0;
+    rl_printf("Failed to write recording, stopped: %s\n", strerror(err));
+    return false;
+}
+
+bool record_open(const char *path) {
+    FILE *f;
+
+    f = fopen(path, "wb");
+    if (f == NULL) {
+        rl_printf("Unable to open recording %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    rec_flush_timeout = timeout_add(RECORD_FLUSH_MS, rec_flush, NULL);
+    if (rec_flush_timeout == 0) {
+        rl_printf("Unable to record: No timeout available\n");
+        fclose(f);
+        return false;
+    }
+
+    setvbuf(f, NULL, _IOFBF, RECORD_BUFFER_SIZE);
+    fwrite(RECORD_MAGIC, 1, sizeof(RECORD_MAGIC) - 1, f);
+
+    pthread_mutex_lock(&rec_lock);
+    rec_file = f;
+    rec_last_us = monotonic_us();
+    rec_dropped = 0;
+    pthread_mutex_unlock(&rec_lock);
+
+    return true;
+}
+
+const bt_interface_t *record_bt_interface(const bt_interface_t *iface) {
+
+    if (rec_file == NULL)
+        return iface;
+
+    real_iface = iface;
+    memcpy(&rec_iface, iface, sizeof(rec_iface));
+    rec_iface.size = sizeof(rec_iface);
+    rec_iface.init = rec_init;
+    rec_iface.get_profile_interface = rec_get_profile_interface;
+
+    return &rec_iface;
+}
+
+void record_command(const char *line) {
+
+    if (ev_begin(EV_COMMAND)) {
+        put_ptr(line, strlen(line) + 1);
+        ev_end();
+    }
+}
+
+void record_close() {
+    FILE *f;
+    unsigned int dropped;
+
+    timeout_remove(rec_flush_timeout);
+    rec_flush_timeout = 0;
+
+    pthread_mutex_lock(&rec_lock);
+    f = rec_file;
+    rec_file = NULL;
+    dropped = rec_dropped;
+    pthread_mutex_unlock(&rec_lock);
+
+    if (f == NULL)
+        return;
+
+    if (fclose(f) != 0)
+        rl_printf("Failed to write recording: %s\n", strerror(errno));
+    else if (dropped > 0)
+        rl_printf("%u events left out of the recording\n", dropped);
+}
+
+/*
+ * Replay
+ */
+
+static struct {
+    bool enabled;
+    FILE *file;
+    double speed;
+    replay_cmd_func_t cmd;
+
+    pthread_t thread;
+    bool started;
+    bool running;
+    bool stop;
+    /* stack thread associated, the application waits for the end of it */
+    bool associated;
+
+    const bt_callbacks_t *cbs;
+    const btgatt_callbacks_t *gatt_cbs;
+
+    /* command handed to the main thread */
+    char *line;
+    bool line_done;
+
+    unsigned int events;
+    unsigned int commands;
+    uint64_t recorded_us;
+    uint64_t start_us;
+    bool corrupt;
+} rp;
+
+/* Protects the flags shared with the main thread */
+static pthread_mutex_t rp_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rp_cond = PTHREAD_COND_INITIALIZER;
+
+/* Arguments of an event. Data referenced by pointers is copied to an aligned
+ * arena, so the callbacks can read it like the buffers of the stack. */
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    size_t pos;
+    uint8_t *arena;
+    size_t arena_pos;
+    bool err;
+} reader_t;
+
+static uint64_t get_varint(reader_t *r) {
+    uint64_t v = 0;
+    int shift = 0;
+
+    while (r->pos < r->len && shift < 64) {
+        uint8_t b = r->data[r->pos++];
+
+        v |= (uint64_t) (b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return v;
+        shift += 7;
+    }
+
+    r->err = true;
+    return 0;
+}
+
+static int64_t get_int(reader_t *r) {
+    uint64_t v = get_varint(r);
+
+    return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+/* Returns a copy of the data of a pointer, or NULL */
+static void *get_ptr(reader_t *r, size_t *len) {
+    uint64_t n = get_varint(r);
+    uint8_t *p;
+
+    *len = 0;
+    if (n == 0 || r->err)
+        return NULL;
+
+    n--;
+    if (n > r->len - r->pos) {
+        r->err = true;
+        return NULL;
+    }
+
+    /* zero terminated, for strings in properties */
+    p = r->arena + r->arena_pos;
+    memcpy(p, r->data + r->pos, n);
+    p[n] = 0;
+    r->pos += n;
+    r->arena_pos += (n + 8) & ~(size_t) 7;
+    *len = n;
+
+    return p;
+}
+
+/* Returns a copy of a structure of size bytes, or NULL */
+static void *get_struct(reader_t *r, size_t size) {
+    size_t len;
+    void *p = get_ptr(r, &len);
+
+    if (p != NULL && len != size) {
+        r->err = true;
+        return NULL;
+    }
+
+    return p;
+}
+
+static int get_props(reader_t *r, bt_property_t *props) {
+    int i, num = get_int(r);
+    size_t len;
+
+    if (num < 0 || num > PROPERTIES_MAX) {
+        r->err = true;
+        return 0;
+    }
+
+    for (i = 0; i < num; i++) {
+        props[i].type = get_int(r);
+        props[i].val = get_ptr(r, &len);
+        props[i].len = len;
+    }
+
+    return num;
+}
+
+static void get_read_params(reader_t *r, btgatt_read_params_t *p) {
+    void *srvc_id, *char_id, *descr_id, *value;
+    size_t len;
+
+    memset(p, 0, sizeof(*p));
+
+    srvc_id = get_struct(r, sizeof(p->srvc_id));
+    char_id = get_struct(r, sizeof(p->char_id));
+    descr_id = get_struct(r, sizeof(p->descr_id));
+    p->value_type = get_int(r);
+    p->status = get_int(r);
+    value = get_ptr(r, &len);
+
+    if (srvc_id != NULL)
+        memcpy(&p->srvc_id, srvc_id, sizeof(p->srvc_id));
+    if (char_id != NULL)
+        memcpy(&p->char_id, char_id, sizeof(p->char_id));
+    if (descr_id != NULL)
+        memcpy(&p->descr_id, descr_id, sizeof(p->descr_id));
+    if (len > sizeof(p->value.value))
+        r->err = true;
+    else if (value != NULL) {
+        memcpy(p->value.value, value, len);
+        p->value.len = len;
+    }
+}
+
+static void get_write_params(reader_t *r, btgatt_write_params_t *p) {
+    void *srvc_id, *char_id, *descr_id;
+
+    memset(p, 0, sizeof(*p));
+
+    srvc_id = get_struct(r, sizeof(p->srvc_id));
+    char_id = get_struct(r, sizeof(p->char_id));
+    descr_id = get_struct(r, sizeof(p->descr_id));
+    p->status = get_int(r);
+
+    if (srvc_id != NULL)
+        memcpy(&p->srvc_id, srvc_id, sizeof(p->srvc_id));
+    if (char_id != NULL)
+        memcpy(&p->char_id, char_id, sizeof(p->char_id));
+    if (descr_id != NULL)
+        memcpy(&p->descr_id, descr_id, sizeof(p->descr_id));
+}
+
+static bool run_command(void *user_data) {
+
+    rp.cmd(rp.line);
+
+    pthread_mutex_lock(&rp_lock);
+    rp.line_done = true;
+    pthread_cond_broadcast(&rp_cond);
+    pthread_mutex_unlock(&rp_lock);
+
+    return false;
+}
+
+/* Runs a command on the main thread and waits for it, as the callbacks that
+ * followed it in the recording may depend on it */
+static void replay_command(char *line) {
+
+    pthread_mutex_lock(&rp_lock);
+    rp.line = line;
+    rp.line_done = false;
+
+    while (!rp.stop && timeout_add(0, run_command, NULL) == 0) {
+        pthread_mutex_unlock(&rp_lock);
+        usleep(1000);
+        pthread_mutex_lock(&rp_lock);
+    }
+
+    while (!rp.stop && !rp.line_done)
+        pthread_cond_wait(&rp_cond, &rp_lock);
+
+    pthread_mutex_unlock(&rp_lock);
+}
+
+/* Calls the callback of an event, returns false if it is malformed */
+static bool dispatch(uint8_t type, reader_t *r) {
+    const bt_callbacks_t *cb = rp.cbs;
+    const btgatt_client_callbacks_t *gc = NULL;
+    bt_property_t props[PROPERTIES_MAX];
+    btgatt_notify_params_t notify;
+    btgatt_read_params_t read;
+    btgatt_write_params_t write;
+    int a, b, c, d, num;
+    void *p1, *p2, *p3;
+    size_t len;
+
+    if (rp.gatt_cbs != NULL)
+        gc = rp.gatt_cbs->client;
+
+    /* arguments are decoded in order, the calls check for errors first */
+    switch (type) {
+        case EV_COMMAND:
+            p1 = get_ptr(r, &len);
+            if (r->err || p1 == NULL || len == 0 ||
+                ((char *) p1)[len - 1] != 0)
+                return false;
+            rp.commands++;
+            replay_command(p1);
+            break;
+        case EV_ADAPTER_STATE:
+            a = get_int(r);
+            if (!r->err && cb->adapter_state_changed_cb != NULL)
+                cb->adapter_state_changed_cb(a);
+            break;
+        case EV_ADAPTER_PROPERTIES:
+            a = get_int(r);
+            num = get_props(r, props);
+            if (!r->err && cb->adapter_properties_cb != NULL)
+                cb->adapter_properties_cb(a, num, props);
+            break;
+        case EV_REMOTE_PROPERTIES:
+            a = get_int(r);
+            p1 = get_struct(r, sizeof(bt_bdaddr_t));
+            num = get_props(r, props);
+            if (!r->err && cb->remote_device_properties_cb != NULL)
+                cb->remote_device_properties_cb(a, p1, num, props);
+            break;
+        case EV_DEVICE_FOUND:
+            num = get_props(r, props);
+            if (!r->err && cb->device_found_cb != NULL)
+                cb->device_found_cb(num, props);
+            break;
+        case EV_DISCOVERY_STATE:
+            a = get_int(r);
+            if (!r->err && cb->discovery_state_changed_cb != NULL)
+                cb->discovery_state_changed_cb(a);
+            break;
+        case EV_PIN_REQUEST:
+            p1 = get_struct(r, sizeof(bt_bdaddr_t));
+            p2 = get_struct(r, sizeof(bt_bdname_t));
+            a = get_int(r);
+            if (!r->err && cb->pin_request_cb != NULL)
+                cb->pin_request_cb(p1, p2, a);
+            break;
+        case EV_SSP_REQUEST:
+            p1 = get_struct(r, sizeof(bt_bdaddr_t));
+            p2 = get_struct(r, sizeof(bt_bdname_t));
+            a = get_int(r);
+            b = get_int(r);
+            c = get_int(r);
+            if (!r->err && cb->ssp_request_cb != NULL)
+                cb->ssp_request_cb(p1, p2, a, b, c);
+            break;
+        case EV_BOND_STATE:
+            a = get_int(r);
+            p1 = get_struct(r, sizeof(bt_bdaddr_t));
+            b = get_int(r);
+            if (!r->err && cb->bond_state_changed_cb != NULL)
+                cb->bond_state_changed_cb(a, p1, b);
+            break;
+        case EV_ACL_STATE:
+            a = get_int(r);
+            p1 = get_struct(r, sizeof(bt_bdaddr_t));
+            b = get_int(r);
+            if (!r->err && cb->acl_state_changed_cb != NULL)
+                cb->acl_state_changed_cb(a, p1, b);
+            break;
+        case EV_THREAD_EVENT:
+            a = get_int(r);
+            if (r->err)
+                break;
+            rp.associated = a == ASSOCIATE_JVM;
+            if (cb->thread_evt_cb != NULL)
+                cb->thread_evt_cb(a);
+            break;
+        case EV_REGISTER_CLIENT:
+            a = get_int(r);
+            b = get_int(r);
+            p1 = get_struct(r, sizeof(bt_uuid_t));
+            if (!r->err && gc != NULL && gc->register_client_cb != NULL)
+                gc->register_client_cb(a, b, p1);
+            break;
+        case EV_SCAN_RESULT:
+            p1 = get_struct(r, sizeof(bt_bdaddr_t));
+            a = get_int(r);
+            p2 = get_struct(r, ADV_DATA_LEN);
+            if (!r->err && gc != NULL && gc->scan_result_cb != NULL)
+                gc->scan_result_cb(p1, a, p2);
+            break;
+        case EV_OPEN:
+        case EV_CLOSE:
+            a = get_int(r);
+            b = get_int(r);
+            c = get_int(r);
+            p1 = get_struct(r, sizeof(bt_bdaddr_t));
+            if (r->err || gc == NULL)
+                break;
+            if (type == EV_OPEN && gc->open_cb != NULL)
+                gc->open_cb(a, b, c, p1);
+            else if (type == EV_CLOSE && gc->close_cb != NULL)
+                gc->close_cb(a, b, c, p1);
+            break;
+        case EV_SEARCH_COMPLETE:
+            a = get_int(r);
+            b = get_int(r);
+            if (!r->err && gc != NULL && gc->search_complete_cb != NULL)
+                gc->search_complete_cb(a, b);
+            break;
+        case EV_SEARCH_RESULT:
+            a = get_int(r);
+            p1 = get_struct(r, sizeof(btgatt_srvc_id_t));
+            if (!r->err && gc != NULL && gc->search_result_cb != NULL)
+                gc->search_result_cb(a, p1);
+            break;
+        case EV_GET_CHAR:
+            a = get_int(r);
+            b = get_int(r);
+            p1 = get_struct(r, sizeof(btgatt_srvc_id_t));
+            p2 = get_struct(r, sizeof(btgatt_char_id_t));
+            c = get_int(r);
+            if (!r->err && gc != NULL && gc->get_characteristic_cb != NULL)
+                gc->get_characteristic_cb(a, b, p1, p2, c);
+            break;
+        case EV_GET_DESC:
+            a = get_int(r);
+            b = get_int(r);
+            p1 = get_struct(r, sizeof(btgatt_srvc_id_t));
+            p2 = get_struct(r, sizeof(btgatt_char_id_t));
+            p3 = get_struct(r, sizeof(bt_uuid_t));
+            if (!r->err && gc != NULL && gc->get_descriptor_cb != NULL)
+                gc->get_descriptor_cb(a, b, p1, p2, p3);
+            break;
+        case EV_GET_INCLUDED:
+            a = get_int(r);
+            b = get_int(r);
+            p1 = get_struct(r, sizeof(btgatt_srvc_id_t));
+            p2 = get_struct(r, sizeof(btgatt_srvc_id_t));
+            if (!r->err && gc != NULL && gc->get_included_service_cb != NULL)
+                gc->get_included_service_cb(a, b, p1, p2);
+            break;
+        case EV_REG_NOTIF:
+            a = get_int(r);
+            b = get_int(r);
+            c = get_int(r);
+            p1 = get_struct(r, sizeof(btgatt_srvc_id_t));
+            p2 = get_struct(r, sizeof(btgatt_char_id_t));
+            if (!r->err && gc != NULL &&
+                gc->register_for_notification_cb != NULL)
+                gc->register_for_notification_cb(a, b, c, p1, p2);
+            break;
+        case EV_NOTIFY:
+            memset(&notify, 0, sizeof(notify));
+            a = get_int(r);
+            p1 = get_struct(r, sizeof(notify.bda));
+            p2 = get_struct(r, sizeof(notify.srvc_id));
+            p3 = get_struct(r, sizeof(notify.char_id));
+            notify.is_notify = get_int(r);
+            if (p1 != NULL)
+                memcpy(&notify.bda, p1, sizeof(notify.bda));
+            if (p2 != NULL)
+                memcpy(&notify.srvc_id, p2, sizeof(notify.srvc_id));
+            if (p3 != NULL)
+                memcpy(&notify.char_id, p3, sizeof(notify.char_id));
+            p1 = get_ptr(r, &len);
+            if (len > sizeof(notify.value))
+                return false;
+            if (p1 != NULL)
+                memcpy(notify.value, p1, len);
+            notify.len = len;
+            if (!r->err && gc != NULL && gc->notify_cb != NULL)
+                gc->notify_cb(a, &notify);
+            break;
+        case EV_READ_CHAR:
+        case EV_READ_DESC:
+            a = get_int(r);
+            b = get_int(r);
+            get_read_params(r, &read);
+            if (r->err || gc == NULL)
+                break;
+            if (type == EV_READ_CHAR && gc->read_characteristic_cb != NULL)
+                gc->read_characteristic_cb(a, b, &read);
+            else if (type == EV_READ_DESC && gc->read_descriptor_cb != NULL)
+                gc->read_descriptor_cb(a, b, &read);
+            break;
+        case EV_WRITE_CHAR:
+        case EV_WRITE_DESC:
+            a = get_int(r);
+            b = get_int(r);
+            get_write_params(r, &write);
+            if (r->err || gc == NULL)
+                break;
+            if (type == EV_WRITE_CHAR && gc->write_characteristic_cb != NULL)
+                gc->write_characteristic_cb(a, b, &write);
+            else if (type == EV_WRITE_DESC && gc->write_descriptor_cb != NULL)
+                gc->write_descriptor_cb(a, b, &write);
+            break;
+        case EV_EXECUTE_WRITE:
+            a = get_int(r);
+            b = get_int(r);
+            if (!r->err && gc != NULL && gc->execute_write_cb != NULL)
+                gc->execute_write_cb(a, b);
+            break;
+        case EV_RSSI:
+            a = get_int(r);
+            p1 = get_struct(r, sizeof(bt_bdaddr_t));
+            b = get_int(r);
+            d = get_int(r);
+            if (!r->err && gc != NULL && gc->read_remote_rssi_cb != NULL)
+                gc->read_remote_rssi_cb(a, p1, b, d);
+            break;
+        default:
+            /* from a newer version, skipped */
+            break;
+    }
+
+    return !r->err;
+}
+
+/* Reads a varint from the recording, returns false at its end */
+static bool read_varint(FILE *f, uint64_t *v) {
+    int shift = 0, c;
+
+    *v = 0;
+    while (shift < 64 && (c = fgetc(f)) != EOF) {
+        *v |= (uint64_t) (c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return true;
+        shift += 7;
+    }
+
+    return false;
+}
+
+static void wait_until(uint64_t when) {
+    uint64_t now;
+
+    /* in slices, so stopping doesn't wait for a long gap */
+    while (!rp.stop && (now = monotonic_us()) < when)
+        usleep(when - now < 50000 ? when - now : 50000);
+}
+
+static bool replay_done(void *user_data) {
+
+    if (rp.corrupt)
+        rl_printf("Replay stopped: recording corrupt after %u events\n",
+                  rp.events);
+    else
+        rl_printf("Replay finished: %u events, %u commands in %llu ms, "
+                  "recorded over %llu ms\n", rp.events, rp.commands,
+                  (unsigned long long) (monotonic_us() - rp.start_us) / 1000,
+                  (unsigned long long) rp.recorded_us / 1000);
+
+    pthread_mutex_lock(&rp_lock);
+    rp.running = false;
+    pthread_mutex_unlock(&rp_lock);
+
+    return false;
+}
+
+static void *replay_thread(void *arg) {
+    uint8_t *data = NULL, *arena = NULL;
+    size_t size = 0;
+    uint64_t delta, len;
+    reader_t r;
+    int type;
+
+    rp.start_us = monotonic_us();
+
+    while (!rp.stop) {
+        if (!read_varint(rp.file, &delta))
+            break;
+
+        type = fgetc(rp.file);
+        if (type == EOF || !read_varint(rp.file, &len) ||
+            len > RECORD_EVENT_MAX) {
+            rp.corrupt = true;
+            break;
+        }
+
+        if (size == 0) {
+            size = RECORD_EVENT_MAX;
+            data = mem_alloc(MEM_REPLAY, size);
+            /* a pointer takes at least a byte, and 8 more in the arena */
+            arena = mem_alloc(MEM_REPLAY, size * 8);
+            if (data == NULL || arena == NULL) {
+                rp.corrupt = true;
+                break;
+            }
+        }
+
+        if (fread(data, 1, len, rp.file) != len) {
+            rp.corrupt = true;
+            break;
+        }
+
+        rp.recorded_us += delta;
+        if (rp.speed > 0)
+            wait_until(rp.start_us + (uint64_t) (rp.recorded_us / rp.speed));
+
+        if (rp.stop)
+            break;
+
+        memset(&r, 0, sizeof(r));
+        r.data = data;
+        r.len = len;
+        r.arena = arena;
+
+        if (!dispatch(type, &r)) {
+            rp.corrupt = true;
+            break;
+        }
+
+        rp.events++;
+    }
+
+    mem_free(data);
+    mem_free(arena);
+
+    /* the replay ends once the main loop reported it */
+    if (rp.stop || timeout_add(0, replay_done, NULL) == 0) {
+        pthread_mutex_lock(&rp_lock);
+        rp.running = false;
+        pthread_mutex_unlock(&rp_lock);
+    }
+
+    return NULL;
+}
+
+/* The stub interface accepts every call and does nothing, the results come
+ * from the recording */
+static bt_status_t stub_gatt_init(const btgatt_callbacks_t *callbacks) {
+
+    rp.gatt_cbs = callbacks;
+    return BT_STATUS_SUCCESS;
+}
+
+static void stub_void() {
+}
+
+static bt_status_t stub_client_if(int client_if) {
+    return BT_STATUS_SUCCESS;
+}
+
+static bt_status_t stub_uuid(bt_uuid_t *uuid) {
+    return BT_STATUS_SUCCESS;
+}
+
+static bt_status_t stub_scan(int client_if, bool start) {
+    return BT_STATUS_SUCCESS;
+}
+
+static bt_status_t stub_connect(int client_if, const bt_bdaddr_t *bd_addr,
+                                bool is_direct) {
+    return BT_STATUS_SUCCESS;
+}
+
+static bt_status_t stub_disconnect(int client_if, const bt_bdaddr_t *bd_addr,
+                                   int conn_id) {
+    return BT_STATUS_SUCCESS;
+}
+
+static bt_status_t stub_refresh(int client_if, const bt_bdaddr_t *bd_addr) {
+    return BT_STATUS_SUCCESS;
+}
+
+static bt_status_t stub_search(int conn_id, bt_uuid_t *filter_uuid) {
+    return BT_STATUS_SUCCESS;
+}
+
+static bt_status_t stub_included(int conn_id, btgatt_srvc_id_t *srvc_id,
+                                 btgatt_srvc_id_t *start_incl_srvc_id) {
+    return BT_STATUS_SUCCESS;
+}
+
+static bt_status_t stub_chars(int conn_id, btgatt_srvc_id_t *srvc_id,
+                              btgatt_char_id_t *start_char_id) {
+    return BT_STATUS_SUCCESS;
+}
+
+static bt_status_t stub_descs(int conn_id, btgatt_srvc_id_t *srvc_id,
+                              btgatt_char_id_t *char_id,
+                              bt_uuid_t *start_descr_id) {
+    return BT_STATUS_SUCCESS;
+}
+
+static bt_status_t stub_read_char(int conn_id, btgatt_srvc_id_t *srvc_id,
+                                  btgatt_char_id_t *char_id, int auth_req) {
+    return BT_STATUS_SUCCESS;
+}
+
+static bt_status_t stub_write_char(int conn_id, btgatt_srvc_id_t *srvc_id,
+                                   btgatt_char_id_t *char_id, int write_type,
+                                   int len, int auth_req, char *p_value) {
+    return BT_STATUS_SUCCESS;
+}
+
+static bt_status_t stub_read_desc(int conn_id, btgatt_srvc_id_t *srvc_id,
+                                  btgatt_char_id_t *char_id,
+                                  bt_uuid_t *descr_id, int auth_req) {
+    return BT_STATUS_SUCCESS;
+}
+
+static bt_status_t stub_write_desc(int conn_id, btgatt_srvc_id_t *srvc_id,
+                                   btgatt_char_id_t *char_id,
+                                   bt_uuid_t *descr_id, int write_type,
+                                   int len, int auth_req, char *p_value) {
+    return BT_STATUS_SUCCESS;
+}
+
+static bt_status_t stub_execute_write(int conn_id, int execute) {
+    return BT_STATUS_SUCCESS;
+}
+
+static bt_status_t stub_notif(int client_if, const bt_bdaddr_t *bd_addr,
+                              btgatt_srvc_id_t *srvc_id,
+                              btgatt_char_id_t *char_id) {
+    return BT_STATUS_SUCCESS;
+}
+
+static bt_status_t stub_rssi(int client_if, const bt_bdaddr_t *bd_addr) {
+    return BT_STATUS_SUCCESS;
+}
+
+static int stub_device_type(const bt_bdaddr_t *bd_addr) {
+    return BT_DEVICE_DEVTYPE_BLE;
+}
+
+static const btgatt_client_interface_t stub_gatt_client = {
+    .register_client = stub_uuid,
+    .unregister_client = stub_client_if,
+    .scan = stub_scan,
+    .connect = stub_connect,
+    .disconnect = stub_disconnect,
+    .refresh = stub_refresh,
+    .search_service = stub_search,
+    .get_included_service = stub_included,
+    .get_characteristic = stub_chars,
+    .get_descriptor = stub_descs,
+    .read_characteristic = stub_read_char,
+    .write_characteristic = stub_write_char,
+    .read_descriptor = stub_read_desc,
+    .write_descriptor = stub_write_desc,
+    .execute_write = stub_execute_write,
+    .register_for_notification = stub_notif,
+    .deregister_for_notification = stub_notif,
+    .read_remote_rssi = stub_rssi,
+    .get_device_type = stub_device_type,
+};
+
+static const btgatt_interface_t stub_gatt = {
+    .size = sizeof(btgatt_interface_t),
+    .init = stub_gatt_init,
+    .cleanup = stub_void,
+    .client = &stub_gatt_client,
+};
+
+static int stub_init(bt_callbacks_t *callbacks) {
+
+    rp.cbs = callbacks;
+
+    pthread_mutex_lock(&rp_lock);
+    rp.running = true;
+    pthread_mutex_unlock(&rp_lock);
+
+    if (pthread_create(&rp.thread, NULL, replay_thread, NULL) != 0) {
+        rp.running = false;
+        return BT_STATUS_FAIL;
+    }
+
+    rp.started = true;
+    return BT_STATUS_SUCCESS;
+}
+
+static void stub_cleanup() {
+
+    if (rp.started) {
+        pthread_mutex_lock(&rp_lock);
+        rp.stop = true;
+        pthread_cond_broadcast(&rp_cond);
+        pthread_mutex_unlock(&rp_lock);
+
+        pthread_join(rp.thread, NULL);
+        rp.started = false;
+    }
+
+    if (rp.file != NULL) {
+        fclose(rp.file);
+        rp.file = NULL;
+    }
+
+    /* the stack thread finishes on cleanup */
+    if (rp.associated && rp.cbs->thread_evt_cb != NULL) {
+        rp.associated = false;
+        rp.cbs->thread_evt_cb(DISASSOCIATE_JVM);
+    }
+}
+
+static int stub_success() {
+    return BT_STATUS_SUCCESS;
+}
+
+static int stub_property_type(bt_property_type_t type) {
+    return BT_STATUS_SUCCESS;
+}
+
+static int stub_property(const bt_property_t *property) {
+    return BT_STATUS_SUCCESS;
+}
+
+static int stub_remote(bt_bdaddr_t *remote_addr) {
+    return BT_STATUS_SUCCESS;
+}
+
+static int stub_remote_type(bt_bdaddr_t *remote_addr,
+                            bt_property_type_t type) {
+    return BT_STATUS_SUCCESS;
+}
+
+static int stub_remote_property(bt_bdaddr_t *remote_addr,
+                                const bt_property_t *property) {
+    return BT_STATUS_SUCCESS;
+}
+
+static int stub_remote_uuid(bt_bdaddr_t *remote_addr, bt_uuid_t *uuid) {
+    return BT_STATUS_SUCCESS;
+}
+
+static int stub_bond(const bt_bdaddr_t *bd_addr) {
+    return BT_STATUS_SUCCESS;
+}
+
+static int stub_pin_reply(const bt_bdaddr_t *bd_addr, uint8_t accept,
+                          uint8_t pin_len, bt_pin_code_t *pin_code) {
+    return BT_STATUS_SUCCESS;
+}
+
+static int stub_ssp_reply(const bt_bdaddr_t *bd_addr,
+                          bt_ssp_variant_t variant, uint8_t accept,
+                          uint32_t passkey) {
+    return BT_STATUS_SUCCESS;
+}
+
+static const void *stub_get_profile_interface(const char *profile_id) {
+
+    if (strcmp(profile_id, BT_PROFILE_GATT_ID) == 0)
+        return &stub_gatt;
+
+    return NULL;
+}
+
+static const bt_interface_t stub_iface = {
+    .size = sizeof(bt_interface_t),
+    .init = stub_init,
+    .enable = stub_success,
+    .disable = stub_success,
+    .cleanup = stub_cleanup,
+    .get_adapter_properties = stub_success,
+    .get_adapter_property = stub_property_type,
+    .set_adapter_property = stub_property,
+    .get_remote_device_properties = stub_remote,
+    .get_remote_device_property = stub_remote_type,
+    .set_remote_device_property = stub_remote_property,
+    .get_remote_service_record = stub_remote_uuid,
+    .get_remote_services = stub_remote,
+    .start_discovery = stub_success,
+    .cancel_discovery = stub_success,
+    .create_bond = stub_bond,
+    .remove_bond = stub_bond,
+    .cancel_bond = stub_bond,
+    .pin_reply = stub_pin_reply,
+    .ssp_reply = stub_ssp_reply,
+    .get_profile_interface = stub_get_profile_interface,
+};
+
+bool replay_open(const char *path, double speed, replay_cmd_func_t cmd) {
+    char magic[sizeof(RECORD_MAGIC) - 1];
+    FILE *f;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        rl_printf("Unable to open recording %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+        memcmp(magic, RECORD_MAGIC, sizeof(magic)) != 0) {
+        rl_printf("%s is not a recording\n", path);
+        fclose(f);
+        return false;
+    }
+
+    memset(&rp, 0, sizeof(rp));
+    rp.enabled = true;
+    rp.file = f;
+    rp.speed = speed;
+    rp.cmd = cmd;
+
+    return true;
+}
+
+bool replay_enabled() {
+
+    return rp.enabled;
+}
+
+bool replay_running() {
+    bool running;
+
+    pthread_mutex_lock(&rp_lock);
+    running = rp.running;
+    pthread_mutex_unlock(&rp_lock);
+
+    return running;
+}
+
+const bt_interface_t *replay_bt_interface() {
+
+    return &stub_iface;
+}
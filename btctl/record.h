@@ -0,0 +1,52 @@
+#ifndef __RECORD_H__
+#define __RECORD_H__
+
+#include <stdbool.h>
+#include <hardware/bluetooth.h>
+
+/* Largest event in a recording */
+#define RECORD_EVENT_MAX 8192
+/* Buffered events are written at least this often, so a crash loses little */
+#define RECORD_FLUSH_MS 1000
+
+/* Recording of the callbacks of the Bluetooth stack and of the commands
+ * entered, with the time each one arrived. Replaying a recording calls the
+ * same callbacks in the same order, on a thread standing for the one of the
+ * stack, and runs the commands on the main loop, so a session can be
+ * reproduced without hardware. HAL calls made during a replay go to a stub
+ * interface which accepts them and does nothing.
+ *
+ * A recording starts with RECORD_MAGIC and is a sequence of events: the time
+ * since the previous event in microseconds, the event type and the length of
+ * its arguments, followed by the arguments. Lengths, times and integers are
+ * varints (signed ones zigzag encoded), parameter structures are stored field
+ * by field and pointers as a length + 1 (0 for NULL) and the data. The data of
+ * addresses, names, UUIDs and GATT IDs is a raw copy of the structure, in the
+ * host layout with any padding, so recordings only replay with the same HAL
+ * headers and ABI. */
+#define RECORD_MAGIC "BTCTLREC1"
+
+/* Starts recording to path, before the stack is initialized */
+bool record_open(const char *path);
+/* Returns a proxy of iface which records the callbacks, or iface if not
+ * recording */
+const bt_interface_t *record_bt_interface(const bt_interface_t *iface);
+/* Records a command line */
+void record_command(const char *line);
+/* Writes what is buffered and stops recording */
+void record_close();
+
+/* Runs a command line on the main thread */
+typedef void (*replay_cmd_func_t)(char *line);
+
+/* Prepares replaying path. Times between events are divided by speed, 0
+ * replays as fast as possible. */
+bool replay_open(const char *path, double speed, replay_cmd_func_t cmd);
+/* True if a replay was opened */
+bool replay_enabled();
+/* True until the replay reaches the end of the recording */
+bool replay_running();
+/* Returns the stub interface, replaying starts when it is initialized */
+const bt_interface_t *replay_bt_interface();
+
+#endif /* __RECORD_H__ */
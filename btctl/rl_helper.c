@@ -20,16 +20,25 @@
  */
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <termios.h>
+#include <unistd.h>
 #include "rl_helper.h"
+#include "mem.h"
+#include "stats.h"
 
 #define MAX_LINE_BUFFER 512
 #define MAX_SEQ 5
+#define MAX_PROMPT 64
 
 #define MIN(a, b) \
     ({ \
@@ -40,7 +49,9 @@
 
 typedef enum {
     K_EOT       = 0x04, /* end-of-transmission (ctrl-d) */
+    K_BEL       = 0x07, /* ctrl-g */
     K_TAB       = 0x09,
+    K_DC2       = 0x12, /* ctrl-r */
     K_ESC       = 0x1b,
     K_BACKSPACE = 0x7f,
     /* user defined codes (used for escape sequences */
@@ -60,9 +71,40 @@ size_t pos = 0;
 char seq[MAX_SEQ]; /* sequence buffer (escape codes) */
 size_t seq_pos = 0;
 const char *prompt = "> ";
-char **history = NULL; /* pointer to history buffer */
-int hs_len = 0; /* how much pointers we have in history buffer */
-int hs_cur = 0; /* current position of up/down keys navigation */
+
+/* History is kept in a fixed size ring of bytes holding NUL terminated
+ * entries, oldest first. When a new entry doesn't fit, the oldest ones are
+ * dropped, so memory usage doesn't grow during long sessions. */
+static char *hs_buf = NULL;
+static size_t hs_size = RL_HISTORY_SIZE_DEFAULT;
+static size_t hs_start = 0; /* offset of the oldest entry */
+static size_t hs_used = 0; /* bytes used by entries */
+static size_t hs_nav = 0; /* entry shown by up/down keys, hs_end() if none */
+static int hs_fd = -1; /* history file, entries are appended to it */
+
+/* reverse incremental search (ctrl-r) state */
+static bool searching = false;
+static bool search_failed = false;
+static char search_str[MAX_PROMPT - 32];
+static size_t search_match; /* entry matching search_str */
+static char search_prompt[MAX_PROMPT];
+
+/* While input is arriving in bulk the prompt is only repainted once input goes
+ * idle, instead of after every character. */
+static volatile bool redraw_deferred = false;
+static volatile bool redraw_pending = false;
+
+/* Full screen views own the terminal while they are shown, messages printed
+ * meanwhile are dropped and counted. */
+static volatile bool suspended = false;
+static volatile unsigned int dropped = 0;
+
+/* terminal size, updated when the window changes size */
+static size_t terminal_cols = 80;
+static size_t terminal_rows = 24;
+static volatile sig_atomic_t terminal_resized = 1;
+
+void rl_reprint_prompt();
 
 typedef struct {
     char sequence[MAX_SEQ];
@@ -120,13 +162,325 @@ void rl_clear_line() {
     printf("\x1b[2K\r");
 }
 
+/* offset right after the newest entry */
+static size_t hs_end() {
+
+    return (hs_start + hs_used) % hs_size;
+}
+
+/* copies the entry starting at off to str (at most len bytes) */
+static void hs_get(size_t off, char *str, size_t len) {
+    size_t i;
+
+    for (i = 0; i < len - 1 && hs_buf[off] != 0; i++) {
+        str[i] = hs_buf[off];
+        off = (off + 1) % hs_size;
+    }
+
+    str[i] = 0;
+}
+
+/* returns the entry before the one at off, or off if it is the oldest */
+static size_t hs_prev(size_t off) {
+
+    if (hs_used == 0 || off == hs_start)
+        return off;
+
+    /* skip NUL of previous entry and look for the one before it */
+    off = (off + hs_size - 1) % hs_size;
+    while (off != hs_start && hs_buf[(off + hs_size - 1) % hs_size] != 0)
+        off = (off + hs_size - 1) % hs_size;
+
+    return off;
+}
+
+/* returns the entry after the one at off, or hs_end() if it is the newest */
+static size_t hs_next(size_t off) {
+
+    if (off == hs_end())
+        return off;
+
+    while (hs_buf[off] != 0)
+        off = (off + 1) % hs_size;
+
+    return (off + 1) % hs_size;
+}
+
+static void hs_drop_oldest() {
+    size_t len = 0;
+
+    while (hs_buf[(hs_start + len) % hs_size] != 0)
+        len++;
+    len++; /* NUL */
+
+    hs_start = (hs_start + len) % hs_size;
+    hs_used -= len;
+}
+
+/* stores line as newest entry, returns false if it wasn't stored */
+static bool hs_add(const char *line) {
+    size_t len = strlen(line) + 1;
+    size_t i, off;
+
+    /* the ring is never completely filled, so hs_end() != hs_start unless
+     * it is empty */
+    if (hs_buf == NULL || len == 1 || len >= hs_size)
+        return false;
+
+    /* don't store the same command twice in a row */
+    if (hs_used > 0) {
+        char last[MAX_LINE_BUFFER];
+
+        hs_get(hs_prev(hs_end()), last, sizeof(last));
+        if (strcmp(last, line) == 0)
+            return false;
+    }
+
+    while (hs_size - hs_used <= len)
+        hs_drop_oldest();
+
+    off = hs_end();
+    for (i = 0; i < len; i++)
+        hs_buf[(off + i) % hs_size] = line[i];
+    hs_used += len;
+
+    return true;
+}
+
+void rl_set_history_size(size_t size) {
+    char *old_buf = hs_buf;
+    size_t old_size = hs_size, old_start = hs_start, old_used = hs_used;
+    char line[MAX_LINE_BUFFER];
+    size_t i, len = 0;
+
+    if (size < MAX_LINE_BUFFER)
+        size = MAX_LINE_BUFFER;
+
+    hs_buf = mem_alloc(MEM_HISTORY, size);
+    if (hs_buf == NULL) {
+        hs_buf = old_buf;
+        return;
+    }
+
+    hs_size = size;
+    hs_start = hs_used = 0;
+
+    /* move old entries to the new buffer, the oldest may be dropped */
+    for (i = 0; old_buf != NULL && i < old_used; i++) {
+        line[len] = old_buf[(old_start + i) % old_size];
+        if (line[len] == 0 || len == sizeof(line) - 1) {
+            line[len] = 0;
+            hs_add(line);
+            len = 0;
+        } else
+            len++;
+    }
+
+    mem_free(old_buf);
+    hs_nav = hs_end();
+}
+
+/* writes the whole history to path, replacing it */
+static void hs_save(const char *path) {
+    char tmp_path[MAX_LINE_BUFFER];
+    char line[MAX_LINE_BUFFER];
+    size_t off;
+    FILE *f;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    f = fopen(tmp_path, "w");
+    if (f == NULL)
+        return;
+
+    for (off = hs_start; hs_used > 0 && off != hs_end(); off = hs_next(off)) {
+        hs_get(off, line, sizeof(line));
+        fprintf(f, "%s\n", line);
+    }
+
+    if (fclose(f) == 0)
+        rename(tmp_path, path);
+    else
+        unlink(tmp_path);
+}
+
+/* appends a line to the history file. On failure the file is closed, so
+ * history is no longer saved, and the error is returned. */
+static int hs_append(char *line, size_t len) {
+    ssize_t n;
+    int err;
+
+    line[len] = '\n';
+    do
+        n = write(hs_fd, line, len + 1);
+    while (n < 0 && errno == EINTR);
+    line[len] = 0;
+
+    if (n == (ssize_t) (len + 1))
+        return 0;
+
+    /* a short write is a full disk */
+    err = n < 0 ? errno : ENOSPC;
+    close(hs_fd);
+    hs_fd = -1;
+    return err;
+}
+
+bool rl_set_history_file(const char *path) {
+    char line[MAX_LINE_BUFFER];
+    struct stat st;
+    FILE *f;
+
+    if (hs_fd >= 0) {
+        close(hs_fd);
+        hs_fd = -1;
+    }
+
+    if (path == NULL)
+        return true;
+
+    f = fopen(path, "r");
+    if (f != NULL) {
+        /* only the tail of the file can fit in the ring */
+        if (fstat(fileno(f), &st) == 0 && (size_t) st.st_size > hs_size) {
+            fseek(f, st.st_size - hs_size, SEEK_SET);
+            fgets(line, sizeof(line), f); /* skip partial line */
+        }
+
+        while (fgets(line, sizeof(line), f) != NULL) {
+            line[strcspn(line, "\r\n")] = 0;
+            hs_add(line);
+        }
+
+        /* the file is append only, rewrite it when it gets too big */
+        if (fstat(fileno(f), &st) == 0 && (size_t) st.st_size > 4 * hs_size)
+            hs_save(path);
+
+        fclose(f);
+    }
+
+    hs_nav = hs_end();
+
+    hs_fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+    return hs_fd >= 0;
+}
+
+/* looks for an entry containing search_str, starting from off backwards */
+static bool hs_search(size_t off) {
+    char line[MAX_LINE_BUFFER];
+
+    if (hs_used == 0)
+        return false;
+
+    while (true) {
+        hs_get(off, line, sizeof(line));
+        if (strstr(line, search_str) != NULL) {
+            search_match = off;
+            return true;
+        }
+
+        if (off == hs_start)
+            return false;
+        off = hs_prev(off);
+    }
+}
+
+static void search_update(bool found) {
+
+    search_failed = !found;
+    snprintf(search_prompt, sizeof(search_prompt),
+             "(%sreverse-i-search)`%s': ", search_failed ? "failed " : "",
+             search_str);
+
+    if (found) {
+        hs_get(search_match, lnbuf, sizeof(lnbuf));
+        pos = strstr(lnbuf, search_str) - lnbuf;
+    }
+}
+
+static void search_start() {
+
+    searching = true;
+    search_str[0] = 0;
+    search_match = hs_prev(hs_end());
+    search_update(hs_used > 0);
+}
+
+/* handles a key while in search mode, returns false if the key must still be
+ * handled by the normal line editing */
+static bool search_feed(int c) {
+    size_t len = strlen(search_str);
+
+    switch (c) {
+        case K_DC2: /* look for an older match */
+            if (!search_failed && search_match != hs_start)
+                search_update(hs_search(hs_prev(search_match)));
+            break;
+        case K_BEL: /* abort */
+            searching = false;
+            rl_clear();
+            break;
+        case K_BACKSPACE:
+            if (len > 0) {
+                search_str[len - 1] = 0;
+                search_update(hs_search(hs_prev(hs_end())));
+            }
+            break;
+        default:
+            if (isprint(c)) {
+                if (len < sizeof(search_str) - 1) {
+                    search_str[len] = c;
+                    search_str[len + 1] = 0;
+                    search_update(!search_failed &&
+                                  hs_search(search_match));
+                }
+                break;
+            }
+
+            /* any other key leaves search mode keeping the matched line */
+            searching = false;
+            pos = strlen(lnbuf);
+            return false;
+    }
+
+    rl_reprint_prompt();
+    return true;
+}
+
+static void sigwinch_handler(int sig) {
+
+    terminal_resized = 1;
+}
+
+static void update_terminal_size() {
+    struct winsize ws;
+
+    terminal_resized = 0;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) {
+        terminal_cols = ws.ws_col;
+        if (ws.ws_row > 0)
+            terminal_rows = ws.ws_row;
+    }
+}
+
 void rl_reprint_prompt() {
     static size_t viewport_pos = 0;
-    size_t terminal_cols = 80;
+    const char *cur_prompt = searching ? search_prompt : prompt;
     size_t len = strlen(lnbuf);
-    size_t viewport_size = terminal_cols - strlen(prompt) - 1;
+    size_t viewport_size;
     size_t viewport_end;
 
+    if (redraw_deferred || suspended) {
+        redraw_pending = true;
+        return;
+    }
+    redraw_pending = false;
+
+    if (terminal_resized)
+        update_terminal_size();
+
+    viewport_size = terminal_cols > strlen(cur_prompt) + 1 ?
+                    terminal_cols - strlen(cur_prompt) - 1 : 1;
+
     rl_clear_line();
 
     if (pos < viewport_pos) /* cursor before viewport */
@@ -134,7 +488,8 @@ void rl_reprint_prompt() {
     if (pos > viewport_pos + viewport_size) /* cursor after viewport */
         viewport_pos = pos - viewport_size;
 
-    printf("%s%.*s", prompt, MIN(viewport_size, len), lnbuf + viewport_pos);
+    printf("%s%.*s", cur_prompt, (int) MIN(viewport_size, len),
+           lnbuf + viewport_pos);
 
     viewport_end = MIN(viewport_pos + viewport_size, len);
     while (viewport_end-- != pos)
@@ -144,14 +499,23 @@ void rl_reprint_prompt() {
 
 void rl_init(line_process_callback cb) {
     struct termios settings;
+    struct sigaction sa;
 
     /* disable echo */
     tcgetattr(0, &settings); /* read settings from stdin (0) */
     settings.c_lflag &= ~(ICANON | ECHO); /* disable canonical and echo flags */
     tcsetattr(0, TCSANOW, &settings); /* store new settings */
 
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigwinch_handler;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &sa, NULL);
+
     rl_clear();
     line_cb = cb;
+
+    if (hs_buf == NULL)
+        rl_set_history_size(hs_size);
 }
 
 void rl_set_prompt(const char *str) {
@@ -160,6 +524,36 @@ void rl_set_prompt(const char *str) {
     rl_reprint_prompt();
 }
 
+void rl_defer_redraw(bool defer) {
+
+    redraw_deferred = defer;
+    if (!defer && redraw_pending)
+        rl_reprint_prompt();
+}
+
+void rl_suspend(bool suspend) {
+
+    if (suspend)
+        dropped = 0;
+    suspended = suspend;
+    if (!suspend)
+        rl_reprint_prompt();
+}
+
+unsigned int rl_dropped() {
+
+    return dropped;
+}
+
+void rl_terminal_size(size_t *rows, size_t *cols) {
+
+    if (terminal_resized)
+        update_terminal_size();
+
+    *rows = terminal_rows;
+    *cols = terminal_cols;
+}
+
 void rl_set_tab_completer(tab_completer_callback cb) {
 
     tab_completer_cb = cb;
@@ -169,6 +563,11 @@ void rl_quit() {
 
     rl_clear();
     rl_clear_line();
+
+    rl_set_history_file(NULL);
+    mem_free(hs_buf);
+    hs_buf = NULL;
+    hs_start = hs_used = hs_nav = 0;
 }
 
 /* returns 1 if char was consumed, 0 otherwise */
@@ -207,6 +606,9 @@ bool rl_feed(int c) {
     if (rl_parse_seq(&c))
         return true;
 
+    if (searching && search_feed(c))
+        return true;
+
     switch (c) {
         case K_EOT:
             putchar('\n');
@@ -227,22 +629,36 @@ bool rl_feed(int c) {
         case '\r':
         case '\n':
             if (strlen(lnbuf) > 0) {
-                char *dup = strdup(lnbuf);
-                /* alloc space in history buffer to new string pointer */
-                hs_len++;
-                history = realloc(history, hs_len * sizeof(history[0]));
-                history[hs_len - 1] = strdup(lnbuf);
+                char line[MAX_LINE_BUFFER];
+                size_t len = strlen(lnbuf);
+                int err = 0;
+
+                memcpy(line, lnbuf, len + 1);
+                if (hs_add(line) && hs_fd >= 0)
+                    err = hs_append(line, len);
+
+                /* the line wasn't drawn yet, show what is being run */
+                if (redraw_pending) {
+                    rl_clear_line();
+                    printf("%s%s", prompt, line);
+                }
                 putchar('\n');
-                line_cb(dup); /* send a copy, so we can change it */
-                free(dup);
+                if (err != 0)
+                    rl_printf("Failed to save history, no longer saving it: "
+                              "%s\n", strerror(err));
+                line_cb(line); /* send a copy, so we can change it */
             } else
                 /* don't parse empty lines */
                 putchar('\n');
 
-            hs_cur = hs_len;
+            hs_nav = hs_end();
             rl_clear();
             rl_reprint_prompt();
             break;
+        case K_DC2:
+            search_start();
+            rl_reprint_prompt();
+            break;
         case K_ESC:
             break;
         case K_BACKSPACE:
@@ -253,25 +669,25 @@ bool rl_feed(int c) {
             }
             break;
         case K_UP:
-            if (hs_cur > 0) {
+            if (hs_used > 0 && hs_nav != hs_start) {
                 /* we have more history commands up */
-                hs_cur--;
-                strcpy(lnbuf, history[hs_cur]);
-                pos = strlen(history[hs_cur]);
+                hs_nav = hs_prev(hs_nav);
+                hs_get(hs_nav, lnbuf, sizeof(lnbuf));
+                pos = strlen(lnbuf);
                 rl_reprint_prompt();
             }
             break;
         case K_DOWN:
-            if (hs_cur < hs_len - 1) {
-                /* we have more history commands down */
-                hs_cur++;
-                strcpy(lnbuf, history[hs_cur]);
-                pos = strlen(history[hs_cur]);
-                rl_reprint_prompt();
-            } else if (hs_cur == hs_len - 1) {
-                /* we don't have more commands down, let's clear the prompt */
-                hs_cur++;
-                rl_clear();
+            if (hs_nav != hs_end()) {
+                hs_nav = hs_next(hs_nav);
+                if (hs_nav != hs_end()) {
+                    /* we have more history commands down */
+                    hs_get(hs_nav, lnbuf, sizeof(lnbuf));
+                    pos = strlen(lnbuf);
+                } else
+                    /* we don't have more commands down, let's clear the
+                     * prompt */
+                    rl_clear();
                 rl_reprint_prompt();
             }
             break;
@@ -317,8 +733,15 @@ bool rl_feed(int c) {
 }
 
 void rl_printf(const char *fmt, ...) {
+    uint64_t start_ns;
     va_list ap;
 
+    if (suspended) {
+        dropped++;
+        return;
+    }
+
+    start_ns = stats_printf_begin();
     va_start(ap, fmt);
 
     rl_clear_line();
@@ -326,4 +749,6 @@ void rl_printf(const char *fmt, ...) {
     va_end(ap);
 
     rl_reprint_prompt();
+
+    stats_printf_end(start_ns);
 }
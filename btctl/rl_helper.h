@@ -1,6 +1,12 @@
 #ifndef __RL_HELPER_H__
 #define __RL_HELPER_H__
 
+#include <stdbool.h>
+#include <stddef.h>
+
+/* default size of the history ring, in bytes */
+#define RL_HISTORY_SIZE_DEFAULT 16384
+
 typedef void (*line_process_callback)(char *line);
 
 typedef const char *(*tab_completer_callback)(char *line, int tab_pos);
@@ -11,10 +17,24 @@ void rl_init(line_process_callback cb);
 void rl_set_prompt(const char *str);
 /* tab completer */
 void rl_set_tab_completer(tab_completer_callback cb);
+/* set how many bytes are used to store history, older entries are dropped */
+void rl_set_history_size(size_t size);
+/* load history from file and append new entries to it, NULL to stop */
+bool rl_set_history_file(const char *path);
 /* close resources */
 void rl_quit();
 /* add char to line buffer, returns false on ctrl-d */
 bool rl_feed(int c);
+/* when true the prompt isn't repainted until called again with false, used
+ * while processing input that arrives in bulk */
+void rl_defer_redraw(bool defer);
+/* when true nothing is printed, the prompt included, used by full screen
+ * views. Messages printed meanwhile are dropped. */
+void rl_suspend(bool suspend);
+/* number of messages dropped since the last rl_suspend(true) */
+unsigned int rl_dropped();
+/* current terminal size, 24x80 if unknown */
+void rl_terminal_size(size_t *rows, size_t *cols);
 /* printf version */
 void rl_printf(const char *fmt, ...);
 
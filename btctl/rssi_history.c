@@ -0,0 +1,182 @@
+/*
+ * Per-device RSSI history
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rssi_history.h"
+#include "util.h"
+
+typedef struct rssi_dev {
+    rssi_stats_t stats;
+    uint8_t head; /* next slot to be written */
+    uint8_t count; /* valid slots */
+    rssi_sample_t samples[RSSI_HISTORY_SAMPLES];
+} rssi_dev_t;
+
+/* Samples arrive from the stack callback thread while commands read them from
+ * the main thread, so the table is protected by a lock. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static rssi_dev_t devs[RSSI_HISTORY_DEVS];
+static int devs_count = 0;
+static float alpha = RSSI_EWMA_ALPHA_DEFAULT;
+
+static rssi_dev_t *find_dev(const bt_bdaddr_t *addr) {
+    int i;
+
+    for (i = 0; i < devs_count; i++)
+        if (!memcmp(&devs[i].stats.addr, addr, sizeof(*addr)))
+            return &devs[i];
+
+    return NULL;
+}
+
+/* Returns an empty entry, recycling the least recently seen one if needed */
+static rssi_dev_t *new_dev(const bt_bdaddr_t *addr, uint32_t now) {
+    rssi_dev_t *dev;
+    int i;
+
+    if (devs_count < RSSI_HISTORY_DEVS)
+        dev = &devs[devs_count++];
+    else {
+        dev = &devs[0];
+        for (i = 1; i < devs_count; i++)
+            if (now - devs[i].stats.last_seen_ms >
+                now - dev->stats.last_seen_ms)
+                dev = &devs[i];
+    }
+
+    memset(dev, 0, sizeof(*dev));
+    memcpy(&dev->stats.addr, addr, sizeof(*addr));
+    dev->stats.first_seen_ms = now;
+
+    return dev;
+}
+
+void rssi_history_add(const bt_bdaddr_t *addr, int rssi) {
+    uint32_t now = monotonic_us() / 1000;
+    rssi_dev_t *dev;
+    rssi_stats_t *st;
+
+    pthread_mutex_lock(&lock);
+
+    dev = find_dev(addr);
+    if (dev == NULL)
+        dev = new_dev(addr, now);
+    st = &dev->stats;
+
+    dev->samples[dev->head].time_ms = now;
+    dev->samples[dev->head].rssi = rssi;
+    dev->head = (dev->head + 1) % RSSI_HISTORY_SAMPLES;
+    if (dev->count < RSSI_HISTORY_SAMPLES)
+        dev->count++;
+
+    if (st->total == 0) {
+        st->min = st->max = rssi;
+        st->ewma = rssi;
+    } else {
+        if (rssi < st->min)
+            st->min = rssi;
+        if (rssi > st->max)
+            st->max = rssi;
+        st->ewma += alpha * (rssi - st->ewma);
+    }
+
+    st->last = rssi;
+    st->last_seen_ms = now;
+    st->total++;
+
+    pthread_mutex_unlock(&lock);
+}
+
+int rssi_history_get(const bt_bdaddr_t *addr, rssi_stats_t *stats,
+                     rssi_sample_t *samples, int max_samples) {
+    rssi_dev_t *dev;
+    int i, n, first;
+
+    pthread_mutex_lock(&lock);
+
+    dev = find_dev(addr);
+    if (dev == NULL) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+
+    memcpy(stats, &dev->stats, sizeof(*stats));
+
+    /* copy the most recent samples, oldest first */
+    n = dev->count < max_samples ? dev->count : max_samples;
+    first = dev->head + RSSI_HISTORY_SAMPLES - n;
+    for (i = 0; i < n; i++)
+        samples[i] = dev->samples[(first + i) % RSSI_HISTORY_SAMPLES];
+
+    pthread_mutex_unlock(&lock);
+
+    return n;
+}
+
+static int cmp_last_seen(const void *a, const void *b) {
+    const rssi_stats_t *sa = a, *sb = b;
+
+    if (sa->last_seen_ms == sb->last_seen_ms)
+        return 0;
+
+    return (int32_t) (sb->last_seen_ms - sa->last_seen_ms) < 0 ? -1 : 1;
+}
+
+int rssi_history_list(rssi_stats_t *stats, int max_devs) {
+    int i, n;
+
+    pthread_mutex_lock(&lock);
+
+    n = devs_count < max_devs ? devs_count : max_devs;
+    for (i = 0; i < n; i++)
+        memcpy(&stats[i], &devs[i].stats, sizeof(stats[i]));
+
+    pthread_mutex_unlock(&lock);
+
+    qsort(stats, n, sizeof(stats[0]), cmp_last_seen);
+
+    return n;
+}
+
+bool rssi_history_set_alpha(float a) {
+
+    if (!(a > 0 && a <= 1))
+        return false;
+
+    pthread_mutex_lock(&lock);
+    alpha = a;
+    pthread_mutex_unlock(&lock);
+
+    return true;
+}
+
+float rssi_history_get_alpha() {
+
+    return alpha;
+}
+
+void rssi_history_clear() {
+
+    pthread_mutex_lock(&lock);
+    devs_count = 0;
+    pthread_mutex_unlock(&lock);
+}
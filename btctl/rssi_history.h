@@ -0,0 +1,50 @@
+#ifndef __RSSI_HISTORY_H__
+#define __RSSI_HISTORY_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <hardware/bluetooth.h>
+
+/* Number of remote devices tracked at the same time. When the table is full
+ * the device that was seen less recently is dropped. */
+#define RSSI_HISTORY_DEVS 64
+/* Number of samples kept per device, older ones are overwritten */
+#define RSSI_HISTORY_SAMPLES 32
+
+#define RSSI_EWMA_ALPHA_DEFAULT 0.25f
+
+typedef struct rssi_sample {
+    uint32_t time_ms; /* monotonic time the sample was taken */
+    int8_t rssi;
+} rssi_sample_t;
+
+typedef struct rssi_stats {
+    bt_bdaddr_t addr;
+    uint32_t total; /* samples received since the device is tracked */
+    uint32_t first_seen_ms;
+    uint32_t last_seen_ms;
+    int8_t last;
+    int8_t min;
+    int8_t max;
+    float ewma;
+} rssi_stats_t;
+
+/* Adds a sample for device addr, taken now */
+void rssi_history_add(const bt_bdaddr_t *addr, int rssi);
+
+/* Copies statistics and samples (oldest first) of a device. Returns the number
+ * of samples copied, or -1 if the device isn't tracked. */
+int rssi_history_get(const bt_bdaddr_t *addr, rssi_stats_t *stats,
+                     rssi_sample_t *samples, int max_samples);
+
+/* Copies statistics of every tracked device, most recently seen first.
+ * Returns the number of devices copied. */
+int rssi_history_list(rssi_stats_t *stats, int max_devs);
+
+/* Smoothing factor of the moving average, between 0 (exclusive) and 1 */
+bool rssi_history_set_alpha(float alpha);
+float rssi_history_get_alpha();
+
+void rssi_history_clear();
+
+#endif /* __RSSI_HISTORY_H__ */
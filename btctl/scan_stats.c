@@ -0,0 +1,168 @@
+/*
+ * Per-window statistics of scheduled scans
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "scan_stats.h"
+#include "util.h"
+
+/* Power of two above SCAN_STATS_DEVS, so probe sequences stay short */
+#define SET_SIZE 256
+
+/* Open addressing set of addresses */
+typedef struct addr_set {
+    uint32_t count;
+    uint8_t used[SET_SIZE];
+    bt_bdaddr_t addrs[SET_SIZE];
+} addr_set_t;
+
+/* Reports arrive from the stack callback thread while windows are opened and
+ * closed from the main loop, so everything is protected by a lock. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static addr_set_t sets[2];
+static addr_set_t *cur = &sets[0], *prev = &sets[1];
+static bool window_open = false;
+static uint64_t start_us;
+static scan_window_t win;
+static scan_totals_t totals;
+static int64_t rssi_sum;
+
+static uint32_t hash_addr(const bt_bdaddr_t *addr) {
+    uint32_t h = 2166136261u;
+    int i;
+
+    for (i = 0; i < 6; i++)
+        h = (h ^ addr->address[i]) * 16777619u;
+
+    return h;
+}
+
+/* Returns true if addr is in set. If not and insert is set, adds it. */
+static bool set_lookup(addr_set_t *set, const bt_bdaddr_t *addr, bool insert) {
+    uint32_t i = hash_addr(addr) & (SET_SIZE - 1);
+
+    while (set->used[i]) {
+        if (!memcmp(&set->addrs[i], addr, sizeof(*addr)))
+            return true;
+        i = (i + 1) & (SET_SIZE - 1);
+    }
+
+    if (insert && set->count < SCAN_STATS_DEVS) {
+        set->used[i] = 1;
+        memcpy(&set->addrs[i], addr, sizeof(*addr));
+        set->count++;
+    }
+
+    return false;
+}
+
+void scan_stats_begin() {
+    addr_set_t *tmp;
+
+    pthread_mutex_lock(&lock);
+
+    /* devices of the last window are the reference for new ones */
+    tmp = prev;
+    prev = cur;
+    cur = tmp;
+    memset(cur, 0, sizeof(*cur));
+
+    memset(&win, 0, sizeof(win));
+    win.index = ++totals.windows;
+    rssi_sum = 0;
+    start_us = monotonic_us();
+    window_open = true;
+
+    pthread_mutex_unlock(&lock);
+}
+
+void scan_stats_add(const bt_bdaddr_t *addr, int rssi) {
+
+    pthread_mutex_lock(&lock);
+
+    if (!window_open) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    if (win.reports == 0 || rssi > win.rssi_max) {
+        win.rssi_max = rssi;
+        memcpy(&win.strongest, addr, sizeof(*addr));
+    }
+    if (win.reports == 0 || rssi < win.rssi_min)
+        win.rssi_min = rssi;
+    rssi_sum += rssi;
+    win.reports++;
+    totals.reports++;
+
+    if (!set_lookup(cur, addr, true)) {
+        if (cur->count == win.devices)
+            win.overflow = true; /* set is full */
+        else {
+            win.devices++;
+            if (!set_lookup(prev, addr, false))
+                win.new_devices++;
+        }
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+bool scan_stats_end(scan_window_t *w) {
+
+    pthread_mutex_lock(&lock);
+
+    if (!window_open) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+
+    window_open = false;
+    win.duration_ms = (monotonic_us() - start_us) / 1000;
+    if (win.reports > 0)
+        win.rssi_mean = (float) rssi_sum / win.reports;
+
+    totals.scan_ms += win.duration_ms;
+    if (win.devices > totals.max_devices)
+        totals.max_devices = win.devices;
+
+    if (w != NULL)
+        memcpy(w, &win, sizeof(*w));
+
+    pthread_mutex_unlock(&lock);
+
+    return true;
+}
+
+void scan_stats_totals(scan_totals_t *t) {
+
+    pthread_mutex_lock(&lock);
+    memcpy(t, &totals, sizeof(*t));
+    pthread_mutex_unlock(&lock);
+}
+
+void scan_stats_reset() {
+
+    pthread_mutex_lock(&lock);
+    memset(sets, 0, sizeof(sets));
+    memset(&totals, 0, sizeof(totals));
+    window_open = false;
+    pthread_mutex_unlock(&lock);
+}
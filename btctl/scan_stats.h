@@ -0,0 +1,44 @@
+#ifndef __SCAN_STATS_H__
+#define __SCAN_STATS_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <hardware/bluetooth.h>
+
+/* Distinct devices counted per scan window, more are reported as overflow */
+#define SCAN_STATS_DEVS 192
+
+/* Summary of a scan window */
+typedef struct scan_window {
+    uint32_t index; /* windows are numbered from 1 */
+    uint32_t duration_ms;
+    uint32_t reports; /* advertising reports received */
+    uint32_t devices; /* distinct addresses */
+    uint32_t new_devices; /* addresses not seen in the previous window */
+    bool overflow; /* more than SCAN_STATS_DEVS devices, counts are partial */
+    int8_t rssi_min;
+    int8_t rssi_max;
+    float rssi_mean;
+    bt_bdaddr_t strongest; /* device with rssi_max */
+} scan_window_t;
+
+/* Totals since the last scan_stats_reset() */
+typedef struct scan_totals {
+    uint32_t windows;
+    uint64_t reports;
+    uint64_t scan_ms; /* time spent inside windows */
+    uint32_t max_devices; /* largest number of devices in a window */
+} scan_totals_t;
+
+/* Opens a new window, closing the current one without a summary */
+void scan_stats_begin();
+/* Accounts an advertising report. Ignored if no window is open. */
+void scan_stats_add(const bt_bdaddr_t *addr, int rssi);
+/* Closes the current window and copies its summary to w (if not NULL).
+ * Returns false if no window was open. */
+bool scan_stats_end(scan_window_t *w);
+
+void scan_stats_totals(scan_totals_t *totals);
+void scan_stats_reset();
+
+#endif /* __SCAN_STATS_H__ */
@@ -0,0 +1,484 @@
+/*
+ * Full screen table of the devices found by a scan
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scan_view.h"
+#include "assigned_numbers.h"
+#include "rl_helper.h"
+#include "timeout.h"
+#include "util.h"
+
+/* Power of two above SCAN_VIEW_DEVS, so probe sequences stay short */
+#define TABLE_SIZE 512
+/* Largest screen drawn, bigger terminals are only partly used */
+#define SCREEN_ROWS 100
+#define SCREEN_COLS 200
+/* Lines above and below the devices */
+#define HEADER_ROWS 2
+#define FOOTER_ROWS 1
+/* Length of the advertising data of a report */
+#define ADV_DATA_LEN 31
+
+/* AD fields found in the reports of a device */
+#define HAS_TX_POWER    (1 << 0)
+#define HAS_UUID16      (1 << 1)
+#define HAS_APPEARANCE  (1 << 2)
+#define HAS_COMPANY     (1 << 3)
+
+typedef struct {
+    bt_bdaddr_t addr;
+    uint8_t used;
+    uint8_t fields; /* HAS_* */
+    int8_t rssi;
+    int8_t tx_power;
+    uint16_t uuid16; /* first one listed */
+    uint16_t appearance;
+    uint16_t company;
+    uint32_t reports;
+    uint32_t drawn_reports; /* reports at the previous redraw */
+    float rate; /* reports per second, smoothed */
+    uint64_t last_us;
+    char name[SCAN_VIEW_NAME_LEN];
+} entry_t;
+
+typedef enum {
+    SORT_RSSI,
+    SORT_RATE,
+    SORT_LAST_SEEN,
+    SORT_ADDRESS,
+    SORT_COUNT,
+} sort_t;
+
+static const char *sort_names[] = {
+    [SORT_RSSI] = "RSSI",
+    [SORT_RATE] = "rate",
+    [SORT_LAST_SEEN] = "last seen",
+    [SORT_ADDRESS] = "address",
+};
+
+/* Reports arrive from the stack callback thread while the table is drawn from
+ * the main loop, so it is protected by a lock. Reports only update their
+ * entry: the cost of drawing doesn't depend on how many arrive. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static entry_t table[TABLE_SIZE];
+static uint32_t devices;
+static uint32_t reports;
+static uint32_t overflow; /* reports of devices that didn't fit */
+static volatile bool active = false;
+
+/* Drawing state, used from the main loop only */
+static int redraw_timeout = 0;
+static sort_t sort = SORT_RSSI;
+static uint64_t drawn_us;
+static uint32_t drawn_reports;
+static float total_rate;
+static entry_t rows[SCAN_VIEW_DEVS];
+/* Lines on the terminal and of the frame being drawn, NUL terminated. Only
+ * the differences between them are written. */
+static char screen[SCREEN_ROWS][SCREEN_COLS + 1];
+static char frame[SCREEN_ROWS][SCREEN_COLS + 1];
+static size_t screen_rows, screen_cols;
+/* Everything written for a frame, sent at once */
+static char out[SCREEN_ROWS * (SCREEN_COLS + 16) + 64];
+static size_t out_len;
+
+static uint32_t hash_addr(const bt_bdaddr_t *addr) {
+    uint32_t h = 2166136261u;
+    int i;
+
+    for (i = 0; i < 6; i++)
+        h = (h ^ addr->address[i]) * 16777619u;
+
+    return h;
+}
+
+/* Returns the entry of addr, adding it if there is room. Must be called with
+ * the lock held. */
+static entry_t *lookup(const bt_bdaddr_t *addr) {
+    uint32_t i = hash_addr(addr) & (TABLE_SIZE - 1);
+
+    while (table[i].used) {
+        if (!memcmp(&table[i].addr, addr, sizeof(*addr)))
+            return &table[i];
+        i = (i + 1) & (TABLE_SIZE - 1);
+    }
+
+    if (devices == SCAN_VIEW_DEVS)
+        return NULL;
+
+    memset(&table[i], 0, sizeof(table[i]));
+    memcpy(&table[i].addr, addr, sizeof(*addr));
+    table[i].used = 1;
+    devices++;
+
+    return &table[i];
+}
+
+static void clear_table() {
+
+    pthread_mutex_lock(&lock);
+    memset(table, 0, sizeof(table));
+    devices = reports = overflow = 0;
+    pthread_mutex_unlock(&lock);
+
+    drawn_reports = 0;
+    total_rate = 0;
+}
+
+/* Keeps the fields of interest of a report. Fields missing from it, eg. a name
+ * only sent in scan responses, keep their previous value. */
+static void parse_adv_data(entry_t *e, const uint8_t *adv_data) {
+    const uint8_t *d;
+    int i = 0, len, j;
+
+    while (i < ADV_DATA_LEN && adv_data[i] != 0) {
+        len = adv_data[i];
+        d = &adv_data[i + 1]; /* d[0] is the AD type */
+        if (i + 1 + len > ADV_DATA_LEN)
+            break;
+
+        switch (d[0]) {
+            case AD_UUID16_SOME:
+            case AD_UUID16_ALL:
+                if (len >= 3) {
+                    e->uuid16 = d[1] | d[2] << 8;
+                    e->fields |= HAS_UUID16;
+                }
+                break;
+            case AD_NAME_SHORT:
+            case AD_NAME_COMPLETE:
+                /* names are shown in fixed width columns */
+                for (j = 0; j < len - 1 && j < SCAN_VIEW_NAME_LEN - 1; j++)
+                    e->name[j] = d[j + 1] >= 0x20 && d[j + 1] < 0x7f ?
+                                 d[j + 1] : '.';
+                e->name[j] = 0;
+                break;
+            case AD_TX_POWER:
+                if (len >= 2) {
+                    e->tx_power = d[1];
+                    e->fields |= HAS_TX_POWER;
+                }
+                break;
+            case AD_GAP_APPEARANCE:
+                if (len >= 3) {
+                    e->appearance = d[1] | d[2] << 8;
+                    e->fields |= HAS_APPEARANCE;
+                }
+                break;
+            case AD_MANUFACTURER_DATA:
+                if (len >= 3) {
+                    e->company = d[1] | d[2] << 8;
+                    e->fields |= HAS_COMPANY;
+                }
+                break;
+        }
+
+        i += len + 1;
+    }
+}
+
+void scan_view_add(const bt_bdaddr_t *addr, int rssi, const uint8_t *adv_data) {
+    entry_t *e;
+
+    if (!active)
+        return;
+
+    pthread_mutex_lock(&lock);
+
+    reports++;
+    e = lookup(addr);
+    if (e == NULL)
+        overflow++;
+    else {
+        e->rssi = rssi;
+        e->reports++;
+        e->last_us = monotonic_us();
+        parse_adv_data(e, adv_data);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+static int compare_rows(const void *a, const void *b) {
+    const entry_t *x = a, *y = b;
+
+    switch (sort) {
+        case SORT_RSSI:
+            if (x->rssi != y->rssi)
+                return y->rssi - x->rssi;
+            break;
+        case SORT_RATE:
+            if (x->rate != y->rate)
+                return y->rate > x->rate ? 1 : -1;
+            break;
+        case SORT_LAST_SEEN:
+            if (x->last_us != y->last_us)
+                return y->last_us > x->last_us ? 1 : -1;
+            break;
+        default:
+            break;
+    }
+
+    return memcmp(&x->addr, &y->addr, sizeof(x->addr));
+}
+
+/* Appends to the output of the frame */
+static void put(const char *fmt, ...) {
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(out + out_len, sizeof(out) - out_len, fmt, ap);
+    va_end(ap);
+
+    if (n > 0)
+        out_len += (size_t) n < sizeof(out) - out_len ? (size_t) n :
+                   sizeof(out) - out_len - 1;
+}
+
+/* Formats the assigned numbers advertised by a device */
+static void format_info(const entry_t *e, char *str, size_t size) {
+    const char *name;
+    size_t n = 0;
+
+    str[0] = 0;
+
+    if (e->fields & HAS_COMPANY) {
+        name = company_name(e->company);
+        if (name != NULL)
+            n += snprintf(str + n, size - n, "%s; ", name);
+        else
+            n += snprintf(str + n, size - n, "company 0x%04x; ", e->company);
+    }
+
+    if (e->fields & HAS_UUID16 && n < size) {
+        name = uuid16_name(e->uuid16);
+        if (name != NULL)
+            n += snprintf(str + n, size - n, "%s; ", name);
+        else
+            n += snprintf(str + n, size - n, "0x%04x; ", e->uuid16);
+    }
+
+    if (e->fields & HAS_APPEARANCE && n < size) {
+        name = appearance_name(e->appearance);
+        if (name != NULL)
+            n += snprintf(str + n, size - n, "%s; ", name);
+    }
+
+    /* drop the last separator */
+    if (n >= 2 && n < size)
+        str[n - 2] = 0;
+}
+
+/* Formats the frame and writes what changed. Rates are only updated by the
+ * timer, so redraws after a key press don't skew them. */
+static void draw(bool tick) {
+    uint64_t now = monotonic_us();
+    double secs = (now - drawn_us) / 1000000.0;
+    size_t n = 0, i, j, max_rows, max_cols, width, shown;
+    char tx[8], info[SCREEN_COLS];
+    uint32_t total, lost;
+    entry_t *e;
+
+    pthread_mutex_lock(&lock);
+
+    for (i = 0; i < TABLE_SIZE; i++) {
+        e = &table[i];
+        if (!e->used)
+            continue;
+
+        if (tick && secs > 0) {
+            e->rate += ((e->reports - e->drawn_reports) / secs - e->rate) / 2;
+            e->drawn_reports = e->reports;
+        }
+        memcpy(&rows[n++], e, sizeof(*e));
+    }
+    total = reports;
+    lost = overflow;
+
+    pthread_mutex_unlock(&lock);
+
+    if (tick && secs > 0) {
+        total_rate += ((total - drawn_reports) / secs - total_rate) / 2;
+        drawn_reports = total;
+        drawn_us = now;
+    }
+
+    qsort(rows, n, sizeof(rows[0]), compare_rows);
+
+    out_len = 0;
+
+    /* a resized terminal is cleared and drawn again */
+    rl_terminal_size(&max_rows, &max_cols);
+    if (max_rows > SCREEN_ROWS)
+        max_rows = SCREEN_ROWS;
+    if (max_cols > SCREEN_COLS)
+        max_cols = SCREEN_COLS;
+    if (max_rows != screen_rows || max_cols != screen_cols) {
+        screen_rows = max_rows;
+        screen_cols = max_cols;
+        memset(screen, 0, sizeof(screen));
+        put("\x1b[H\x1b[2J");
+    }
+
+    /* the last column is left empty, so terminals never scroll */
+    width = screen_cols - 1;
+    memset(frame, 0, sizeof(frame));
+    shown = screen_rows > HEADER_ROWS + FOOTER_ROWS ?
+            screen_rows - HEADER_ROWS - FOOTER_ROWS : 0;
+    if (shown > n)
+        shown = n;
+
+    snprintf(frame[0], width + 1, "%s%u devices, %.1f reports/s, %u shown, "
+             "sorted by %s", lost > 0 ? "more than " : "", (unsigned int) n,
+             total_rate, (unsigned int) shown, sort_names[sort]);
+    snprintf(frame[1], width + 1, "%-17s %4s %7s %8s %6s %4s %-20s %s",
+             "Address", "RSSI", "Rate/s", "Reports", "Seen", "TxP", "Name",
+             "Info");
+
+    for (i = 0; i < shown; i++) {
+        char addr_str[BT_ADDRESS_STR_LEN];
+
+        e = &rows[i];
+        if (e->fields & HAS_TX_POWER)
+            snprintf(tx, sizeof(tx), "%d", e->tx_power);
+        else
+            strcpy(tx, "-");
+        format_info(e, info, sizeof(info));
+
+        snprintf(frame[HEADER_ROWS + i], width + 1,
+                 "%-17s %4d %7.1f %8u %5.1fs %4s %-20.20s %s",
+                 ba2str(e->addr.address, addr_str), e->rssi, e->rate,
+                 e->reports, (now - e->last_us) / 1000000.0, tx,
+                 e->name[0] ? e->name : "-", info);
+    }
+
+    if (screen_rows > HEADER_ROWS) {
+        if (rl_dropped() > 0)
+            snprintf(frame[screen_rows - 1], width + 1, "q: quit  s: sort  "
+                     "c: clear  (%u messages hidden)", rl_dropped());
+        else
+            snprintf(frame[screen_rows - 1], width + 1,
+                     "q: quit  s: sort  c: clear");
+    }
+
+    /* rewrite each line from its first changed character */
+    for (i = 0; i < screen_rows; i++) {
+        const char *old = screen[i], *new = frame[i];
+
+        for (j = 0; old[j] != 0 && old[j] == new[j]; j++)
+            ;
+        if (old[j] == 0 && new[j] == 0)
+            continue;
+
+        put("\x1b[%u;%uH%s", (unsigned int) i + 1, (unsigned int) j + 1,
+            new + j);
+        if (strlen(old) > strlen(new))
+            put("\x1b[K");
+        strcpy(screen[i], new);
+    }
+
+    if (out_len > 0) {
+        fwrite(out, 1, out_len, stdout);
+        fflush(stdout);
+    }
+}
+
+static bool redraw(void *user_data) {
+
+    draw(true);
+    return true;
+}
+
+bool scan_view_start() {
+
+    if (active)
+        return false;
+
+    clear_table();
+
+    redraw_timeout = timeout_add(SCAN_VIEW_REDRAW_MS, redraw, NULL);
+    if (redraw_timeout == 0) {
+        rl_printf("Unable to schedule the redraw of the scan view\n");
+        return false;
+    }
+
+    /* alternate screen, hidden cursor */
+    rl_suspend(true);
+    printf("\x1b[?1049h\x1b[?25l");
+    screen_rows = screen_cols = 0;
+    drawn_us = monotonic_us();
+    active = true;
+
+    draw(false);
+
+    return true;
+}
+
+void scan_view_stop() {
+    unsigned int hidden;
+
+    if (!active)
+        return;
+
+    active = false;
+    timeout_remove(redraw_timeout);
+    redraw_timeout = 0;
+
+    printf("\x1b[?25h\x1b[?1049l");
+    fflush(stdout);
+
+    hidden = rl_dropped();
+    rl_suspend(false);
+    if (hidden > 0)
+        rl_printf("%u messages were hidden by the scan view\n", hidden);
+}
+
+bool scan_view_active() {
+
+    return active;
+}
+
+bool scan_view_key(int c) {
+
+    switch (c) {
+        case 'q':
+        case 'Q':
+            return false;
+        case 's':
+        case 'S':
+            sort = (sort + 1) % SORT_COUNT;
+            break;
+        case 'c':
+        case 'C':
+            clear_table();
+            break;
+        default:
+            return true;
+    }
+
+    draw(false);
+
+    return true;
+}
@@ -0,0 +1,34 @@
+#ifndef __SCAN_VIEW_H__
+#define __SCAN_VIEW_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <hardware/bluetooth.h>
+
+/* Devices in the table, more are counted but not shown */
+#define SCAN_VIEW_DEVS 256
+/* The screen is redrawn this often, whatever the rate of reports */
+#define SCAN_VIEW_REDRAW_MS 250
+/* Longest name shown, plus the NUL */
+#define SCAN_VIEW_NAME_LEN 32
+
+/* Full screen table of the devices found by a scan, like top. Reports only
+ * update the table; a timer sorts it and redraws the screen, writing just the
+ * characters that changed since the previous frame.
+ *
+ * While the view is shown it owns the terminal: messages are dropped (see
+ * rl_suspend()) and keys go to scan_view_key(). */
+
+/* Takes over the terminal and starts redrawing */
+bool scan_view_start();
+/* Restores the terminal and the prompt */
+void scan_view_stop();
+bool scan_view_active();
+
+/* Handles a key pressed in the view. Returns false when it must be closed. */
+bool scan_view_key(int c);
+
+/* Accounts an advertising report. Ignored if the view isn't shown. */
+void scan_view_add(const bt_bdaddr_t *addr, int rssi, const uint8_t *adv_data);
+
+#endif /* __SCAN_VIEW_H__ */
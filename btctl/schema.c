@@ -0,0 +1,516 @@
+/*
+ * Decoding of characteristic values with declarative schemas
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "schema.h"
+#include "rl_helper.h"
+#include "stats.h"
+#include "util.h"
+
+#define LINE_LEN 256
+/* Longest line of decoded fields */
+#define OUT_LEN 1024
+
+typedef enum {
+    FIELD_U8,
+    FIELD_I8,
+    FIELD_U16LE,
+    FIELD_U16BE,
+    FIELD_I16LE,
+    FIELD_I16BE,
+    FIELD_U24LE,
+    FIELD_I24LE,
+    FIELD_U32LE,
+    FIELD_U32BE,
+    FIELD_I32LE,
+    FIELD_I32BE,
+} field_type_t;
+
+static const struct {
+    const char *name;
+    uint8_t size;
+} field_types[] = {
+    [FIELD_U8] = { "u8", 1 },
+    [FIELD_I8] = { "i8", 1 },
+    [FIELD_U16LE] = { "u16le", 2 },
+    [FIELD_U16BE] = { "u16be", 2 },
+    [FIELD_I16LE] = { "i16le", 2 },
+    [FIELD_I16BE] = { "i16be", 2 },
+    [FIELD_U24LE] = { "u24le", 3 },
+    [FIELD_I24LE] = { "i24le", 3 },
+    [FIELD_U32LE] = { "u32le", 4 },
+    [FIELD_U32BE] = { "u32be", 4 },
+    [FIELD_I32LE] = { "i32le", 4 },
+    [FIELD_I32BE] = { "i32be", 4 },
+};
+
+#define FIELD_TYPES (sizeof(field_types) / sizeof(field_types[0]))
+
+/* A compiled field, everything decoding needs is resolved here */
+typedef struct {
+    uint8_t type; /* field_type_t */
+    uint8_t decimals; /* digits printed after the point, when scaled */
+    uint16_t offset;
+    uint16_t end; /* offset + size, the value must be at least this long */
+    bool scaled;
+    double scale;
+    char name[SCHEMA_NAME_LEN];
+} field_t;
+
+typedef struct {
+    bt_uuid_t uuid;
+    uint16_t first; /* index in fields */
+    uint16_t count;
+    char spec[LINE_LEN]; /* as given, for the status */
+} schema_t;
+
+/* Values are decoded on the stack callback thread, schemas are changed from
+ * commands */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static schema_t schemas[SCHEMA_MAX];
+static int schemas_count = 0;
+static field_t fields[SCHEMA_FIELDS_MAX];
+static int fields_count = 0;
+static bool json = false;
+
+static char *trim(char *str) {
+    char *end;
+
+    while (isspace((unsigned char) *str))
+        str++;
+
+    end = str + strlen(str);
+    while (end > str && isspace((unsigned char) end[-1]))
+        end--;
+    *end = 0;
+
+    return str;
+}
+
+/* Digits needed after the point to show a value scaled by scale. The factor
+ * is given as text, so "0.5" gives 1 and "/100" gives 2. */
+static int scale_decimals(const char *num, bool divisor) {
+    const char *dot = strchr(num, '.');
+    double d;
+    int n;
+
+    if (!divisor)
+        return dot ? (int) strlen(dot + 1) : 0;
+
+    /* powers of 10 are exact, anything else gets 3 digits */
+    d = strtod(num, NULL);
+    for (n = 0; n < 9 && d > 1.0; n++)
+        d /= 10.0;
+
+    return d == 1.0 ? n : 3;
+}
+
+/* Compiles one field into f, advancing offset. Returns false if it's
+ * invalid, is_skip is set for skip, which produces no field. */
+static bool compile_field(char *str, field_t *f, int *offset, bool *is_skip,
+                          const char **error) {
+    char *type, *name, *op, *end, *save;
+    unsigned long n;
+    unsigned int i;
+    double scale;
+
+    type = strtok_r(str, " \t", &save);
+    name = strtok_r(NULL, " \t", &save);
+    if (type == NULL || name == NULL || strtok_r(NULL, " \t", &save)) {
+        *error = "expected \"<type> <name>\"";
+        return false;
+    }
+
+    if (strcmp(type, "skip") == 0) {
+        errno = 0;
+        n = strtoul(name, &end, 10);
+        if (*end != 0 || errno != 0 || n == 0 || n > BTGATT_MAX_ATTR_LEN) {
+            *error = "invalid skip";
+            return false;
+        }
+        *offset += n;
+        *is_skip = true;
+        return true;
+    }
+
+    *is_skip = false;
+
+    for (i = 0; i < FIELD_TYPES; i++)
+        if (strcmp(type, field_types[i].name) == 0)
+            break;
+
+    if (i == FIELD_TYPES) {
+        *error = "unknown type";
+        return false;
+    }
+
+    memset(f, 0, sizeof(*f));
+    f->type = i;
+    f->offset = *offset;
+    f->end = *offset + field_types[i].size;
+    *offset = f->end;
+
+    op = strpbrk(name, "/*");
+    if (op != NULL) {
+        errno = 0;
+        scale = strtod(op + 1, &end);
+        if (op[1] == 0 || *end != 0 || errno != 0 || scale <= 0.0) {
+            *error = "invalid scale";
+            return false;
+        }
+        f->scaled = true;
+        f->scale = *op == '/' ? 1.0 / scale : scale;
+        f->decimals = scale_decimals(op + 1, *op == '/');
+        *op = 0;
+    }
+
+    if (name[0] == 0 || strlen(name) >= SCHEMA_NAME_LEN) {
+        *error = "invalid name";
+        return false;
+    }
+
+    for (end = name; *end != 0; end++)
+        if (!isalnum((unsigned char) *end) && *end != '_') {
+            *error = "invalid name";
+            return false;
+        }
+
+    strcpy(f->name, name);
+
+    if (f->end > BTGATT_MAX_ATTR_LEN) {
+        *error = "fields longer than a value";
+        return false;
+    }
+
+    return true;
+}
+
+static schema_t *find_schema(const bt_uuid_t *uuid) {
+    int i;
+
+    for (i = 0; i < schemas_count; i++)
+        if (!memcmp(&schemas[i].uuid, uuid, sizeof(*uuid)))
+            return &schemas[i];
+
+    return NULL;
+}
+
+/* Removes a schema and its fields, keeping both lists packed. Must be called
+ * with the lock held. */
+static void remove_schema(schema_t *s) {
+    int i, first = s->first, count = s->count;
+
+    memmove(&fields[first], &fields[first + count],
+            (fields_count - first - count) * sizeof(field_t));
+    fields_count -= count;
+
+    for (i = 0; i < schemas_count; i++)
+        if (schemas[i].first > first)
+            schemas[i].first -= count;
+
+    memmove(s, s + 1, (&schemas[schemas_count] - s - 1) * sizeof(schema_t));
+    schemas_count--;
+}
+
+bool schema_add(const char *spec, const char *where) {
+    field_t compiled[SCHEMA_FIELDS_MAX];
+    char line[LINE_LEN];
+    const char *error = NULL;
+    char *p, *uuid_str, *field, *save;
+    bt_uuid_t uuid;
+    schema_t *s;
+    bool is_skip;
+    int count = 0, offset = 0, existing = 0;
+
+    if (strlen(spec) >= sizeof(line)) {
+        error = "schema too long";
+        goto failed;
+    }
+
+    strcpy(line, spec);
+    p = trim(line);
+
+    uuid_str = p;
+    p += strcspn(p, " \t");
+    if (*p != 0)
+        *p++ = 0;
+
+    if (!str2uuid(uuid_str, &uuid)) {
+        error = "invalid UUID";
+        goto failed;
+    }
+
+    for (field = strtok_r(p, ",", &save); field != NULL;
+         field = strtok_r(NULL, ",", &save)) {
+        if (count == SCHEMA_FIELDS_MAX) {
+            error = "too many fields";
+            goto failed;
+        }
+
+        if (!compile_field(field, &compiled[count], &offset, &is_skip,
+                           &error))
+            goto failed;
+
+        if (!is_skip)
+            count++;
+    }
+
+    if (count == 0) {
+        error = "no fields";
+        goto failed;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    s = find_schema(&uuid);
+    if (s != NULL)
+        existing = s->count;
+
+    if (s == NULL && schemas_count == SCHEMA_MAX) {
+        pthread_mutex_unlock(&lock);
+        error = "too many schemas";
+        goto failed;
+    }
+
+    if (fields_count - existing + count > SCHEMA_FIELDS_MAX) {
+        pthread_mutex_unlock(&lock);
+        error = "too many fields";
+        goto failed;
+    }
+
+    if (s != NULL)
+        remove_schema(s);
+
+    s = &schemas[schemas_count++];
+    memcpy(&s->uuid, &uuid, sizeof(uuid));
+    s->first = fields_count;
+    s->count = count;
+    snprintf(s->spec, sizeof(s->spec), "%s", trim(strcpy(line, spec)));
+    memcpy(&fields[fields_count], compiled, count * sizeof(field_t));
+    fields_count += count;
+
+    pthread_mutex_unlock(&lock);
+
+    return true;
+
+failed:
+    if (where != NULL)
+        rl_printf("%s: %s\n", where, error);
+    else
+        rl_printf("Invalid schema: %s\n", error);
+    return false;
+}
+
+bool schema_load(const char *path) {
+    char line[LINE_LEN];
+    char where[LINE_LEN];
+    int lineno = 0, added = 0;
+    char *p;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        rl_printf("Unable to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+
+        p = strchr(line, '#');
+        if (p != NULL)
+            *p = 0;
+
+        p = trim(line);
+        if (*p == 0)
+            continue;
+
+        snprintf(where, sizeof(where), "%s:%d", path, lineno);
+        if (schema_add(p, where))
+            added++;
+    }
+
+    fclose(f);
+
+    rl_printf("Added %d schemas\n", added);
+
+    return added > 0;
+}
+
+bool schema_remove(const bt_uuid_t *uuid) {
+    schema_t *s;
+
+    pthread_mutex_lock(&lock);
+
+    s = find_schema(uuid);
+    if (s != NULL)
+        remove_schema(s);
+
+    pthread_mutex_unlock(&lock);
+
+    return s != NULL;
+}
+
+void schema_clear() {
+
+    pthread_mutex_lock(&lock);
+    schemas_count = 0;
+    fields_count = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+void schema_set_json(bool enable) {
+
+    json = enable;
+}
+
+void schema_print_status() {
+    int i;
+
+    pthread_mutex_lock(&lock);
+
+    rl_printf("%d schemas, %d of %d fields, %s output\n", schemas_count,
+              fields_count, SCHEMA_FIELDS_MAX, json ? "JSON" : "text");
+
+    for (i = 0; i < schemas_count; i++)
+        rl_printf("  %s\n", schemas[i].spec);
+
+    pthread_mutex_unlock(&lock);
+}
+
+/* Reads a field from a value at least f->end bytes long */
+static int64_t read_field(const field_t *f, const uint8_t *value) {
+    const uint8_t *p = value + f->offset;
+
+    switch (f->type) {
+        case FIELD_U8:
+            return p[0];
+        case FIELD_I8:
+            return (int8_t) p[0];
+        case FIELD_U16LE:
+            return (uint16_t) (p[0] | p[1] << 8);
+        case FIELD_U16BE:
+            return (uint16_t) (p[1] | p[0] << 8);
+        case FIELD_I16LE:
+            return (int16_t) (p[0] | p[1] << 8);
+        case FIELD_I16BE:
+            return (int16_t) (p[1] | p[0] << 8);
+        case FIELD_U24LE:
+            return p[0] | p[1] << 8 | p[2] << 16;
+        case FIELD_I24LE:
+            /* sign extended from bit 23 */
+            return ((int32_t) (p[0] << 8 | p[1] << 16 | (uint32_t) p[2] << 24))
+                   >> 8;
+        case FIELD_U32LE:
+            return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+        case FIELD_U32BE:
+            return p[3] | p[2] << 8 | p[1] << 16 | (uint32_t) p[0] << 24;
+        case FIELD_I32LE:
+            return (int32_t) (p[0] | p[1] << 8 | p[2] << 16 |
+                              (uint32_t) p[3] << 24);
+        case FIELD_I32BE:
+            return (int32_t) (p[3] | p[2] << 8 | p[1] << 16 |
+                              (uint32_t) p[0] << 24);
+    }
+
+    return 0;
+}
+
+/* Decodes a value into out with the fields of s. Must be called with the lock
+ * held. */
+static void decode(const schema_t *s, const uint8_t *value, int len,
+                   char *out) {
+    const field_t *first = &fields[s->first];
+    const field_t *last = first + s->count;
+    const field_t *f;
+    char *p = out, *end;
+    const char *sep;
+    int64_t raw;
+
+    STATS_SCOPE("decode", __func__);
+
+    /* keep room for the closing brace and the NUL */
+    end = out + OUT_LEN - (json ? 2 : 1);
+
+    if (json)
+        *p++ = '{';
+
+    for (f = first; f < last && f->end <= len && p < end; f++) {
+        raw = read_field(f, value);
+        sep = f == first ? "" : json ? "," : " ";
+
+        if (json)
+            p += snprintf(p, end - p, "%s\"%s\":", sep, f->name);
+        else
+            p += snprintf(p, end - p, "%s%s=", sep, f->name);
+
+        if (p >= end)
+            break;
+
+        if (f->scaled)
+            p += snprintf(p, end - p, "%.*f", f->decimals, raw * f->scale);
+        else
+            p += snprintf(p, end - p, "%lld", (long long) raw);
+    }
+
+    /* fields past the end of a short value are left out */
+    if (f < last && p < end) {
+        sep = f == first ? "" : json ? "," : " ";
+        p += snprintf(p, end - p, json ? "%s\"truncated\":true" :
+                      "%s(truncated)", sep);
+    }
+
+    if (p > end)
+        p = end;
+    if (json)
+        *p++ = '}';
+    *p = 0;
+}
+
+bool schema_print(const bt_uuid_t *uuid, const uint8_t *value, int len) {
+    char out[OUT_LEN];
+    bool as_json;
+    schema_t *s;
+
+    pthread_mutex_lock(&lock);
+
+    s = find_schema(uuid);
+    if (s == NULL) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+
+    as_json = json;
+    decode(s, value, len, out);
+
+    pthread_mutex_unlock(&lock);
+
+    if (as_json)
+        rl_printf("  %s\n", out);
+    else
+        rl_printf("  Fields: %s\n", out);
+
+    return true;
+}
@@ -0,0 +1,45 @@
+#ifndef __SCHEMA_H__
+#define __SCHEMA_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <hardware/bluetooth.h>
+#include <hardware/bt_gatt.h>
+
+/* Maximum number of characteristics with a schema */
+#define SCHEMA_MAX 32
+/* Maximum number of fields, over all schemas */
+#define SCHEMA_FIELDS_MAX 256
+/* Longest field name, plus the NUL */
+#define SCHEMA_NAME_LEN 16
+
+/* Schemas describe the layout of characteristic values so they can be printed
+ * as named fields instead of bytes. A schema is a characteristic UUID followed
+ * by comma separated fields, in the order they appear in the value:
+ *   0x2a6e u16le temp/100, i8 rssi, skip 1, u32le seq
+ * Field types are u8, i8, u16le, u16be, i16le, i16be, u24le, i24le, u32le,
+ * u32be, i32le and i32be; "skip <n>" jumps over n bytes. A name may be
+ * followed by /<divisor> or *<factor> to scale the value.
+ *
+ * Schemas are compiled when added into a flat list of fields with their
+ * offsets and scales, so decoding a value is a single pass over that list. */
+
+/* Adds the schema in spec, replacing the one of the same characteristic.
+ * Prints the reason, prefixed with where if not NULL, and returns false if it
+ * is invalid. */
+bool schema_add(const char *spec, const char *where);
+/* Adds the schemas in a file, one per line, # starts a comment */
+bool schema_load(const char *path);
+bool schema_remove(const bt_uuid_t *uuid);
+void schema_clear();
+
+/* Decoded values are printed as name=value pairs, or as one JSON object */
+void schema_set_json(bool json);
+
+void schema_print_status();
+
+/* Prints the fields of a value of the characteristic with UUID uuid. Returns
+ * false if it has no schema. */
+bool schema_print(const bt_uuid_t *uuid, const uint8_t *value, int len);
+
+#endif /* __SCHEMA_H__ */
@@ -0,0 +1,190 @@
+/*
+ * Cost accounting of callbacks and commands
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mem.h"
+#include "rl_helper.h"
+#include "stats.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/* sites entered so far, newest first */
+static stats_site_t *sites = NULL;
+
+/* rl_printf time of each thread, no_printf_ns if it couldn't be allocated */
+static pthread_key_t printf_key;
+static pthread_once_t printf_key_once = PTHREAD_ONCE_INIT;
+static uint64_t no_printf_ns;
+
+static void create_key() {
+
+    pthread_key_create(&printf_key, mem_free);
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Returns the rl_printf time of the calling thread */
+static uint64_t *thread_printf_ns() {
+    uint64_t *ns;
+
+    pthread_once(&printf_key_once, create_key);
+
+    ns = pthread_getspecific(printf_key);
+    if (ns != NULL)
+        return ns;
+
+    ns = mem_calloc(MEM_STATS, 1, sizeof(*ns));
+    if (ns == NULL || pthread_setspecific(printf_key, ns) != 0) {
+        mem_free(ns);
+        return &no_printf_ns;
+    }
+
+    return ns;
+}
+
+static void register_site(stats_site_t *site, const char *cat,
+                          const char *name) {
+
+    pthread_mutex_lock(&lock);
+
+    if (site->cat == NULL) {
+        site->name = name;
+        site->next = sites;
+        sites = site;
+        /* set last, the site is only looked at again once cat is set */
+        __sync_synchronize();
+        site->cat = cat;
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+stats_scope_t stats_scope_begin(stats_site_t *site, const char *cat,
+                                const char *name) {
+    stats_scope_t scope;
+
+    if (__builtin_expect(site->cat == NULL, 0))
+        register_site(site, cat, name);
+
+    scope.site = site;
+    scope.printf_ns = *thread_printf_ns();
+    scope.start_ns = now_ns();
+
+    return scope;
+}
+
+void stats_scope_end(const stats_scope_t *scope) {
+    stats_site_t *site = scope->site;
+    uint64_t ns = now_ns() - scope->start_ns;
+
+    site->count++;
+    site->total_ns += ns;
+    if (ns > site->max_ns)
+        site->max_ns = ns;
+    site->printf_ns += *thread_printf_ns() - scope->printf_ns;
+}
+
+uint64_t stats_printf_begin() {
+
+    return now_ns();
+}
+
+void stats_printf_end(uint64_t start_ns) {
+
+    *thread_printf_ns() += now_ns() - start_ns;
+}
+
+void stats_clear() {
+    stats_site_t *site;
+
+    pthread_mutex_lock(&lock);
+
+    for (site = sites; site != NULL; site = site->next) {
+        site->count = 0;
+        site->total_ns = 0;
+        site->max_ns = 0;
+        site->printf_ns = 0;
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+static int cmp_total(const void *a, const void *b) {
+    const stats_site_t *sa = *(stats_site_t * const *) a;
+    const stats_site_t *sb = *(stats_site_t * const *) b;
+
+    if (sa->total_ns != sb->total_ns)
+        return sa->total_ns < sb->total_ns ? 1 : -1;
+
+    return strcmp(sa->name, sb->name);
+}
+
+void stats_print(const char *cat) {
+    stats_site_t **list;
+    stats_site_t *site;
+    size_t n = 0, i;
+
+    pthread_mutex_lock(&lock);
+
+    for (site = sites; site != NULL; site = site->next)
+        n++;
+
+    list = mem_alloc(MEM_STATS, n * sizeof(*list) + 1);
+    if (list == NULL) {
+        pthread_mutex_unlock(&lock);
+        rl_printf("Not enough memory\n");
+        return;
+    }
+
+    n = 0;
+    for (site = sites; site != NULL; site = site->next)
+        if (site->count > 0 && (cat == NULL || strcmp(site->cat, cat) == 0))
+            list[n++] = site;
+
+    pthread_mutex_unlock(&lock);
+
+    if (n == 0) {
+        rl_printf("Nothing accounted\n");
+        mem_free(list);
+        return;
+    }
+
+    qsort(list, n, sizeof(list[0]), cmp_total);
+
+    rl_printf("%-8s %-28s %6s %9s %7s %8s %8s\n", "Type", "Name", "Calls",
+              "Total ms", "Avg us", "Max us", "Print ms");
+
+    for (i = 0; i < n; i++) {
+        site = list[i];
+        rl_printf("%-8s %-28s %6u %9.3f %7.1f %8.1f %8.3f\n", site->cat,
+                  site->name, site->count, site->total_ns / 1e6,
+                  site->total_ns / 1e3 / site->count, site->max_ns / 1e3,
+                  site->printf_ns / 1e6);
+    }
+
+    mem_free(list);
+}
@@ -0,0 +1,57 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Cost accounting of callbacks, commands and other code worth watching: how
+ * many times each was entered, the total and longest time spent in it and
+ * how much of that time went to rl_printf, so a busy session shows whether
+ * decoding, formatting or terminal output is what keeps the tool busy.
+ *
+ * Each place accounted has a site, registered the first time it is entered.
+ * A site is meant to be entered from one thread at a time, as callbacks run
+ * on the stack thread and commands on the main one, its counters are updated
+ * without locking. Accounting is always on and costs two clock reads. */
+typedef struct stats_site {
+    const char *cat;
+    const char *name;
+    uint32_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t printf_ns; /* part of total_ns spent in rl_printf */
+    struct stats_site *next;
+} stats_site_t;
+
+typedef struct {
+    stats_site_t *site;
+    uint64_t start_ns;
+    uint64_t printf_ns; /* rl_printf time of the thread when entered */
+} stats_scope_t;
+
+/* Accounts the rest of the enclosing block to site, ending on any return */
+#define STATS_SITE_SCOPE(site, cat, name) \
+    stats_scope_t __stats_scope __attribute__((cleanup(stats_scope_end))) = \
+        stats_scope_begin(site, cat, name)
+
+/* Same, with a site of its own for the code it is used in */
+#define STATS_SCOPE(cat, name) \
+    static stats_site_t __stats_site; \
+    STATS_SITE_SCOPE(&__stats_site, cat, name)
+
+stats_scope_t stats_scope_begin(stats_site_t *site, const char *cat,
+                                const char *name);
+void stats_scope_end(const stats_scope_t *scope);
+
+/* Accounts a call of rl_printf, started at the time returned by
+ * stats_printf_begin() */
+uint64_t stats_printf_begin();
+void stats_printf_end(uint64_t start_ns);
+
+/* Resets the counters of all sites */
+void stats_clear();
+/* Prints the sites entered, those with the most time spent first, limited to
+ * the category cat unless it is NULL */
+void stats_print(const char *cat);
+
+#endif /* __STATS_H__ */
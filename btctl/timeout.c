@@ -0,0 +1,196 @@
+/*
+ * Main loop timeouts
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "timeout.h"
+#include "util.h"
+
+/* an expiration time no timeout ever reaches, used while one is running */
+#define RUNNING UINT64_MAX
+
+typedef struct timeout {
+    int id; /* 0 if the slot is free */
+    uint64_t expire_us;
+    unsigned int interval_ms;
+    timeout_func_t func;
+    void *user_data;
+} timeout_t;
+
+/* Timeouts run on the main thread but can be armed or disarmed from the stack
+ * callback thread, so the table is protected by a lock. It is never held
+ * while running a callback. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static timeout_t timeouts[TIMEOUT_MAX];
+static int last_id = 0;
+static int wakeup_pipe[2] = { -1, -1 };
+
+/* Must be called with the lock held */
+static void init_pipe() {
+
+    if (wakeup_pipe[0] >= 0 || pipe(wakeup_pipe) < 0)
+        return;
+
+    fcntl(wakeup_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(wakeup_pipe[1], F_SETFL, O_NONBLOCK);
+}
+
+int timeout_add(unsigned int ms, timeout_func_t func, void *user_data) {
+    timeout_t *t = NULL;
+    int i, id = 0;
+
+    pthread_mutex_lock(&lock);
+
+    for (i = 0; i < TIMEOUT_MAX; i++)
+        if (timeouts[i].id == 0) {
+            t = &timeouts[i];
+            break;
+        }
+
+    if (t != NULL) {
+        /* IDs are positive and not reused until they wrap around */
+        if (++last_id <= 0)
+            last_id = 1;
+
+        t->id = id = last_id;
+        t->expire_us = monotonic_us() + (uint64_t) ms * 1000;
+        t->interval_ms = ms;
+        t->func = func;
+        t->user_data = user_data;
+    }
+
+    init_pipe();
+
+    pthread_mutex_unlock(&lock);
+
+    /* let the main loop recompute its poll timeout. If the pipe is full a
+     * wakeup is already pending. */
+    if (id > 0 && wakeup_pipe[1] >= 0) {
+        char c = 0;
+
+        if (write(wakeup_pipe[1], &c, 1) < 0) {
+            /* nothing to do */
+        }
+    }
+
+    return id;
+}
+
+void timeout_remove(int id) {
+    int i;
+
+    if (id <= 0)
+        return;
+
+    pthread_mutex_lock(&lock);
+
+    for (i = 0; i < TIMEOUT_MAX; i++)
+        if (timeouts[i].id == id) {
+            timeouts[i].id = 0;
+            break;
+        }
+
+    pthread_mutex_unlock(&lock);
+}
+
+int timeout_fd() {
+    int fd;
+
+    pthread_mutex_lock(&lock);
+    init_pipe();
+    fd = wakeup_pipe[0];
+    pthread_mutex_unlock(&lock);
+
+    return fd;
+}
+
+int timeout_poll_ms() {
+    uint64_t next = RUNNING, now = monotonic_us();
+    int i;
+
+    pthread_mutex_lock(&lock);
+
+    for (i = 0; i < TIMEOUT_MAX; i++)
+        if (timeouts[i].id != 0 && timeouts[i].expire_us < next)
+            next = timeouts[i].expire_us;
+
+    pthread_mutex_unlock(&lock);
+
+    if (next == RUNNING)
+        return -1;
+
+    if (next <= now)
+        return 0;
+
+    /* round up, so poll() doesn't return just before the expiration */
+    return (next - now + 999) / 1000;
+}
+
+void timeout_dispatch() {
+    char buf[64];
+    uint64_t now = monotonic_us();
+
+    /* consume the wakeups */
+    while (wakeup_pipe[0] >= 0 && read(wakeup_pipe[0], buf, sizeof(buf)) > 0)
+        ;
+
+    while (true) {
+        timeout_t *t = NULL, run;
+        bool again;
+        int i;
+
+        pthread_mutex_lock(&lock);
+
+        for (i = 0; i < TIMEOUT_MAX; i++)
+            if (timeouts[i].id != 0 && timeouts[i].expire_us <= now &&
+                (t == NULL || timeouts[i].expire_us < t->expire_us))
+                t = &timeouts[i];
+
+        if (t == NULL) {
+            pthread_mutex_unlock(&lock);
+            break;
+        }
+
+        run = *t;
+        t->expire_us = RUNNING;
+
+        pthread_mutex_unlock(&lock);
+
+        again = run.func(run.user_data);
+
+        pthread_mutex_lock(&lock);
+
+        /* the callback may have removed it, and the slot may be reused */
+        if (t->id == run.id) {
+            if (again && run.interval_ms > 0) {
+                t->expire_us = run.expire_us + (uint64_t) run.interval_ms *
+                               1000;
+                /* skip periods missed while the main loop was busy */
+                if (t->expire_us <= now)
+                    t->expire_us = now + (uint64_t) run.interval_ms * 1000;
+            } else
+                t->id = 0;
+        }
+
+        pthread_mutex_unlock(&lock);
+    }
+}
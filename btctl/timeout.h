@@ -0,0 +1,33 @@
+#ifndef __TIMEOUT_H__
+#define __TIMEOUT_H__
+
+#include <stdbool.h>
+
+/* Maximum number of timeouts armed at the same time. The fleet and pair batch
+ * engines arm a deadline per slot besides their runs, and scans, the scan
+ * view, value logs, notification sinks and replays a few more; about 30 at
+ * worst, with room to spare. */
+#define TIMEOUT_MAX 64
+
+/* Called from the main loop when a timeout expires. Returning true re-arms it
+ * with the same interval, counted from the previous expiration so repeating
+ * timeouts don't drift. */
+typedef bool (*timeout_func_t)(void *user_data);
+
+/* Arms a timeout of ms milliseconds. Returns its ID (> 0), or 0 if all
+ * timeouts are in use. Can be called from any thread. */
+int timeout_add(unsigned int ms, timeout_func_t func, void *user_data);
+/* Disarms a timeout. Removing an expired or unknown ID does nothing. */
+void timeout_remove(int id);
+
+/* Main loop integration: poll() timeout_fd() for POLLIN with a timeout of
+ * timeout_poll_ms(), then call timeout_dispatch(). The descriptor becomes
+ * readable when a timeout is added from another thread, so poll() returns to
+ * recompute its timeout. */
+int timeout_fd();
+/* Milliseconds until the next expiration, or -1 if no timeout is armed */
+int timeout_poll_ms();
+/* Runs the callbacks of expired timeouts */
+void timeout_dispatch();
+
+#endif /* __TIMEOUT_H__ */
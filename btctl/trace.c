@@ -0,0 +1,257 @@
+/*
+ * Trace points with per-thread ring buffers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mem.h"
+#include "rl_helper.h"
+#include "trace.h"
+
+typedef struct {
+    /* index the event was written at, set last: a reader copying the event
+     * while it is overwritten sees it change */
+    volatile uint64_t seq;
+    uint64_t ts_ns;
+    const char *cat;
+    const char *name;
+    int64_t arg;
+    char phase;
+} trace_ev_t;
+
+/* Only its thread writes a ring. head is published after the event, so
+ * readers never look at an event being written. */
+typedef struct {
+    trace_ev_t *events;
+    volatile uint64_t head; /* events ever written */
+    volatile uint64_t start; /* events before it were cleared */
+    pid_t tid;
+    char name[17];
+} ring_t;
+
+volatile bool trace_on = false;
+
+static ring_t rings[TRACE_THREADS_MAX];
+static volatile int ring_count = 0;
+/* given to threads beyond TRACE_THREADS_MAX, their events are dropped */
+static ring_t no_ring;
+
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static void create_key() {
+
+    pthread_key_create(&ring_key, NULL);
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Returns the ring of the calling thread, claiming one on its first event */
+static ring_t *thread_ring() {
+    ring_t *ring;
+    int i;
+
+    pthread_once(&ring_key_once, create_key);
+
+    ring = pthread_getspecific(ring_key);
+    if (ring != NULL)
+        return ring;
+
+    ring = &no_ring;
+    i = __sync_fetch_and_add(&ring_count, 1);
+    if (i < TRACE_THREADS_MAX) {
+        ring_t *r = &rings[i];
+
+        r->events = mem_calloc(MEM_TRACE, TRACE_RING_SIZE,
+                               sizeof(trace_ev_t));
+        r->tid = syscall(SYS_gettid);
+        if (prctl(PR_GET_NAME, r->name) != 0)
+            snprintf(r->name, sizeof(r->name), "%d", r->tid);
+
+        if (r->events != NULL)
+            ring = r;
+    }
+
+    pthread_setspecific(ring_key, ring);
+
+    return ring;
+}
+
+void trace_event(char phase, const char *cat, const char *name, int64_t arg) {
+    ring_t *ring = thread_ring();
+    trace_ev_t *ev;
+    uint64_t head;
+
+    if (ring == &no_ring)
+        return;
+
+    head = ring->head;
+    ev = &ring->events[head & (TRACE_RING_SIZE - 1)];
+
+    /* invalidate first, so a reader doesn't take a half written event for
+     * the one it replaces */
+    ev->seq = UINT64_MAX;
+    __sync_synchronize();
+
+    ev->ts_ns = now_ns();
+    ev->cat = cat;
+    ev->name = name;
+    ev->arg = arg;
+    ev->phase = phase;
+
+    __sync_synchronize();
+    ev->seq = head;
+    ring->head = head + 1;
+}
+
+void trace_enable(bool enable) {
+
+    trace_on = enable;
+}
+
+void trace_clear() {
+    int i, count = ring_count;
+
+    for (i = 0; i < count && i < TRACE_THREADS_MAX; i++)
+        rings[i].start = rings[i].head;
+}
+
+void trace_print_status() {
+    int i, count = ring_count;
+    uint64_t n;
+
+    rl_printf("Tracing %s\n", trace_on ? "on" : "off");
+
+    for (i = 0; i < count && i < TRACE_THREADS_MAX; i++) {
+        n = rings[i].head - rings[i].start;
+        rl_printf("  thread %d (%s): %llu events, %llu kept\n", rings[i].tid,
+                  rings[i].name, (unsigned long long) n,
+                  (unsigned long long) (n < TRACE_RING_SIZE ? n :
+                                        TRACE_RING_SIZE));
+    }
+
+    if (count > TRACE_THREADS_MAX)
+        rl_printf("  events of %d threads dropped\n",
+                  count - TRACE_THREADS_MAX);
+}
+
+/* Writes a JSON string, names are identifiers but may come from commands */
+static void put_string(FILE *f, const char *str) {
+
+    fputc('"', f);
+    for (; *str != 0; str++) {
+        if (*str == '"' || *str == '\\')
+            fputc('\\', f);
+        if ((unsigned char) *str >= 0x20)
+            fputc(*str, f);
+    }
+    fputc('"', f);
+}
+
+/* Copies the events kept in a ring to f, returns how many */
+static unsigned int dump_ring(FILE *f, const ring_t *ring, pid_t pid,
+                              bool *first) {
+    uint64_t head = ring->head, i;
+    unsigned int n = 0;
+    trace_ev_t ev;
+
+    __sync_synchronize();
+
+    i = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    if (i < ring->start)
+        i = ring->start;
+
+    for (; i < head; i++) {
+        const trace_ev_t *slot = &ring->events[i & (TRACE_RING_SIZE - 1)];
+
+        if (slot->seq != i)
+            continue;
+        __sync_synchronize();
+        memcpy(&ev, (const void *) slot, sizeof(ev));
+        __sync_synchronize();
+        /* overwritten while copying */
+        if (slot->seq != i)
+            continue;
+
+        fprintf(f, "%s\n{\"ph\":\"%c\",\"cat\":", *first ? "" : ",",
+                ev.phase);
+        put_string(f, ev.cat);
+        fprintf(f, ",\"name\":");
+        put_string(f, ev.name);
+        fprintf(f, ",\"ts\":%llu.%03u,\"pid\":%d,\"tid\":%d,"
+                "\"args\":{\"arg\":%lld}%s}",
+                (unsigned long long) (ev.ts_ns / 1000),
+                (unsigned int) (ev.ts_ns % 1000), pid, ring->tid,
+                (long long) ev.arg, ev.phase == 'i' ? ",\"s\":\"t\"" : "");
+        *first = false;
+        n++;
+    }
+
+    return n;
+}
+
+bool trace_dump(const char *path) {
+    int i, count = ring_count;
+    unsigned int n = 0;
+    bool first = true;
+    pid_t pid = getpid();
+    FILE *f;
+
+    f = fopen(path, "w");
+    if (f == NULL) {
+        rl_printf("Unable to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    for (i = 0; i < count && i < TRACE_THREADS_MAX; i++) {
+        fprintf(f, "%s\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,"
+                "\"tid\":%d,\"args\":{\"name\":", first ? "" : ",", pid,
+                rings[i].tid);
+        put_string(f, rings[i].name);
+        fprintf(f, "}}");
+        first = false;
+
+        n += dump_ring(f, &rings[i], pid, &first);
+    }
+
+    fprintf(f, "\n]}\n");
+
+    if (fclose(f) != 0) {
+        rl_printf("Failed to write %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    rl_printf("%u events written to %s\n", n, path);
+
+    return true;
+}
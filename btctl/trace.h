@@ -0,0 +1,94 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Events kept per thread, a power of 2 */
+#define TRACE_RING_SIZE 4096
+/* Threads that can record events */
+#define TRACE_THREADS_MAX 8
+
+/* Trace points: the beginning and end of something, or an instant, with a
+ * category, a name and a small integer argument. Names and categories must
+ * be string constants, only their address is kept.
+ *
+ * Each thread writes to its own ring of the last TRACE_RING_SIZE events, with
+ * no lock, and "trace dump" exports them in the Chrome trace event format,
+ * which Perfetto and chrome://tracing read. While tracing is off a trace
+ * point is a single branch on trace_on, expected not to be taken. */
+extern volatile bool trace_on;
+
+#define TRACE_LIKELY_OFF() __builtin_expect(trace_on, 0)
+
+#define TRACE_BEGIN(cat, name, arg) \
+    do { \
+        if (TRACE_LIKELY_OFF()) \
+            trace_event('B', cat, name, arg); \
+    } while (0)
+
+#define TRACE_END(cat, name, arg) \
+    do { \
+        if (TRACE_LIKELY_OFF()) \
+            trace_event('E', cat, name, arg); \
+    } while (0)
+
+#define TRACE_INSTANT(cat, name, arg) \
+    do { \
+        if (TRACE_LIKELY_OFF()) \
+            trace_event('i', cat, name, arg); \
+    } while (0)
+
+/* Calls iface->func(...), traced as a HAL call with its result as argument of
+ * the end */
+#define HAL_CALL(iface, func, ...) \
+    ({ \
+        __typeof__((iface)->func(__VA_ARGS__)) __hal_ret; \
+        TRACE_BEGIN("hal", #func, 0); \
+        __hal_ret = (iface)->func(__VA_ARGS__); \
+        TRACE_END("hal", #func, __hal_ret); \
+        __hal_ret; \
+    })
+
+/* Traces the rest of the enclosing block, ending it on any return. Whether
+ * tracing is on is read once, when the scope begins, and the end tests that
+ * copy, so a scope is also a single branch while tracing is off. */
+typedef struct {
+    bool on; /* tracing was on when the scope began */
+    const char *cat;
+    const char *name;
+} trace_scope_t;
+
+#define TRACE_SCOPE(cat, name, arg) \
+    trace_scope_t __trace_scope __attribute__((cleanup(trace_scope_end))) = \
+        trace_scope_begin(cat, name, arg)
+
+/* Traces a stack callback, named after the function */
+#define TRACE_CALLBACK(arg) TRACE_SCOPE("callback", __func__, arg)
+
+void trace_event(char phase, const char *cat, const char *name, int64_t arg);
+
+static inline trace_scope_t trace_scope_begin(const char *cat,
+                                              const char *name, int64_t arg) {
+    trace_scope_t scope = { TRACE_LIKELY_OFF(), cat, name };
+
+    if (__builtin_expect(scope.on, 0))
+        trace_event('B', cat, name, arg);
+
+    return scope;
+}
+
+static inline void trace_scope_end(const trace_scope_t *scope) {
+
+    if (__builtin_expect(scope->on, 0))
+        trace_event('E', scope->cat, scope->name, 0);
+}
+
+void trace_enable(bool enable);
+/* Forgets the events recorded so far */
+void trace_clear();
+void trace_print_status();
+/* Writes the events to path as Chrome trace event JSON */
+bool trace_dump(const char *path);
+
+#endif /* __TRACE_H__ */
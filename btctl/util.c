@@ -1,65 +1,286 @@
-#include <ctype.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
 
 #include <hardware/bluetooth.h>
 
 #include "util.h"
 
-static int bachk(const char *str) {
-    if (!str)
-        return -1;
+/* Value of each hex digit character, 0xff for anything else */
+static const uint8_t hex_val[256] = {
+    [0 ... 255] = 0xff,
+    ['0'] = 0x0, ['1'] = 0x1, ['2'] = 0x2, ['3'] = 0x3, ['4'] = 0x4,
+    ['5'] = 0x5, ['6'] = 0x6, ['7'] = 0x7, ['8'] = 0x8, ['9'] = 0x9,
+    ['a'] = 0xa, ['b'] = 0xb, ['c'] = 0xc, ['d'] = 0xd, ['e'] = 0xe,
+    ['f'] = 0xf,
+    ['A'] = 0xa, ['B'] = 0xb, ['C'] = 0xc, ['D'] = 0xd, ['E'] = 0xe,
+    ['F'] = 0xf,
+};
 
-    if (strlen(str) != 17)
-        return -1;
+static const char hex_upper[16] = "0123456789ABCDEF";
+static const char hex_lower[16] = "0123456789abcdef";
+
+#ifndef __SSSE3__
+/* Offset of the high nibble of each byte of a 128-bit UUID string, in string
+ * order (most significant byte first) */
+static const uint8_t uuid_hex_pos[16] = {
+    0, 2, 4, 6, 9, 11, 14, 16, 19, 21, 24, 26, 28, 30, 32, 34
+};
+#else
+/* Converts 16 characters to their hex values. Bits of *invalid are set for
+ * the lanes that are not hex digits. */
+static inline __m128i hex_nibbles(__m128i v, int *invalid) {
+    __m128i lc = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lc, _mm_set1_epi8('a' - 1)),
+                                  _mm_cmplt_epi8(lc, _mm_set1_epi8('f' + 1)));
+
+    *invalid = ~_mm_movemask_epi8(_mm_or_si128(digit, alpha)) & 0xffff;
+
+    return _mm_or_si128(
+            _mm_and_si128(digit, _mm_sub_epi8(v, _mm_set1_epi8('0'))),
+            _mm_and_si128(alpha, _mm_sub_epi8(lc, _mm_set1_epi8('a' - 10))));
+}
+
+/* Converts the low 8 bytes of v to 16 hex characters */
+static inline __m128i hex_chars_lo(__m128i v, __m128i table) {
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0f));
+    __m128i lo = _mm_and_si128(v, _mm_set1_epi8(0x0f));
+
+    return _mm_unpacklo_epi8(_mm_shuffle_epi8(table, hi),
+                             _mm_shuffle_epi8(table, lo));
+}
+
+/* Same as hex_chars_lo(), for the high 8 bytes of v */
+static inline __m128i hex_chars_hi(__m128i v, __m128i table) {
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0f));
+    __m128i lo = _mm_and_si128(v, _mm_set1_epi8(0x0f));
+
+    return _mm_unpackhi_epi8(_mm_shuffle_epi8(table, hi),
+                             _mm_shuffle_epi8(table, lo));
+}
+#endif
+
+bool parse_bdaddr(const char *str, bt_bdaddr_t *ba) {
+#ifdef __SSSE3__
+    /* separators are at offsets 2, 5, 8, 11 and 14 */
+    const int sep_mask = 0x4924;
+    __m128i a, b, hi, lo;
+    int inv_a, inv_b, colons;
+#else
+    int i;
+#endif
+    uint8_t out[16];
 
-    while (*str) {
-        if (!isxdigit(*str++))
-            return -1;
+    /* also makes sure the loads below don't go past the end of the string */
+    if (str == NULL || strnlen(str, BT_ADDRESS_STR_LEN) !=
+        BT_ADDRESS_STR_LEN - 1)
+        return false;
 
-            if (!isxdigit(*str++))
-                return -1;
+#ifdef __SSSE3__
+    /* a holds characters 0 to 15 and b characters 1 to 16, so the high
+     * nibbles are taken from a and the low nibbles from b at the same lanes */
+    a = _mm_loadu_si128((const __m128i *) str);
+    b = _mm_loadu_si128((const __m128i *) (str + 1));
+    colons = _mm_movemask_epi8(_mm_cmpeq_epi8(a, _mm_set1_epi8(':')));
+    a = hex_nibbles(a, &inv_a);
+    b = hex_nibbles(b, &inv_b);
 
-            if (*str == 0)
-                break;
+    if ((inv_a & ~sep_mask) || (colons & sep_mask) != sep_mask ||
+        (inv_b & 0x8000))
+        return false;
 
-            if (*str++ != ':')
-                return -1;
+    hi = _mm_shuffle_epi8(a, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1,
+                                           -1, -1, -1, -1, -1, -1));
+    lo = _mm_shuffle_epi8(b, _mm_setr_epi8(0, 3, 6, 9, 12, 15, -1, -1, -1, -1,
+                                           -1, -1, -1, -1, -1, -1));
+    /* nibbles are at most 0xf, so shifting 16-bit lanes doesn't carry */
+    _mm_storeu_si128((__m128i *) out, _mm_or_si128(_mm_slli_epi16(hi, 4), lo));
+#else
+    for (i = 0; i < 6; i++, str += 3) {
+        uint8_t h = hex_val[(uint8_t) str[0]];
+        uint8_t l = hex_val[(uint8_t) str[1]];
+
+        if ((h | l) & 0xf0 || (i < 5 && str[2] != ':'))
+            return false;
+
+        out[i] = h << 4 | l;
     }
+#endif
 
-    return 0;
+    memcpy(ba->address, out, sizeof(ba->address));
+    return true;
 }
 
-int str2ba(const char *str, bt_bdaddr_t *ba) {
+void format_bdaddr(const uint8_t *ba, char *str) {
+#ifdef __SSSE3__
+    uint8_t in[16] = {0};
+    __m128i chars;
+
+    memcpy(in, ba, 6);
+    chars = hex_chars_lo(_mm_loadu_si128((const __m128i *) in),
+                         _mm_loadu_si128((const __m128i *) hex_upper));
+
+    /* spread the 12 digits leaving room for the separators */
+    chars = _mm_shuffle_epi8(chars, _mm_setr_epi8(0, 1, -1, 2, 3, -1, 4, 5, -1,
+                                                  6, 7, -1, 8, 9, -1, 10));
+    chars = _mm_or_si128(chars, _mm_setr_epi8(0, 0, ':', 0, 0, ':', 0, 0, ':',
+                                              0, 0, ':', 0, 0, ':', 0));
+    _mm_storeu_si128((__m128i *) str, chars);
+    str[16] = hex_upper[ba[5] & 0xf];
+    str[17] = 0;
+#else
     int i;
 
-    if (bachk(str) < 0) {
-        memset(ba, 0, sizeof(*ba));
-            return -1;
+    for (i = 0; i < 6; i++, str += 3) {
+        str[0] = hex_upper[ba[i] >> 4];
+        str[1] = hex_upper[ba[i] & 0xf];
+        str[2] = i < 5 ? ':' : 0;
     }
+#endif
+}
+
+bool parse_uuid128(const char *str, bt_uuid_t *uuid) {
+#ifdef __SSSE3__
+    __m128i a, b, c, hi, lo;
+    int inv_a, inv_b, inv_c, dashes_a, dashes_b;
+#else
+    int i;
+#endif
+    uint8_t out[16];
+
+    if (str == NULL || strnlen(str, UUID128_STR_LEN) != UUID128_STR_LEN - 1)
+        return false;
+
+#ifdef __SSSE3__
+    /* a holds characters 0 to 15, b 16 to 31 and c 20 to 35. Dashes are at
+     * offsets 8, 13, 18 and 23. */
+    a = _mm_loadu_si128((const __m128i *) str);
+    b = _mm_loadu_si128((const __m128i *) (str + 16));
+    c = _mm_loadu_si128((const __m128i *) (str + 20));
+    dashes_a = _mm_movemask_epi8(_mm_cmpeq_epi8(a, _mm_set1_epi8('-')));
+    dashes_b = _mm_movemask_epi8(_mm_cmpeq_epi8(b, _mm_set1_epi8('-')));
+    a = hex_nibbles(a, &inv_a);
+    b = hex_nibbles(b, &inv_b);
+    c = hex_nibbles(c, &inv_c);
+
+    if (inv_a != 0x2100 || (dashes_a & 0x2100) != 0x2100 ||
+        inv_b != 0x0084 || (dashes_b & 0x0084) != 0x0084 ||
+        (inv_c & 0xf000))
+        return false;
 
-    for (i = 5; i >= 0; i--, str += 3)
-        ba->address[5-i] = strtol(str, NULL, 16);
+    /* gather the nibbles of each byte, the last string byte goes to uu[0] */
+    hi = _mm_or_si128(
+            _mm_or_si128(
+                _mm_shuffle_epi8(a, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1,
+                                                  -1, -1, 14, 11, 9, 6, 4, 2,
+                                                  0)),
+                _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, 14, 12, 10, 8, 5, 3,
+                                                  0, -1, -1, -1, -1, -1, -1,
+                                                  -1))),
+            _mm_shuffle_epi8(c, _mm_setr_epi8(14, 12, -1, -1, -1, -1, -1, -1,
+                                              -1, -1, -1, -1, -1, -1, -1, -1)));
+    lo = _mm_or_si128(
+            _mm_or_si128(
+                _mm_shuffle_epi8(a, _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1,
+                                                  -1, -1, 15, 12, 10, 7, 5, 3,
+                                                  1)),
+                _mm_shuffle_epi8(b, _mm_setr_epi8(-1, -1, 15, 13, 11, 9, 6, 4,
+                                                  1, -1, -1, -1, -1, -1, -1,
+                                                  -1))),
+            _mm_shuffle_epi8(c, _mm_setr_epi8(15, 13, -1, -1, -1, -1, -1, -1,
+                                              -1, -1, -1, -1, -1, -1, -1, -1)));
+    _mm_storeu_si128((__m128i *) out, _mm_or_si128(_mm_slli_epi16(hi, 4), lo));
+#else
+    if (str[8] != '-' || str[13] != '-' || str[18] != '-' || str[23] != '-')
+        return false;
+
+    for (i = 0; i < 16; i++) {
+        uint8_t h = hex_val[(uint8_t) str[uuid_hex_pos[i]]];
+        uint8_t l = hex_val[(uint8_t) str[uuid_hex_pos[i] + 1]];
+
+        if ((h | l) & 0xf0)
+            return false;
+
+        out[15 - i] = h << 4 | l;
+    }
+#endif
+
+    memcpy(uuid->uu, out, sizeof(uuid->uu));
+    return true;
+}
+
+void format_uuid128(const bt_uuid_t *uuid, char *str) {
+#ifdef __SSSE3__
+    __m128i table = _mm_loadu_si128((const __m128i *) hex_lower);
+    __m128i v = _mm_loadu_si128((const __m128i *) uuid->uu);
+    __m128i lo, hi, out;
+    uint32_t tail;
+
+    /* uu[15] is printed first */
+    v = _mm_shuffle_epi8(v, _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6,
+                                          5, 4, 3, 2, 1, 0));
+    lo = hex_chars_lo(v, table); /* digits 0 to 15 */
+    hi = hex_chars_hi(v, table); /* digits 16 to 31 */
+
+    out = _mm_or_si128(
+            _mm_shuffle_epi8(lo, _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, -1, 8,
+                                               9, 10, 11, -1, 12, 13)),
+            _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, '-', 0, 0, 0, 0, '-', 0, 0));
+    _mm_storeu_si128((__m128i *) str, out);
+
+    out = _mm_or_si128(
+            _mm_or_si128(
+                _mm_shuffle_epi8(lo, _mm_setr_epi8(14, 15, -1, -1, -1, -1, -1,
+                                                   -1, -1, -1, -1, -1, -1, -1,
+                                                   -1, -1)),
+                _mm_shuffle_epi8(hi, _mm_setr_epi8(-1, -1, -1, 0, 1, 2, 3, -1,
+                                                   4, 5, 6, 7, 8, 9, 10, 11))),
+            _mm_setr_epi8(0, 0, '-', 0, 0, 0, 0, '-', 0, 0, 0, 0, 0, 0, 0, 0));
+    _mm_storeu_si128((__m128i *) (str + 16), out);
+
+    tail = _mm_cvtsi128_si32(_mm_srli_si128(hi, 12));
+    memcpy(str + 32, &tail, sizeof(tail));
+    str[36] = 0;
+#else
+    int i, j = 0;
+
+    for (i = 0; i < 16; i++) {
+        if (uuid_hex_pos[i] != j)
+            str[j++] = '-';
+        str[j++] = hex_lower[uuid->uu[15 - i] >> 4];
+        str[j++] = hex_lower[uuid->uu[15 - i] & 0xf];
+    }
+    str[j] = 0;
+#endif
+}
+
+int str2ba(const char *str, bt_bdaddr_t *ba) {
+
+    if (!parse_bdaddr(str, ba)) {
+        memset(ba, 0, sizeof(*ba));
+        return -1;
+    }
 
     return 0;
 }
 
 char *ba2str(const uint8_t *ba, char *str) {
 
-    sprintf(str, "%02X:%02X:%02X:%02X:%02X:%02X", ba[0], ba[1], ba[2], ba[3],
-            ba[4], ba[5]);
+    format_bdaddr(ba, str);
     return str;
 }
 
 char *uuid2str(bt_uuid_t *uuid, char *str) {
 
     /* format: 11223344-5566-7788-9900-112233445566 */
-    sprintf(str, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-"
-            "%02x%02x%02x%02x%02x%02x", uuid->uu[15], uuid->uu[14],
-            uuid->uu[13], uuid->uu[12], uuid->uu[11], uuid->uu[10], uuid->uu[9],
-            uuid->uu[8], uuid->uu[7], uuid->uu[6], uuid->uu[5], uuid->uu[4],
-            uuid->uu[3], uuid->uu[2], uuid->uu[1], uuid->uu[0]);
+    format_uuid128(uuid, str);
     return str;
 }
 
@@ -67,24 +288,25 @@ bool str2uuid(const char *str, bt_uuid_t *uuid) {
     /* base UUID used to convert small ones */
     bt_uuid_t _uuid = {.uu = {0xfb, 0x34, 0x9b, 0x5f, 0x80, 0x00, 0x00, 0x80,
                               0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}};
-    int ret;
+    int i;
 
-    switch (strlen(str)) {
-        case 6: /* 16-bits */
-            ret = sscanf(str, "0x%02hhx%02hhx", &_uuid.uu[13], &_uuid.uu[12]);
-            if (ret != 2)
+    switch (strnlen(str, UUID128_STR_LEN)) {
+        case 6: /* 16-bits, 0xNNNN */
+            if (str[0] != '0' || str[1] != 'x')
                 return false;
+
+            for (i = 0; i < 2; i++) {
+                uint8_t h = hex_val[(uint8_t) str[2 + i * 2]];
+                uint8_t l = hex_val[(uint8_t) str[3 + i * 2]];
+
+                if ((h | l) & 0xf0)
+                    return false;
+
+                _uuid.uu[13 - i] = h << 4 | l;
+            }
             break;
         case 36: /* 128-bits */
-            ret = sscanf(str, "%02hhx%02hhx%02hhx%02hhx-%02hhx%02hhx-"
-                         "%02hhx%02hhx-%02hhx%02hhx-"
-                         "%02hhx%02hhx%02hhx%02hhx%02hhx%02hhx", &_uuid.uu[15],
-                         &_uuid.uu[14], &_uuid.uu[13], &_uuid.uu[12],
-                         &_uuid.uu[11], &_uuid.uu[10], &_uuid.uu[9],
-                         &_uuid.uu[8], &_uuid.uu[7], &_uuid.uu[6], &_uuid.uu[5],
-                         &_uuid.uu[4], &_uuid.uu[3], &_uuid.uu[2], &_uuid.uu[1],
-                         &_uuid.uu[0]);
-            if (ret != 16)
+            if (!parse_uuid128(str, &_uuid))
                 return false;
             break;
         default:
@@ -192,3 +414,10 @@ const char *atterror2str(int err) {
                 return "Reserved";
     }
 }
+
+uint64_t monotonic_us() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -2,11 +2,41 @@
 #define __UTIL_H__
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <hardware/bluetooth.h>
 
 #define BT_ADDRESS_STR_LEN 18
 #define UUID128_STR_LEN 16*2+5
 
+/* AD types of advertising data */
+#define AD_FLAGS              0x01
+#define AD_UUID16_SOME        0x02
+#define AD_UUID16_ALL         0x03
+#define AD_UUID128_SOME       0x06
+#define AD_UUID128_ALL        0x07
+#define AD_NAME_SHORT         0x08
+#define AD_NAME_COMPLETE      0x09
+#define AD_TX_POWER           0x0a
+#define AD_SLAVE_CONN_INT     0x12
+#define AD_SOLICIT_UUID16     0x14
+#define AD_SOLICIT_UUID128    0x15
+#define AD_SERVICE_DATA       0x16
+#define AD_PUBLIC_ADDRESS     0x17
+#define AD_RANDOM_ADDRESS     0x18
+#define AD_GAP_APPEARANCE     0x19
+#define AD_ADV_INTERVAL       0x1a
+#define AD_MANUFACTURER_DATA  0xff
+
+/* Strict conversion kernels. Addresses are "XX:XX:XX:XX:XX:XX" and 128-bit
+ * UUIDs "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx", hex digits in any case. They
+ * use SSSE3 when built for it and lookup tables otherwise. */
+bool parse_bdaddr(const char *str, bt_bdaddr_t *ba);
+/* Needs a buffer of at least BT_ADDRESS_STR_LEN bytes, prints uppercase */
+void format_bdaddr(const uint8_t *ba, char *str);
+bool parse_uuid128(const char *str, bt_uuid_t *uuid);
+/* Needs a buffer of at least UUID128_STR_LEN bytes, prints lowercase */
+void format_uuid128(const bt_uuid_t *uuid, char *str);
+
 int str2ba(const char *str, bt_bdaddr_t *ba);
 /* Needs a buffer of at least BT_ADDRESS_STR_LEN bytes */
 char *ba2str(const uint8_t *ba, char *str);
@@ -21,4 +51,7 @@ int str_in_list(const char* list[], const char *str);
 /* Converts ATT error to string */
 const char *atterror2str(int err);
 
+/* Monotonic clock, in microseconds */
+uint64_t monotonic_us();
+
 #endif /* __UTIL_H__ */
@@ -0,0 +1,366 @@
+/*
+ * Randomized differential test of the address and UUID kernels of util.c
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/* Built with SSSE3 and linked with util.c, this file compiles util.c once more
+ * without it, renaming its functions. Both builds of the kernels are given
+ * the same valid and mutated strings and must agree on every result, with
+ * each other and with the strtol() and sscanf() code they replaced. The old
+ * UUID parsing was more lenient: sscanf() skips blanks, takes signs and 0x
+ * prefixes inside fields and ends a field, the last one included, at any
+ * character that isn't a digit. Strings only it accepts for that reason are
+ * counted, not reported.
+ *
+ *   gcc -std=gnu99 -mssse3 util_test.c util.c -o util_test
+ *   ./util_test [iterations] [seed] */
+
+#ifndef __SSSE3__
+#error "Build with -mssse3, the SSSE3 kernels are compared with the tables"
+#endif
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* the table build of util.c */
+#undef __SSSE3__
+#define parse_bdaddr table_parse_bdaddr
+#define format_bdaddr table_format_bdaddr
+#define parse_uuid128 table_parse_uuid128
+#define format_uuid128 table_format_uuid128
+#define str2ba table_str2ba
+#define ba2str table_ba2str
+#define uuid2str table_uuid2str
+#define str2uuid table_str2uuid
+#define str_in_list table_str_in_list
+#define atterror2str table_atterror2str
+#define monotonic_us table_monotonic_us
+#include "util.c"
+#undef parse_bdaddr
+#undef format_bdaddr
+#undef parse_uuid128
+#undef format_uuid128
+
+/* the SSSE3 build, in util.c. util.h was included with the names above. */
+bool parse_bdaddr(const char *str, bt_bdaddr_t *ba);
+void format_bdaddr(const uint8_t *ba, char *str);
+bool parse_uuid128(const char *str, bt_uuid_t *uuid);
+void format_uuid128(const bt_uuid_t *uuid, char *str);
+
+/* Mismatches printed before giving up on the details */
+#define REPORT_MAX 10
+/* Room for the mutated strings, which may grow by a character */
+#define STR_LEN 64
+
+static unsigned long checks = 0, mismatches = 0, lenient = 0;
+
+/*
+ * The parsers and printers as they were before the kernels. isxdigit() now
+ * gets an unsigned char, the original passed a char, undefined above 0x7f.
+ */
+
+static int old_bachk(const char *str) {
+    if (!str)
+        return -1;
+
+    if (strlen(str) != 17)
+        return -1;
+
+    while (*str) {
+        if (!isxdigit((uint8_t) *str++))
+            return -1;
+
+        if (!isxdigit((uint8_t) *str++))
+            return -1;
+
+        if (*str == 0)
+            break;
+
+        if (*str++ != ':')
+            return -1;
+    }
+
+    return 0;
+}
+
+static int old_str2ba(const char *str, bt_bdaddr_t *ba) {
+    int i;
+
+    if (old_bachk(str) < 0) {
+        memset(ba, 0, sizeof(*ba));
+        return -1;
+    }
+
+    for (i = 5; i >= 0; i--, str += 3)
+        ba->address[5-i] = strtol(str, NULL, 16);
+
+    return 0;
+}
+
+static char *old_ba2str(const uint8_t *ba, char *str) {
+
+    sprintf(str, "%02X:%02X:%02X:%02X:%02X:%02X", ba[0], ba[1], ba[2], ba[3],
+            ba[4], ba[5]);
+    return str;
+}
+
+static char *old_uuid2str(bt_uuid_t *uuid, char *str) {
+
+    sprintf(str, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-"
+            "%02x%02x%02x%02x%02x%02x", uuid->uu[15], uuid->uu[14],
+            uuid->uu[13], uuid->uu[12], uuid->uu[11], uuid->uu[10], uuid->uu[9],
+            uuid->uu[8], uuid->uu[7], uuid->uu[6], uuid->uu[5], uuid->uu[4],
+            uuid->uu[3], uuid->uu[2], uuid->uu[1], uuid->uu[0]);
+    return str;
+}
+
+static bool old_str2uuid(const char *str, bt_uuid_t *uuid) {
+    bt_uuid_t _uuid = {.uu = {0xfb, 0x34, 0x9b, 0x5f, 0x80, 0x00, 0x00, 0x80,
+                              0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}};
+    int ret;
+
+    switch (strlen(str)) {
+        case 6: /* 16-bits */
+            ret = sscanf(str, "0x%02hhx%02hhx", &_uuid.uu[13], &_uuid.uu[12]);
+            if (ret != 2)
+                return false;
+            break;
+        case 36: /* 128-bits */
+            ret = sscanf(str, "%02hhx%02hhx%02hhx%02hhx-%02hhx%02hhx-"
+                         "%02hhx%02hhx-%02hhx%02hhx-"
+                         "%02hhx%02hhx%02hhx%02hhx%02hhx%02hhx", &_uuid.uu[15],
+                         &_uuid.uu[14], &_uuid.uu[13], &_uuid.uu[12],
+                         &_uuid.uu[11], &_uuid.uu[10], &_uuid.uu[9],
+                         &_uuid.uu[8], &_uuid.uu[7], &_uuid.uu[6], &_uuid.uu[5],
+                         &_uuid.uu[4], &_uuid.uu[3], &_uuid.uu[2], &_uuid.uu[1],
+                         &_uuid.uu[0]);
+            if (ret != 16)
+                return false;
+            break;
+        default:
+            return false;
+    }
+
+    memcpy(uuid, &_uuid, sizeof(_uuid));
+    return true;
+}
+
+/* True if sscanf() could have accepted str only by being lenient: a field
+ * holds something else than hex digits. With only hex digits in them every
+ * field is 2 characters, so the separators are checked as strictly as the
+ * kernels do. */
+static bool sscanf_lenient(const char *str) {
+    size_t i, len = strlen(str);
+
+    for (i = 0; i < len; i++) {
+        /* skip the separators of 128-bit UUIDs and the 0x of 16-bit ones */
+        if (len == 36 && (i == 8 || i == 13 || i == 18 || i == 23))
+            continue;
+        if (len == 6 && i < 2)
+            continue;
+
+        if (!isxdigit((uint8_t) str[i]))
+            return true;
+    }
+
+    return false;
+}
+
+static void report(const char *kernel, const char *input) {
+
+    if (++mismatches <= REPORT_MAX)
+        printf("%s mismatch on \"%s\"\n", kernel, input);
+}
+
+/* Characters mutations are made of: the ones the kernels look at, and any
+ * byte but NUL */
+static char random_char() {
+    static const char interesting[] = "0123456789abcdefABCDEFgG:-/@`";
+
+    if (rand() % 4 == 0)
+        return 1 + rand() % 255;
+
+    return interesting[rand() % (sizeof(interesting) - 1)];
+}
+
+/* Changes, removes or inserts a few characters of a valid string, or none so
+ * the valid one is checked too */
+static void mutate(char *str) {
+    int n = rand() % 4, len, pos;
+
+    while (n-- > 0) {
+        len = strlen(str);
+        pos = rand() % (len + 1);
+
+        switch (rand() % 4) {
+            case 0: /* truncate */
+                str[pos] = 0;
+                break;
+            case 1: /* insert */
+                if (len + 1 < STR_LEN) {
+                    memmove(str + pos + 1, str + pos, len - pos + 1);
+                    str[pos] = random_char();
+                }
+                break;
+            default: /* replace */
+                if (pos < len)
+                    str[pos] = random_char();
+                break;
+        }
+    }
+}
+
+/* Randomizes the case of the hex digits of a string */
+static void mix_case(char *str) {
+
+    for (; *str; str++)
+        if (*str >= 'a' && *str <= 'f' && rand() % 2)
+            *str -= 'a' - 'A';
+}
+
+static void check_bdaddr() {
+    uint8_t ba[6];
+    bt_bdaddr_t a, b, c;
+    char str[STR_LEN], s1[BT_ADDRESS_STR_LEN], s2[BT_ADDRESS_STR_LEN];
+    char s3[BT_ADDRESS_STR_LEN];
+    bool ra, rb, rc;
+    int i;
+
+    for (i = 0; i < 6; i++)
+        ba[i] = rand();
+
+    format_bdaddr(ba, s1);
+    table_format_bdaddr(ba, s2);
+    old_ba2str(ba, s3);
+    checks++;
+    if (strcmp(s1, s2) || strcmp(s1, s3))
+        report("format_bdaddr", s3);
+
+    memset(str, 0, sizeof(str));
+    strcpy(str, s2);
+    mix_case(str);
+    mutate(str);
+
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    ra = parse_bdaddr(str, &a);
+    rb = table_parse_bdaddr(str, &b);
+    rc = old_str2ba(str, &c) == 0;
+    checks++;
+    if (ra != rb || ra != rc ||
+        (ra && (memcmp(&a, &b, sizeof(a)) || memcmp(&a, &c, sizeof(a)))))
+        report("parse_bdaddr", str);
+}
+
+/* Compares the kernels with sscanf() on str. str2uuid() takes 16-bit UUIDs
+ * as well, both go through it; 128-bit ones are also given to the kernels
+ * directly. */
+static void check_str2uuid(const char *str) {
+    bt_uuid_t a, b, c;
+    bool ra, rb, rc;
+
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    memset(&c, 0, sizeof(c));
+    ra = str2uuid(str, &a);
+    rb = table_str2uuid(str, &b);
+    rc = old_str2uuid(str, &c);
+    checks++;
+
+    if (ra != rb || (ra && memcmp(&a, &b, sizeof(a)))) {
+        report("str2uuid", str);
+        return;
+    }
+
+    if (ra == rc && (!ra || !memcmp(&a, &c, sizeof(a))))
+        return;
+
+    if (!ra && rc && sscanf_lenient(str))
+        lenient++;
+    else
+        report("str2uuid (sscanf)", str);
+}
+
+static void check_uuid16() {
+    char str[STR_LEN];
+
+    memset(str, 0, sizeof(str));
+    snprintf(str, sizeof(str), "0x%04x", rand() & 0xffff);
+    mix_case(str);
+    mutate(str);
+
+    check_str2uuid(str);
+}
+
+static void check_uuid128() {
+    bt_uuid_t uuid, a, b;
+    char str[STR_LEN], s1[UUID128_STR_LEN], s2[UUID128_STR_LEN];
+    char s3[UUID128_STR_LEN];
+    bool ra, rb;
+    int i;
+
+    for (i = 0; i < 16; i++)
+        uuid.uu[i] = rand();
+
+    format_uuid128(&uuid, s1);
+    table_format_uuid128(&uuid, s2);
+    old_uuid2str(&uuid, s3);
+    checks++;
+    if (strcmp(s1, s2) || strcmp(s1, s3))
+        report("format_uuid128", s3);
+
+    memset(str, 0, sizeof(str));
+    strcpy(str, s2);
+    mix_case(str);
+    mutate(str);
+
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    ra = parse_uuid128(str, &a);
+    rb = table_parse_uuid128(str, &b);
+    checks++;
+    if (ra != rb || (ra && memcmp(&a, &b, sizeof(a))))
+        report("parse_uuid128", str);
+
+    check_str2uuid(str);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned long iterations = 1000000, i;
+    unsigned int seed = time(NULL);
+
+    if (argc > 1)
+        iterations = strtoul(argv[1], NULL, 0);
+    if (argc > 2)
+        seed = strtoul(argv[2], NULL, 0);
+
+    srand(seed);
+
+    for (i = 0; i < iterations; i++) {
+        check_bdaddr();
+        check_uuid16();
+        check_uuid128();
+    }
+
+    printf("%lu checks, %lu mismatches, %lu only accepted by sscanf(), seed "
+           "%u\n", checks, mismatches, lenient, seed);
+
+    return mismatches > 0;
+}
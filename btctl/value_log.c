@@ -0,0 +1,468 @@
+/*
+ * Columnar log of characteristic values
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "value_log.h"
+#include "mem.h"
+#include "rl_helper.h"
+#include "timeout.h"
+
+/* Columns of the block being filled. Key indexes are below 64 and values
+ * shorter than BTGATT_MAX_ATTR_LEN, so sources and lengths take at most 2
+ * bytes per sample as varints. */
+typedef struct {
+    int count;
+    uint64_t first_us;
+    uint64_t last_us;
+    int keys_count;
+    int last_key; /* samples tend to repeat the same characteristic */
+    uint8_t keys[VALUE_LOG_BLOCK_KEYS][VALUE_LOG_KEY_LEN];
+    size_t times_len;
+    uint8_t times[VALUE_LOG_BLOCK_SAMPLES * 10];
+    size_t sources_len;
+    uint8_t sources[VALUE_LOG_BLOCK_SAMPLES * 2];
+    size_t lengths_len;
+    uint8_t lengths[VALUE_LOG_BLOCK_SAMPLES * 2];
+    size_t values_len;
+    uint8_t values[VALUE_LOG_BLOCK_VALUES];
+} block_t;
+
+/* Largest uncompressed payload: the columns and their lengths */
+#define PAYLOAD_MAX (10 + VALUE_LOG_BLOCK_KEYS * VALUE_LOG_KEY_LEN + \
+                     5 * 10 + VALUE_LOG_BLOCK_SAMPLES * 14 + \
+                     VALUE_LOG_BLOCK_VALUES)
+
+/* Samples are added on the stack callback thread. A full block is handed to
+ * the main loop, which compresses and writes it while the other block is
+ * filled; samples are dropped if both are full. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int fd = -1;
+static char log_path[256];
+static block_t *filling;
+static block_t *full; /* NULL unless waiting to be written */
+static block_t *blocks[2];
+static uint8_t *payload;
+static uint8_t *compressed;
+static uLong compressed_cap;
+static int write_timeout = 0;
+static int flush_timeout = 0;
+
+static uint64_t samples;
+static uint64_t dropped;
+static uint64_t blocks_written;
+static uint64_t values_bytes;
+static uint64_t payload_bytes;
+static uint64_t file_bytes;
+
+static uint64_t realtime_us() {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Encodes v as a varint in buf, returns the number of bytes used */
+static size_t varint(uint8_t *buf, uint64_t v) {
+    size_t n = 0;
+
+    do {
+        buf[n] = v & 0x7f;
+        v >>= 7;
+        if (v != 0)
+            buf[n] |= 0x80;
+        n++;
+    } while (v != 0);
+
+    return n;
+}
+
+static void put_le(uint8_t *buf, uint64_t v, int bytes) {
+    int i;
+
+    for (i = 0; i < bytes; i++)
+        buf[i] = v >> (i * 8);
+}
+
+static void clear_block(block_t *b) {
+
+    b->count = 0;
+    b->keys_count = 0;
+    b->last_key = -1;
+    b->times_len = 0;
+    b->sources_len = 0;
+    b->lengths_len = 0;
+    b->values_len = 0;
+}
+
+/* Appends a column to the payload, returns the new payload length */
+static size_t put_column(size_t pos, const uint8_t *data, size_t len) {
+
+    pos += varint(payload + pos, len);
+    memcpy(payload + pos, data, len);
+    return pos + len;
+}
+
+static void fail(int err) {
+
+    rl_printf("Value log %s closed: %s\n", log_path, strerror(err));
+    close(fd);
+    fd = -1;
+}
+
+/* Compresses and writes a block. Runs on the main loop. */
+static void write_block(block_t *b) {
+    uint8_t hdr[VALUE_LOG_HEADER_LEN];
+    uint8_t count[10];
+    struct iovec iov[2];
+    size_t pos, n, keys_len;
+    uLong len = compressed_cap;
+    ssize_t ret;
+
+    if (b->count == 0 || fd < 0)
+        return;
+
+    /* the keys column is their count followed by the keys */
+    n = varint(count, b->keys_count);
+    keys_len = b->keys_count * VALUE_LOG_KEY_LEN;
+    pos = varint(payload, n + keys_len);
+    memcpy(payload + pos, count, n);
+    memcpy(payload + pos + n, b->keys, keys_len);
+    pos += n + keys_len;
+
+    pos = put_column(pos, b->times, b->times_len);
+    pos = put_column(pos, b->sources, b->sources_len);
+    pos = put_column(pos, b->lengths, b->lengths_len);
+    pos = put_column(pos, b->values, b->values_len);
+
+    if (compress2(compressed, &len, payload, pos, Z_DEFAULT_COMPRESSION) !=
+        Z_OK) {
+        rl_printf("Value log: failed to compress a block\n");
+        dropped += b->count;
+        return;
+    }
+
+    put_le(hdr, len, 4);
+    put_le(hdr + 4, pos, 4);
+    put_le(hdr + 8, b->count, 4);
+    put_le(hdr + 12, b->first_us, 8);
+    put_le(hdr + 20, b->last_us, 8);
+    put_le(hdr + 28, crc32(0, compressed, len), 4);
+
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = compressed;
+    iov[1].iov_len = len;
+
+    do
+        ret = writev(fd, iov, 2);
+    while (ret < 0 && errno == EINTR);
+
+    if (ret != (ssize_t) (sizeof(hdr) + len)) {
+        fail(ret < 0 ? errno : ENOSPC);
+        return;
+    }
+
+    blocks_written++;
+    values_bytes += b->values_len;
+    payload_bytes += pos;
+    file_bytes += ret;
+}
+
+/* Writes the full block, if any */
+static bool write_full(void *user_data) {
+    block_t *b;
+
+    pthread_mutex_lock(&lock);
+    b = full;
+    write_timeout = 0;
+    pthread_mutex_unlock(&lock);
+
+    if (b == NULL)
+        return false;
+
+    write_block(b);
+
+    pthread_mutex_lock(&lock);
+    clear_block(b);
+    full = NULL;
+    pthread_mutex_unlock(&lock);
+
+    return false;
+}
+
+/* Hands the block being filled to the main loop. Must be called with the lock
+ * held and no full block. If the write can't be scheduled, flush() does it. */
+static void swap_blocks() {
+
+    full = filling;
+    filling = filling == blocks[0] ? blocks[1] : blocks[0];
+
+    if (write_timeout == 0)
+        write_timeout = timeout_add(0, write_full, NULL);
+}
+
+/* Writes what was logged recently, even if the block isn't full */
+static bool flush(void *user_data) {
+    bool lost;
+
+    pthread_mutex_lock(&lock);
+    if (full == NULL && filling->count > 0)
+        swap_blocks();
+    /* the timeout table was full, samples are dropped until it is written */
+    lost = full != NULL && write_timeout == 0;
+    pthread_mutex_unlock(&lock);
+
+    if (lost)
+        write_full(NULL);
+
+    return true;
+}
+
+bool value_log_open(const char *path) {
+    char magic[VALUE_LOG_MAGIC_LEN];
+    ssize_t n;
+    int i;
+
+    if (fd >= 0) {
+        rl_printf("Already logging to %s\n", log_path);
+        return false;
+    }
+
+    /* buffers of a log closed by a write error */
+    if (blocks[0] != NULL)
+        value_log_close();
+
+    if (strlen(path) >= sizeof(log_path)) {
+        rl_printf("Path too long\n");
+        return false;
+    }
+
+    fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        rl_printf("Failed to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    /* a new file gets the magic, an existing one must be a log */
+    n = pread(fd, magic, sizeof(magic), 0);
+    if (n == 0)
+        n = write(fd, VALUE_LOG_MAGIC, VALUE_LOG_MAGIC_LEN) ==
+            VALUE_LOG_MAGIC_LEN ? VALUE_LOG_MAGIC_LEN : -1;
+    else if (n != VALUE_LOG_MAGIC_LEN ||
+             memcmp(magic, VALUE_LOG_MAGIC, VALUE_LOG_MAGIC_LEN)) {
+        rl_printf("%s is not a value log\n", path);
+        close(fd);
+        fd = -1;
+        return false;
+    }
+
+    if (n < 0) {
+        rl_printf("Failed to write %s: %s\n", path, strerror(errno));
+        close(fd);
+        fd = -1;
+        return false;
+    }
+
+    compressed_cap = compressBound(PAYLOAD_MAX);
+    for (i = 0; i < 2; i++)
+        blocks[i] = mem_alloc(MEM_LOG, sizeof(block_t));
+    payload = mem_alloc(MEM_LOG, PAYLOAD_MAX);
+    compressed = mem_alloc(MEM_LOG, compressed_cap);
+
+    if (blocks[0] == NULL || blocks[1] == NULL || payload == NULL ||
+        compressed == NULL) {
+        rl_printf("Out of memory\n");
+        value_log_close();
+        return false;
+    }
+
+    strcpy(log_path, path);
+    clear_block(blocks[0]);
+    clear_block(blocks[1]);
+    samples = dropped = blocks_written = 0;
+    values_bytes = payload_bytes = file_bytes = 0;
+
+    pthread_mutex_lock(&lock);
+    filling = blocks[0];
+    full = NULL;
+    pthread_mutex_unlock(&lock);
+
+    flush_timeout = timeout_add(VALUE_LOG_FLUSH_MS, flush, NULL);
+    if (flush_timeout == 0) {
+        rl_printf("No timeout available\n");
+        value_log_close();
+        return false;
+    }
+
+    return true;
+}
+
+void value_log_close() {
+    int i;
+
+    timeout_remove(flush_timeout);
+    flush_timeout = 0;
+
+    /* the full block first, samples must stay in order */
+    write_full(NULL);
+
+    pthread_mutex_lock(&lock);
+    if (filling != NULL && filling->count > 0)
+        swap_blocks();
+    pthread_mutex_unlock(&lock);
+
+    write_full(NULL);
+
+    pthread_mutex_lock(&lock);
+    timeout_remove(write_timeout);
+    write_timeout = 0;
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
+    filling = NULL;
+    pthread_mutex_unlock(&lock);
+
+    for (i = 0; i < 2; i++) {
+        mem_free(blocks[i]);
+        blocks[i] = NULL;
+    }
+    mem_free(payload);
+    payload = NULL;
+    mem_free(compressed);
+    compressed = NULL;
+}
+
+bool value_log_enabled() {
+
+    return fd >= 0;
+}
+
+void value_log_print_status() {
+    int pending;
+
+    if (fd < 0) {
+        rl_printf("Not logging\n");
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    pending = filling->count + (full != NULL ? full->count : 0);
+    pthread_mutex_unlock(&lock);
+
+    rl_printf("Logging to %s\n", log_path);
+    rl_printf("%llu samples, %d pending, %llu dropped\n",
+              (unsigned long long) samples, pending,
+              (unsigned long long) dropped);
+    rl_printf("%llu blocks, %llu bytes written, %llu bytes uncompressed, "
+              "%llu bytes of values\n", (unsigned long long) blocks_written,
+              (unsigned long long) file_bytes,
+              (unsigned long long) payload_bytes,
+              (unsigned long long) values_bytes);
+}
+
+/* Returns the index of a key in the block, -1 if it isn't there */
+static int find_key(block_t *b, const uint8_t *key) {
+    int i;
+
+    if (b->last_key >= 0 &&
+        !memcmp(b->keys[b->last_key], key, VALUE_LOG_KEY_LEN))
+        return b->last_key;
+
+    for (i = 0; i < b->keys_count; i++)
+        if (!memcmp(b->keys[i], key, VALUE_LOG_KEY_LEN))
+            return i;
+
+    return -1;
+}
+
+void value_log_add(const bt_bdaddr_t *addr, const btgatt_srvc_id_t *srvc_id,
+                   const btgatt_char_id_t *char_id, int kind,
+                   const uint8_t *value, int len) {
+    uint8_t key[VALUE_LOG_KEY_LEN];
+    uint64_t now = realtime_us();
+    block_t *b;
+    int k;
+
+    if (fd < 0)
+        return;
+
+    if (len < 0 || len > BTGATT_MAX_ATTR_LEN)
+        len = 0;
+
+    memcpy(key, addr->address, 6);
+    memcpy(key + 6, srvc_id->id.uuid.uu, 16);
+    key[22] = srvc_id->id.inst_id;
+    memcpy(key + 23, char_id->uuid.uu, 16);
+    key[39] = char_id->inst_id;
+
+    pthread_mutex_lock(&lock);
+
+    if (fd < 0 || filling == NULL) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    b = filling;
+    k = find_key(b, key);
+
+    if (b->count == VALUE_LOG_BLOCK_SAMPLES ||
+        b->values_len + len > VALUE_LOG_BLOCK_VALUES ||
+        (k < 0 && b->keys_count == VALUE_LOG_BLOCK_KEYS)) {
+        if (full != NULL) {
+            dropped++;
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+
+        swap_blocks();
+        b = filling;
+        k = -1;
+    }
+
+    if (k < 0) {
+        k = b->keys_count++;
+        memcpy(b->keys[k], key, VALUE_LOG_KEY_LEN);
+    }
+    b->last_key = k;
+
+    if (b->count == 0)
+        b->first_us = b->last_us = now;
+    else if (now < b->last_us)
+        now = b->last_us; /* the clock was set back */
+
+    b->times_len += varint(b->times + b->times_len, now - b->last_us);
+    b->sources_len += varint(b->sources + b->sources_len, k << 2 | kind);
+    b->lengths_len += varint(b->lengths + b->lengths_len, len);
+    memcpy(b->values + b->values_len, value, len);
+    b->values_len += len;
+    b->last_us = now;
+    b->count++;
+    samples++;
+
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,64 @@
+#ifndef __VALUE_LOG_H__
+#define __VALUE_LOG_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <hardware/bluetooth.h>
+#include <hardware/bt_gatt.h>
+
+/* Log of characteristic values: every read and notification is appended as a
+ * sample (time, device, characteristic, value) to a file in compact columnar
+ * blocks, to be extracted later with the btlog tool.
+ *
+ * A log starts with VALUE_LOG_MAGIC and is a sequence of blocks. Each block
+ * has a header of little endian integers:
+ *   u32 payload length, compressed
+ *   u32 payload length, uncompressed
+ *   u32 number of samples
+ *   u64 time of the first sample, in microseconds since the epoch
+ *   u64 time of the last sample
+ *   u32 CRC-32 of the compressed payload
+ * so readers can skip blocks outside a time range without decompressing them.
+ * The payload is zlib compressed and holds the columns of the block, each
+ * one a varint length followed by the data:
+ *   keys     varint count, then for each one the device address (6 bytes),
+ *            service UUID (16), service instance (1), characteristic UUID
+ *            (16) and characteristic instance (1), in the order they first
+ *            appear in the block
+ *   times    varint time of each sample minus the previous one, the first
+ *            one minus the time of the first sample in the header
+ *   sources  varint key index << 2 | kind (VALUE_LOG_*) of each sample
+ *   lengths  varint value length of each sample
+ *   values   the values, one after the other */
+#define VALUE_LOG_MAGIC "BTCTLLOG1"
+#define VALUE_LOG_MAGIC_LEN 9
+#define VALUE_LOG_HEADER_LEN 32
+#define VALUE_LOG_KEY_LEN 40
+
+/* Samples and distinct characteristics in a block */
+#define VALUE_LOG_BLOCK_SAMPLES 4096
+#define VALUE_LOG_BLOCK_KEYS 64
+/* Value bytes in a block */
+#define VALUE_LOG_BLOCK_VALUES (256 * 1024)
+/* Blocks are also written at least this often, so little is lost on a crash */
+#define VALUE_LOG_FLUSH_MS 5000
+
+/* Kinds of samples */
+#define VALUE_LOG_READ 0
+#define VALUE_LOG_NOTIFY 1
+#define VALUE_LOG_INDICATE 2
+
+/* Starts logging to path, appending if it is a log already */
+bool value_log_open(const char *path);
+/* Writes the pending samples and stops logging */
+void value_log_close();
+bool value_log_enabled();
+
+void value_log_print_status();
+
+/* Appends a sample. Blocks are compressed and written from the main loop. */
+void value_log_add(const bt_bdaddr_t *addr, const btgatt_srvc_id_t *srvc_id,
+                   const btgatt_char_id_t *char_id, int kind,
+                   const uint8_t *value, int len);
+
+#endif /* __VALUE_LOG_H__ */
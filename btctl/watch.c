@@ -0,0 +1,299 @@
+/*
+ * Printing of characteristic values on change only
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "watch.h"
+#include "rl_helper.h"
+#include "util.h"
+
+typedef struct {
+    bool used;
+    bt_bdaddr_t addr;
+    btgatt_srvc_id_t srvc_id;
+    btgatt_char_id_t char_id;
+    uint16_t svc;
+    uint16_t ch;
+    bool delta;
+
+    /* sorted and merged, so the bytes compared are the gaps between them */
+    watch_range_t ignore[WATCH_IGNORE_MAX];
+    int ignore_count;
+
+    bool has_last;
+    uint16_t last_len;
+    uint8_t last[BTGATT_MAX_ATTR_LEN];
+
+    uint64_t values;
+    uint64_t changes;
+    uint32_t unchanged; /* values since the last change */
+} watch_t;
+
+/* Values arrive on the stack callback thread, watches are changed from
+ * commands */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static watch_t watches[WATCH_MAX];
+
+static bool same_char(const watch_t *w, const bt_bdaddr_t *addr,
+                      const btgatt_srvc_id_t *srvc_id,
+                      const btgatt_char_id_t *char_id) {
+
+    return !memcmp(&w->addr, addr, sizeof(*addr)) &&
+           w->srvc_id.is_primary == srvc_id->is_primary &&
+           w->srvc_id.id.inst_id == srvc_id->id.inst_id &&
+           !memcmp(&w->srvc_id.id.uuid, &srvc_id->id.uuid,
+                   sizeof(bt_uuid_t)) &&
+           w->char_id.inst_id == char_id->inst_id &&
+           !memcmp(&w->char_id.uuid, &char_id->uuid, sizeof(bt_uuid_t));
+}
+
+static watch_t *find_watch(const bt_bdaddr_t *addr,
+                           const btgatt_srvc_id_t *srvc_id,
+                           const btgatt_char_id_t *char_id) {
+    int i;
+
+    for (i = 0; i < WATCH_MAX; i++)
+        if (watches[i].used && same_char(&watches[i], addr, srvc_id, char_id))
+            return &watches[i];
+
+    return NULL;
+}
+
+/* Copies ranges to w sorted by start, merging those that overlap or touch */
+static void set_ignore(watch_t *w, const watch_range_t *ranges, int count) {
+    watch_range_t tmp;
+    watch_range_t *prev;
+    int i, j;
+
+    w->ignore_count = 0;
+
+    for (i = 0; i < count; i++) {
+        tmp = ranges[i];
+        if (tmp.len == 0)
+            continue;
+
+        for (j = w->ignore_count; j > 0 && w->ignore[j - 1].start > tmp.start;
+             j--)
+            w->ignore[j] = w->ignore[j - 1];
+        w->ignore[j] = tmp;
+        w->ignore_count++;
+    }
+
+    for (i = 1, j = 0; i < w->ignore_count; i++) {
+        prev = &w->ignore[j];
+        if (w->ignore[i].start <= prev->start + prev->len) {
+            if (w->ignore[i].start + w->ignore[i].len >
+                prev->start + prev->len)
+                prev->len = w->ignore[i].start + w->ignore[i].len -
+                            prev->start;
+        } else
+            w->ignore[++j] = w->ignore[i];
+    }
+
+    if (w->ignore_count > 0)
+        w->ignore_count = j + 1;
+}
+
+/* Compares a value to the last one, leaving out the ignored ranges */
+static bool changed(const watch_t *w, const uint8_t *value, int len) {
+    int pos = 0, end, i;
+
+    if (!w->has_last || w->last_len != len)
+        return true;
+
+    for (i = 0; i < w->ignore_count && pos < len; i++) {
+        end = w->ignore[i].start < len ? w->ignore[i].start : len;
+        if (end > pos && memcmp(value + pos, w->last + pos, end - pos))
+            return true;
+        pos = w->ignore[i].start + w->ignore[i].len;
+    }
+
+    return pos < len && memcmp(value + pos, w->last + pos, len - pos);
+}
+
+bool watch_add(conn_t *conn, int svc, int ch, const watch_range_t *ignore,
+               int ignore_count, bool delta) {
+    btgatt_srvc_id_t srvc_id;
+    btgatt_char_id_t char_id;
+    watch_t *w;
+    int i;
+
+    if (ignore_count > WATCH_IGNORE_MAX) {
+        rl_printf("Too many ignored ranges (max %d)\n", WATCH_IGNORE_MAX);
+        return false;
+    }
+
+    gatt_db_svc_id(&conn->db, svc, &srvc_id);
+    gatt_db_char_id(&conn->db, svc, ch, &char_id);
+
+    pthread_mutex_lock(&lock);
+
+    /* watching again replaces the settings and forgets the last value */
+    w = find_watch(&conn->addr, &srvc_id, &char_id);
+
+    for (i = 0; i < WATCH_MAX && w == NULL; i++)
+        if (!watches[i].used)
+            w = &watches[i];
+
+    if (w == NULL) {
+        pthread_mutex_unlock(&lock);
+        rl_printf("Too many characteristics watched (max %d)\n", WATCH_MAX);
+        return false;
+    }
+
+    memset(w, 0, sizeof(*w));
+    w->used = true;
+    memcpy(&w->addr, &conn->addr, sizeof(w->addr));
+    memcpy(&w->srvc_id, &srvc_id, sizeof(srvc_id));
+    memcpy(&w->char_id, &char_id, sizeof(char_id));
+    w->svc = svc;
+    w->ch = ch;
+    w->delta = delta;
+    set_ignore(w, ignore, ignore_count);
+
+    pthread_mutex_unlock(&lock);
+
+    return true;
+}
+
+bool watch_remove(conn_t *conn, int svc, int ch) {
+    btgatt_srvc_id_t srvc_id;
+    btgatt_char_id_t char_id;
+    watch_t *w;
+
+    gatt_db_svc_id(&conn->db, svc, &srvc_id);
+    gatt_db_char_id(&conn->db, svc, ch, &char_id);
+
+    pthread_mutex_lock(&lock);
+
+    w = find_watch(&conn->addr, &srvc_id, &char_id);
+    if (w != NULL)
+        w->used = false;
+
+    pthread_mutex_unlock(&lock);
+
+    return w != NULL;
+}
+
+void watch_clear() {
+    int i;
+
+    pthread_mutex_lock(&lock);
+
+    for (i = 0; i < WATCH_MAX; i++)
+        watches[i].used = false;
+
+    pthread_mutex_unlock(&lock);
+}
+
+void watch_print_status() {
+    char addr_str[BT_ADDRESS_STR_LEN];
+    char ignore_str[WATCH_IGNORE_MAX * 12 + 1];
+    const watch_t *w;
+    bool any = false;
+    int i, j, n;
+
+    pthread_mutex_lock(&lock);
+
+    for (i = 0; i < WATCH_MAX; i++) {
+        w = &watches[i];
+        if (!w->used)
+            continue;
+
+        any = true;
+
+        n = 0;
+        ignore_str[0] = 0;
+        for (j = 0; j < w->ignore_count; j++)
+            n += sprintf(&ignore_str[n], " %u-%u", w->ignore[j].start,
+                         w->ignore[j].start + w->ignore[j].len - 1);
+
+        rl_printf("%s service %d characteristic %d%s%s%s: %llu values, %llu "
+                  "changes\n", ba2str(w->addr.address, addr_str), w->svc,
+                  w->ch, w->delta ? " delta" : "",
+                  w->ignore_count > 0 ? " ignore" : "", ignore_str,
+                  (unsigned long long) w->values,
+                  (unsigned long long) w->changes);
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    if (!any)
+        rl_printf("No characteristics watched\n");
+}
+
+bool watch_value(const bt_bdaddr_t *addr, const btgatt_srvc_id_t *srvc_id,
+                 const btgatt_char_id_t *char_id, const uint8_t *value,
+                 int len) {
+    char addr_str[BT_ADDRESS_STR_LEN];
+    char hexstr[BTGATT_MAX_ATTR_LEN * 3 + 1] = {0};
+    bool xor;
+    uint32_t unchanged;
+    int svc, ch, i;
+    watch_t *w;
+
+    if (len < 0 || len > BTGATT_MAX_ATTR_LEN)
+        len = 0;
+
+    pthread_mutex_lock(&lock);
+
+    w = find_watch(addr, srvc_id, char_id);
+    if (w == NULL) {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+
+    w->values++;
+
+    if (!changed(w, value, len)) {
+        w->unchanged++;
+        pthread_mutex_unlock(&lock);
+        return true;
+    }
+
+    /* the delta only makes sense between values of the same length */
+    xor = w->delta && w->has_last && w->last_len == len;
+    for (i = 0; i < len; i++)
+        sprintf(&hexstr[i * 3], "%02hhx ", xor ? value[i] ^ w->last[i] :
+                                                 value[i]);
+
+    svc = w->svc;
+    ch = w->ch;
+    unchanged = w->unchanged;
+
+    w->changes++;
+    w->unchanged = 0;
+    w->has_last = true;
+    w->last_len = len;
+    memcpy(w->last, value, len);
+
+    pthread_mutex_unlock(&lock);
+
+    if (unchanged > 0)
+        rl_printf("%s %d/%d %s %s(after %u unchanged)\n",
+                  ba2str(addr->address, addr_str), svc, ch,
+                  xor ? "xor:" : "value:", hexstr, unchanged);
+    else
+        rl_printf("%s %d/%d %s %s\n", ba2str(addr->address, addr_str), svc,
+                  ch, xor ? "xor:" : "value:", hexstr);
+
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef __WATCH_H__
+#define __WATCH_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <hardware/bluetooth.h>
+#include <hardware/bt_gatt.h>
+
+#include "conn.h"
+
+/* Maximum number of watched characteristics */
+#define WATCH_MAX 16
+/* Maximum number of ignored byte ranges per characteristic */
+#define WATCH_IGNORE_MAX 4
+
+/* Bytes [start, start + len) of a value, left out of comparisons */
+typedef struct {
+    uint16_t start;
+    uint16_t len;
+} watch_range_t;
+
+/* Reads and notifications of watched characteristics are printed on a single
+ * line, and only when the value differs from the last one received. Byte
+ * ranges holding counters or timestamps can be ignored in the comparison. A
+ * change can be printed as the XOR of the old and new values, so the bits
+ * that changed stand out. Like notification sinks, characteristics are
+ * identified by the address of the device and their service and
+ * characteristic IDs, so watches outlive reconnections. */
+
+/* Watches characteristic ch of service svc on conn, replacing a previous
+ * watch of it. Prints the reason and returns false on failure. */
+bool watch_add(conn_t *conn, int svc, int ch, const watch_range_t *ignore,
+               int ignore_count, bool delta);
+/* Returns false if the characteristic isn't watched */
+bool watch_remove(conn_t *conn, int svc, int ch);
+void watch_clear();
+
+void watch_print_status();
+
+/* Handles a value read or notified, printing it if it changed. Returns false
+ * if the characteristic isn't watched. */
+bool watch_value(const bt_bdaddr_t *addr, const btgatt_srvc_id_t *srvc_id,
+                 const btgatt_char_id_t *char_id, const uint8_t *value,
+                 int len);
+
+#endif /* __WATCH_H__ */